@@ -0,0 +1,145 @@
+// ==================================================================
+// capture.cpp
+// Hands raw ADC blocks from the DMA interrupt to loop(), which streams them out in frames
+// ==================================================================
+#include <Arduino.h>
+#include <string.h>  // for memcpy
+
+#include "capture.h"
+#include "modem_profile.h"
+#include "serial_frame.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+typedef enum {
+  CAPTURE_SLOT_FREE,           // Owned by the ADC interrupt
+  CAPTURE_SLOT_FULL,           // Owned by loop() until every chunk is sent
+} capture_slot_state_t;
+
+typedef struct {
+  volatile capture_slot_state_t state;
+  uint32_t block;
+  uint32_t timestamp_us;
+  uint8_t gain_index;
+  uint8_t profile_index;
+  uint16_t samples[CAPTURE_BLOCK_SAMPLES];
+} capture_slot_t;
+
+// CPU-only, so these can sit in the (otherwise idle) OCRAM:
+DMAMEM static capture_slot_t slots[CAPTURE_SLOTS];
+
+// Slot the interrupt fills next and the slot loop() sends next; both advance in order, so blocks go out
+// in the order they were captured:
+static uint32_t fill_slot = 0;
+static uint32_t send_slot = 0;
+static uint32_t next_chunk_sample = 0;
+
+static volatile bool capturing = false;
+static volatile uint32_t blocks_captured = 0;  // Including dropped ones; numbers the next block
+static volatile uint32_t blocks_dropped = 0;
+static uint32_t blocks_to_capture = 0;         // 0 runs until stop_capture()
+static uint32_t blocks_sent = 0;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Starts streaming every ADC block, for block_limit blocks (0 for until stop_capture()).
+ */
+void start_capture(uint32_t block_limit) {
+  noInterrupts();
+  for (int i = 0; i < CAPTURE_SLOTS; i++) {
+    slots[i].state = CAPTURE_SLOT_FREE;
+  }
+  fill_slot = 0;
+  send_slot = 0;
+  next_chunk_sample = 0;
+  blocks_captured = 0;
+  blocks_dropped = 0;
+  blocks_sent = 0;
+  blocks_to_capture = block_limit;
+  capturing = true;
+  interrupts();
+}
+
+/**
+ * Stops taking new blocks; any already taken are still sent.
+ */
+void stop_capture() {
+  capturing = false;
+}
+
+void print_capture_status() {
+  Serial.printf("Capture %s: %lu blocks taken, %lu sent, %lu dropped (%lu samples @ %lu Hz per block)\n",
+                capturing ? "running" : "stopped", (unsigned long)blocks_captured, (unsigned long)blocks_sent,
+                (unsigned long)blocks_dropped, (unsigned long)CAPTURE_BLOCK_SAMPLES,
+                (unsigned long)MODEM_SAMPLE_RATE);
+}
+
+/**
+ * Takes a copy of one ADC block if capture is running. Called from the ADC interrupt; when loop() hasn't
+ * finished sending the older blocks the new one is dropped (and its number skipped, so the host sees the gap).
+ */
+void capture_adc_block(const uint16_t *samples, uint32_t timestamp_us, uint8_t gain_index) {
+  if (!capturing) {
+    return;
+  }
+  uint32_t block = blocks_captured++;
+  if (blocks_to_capture != 0 && blocks_captured >= blocks_to_capture) {
+    capturing = false;
+  }
+
+  capture_slot_t *slot = &slots[fill_slot];
+  if (slot->state != CAPTURE_SLOT_FREE) {
+    blocks_dropped++;
+    return;
+  }
+  slot->block = block;
+  slot->timestamp_us = timestamp_us;
+  slot->gain_index = gain_index;
+  slot->profile_index = get_active_modem_profile_index();
+  memcpy(slot->samples, samples, sizeof(slot->samples));
+  slot->state = CAPTURE_SLOT_FULL;
+  fill_slot = (fill_slot + 1) % CAPTURE_SLOTS;
+}
+
+/**
+ * Sends as many chunks of the captured blocks as the USB buffer takes without blocking. Call from loop().
+ */
+void poll_capture() {
+  static uint8_t payload[sizeof(capture_chunk_header_t) + CAPTURE_CHUNK_SAMPLES * 3 / 2];
+
+  while (slots[send_slot].state == CAPTURE_SLOT_FULL && serial_frame_space() >= sizeof(payload)) {
+    capture_slot_t *slot = &slots[send_slot];
+    capture_chunk_header_t header;
+    header.block = slot->block;
+    header.timestamp_us = slot->timestamp_us;
+    header.sample_rate = MODEM_SAMPLE_RATE;
+    header.block_samples = CAPTURE_BLOCK_SAMPLES;
+    header.first_sample = next_chunk_sample;
+    header.sample_count = CAPTURE_CHUNK_SAMPLES;
+    header.gain_index = slot->gain_index;
+    header.profile_index = slot->profile_index;
+    memcpy(payload, &header, sizeof(header));
+
+    const uint16_t *x = &slot->samples[next_chunk_sample];
+    uint8_t *packed = &payload[sizeof(header)];
+    for (int i = 0; i < CAPTURE_CHUNK_SAMPLES; i += 2) {
+      *packed++ = x[i];
+      *packed++ = ((x[i] >> 8) & 0x0F) | (x[i + 1] << 4);
+      *packed++ = x[i + 1] >> 4;
+    }
+    write_serial_frame(SERIAL_FRAME_ADC_CAPTURE, payload, sizeof(payload));
+
+    next_chunk_sample += CAPTURE_CHUNK_SAMPLES;
+    if (next_chunk_sample == CAPTURE_BLOCK_SAMPLES) {
+      next_chunk_sample = 0;
+      blocks_sent++;
+      slot->state = CAPTURE_SLOT_FREE;
+      send_slot = (send_slot + 1) % CAPTURE_SLOTS;
+    }
+  }
+}
@@ -0,0 +1,46 @@
+// ==================================================================
+// capture.h
+// Declares raw ADC capture, streamed to a host over USB serial
+// ==================================================================
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#include "receiver.h"
+
+//----------------------------------------
+// Capture Configuration
+//----------------------------------------
+#define CAPTURE_BLOCK_SAMPLES       RECEIVER_BLOCK_SAMPLES  // One DMA buffer per block
+#define CAPTURE_CHUNK_SAMPLES       320     // Samples per SERIAL_FRAME_ADC_CAPTURE frame (even, divides a block)
+#define CAPTURE_SLOTS               2       // Blocks buffered between the ADC interrupt and loop()
+
+// Precedes each chunk's samples, which follow packed two 12-bit samples to 3 bytes (little-endian:
+// byte 0 = a[7:0], byte 1 = a[11:8] | b[3:0] << 4, byte 2 = b[11:4]):
+typedef struct __attribute__((packed)) {
+  uint32_t block;              // Blocks since the capture started; a gap means blocks were dropped
+  uint32_t timestamp_us;       // micros() at the block's first sample
+  uint32_t sample_rate;        // Hz
+  uint16_t block_samples;
+  uint16_t first_sample;       // Index in the block of the chunk's first sample
+  uint16_t sample_count;       // Samples in this chunk
+  uint8_t gain_index;          // Charge amplifier gain setting (see set_charge_amplifier_gain())
+  uint8_t profile_index;       // Modem profile the receiver was tuned to
+} capture_chunk_header_t;
+
+static_assert(sizeof(capture_chunk_header_t) == 20, "capture_adc.py and replay.cpp expect 20-byte headers");
+static_assert(CAPTURE_BLOCK_SAMPLES % CAPTURE_CHUNK_SAMPLES == 0 && CAPTURE_CHUNK_SAMPLES % 2 == 0,
+              "chunks tile a block and pack in pairs");
+
+void start_capture(uint32_t block_limit);
+
+void stop_capture();
+
+void print_capture_status();
+
+void capture_adc_block(const uint16_t *samples, uint32_t timestamp_us, uint8_t gain_index);
+
+void poll_capture();
+
+#endif
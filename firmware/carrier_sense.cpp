@@ -0,0 +1,46 @@
+// ==================================================================
+// carrier_sense.cpp
+// Tracks the ambient noise floor from per-block in-band power and says when the channel is busy
+// ==================================================================
+#include "carrier_sense.h"
+#include "receiver.h"
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Clears the tracker: the first block's power becomes the floor.
+ */
+void initialize_carrier_sense(carrier_sense_state *cs) {
+  cs->power = 0;
+  cs->floor = 0;
+  cs->measured = false;
+  cs->busy_blocks = 0;
+}
+
+/**
+ * Takes one block's in-band power and moves the floor: straight down to a quieter block, otherwise up by
+ * RECEIVER_NOISE_FLOOR_RISE a block (doubling in about 9 s) so it follows a rising ambient level. While
+ * blocks stand busy the floor holds still, so a long transmission is never mistaken for the ambient; a
+ * channel busy for longer than RECEIVER_NOISE_FLOOR_HOLD blocks is taken to be louder ambient and the floor
+ * creeps up after all.
+ */
+void update_carrier_sense(carrier_sense_state *cs, float power) {
+  const bool busy = cs->measured && power > RECEIVER_CARRIER_SENSE_RATIO * cs->floor;
+  cs->busy_blocks = (busy) ? cs->busy_blocks + 1 : 0;
+  cs->power = power;
+  if (busy && cs->busy_blocks <= RECEIVER_NOISE_FLOOR_HOLD) {
+    return;
+  }
+  const float risen_floor = cs->floor * RECEIVER_NOISE_FLOOR_RISE;
+  cs->floor = (!cs->measured || power < risen_floor) ? power : risen_floor;
+  cs->measured = true;
+}
+
+/**
+ * Whether the last block's power stood RECEIVER_CARRIER_SENSE_RATIO above the floor.
+ */
+bool carrier_sense_busy(const carrier_sense_state *cs) {
+  return cs->power > RECEIVER_CARRIER_SENSE_RATIO * cs->floor;
+}
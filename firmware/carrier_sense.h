@@ -0,0 +1,23 @@
+// ==================================================================
+// carrier_sense.h
+// Defines the noise floor tracker behind energy-detect carrier sense
+// ==================================================================
+#ifndef CARRIER_SENSE_H
+#define CARRIER_SENSE_H
+
+#include <stdint.h>
+
+typedef struct {
+  volatile float power;        // Mean in-band power of the last block
+  volatile float floor;        // Estimate of the ambient level the power is compared with
+  bool measured;               // Both are 0 until the first block
+  uint32_t busy_blocks;        // Blocks in a row that have stood above the floor
+} carrier_sense_state;
+
+void initialize_carrier_sense(carrier_sense_state *cs);
+
+void update_carrier_sense(carrier_sense_state *cs, float power);
+
+bool carrier_sense_busy(const carrier_sense_state *cs);
+
+#endif
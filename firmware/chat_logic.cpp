@@ -2,11 +2,21 @@
 // chat_logic.cpp
 // Handles chat buffer state, message logging, and packetization
 // ==================================================================
-#include <string.h>  // for strncpy
+#include <stdio.h>   // for snprintf
+#include <string.h>  // for memcpy, strncpy, strnlen
 #include <time.h>    // for time()
 
 #include "chat_logic.h"
+#include "deframer.h"
 #include "display.h"
+#include "event_log.h"
+#include "fragment.h"
+#include "link.h"
+#include "mac.h"
+#include "modem_profile.h"
+#include "receiver.h"
+#include "relay.h"
+#include "tdma.h"
 
 // ------------------------------------------------------------------
 // State
@@ -15,6 +25,42 @@
 IntervalTimer test_incoming_message;
 static ChatBufferState chat_buffer_state = {0, 0, 0, {}};
 static int incoming_message_count = 0;
+static volatile int test_messages_due = 0;  // Posted by poll_incoming_messages(), like received ones
+
+// Receive-side deframing state, driven one bit at a time from the ADC interrupt:
+static deframer_state deframer = {};
+
+// Completed incoming frame, handed from the interrupt to loop(), with the local time (ms) it started arriving,
+// and, when the receiver timed its leading edge (arrival_valid), that time (micros()) and its SNR (else -1):
+static mac_header_t pending_incoming_header;
+static char pending_incoming_text[MAX_TEXT_LENGTH];
+static uint32_t pending_incoming_arrival_ms;
+static bool pending_incoming_arrival_valid;
+static uint32_t pending_incoming_arrival_us;
+static float pending_incoming_snr;
+static bool pending_incoming_for_us;  // Otherwise only kept to be relayed
+static volatile bool pending_incoming = false;
+
+// Channel access for outgoing messages (queued and sent from loop()), and where they are addressed:
+static mac_state mac;
+static uint8_t message_destination = MAC_BROADCAST_ADDRESS;
+
+// Coordinated access, whenever this unit is the station or hears one (otherwise the MAC contends), and
+// the beacon or request it last built:
+static tdma_state tdma;
+static mac_frame_t tdma_control_frame;
+
+// Forwarding for divers out of each other's range, and the frame last handed from it to the MAC:
+static relay_state relay;
+static mac_frame_t relay_frame;
+
+// Text messages being put back together from their fragments:
+static reassembly_state reassembly;
+
+// Ranging and link quality for each node heard, and the reply last taken from it to send:
+static link_state link;
+static mac_frame_t link_reply_frame;
+static bool link_display_stale = false;  // Destination changed: poll_incoming_messages() redraws the readout
 
 // ------------------------------------------------------------------
 // Functions
@@ -38,12 +84,17 @@ void _debug_print_chat_history(ChatBufferState* state) {
 }
 
 /**
- * Copies the provided message text, sender, and recipient into the chat history buffer,
- * updates the write index, and increments the message count (up to a maximum).
+ * Copies the provided message text, sender, recipient and flags (MESSAGE_FLAG_*) into the chat history buffer,
+ * updates the write index, and increments the message count (up to a maximum). Returns the entry's index.
+ * Call from loop() only (see poll_keyboard() and poll_incoming_messages()): nothing else touches the history.
  */
-void add_message_to_chat_history(ChatBufferState* state, const char* message_text, const char* sender, const char* recipient) {
+int add_message_to_chat_history(ChatBufferState* state, const char* message_text, const char* sender, const char* recipient,
+                                 uint8_t flags) {
   message_t curr_message;
   curr_message.timestamp = time(NULL);
+  curr_message.flags = flags;
+  curr_message.source = 0;
+  curr_message.sequence = 0;
 
   // Have to copy into curr_message like this bc message_text won't be available in mem:
   strncpy(curr_message.text, message_text, MAX_TEXT_LENGTH - 1);
@@ -54,56 +105,514 @@ void add_message_to_chat_history(ChatBufferState* state, const char* message_tex
   curr_message.recipient[MAX_NAME_LENGTH - 1] = '\0';
 
   // Ring buffer logic to overwrite oldest message when buffer is exceeded:
-  state->chat_history[state->message_buffer_write_index] = curr_message;
+  int index = state->message_buffer_write_index;
+  state->chat_history[index] = curr_message;
   state->message_buffer_write_index = (state->message_buffer_write_index + 1) % MAX_CHAT_MESSAGES;
   if (state->chat_history_message_count < MAX_CHAT_MESSAGES) {
     state->chat_history_message_count++;
   }
+  return index;
 }
 
 /**
- * Packetizes a message by adding header (SOH and STX) and footer (ETX and EOT) bytes to the original message,
- * storing the result in transmit_buffer.
+ * Packetizes a message by adding header (SOH, STX and the MAC header) and footer (ETX and EOT) bytes to the
+ * header->length bytes of payload, storing the result in transmit_buffer. Returns the packet length: the
+ * MAC header (and a TDMA payload) is binary, so the packet is not a C string.
  */
-void packetize_message(const char* message, char* transmit_buffer) {
-  // Adds header bytes: SOH (0x01) and STX (0x02)
+size_t packetize_message(const mac_header_t* header, const char* message, char* transmit_buffer) {
+  // Adds header bytes: SOH (0x01) and STX (0x02), then the type, addresses and length
   transmit_buffer[0] = 0x01;
   transmit_buffer[1] = 0x02;
+  memcpy(&transmit_buffer[2], header, sizeof(mac_header_t));
+  const size_t text_start = 2 + sizeof(mac_header_t);
 
-  // Copies message into buffer, accounting for 2 header bytes:
-  strncpy(&transmit_buffer[2], message, MAX_PACKET_SIZE - 4);
-  int msg_len = strlen(&transmit_buffer[2]);
+  // Copies the payload into buffer after the header:
+  size_t msg_len = (header->length < MAX_TEXT_LENGTH) ? header->length : MAX_TEXT_LENGTH - 1;
+  memcpy(&transmit_buffer[text_start], message, msg_len);
 
   // Adds footer bytes: ETX (0x03) and EOT (0x04)
-  transmit_buffer[2 + msg_len]     = 0x03;
-  transmit_buffer[2 + msg_len + 1] = 0x04;
+  transmit_buffer[text_start + msg_len]     = 0x03;
+  transmit_buffer[text_start + msg_len + 1] = 0x04;
+  return text_start + msg_len + 2;
+}
 
-  // Null-terminates the string:
-  transmit_buffer[2 + msg_len + 2] = '\0';
+/**
+ * Feeds one demodulated bit to the deframer (see update_deframer()). A complete frame for this node, or
+ * one to relay, is parked for poll_incoming_messages(), since this runs in the ADC interrupt, stamped with
+ * when it started arriving: the time its last bit was sampled, less its airtime. The receiver's timing of
+ * the leading edge goes with it when it lines up with that estimate (within two symbols, plus the ms the
+ * airtime is rounded to), so ranging never measures from some other burst of noise.
+ */
+void receive_bit(int bit) {
+  if (!update_deframer(&deframer, bit)) {
+    return;
+  }
+  bool for_us = accept_mac_frame(&mac, &deframer.header);
+  if (!for_us && !wants_relay_frame(&relay, &deframer.header)) {
+    log_event(EVENT_MAC_FILTERED, deframer.header.source, deframer.header.destination);
+    return;
+  }
+  // Only kept if loop() has taken the previous one:
+  if (!pending_incoming) {
+    uint32_t age_ms = (micros() - get_receiver_sample_time_us()) / 1000;
+    const tx_parameters_t *tx = &get_active_modem_profile()->tx;
+    uint32_t airtime_ms = modem_packet_airtime_ms(tx, MAC_PACKET_OVERHEAD + deframer.header.length);
+    pending_incoming_arrival_ms = millis() - age_ms - airtime_ms;
+    uint32_t estimated_start_us = get_receiver_sample_time_us() - airtime_ms * 1000;
+    int32_t tolerance_us = 2 * tx->usec_per_symbol + 5000;
+    int32_t offset_us = 0;
+    pending_incoming_arrival_valid = get_receiver_arrival(&pending_incoming_arrival_us, &pending_incoming_snr);
+    if (pending_incoming_arrival_valid) {
+      offset_us = (int32_t)(pending_incoming_arrival_us - estimated_start_us);
+    }
+    pending_incoming_arrival_valid = pending_incoming_arrival_valid && offset_us > -tolerance_us && offset_us < tolerance_us;
+    if (!pending_incoming_arrival_valid) {
+      pending_incoming_snr = -1;
+    }
+    pending_incoming_header = deframer.header;
+    pending_incoming_for_us = for_us;
+    memcpy(pending_incoming_text, deframer.text, deframer.text_length + 1);
+    pending_incoming = true;
+    log_event(EVENT_RX_FRAME, deframer.text_length);
+  } else {
+    log_event(EVENT_RX_FRAME_DROPPED, deframer.text_length);
+  }
 }
 
 /**
- * This function packetizes the given message by adding protocol-specific header and footer bytes,
- * transmits the resulting packet using predefined transmission parameters (e.g., 2000 Hz for a 0 bit,
- * 2200 Hz for a 1 bit, with a 10 ms bit period), and then logs the original message into the chat history,
- * then redraws the display.
+ * Shows a message as far as its fragments have arrived: the first one adds a chat history entry, later
+ * ones fill in the same entry, which stays marked partial until every fragment is in. If the entry has
+ * since been overwritten (the history is a ring), the message starts a new one. Runs from loop(), the only
+ * place the history changes, so no new message can take the entry between checking it and filling it in.
  */
-void send_message(const char* message_text) {
-  char transmit_buffer[MAX_PACKET_SIZE];
-  packetize_message(message_text, transmit_buffer);
-  tx_parameters_t params = {2000, 2200, 10000};
-  transmit_message(transmit_buffer, &params);
-  add_message_to_chat_history(&chat_buffer_state, message_text, RECIPIENT_UNKEY, RECIPIENT_VOID);
+static void show_fragments(fragment_slot_t *slot) {
+  char text[MAX_TEXT_LENGTH];
+  render_fragments(slot, text, sizeof(text));
+  uint8_t flags = MESSAGE_FLAG_INCOMING | ((slot->header.hops > 0) ? MESSAGE_FLAG_RELAYED : 0) |
+                  (slot->complete ? 0 : MESSAGE_FLAG_PARTIAL);
+
+  message_t *entry = (slot->history_index >= 0) ? &chat_buffer_state.chat_history[slot->history_index] : NULL;
+  if (entry && (entry->flags & MESSAGE_FLAG_PARTIAL) && entry->source == slot->header.source &&
+      entry->sequence == slot->header.sequence) {
+    strncpy(entry->text, text, MAX_TEXT_LENGTH - 1);
+    entry->text[MAX_TEXT_LENGTH - 1] = '\0';
+    entry->flags = flags;
+  } else {
+    char sender[MAX_NAME_LENGTH], recipient[MAX_NAME_LENGTH];
+    format_mac_address(slot->header.source, sender, sizeof(sender));
+    format_mac_address(slot->header.destination, recipient, sizeof(recipient));
+    slot->history_index = add_message_to_chat_history(&chat_buffer_state, text, sender, recipient, flags);
+    entry = &chat_buffer_state.chat_history[slot->history_index];
+    entry->source = slot->header.source;
+    entry->sequence = slot->header.sequence;
+  }
   display_chat_history(&chat_buffer_state);
 }
 
 /**
- * Currently used to simulated staggered incoming messages.
+ * Shows the link to the current destination beside the battery ("#12 43.5m 18dB": address, range and the
+ * SNR it is heard with), or when broadcasting, to the node ranged most recently.
  */
-void incoming_message_callback() {
-  const char *test_message_text = TEST_MESSAGE_TEXT;
-  add_message_to_chat_history(&chat_buffer_state, test_message_text, RECIPIENT_VOID, RECIPIENT_UNKEY);
+static void update_link_display() {
+  const link_node_t *node = NULL;
+  if (message_destination != MAC_BROADCAST_ADDRESS) {
+    node = find_link_node(&link, message_destination);
+  } else {
+    for (int i = 0; i < LINK_MAX_NODES; i++) {
+      const link_node_t *n = &link.nodes[i];
+      if (n->used && n->ranged && (!node || (int32_t)(n->range_ms - node->range_ms) > 0)) {
+        node = n;
+      }
+    }
+  }
+  char status[LINK_STATUS_TEXT_LENGTH] = "";
+  if (node && node->ranged) {
+    snprintf(status, sizeof(status), "#%u %.1fm %.0fdB", (unsigned)node->address, node->range_m, node->snr_db);
+  } else if (node && node->snr_known) {
+    snprintf(status, sizeof(status), "#%u %.0fdB", (unsigned)node->address, node->snr_db);
+  }
+  display_link_status(status);
+}
+
+/**
+ * Counts a received frame for the link's quality figures once its payload has been checked (intact), since
+ * the MAC header has no checksum of its own. A frame failing its check counts as lost only against a node
+ * already in the link table: its source may be as corrupt as the rest, and mustn't add a node.
+ */
+static void note_checked_packet(uint8_t source, bool intact) {
+  if (intact || find_link_node(&link, source)) {
+    note_link_packet(&link, source, intact, pending_incoming_snr, millis());
+  }
+}
+
+/**
+ * Adds any message completed by receive_bit() to the chat history (once, however many relays it comes
+ * through) and redraws the display, offering it for relaying as well. Fragments show up as they arrive
+ * (see show_fragments()). TDMA beacons and requests go on to the schedule, and ranging pings and replies
+ * to the link (see link.h), which also counts every frame with a payload check for its quality figures.
+ * Text only arrives in fragments: transmit_frame() never sends a whole message. Test messages (see
+ * incoming_message_callback()) are added here too, and the link readout follows destination changes: with
+ * poll_keyboard(), this is the only place the chat history and link readout change or are redrawn, all
+ * from loop().
+ */
+void poll_incoming_messages() {
+  noInterrupts();
+  int test_messages = test_messages_due;
+  test_messages_due = 0;
+  interrupts();
+  for (int i = 0; i < test_messages; i++) {
+    add_message_to_chat_history(&chat_buffer_state, TEST_MESSAGE_TEXT, RECIPIENT_VOID, RECIPIENT_UNKEY,
+                                MESSAGE_FLAG_INCOMING);
+  }
+  if (test_messages > 0) {
+    display_chat_history(&chat_buffer_state);
+  }
+  if (link_display_stale) {
+    link_display_stale = false;
+    update_link_display();
+  }
+
+  if (!pending_incoming) {
+    return;
+  }
+  switch (pending_incoming_header.type) {
+    case MAC_FRAME_TEXT_FRAGMENT: {
+      // A copy of a message already complete here (heard again through a relay):
+      if (relay_frame_seen(&relay, &pending_incoming_header)) {
+        noInterrupts();
+        note_relay_frame(&relay, &pending_incoming_header, &mac);
+        interrupts();
+        break;
+      }
+      uint32_t rejected = reassembly.fragments_rejected;
+      fragment_slot_t *slot = add_fragment(&reassembly, &pending_incoming_header, pending_incoming_text, millis());
+      note_checked_packet(pending_incoming_header.source, reassembly.fragments_rejected == rejected);
+      if (!slot) {
+        break;
+      }
+      if (pending_incoming_for_us) {
+        show_fragments(slot);
+      }
+      if (slot->complete) {
+        noInterrupts();
+        note_relay_frame(&relay, &slot->header, &mac);
+        interrupts();
+        offer_relay_frame(&relay, &slot->header, slot->text, millis());
+      }
+      break;
+    }
+    case MAC_FRAME_TDMA_BEACON:
+      note_checked_packet(pending_incoming_header.source, tdma_frame_intact(&pending_incoming_header, pending_incoming_text));
+      handle_tdma_beacon(&tdma, &pending_incoming_header, pending_incoming_text, pending_incoming_arrival_ms);
+      break;
+    case MAC_FRAME_TDMA_REQUEST:
+      note_checked_packet(pending_incoming_header.source, tdma_frame_intact(&pending_incoming_header, pending_incoming_text));
+      handle_tdma_request(&tdma, &pending_incoming_header, pending_incoming_text, pending_incoming_arrival_ms);
+      break;
+    case MAC_FRAME_RANGE_PING:
+      // Pings and replies carry no checksum (their pattern counts bit errors instead); one the link takes counts:
+      if (handle_link_ping(&link, &pending_incoming_header, pending_incoming_text, pending_incoming_arrival_valid,
+                           pending_incoming_arrival_us, pending_incoming_snr, micros(), millis())) {
+        note_checked_packet(pending_incoming_header.source, true);
+      }
+      break;
+    case MAC_FRAME_RANGE_REPLY:
+      if (handle_link_reply(&link, &pending_incoming_header, pending_incoming_text, pending_incoming_arrival_valid,
+                            pending_incoming_arrival_us, millis())) {
+        note_checked_packet(pending_incoming_header.source, true);
+      }
+      break;
+  }
+  pending_incoming = false;
+  update_link_display();
+}
+
+/**
+ * Queues the message for the MAC to send to the current destination (see set_message_destination()),
+ * then logs it into the chat history and redraws the display. Returns false, leaving the history alone,
+ * if too many messages are already waiting for the channel.
+ */
+bool send_message(const char* message_text) {
+  size_t length = strnlen(message_text, MAX_TEXT_LENGTH - 1);
+  noInterrupts();
+  bool queued = queue_mac_frame(&mac, message_destination, message_text);
+  int waiting = mac.queue_count;
+  interrupts();
+  if (!queued) {
+    log_event(EVENT_MAC_QUEUE_FULL, length);
+    return false;
+  }
+  log_event(EVENT_MAC_QUEUED, length, waiting);
+
+  char sender[MAX_NAME_LENGTH], recipient[MAX_NAME_LENGTH];
+  format_mac_address(mac.address, sender, sizeof(sender));
+  format_mac_address(message_destination, recipient, sizeof(recipient));
+  add_message_to_chat_history(&chat_buffer_state, message_text, sender, recipient, 0);
   display_chat_history(&chat_buffer_state);
+  return true;
+}
+
+/**
+ * Packetizes and transmits one frame using the active modem profile's transmission parameters (e.g. for
+ * "fsk80", 14840 Hz for a 0 bit and 15160 Hz for a 1 bit with a 12.5 ms symbol period), starting at
+ * micros() == start_us (0 for straight away). Text goes out one fragment per call (fragment_index of it), so
+ * the recipient can show each part as soon as it decodes. Pings and replies go at the power level they carry;
+ * anything else at the level the link picks for its destination (see choose_link_power_level()).
+ */
+static void transmit_frame(const mac_frame_t *frame, int fragment_index, uint32_t contention_slots, uint32_t start_us) {
+  static mac_frame_t fragment;
+  char transmit_buffer[MAX_PACKET_SIZE];
+  const tx_parameters_t *tx = &get_active_modem_profile()->tx;
+  log_event(EVENT_MAC_TRANSMIT, frame->header.length, frame->header.destination, contention_slots);
+  const bool ranging = frame->header.type == MAC_FRAME_RANGE_PING || frame->header.type == MAC_FRAME_RANGE_REPLY;
+  set_transmit_power_level((ranging) ? ((const link_ping_t *)frame->text)->power_level
+                                     : choose_link_power_level(&link, frame->header.destination, millis()));
+  if (frame->header.type != MAC_FRAME_TEXT) {
+    size_t packet_length = packetize_message(&frame->header, frame->text, transmit_buffer);
+    uint32_t sent_us = transmit_message_at(transmit_buffer, packet_length, tx, start_us);
+    if (frame->header.type == MAC_FRAME_RANGE_PING) {
+      note_link_ping_sent(&link, &frame->header, sent_us, millis());
+    }
+    return;
+  }
+  build_fragment(frame, fragment_index, &fragment);
+  size_t packet_length = packetize_message(&fragment.header, fragment.text, transmit_buffer);
+  transmit_message(transmit_buffer, packet_length, tx);
+}
+
+/**
+ * Sends whatever may go out now. A ranging reply comes first: it skips channel access like an ACK would, at
+ * the time it promised its ping (nothing else starts while it waits, so nothing holds it up). Otherwise,
+ * while this unit is a TDMA station, or hears one, the schedule decides (see update_tdma()); failing that
+ * the MAC contends for the channel, sensing it busy while the receiver hears in-band energy or is partway
+ * through a packet. Text goes a fragment per call either way, so loop() gets a pass between fragments and
+ * contention senses the channel again before each one. Call from loop(); transmitting blocks it.
+ */
+void poll_outgoing_messages() {
+  update_link(&link, millis());
+  if (link.reply_pending) {
+    uint32_t start_us;
+    if (take_link_reply(&link, micros(), &link_reply_frame, &start_us)) {
+      transmit_frame(&link_reply_frame, 0, 0, start_us);
+    }
+    return;
+  }
+
+  // Relayed frames whose forwarding delay is up join the queue like our own, but never take its last
+  // places, so a busy relay can't turn away the user's SEND:
+  noInterrupts();
+  bool mac_has_room = mac.queue_count < MAC_RELAY_QUEUE_LENGTH;
+  interrupts();
+  if (mac_has_room && take_relay_frame(&relay, millis(), &relay_frame)) {
+    noInterrupts();
+    forward_mac_frame(&mac, &relay_frame);
+    interrupts();
+  }
+
+  const tx_parameters_t *tx = &get_active_modem_profile()->tx;
+  uint32_t head_airtime_ms;
+  noInterrupts();
+  uint32_t demand_ms = mac_queue_airtime_ms(&mac, tx, &head_airtime_ms);
+  interrupts();
+
+  // Follows profile changes from the MENU key, so slots are sized for what is actually sent:
+  tdma.tx = tx;
+  tdma_action_t action = update_tdma(&tdma, millis(), head_airtime_ms, demand_ms, &tdma_control_frame);
+  if (action == TDMA_WAIT) {
+    return;
+  }
+  if (action == TDMA_SEND_CONTROL) {
+    transmit_frame(&tdma_control_frame, 0, 0, 0);
+    return;
+  }
+
+  // The frame stays at the head of the queue (send_message() only adds at the tail) until its last fragment
+  // is out:
+  noInterrupts();
+  const mac_frame_t *frame = (action == TDMA_SEND_QUEUED)
+                           ? peek_mac_frame(&mac)
+                           : update_mac(&mac, millis(), receiver_channel_busy() || deframer.in_packet);
+  uint32_t contention_slots = mac.contention_slots;
+  int fragment_index = mac.head_fragments_sent;
+  interrupts();
+  if (!frame) {
+    return;
+  }
+  transmit_frame(frame, fragment_index, contention_slots, 0);
+  noInterrupts();
+  finish_mac_fragment(&mac, millis());
+  interrupts();
+}
+
+/**
+ * Starts the MAC with an address taken from the chip's unique ID (set_mac_address() overrides it), which
+ * also seeds its backoff draws, and TDMA following any station it hears. Call before setup_receiver(),
+ * which starts delivering frames.
+ */
+void setup_mac() {
+  uint32_t chip_id = HW_OCOTP_CFG0 ^ HW_OCOTP_CFG1;
+  uint8_t address = MAC_MIN_ADDRESS + chip_id % (MAC_MAX_ADDRESS - MAC_MIN_ADDRESS + 1);
+  initialize_mac(&mac, address, chip_id ^ ARM_DWT_CYCCNT, millis());
+  initialize_tdma(&tdma, address, &get_active_modem_profile()->tx, chip_id ^ micros());
+  initialize_relay(&relay, address, chip_id ^ (micros() << 16));
+  initialize_reassembly(&reassembly);
+  initialize_link(&link, address);
+}
+
+/**
+ * Changes this node's address. Messages already queued keep the old one as their source.
+ */
+void set_mac_address(uint8_t address) {
+  mac.address = address;
+  tdma.address = address;
+  relay.address = address;
+  link.address = address;
+}
+
+/**
+ * Sets where send_message() addresses messages: a node address, or MAC_BROADCAST_ADDRESS for everyone. The
+ * link readout switches to the new destination on the next poll_incoming_messages().
+ */
+void set_message_destination(uint8_t destination) {
+  message_destination = destination;
+  link_display_stale = true;
+}
+
+/**
+ * Makes this unit the TDMA station for its group (beacons start straight away), or a follower again.
+ */
+void set_tdma_station_mode(bool station) {
+  set_tdma_station(&tdma, station, millis());
+}
+
+/**
+ * Prints the TDMA role, clock and slot (a station also lists the nodes it schedules) to serial.
+ */
+void print_tdma_status() {
+  if (tdma.station) {
+    Serial.printf("TDMA station, cycle %u of %lu ms, guard %lu ms, %lu beacons sent, %lu requests heard\n",
+                  (unsigned)tdma.cycle, (unsigned long)tdma.cycle_ms, (unsigned long)tdma_guard_ms(&tdma),
+                  (unsigned long)tdma.beacons, (unsigned long)tdma.requests);
+    for (int i = 0; i < tdma.node_count; i++) {
+      Serial.printf("  node %u: range %u ms, %u ms queued, last heard in cycle %u\n", (unsigned)tdma.nodes[i].address,
+                    (unsigned)tdma.nodes[i].range_ms, (unsigned)tdma.nodes[i].demand_ms,
+                    (unsigned)tdma.nodes[i].last_heard_cycle);
+    }
+  } else if (tdma.synced) {
+    Serial.printf("TDMA node of station %u, cycle %u: clock offset %ld ms, range %u ms, slot %lu ms%s\n",
+                  (unsigned)tdma.station_address, (unsigned)tdma.cycle, (long)tdma.clock_offset_ms,
+                  (unsigned)tdma.range_ms, (unsigned long)tdma.slot_length_ms, tdma.listed ? "" : " (not listed yet)");
+  } else {
+    Serial.println("No TDMA station heard: contending (CSMA)");
+  }
+}
+
+/**
+ * Turns forwarding of other divers' messages on or off.
+ */
+void set_relay_enabled(bool enabled) {
+  relay.enabled = enabled;
+}
+
+/**
+ * Prints whether this node relays, what it has forwarded and the duplicates it has suppressed to serial.
+ */
+void print_relay_status() {
+  Serial.printf("Relaying %s: %lu forwarded, %d waiting, %lu cancelled (another relay was first), %lu dropped "
+                "(queue full)\n", relay.enabled ? "on" : "off", (unsigned long)relay.frames_forwarded,
+                relay.queue_count, (unsigned long)relay.forwards_cancelled, (unsigned long)relay.frames_rejected);
+  Serial.printf("%lu duplicate messages suppressed\n", (unsigned long)relay.duplicates_dropped);
+}
+
+/**
+ * Prints this node's address, the destination, the MAC queue and counters, and carrier sense to serial.
+ */
+void print_mac_status() {
+  float power, floor_power;
+  get_receiver_channel_power(&power, &floor_power);
+  char destination[MAX_NAME_LENGTH];
+  format_mac_address(message_destination, destination, sizeof(destination));
+
+  noInterrupts();
+  mac_state snapshot = mac;
+  interrupts();
+  Serial.printf("Address %u, sending to %s\n", (unsigned)snapshot.address, destination);
+  Serial.printf("%d queued, contention window %lu slots of %d ms\n", snapshot.queue_count,
+                (unsigned long)snapshot.contention_slots, MAC_SLOT_MS);
+  Serial.printf("%lu sent, %lu rejected (queue full), %lu backoffs interrupted, %lu frames for others\n",
+                (unsigned long)snapshot.frames_sent, (unsigned long)snapshot.frames_rejected,
+                (unsigned long)snapshot.backoffs_interrupted, (unsigned long)snapshot.frames_filtered);
+  Serial.printf("%lu fragments received, %lu rejected (checksum), %lu messages completed\n",
+                (unsigned long)reassembly.fragments_received, (unsigned long)reassembly.fragments_rejected,
+                (unsigned long)reassembly.messages_completed);
+  Serial.printf("Channel %s: power %.3g, noise floor %.3g\n", receiver_channel_busy() ? "busy" : "clear", power,
+                floor_power);
+}
+
+/**
+ * Queues a ranging ping to destination, which answers with the SNR and bit errors it heard it with; the
+ * round trip gives the range (see link.h). Returns false while an earlier ping is still unanswered, or if
+ * the MAC queue is full.
+ */
+bool send_link_ping(uint8_t destination) {
+  mac_frame_t ping;
+  if (destination == MAC_BROADCAST_ADDRESS ||
+      !start_link_ping(&link, destination, choose_link_power_level(&link, destination, millis()), &ping)) {
+    return false;
+  }
+  noInterrupts();
+  bool queued = forward_mac_frame(&mac, &ping);
+  interrupts();
+  if (!queued) {
+    link.ping_pending = false;
+  }
+  return queued;
+}
+
+/**
+ * Prints each node's range, SNR both ways, bit and packet error rates, the power level sent to it and
+ * whether a different rate would suit it, then the ping counters, to serial.
+ */
+void print_link_status() {
+  static const char *const rate_hints[] = {"hold", "slower", "faster"};
+  const uint32_t now_ms = millis();
+  int listed = 0;
+  for (int i = 0; i < LINK_MAX_NODES; i++) {
+    const link_node_t *node = &link.nodes[i];
+    if (!node->used) {
+      continue;
+    }
+    listed++;
+    Serial.printf("node %u, heard %lu s ago:", (unsigned)node->address, (unsigned long)(now_ms - node->last_heard_ms) / 1000);
+    if (node->ranged) {
+      Serial.printf(" range %.1f m (%lu s ago),", node->range_m, (unsigned long)(now_ms - node->range_ms) / 1000);
+    }
+    if (node->snr_known) {
+      Serial.printf(" SNR %.1f dB,", node->snr_db);
+    }
+    if (node->far_snr_known) {
+      Serial.printf(" far SNR %.1f dB,", node->far_snr_db);
+    }
+    Serial.printf(" BER %.2g (%lu bits), PER %.2g (%lu packets), power level %u, rate %s\n",
+                  link_bit_error_rate(node), (unsigned long)node->bits, link_packet_error_rate(node),
+                  (unsigned long)node->packets, (unsigned)choose_link_power_level(&link, node->address, now_ms),
+                  rate_hints[link_rate_hint(node)]);
+  }
+  if (!listed) {
+    Serial.println("No nodes heard");
+  }
+  Serial.printf("%lu pings sent%s, %lu replies sent, %lu late, %lu ranges rejected (arrival not timed)\n",
+                (unsigned long)link.pings_sent, link.ping_pending ? " (one waiting)" : "",
+                (unsigned long)link.replies_sent, (unsigned long)link.replies_late,
+                (unsigned long)link.ranges_rejected);
+}
+
+/**
+ * Currently used to simulated staggered incoming messages. Runs from a timer interrupt, so it only counts
+ * the message; poll_incoming_messages() adds it to the chat history.
+ */
+void incoming_message_callback() {
+  test_messages_due++;
   incoming_message_count++;
   if (incoming_message_count >= TESTING_MESSAGE_COUNT_LIMIT) {
     test_incoming_message.end();
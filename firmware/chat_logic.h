@@ -14,7 +14,33 @@ extern IntervalTimer test_incoming_message;
 
 ChatBufferState* get_chat_buffer_state();
 
-void send_message(const char* message_text);
+bool send_message(const char* message_text);
+
+void receive_bit(int bit);
+
+void poll_incoming_messages();
+
+void poll_outgoing_messages();
+
+void setup_mac();
+
+void set_mac_address(uint8_t address);
+
+void set_message_destination(uint8_t destination);
+
+void print_mac_status();
+
+void set_tdma_station_mode(bool station);
+
+void print_tdma_status();
+
+void set_relay_enabled(bool enabled);
+
+void print_relay_status();
+
+bool send_link_ping(uint8_t destination);
+
+void print_link_status();
 
 void incoming_message_callback();
 
@@ -0,0 +1,173 @@
+// ==================================================================
+// chirp.cpp
+// Demodulates chirp spread spectrum by dechirping and taking an FFT
+// ==================================================================
+#include <arm_math.h>
+#include <arm_const_structs.h>
+#include <string.h>  // for memcpy
+
+#include "chirp.h"
+#include "sine_table.h"
+
+// ------------------------------------------------------------------
+// Tables
+// ------------------------------------------------------------------
+
+/**
+ * Conjugate of the unshifted baseband up-chirp (-B/2 to +B/2 over one symbol, B = half the baseband
+ * rate), interleaved complex. Multiplying a received symbol by it leaves a tone whose FFT bin is the
+ * symbol's cyclic shift.
+ */
+typedef struct {
+  float values[2 * CHIRP_FFT_SIZE];
+} chirp_table_t;
+
+constexpr chirp_table_t make_downchirp_table() {
+  chirp_table_t t = {};
+  for (int n = 0; n < CHIRP_FFT_SIZE; n++) {
+    // Instantaneous frequency -fs/4 + (fs/2) * n / N cycles per second, integrated over n samples:
+    double cycles = -n / 4.0 + (double)n * n / (4.0 * CHIRP_FFT_SIZE);
+    double phase = 2 * 3.14159265358979323846 * (cycles - (int64_t)cycles);
+    t.values[2 * n] = (float)constexpr_cos(phase);
+    t.values[2 * n + 1] = (float)-constexpr_sin(phase);
+  }
+  return t;
+}
+
+static constexpr chirp_table_t downchirp = make_downchirp_table();
+
+static_assert(CHIRP_FFT_SIZE == 128, "update_chirp() uses the 128-point CMSIS FFT");
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// Dechirped window and its FFT (in place), then power per bin:
+static float spectrum[2 * CHIRP_FFT_SIZE];
+static float power[CHIRP_FFT_SIZE];
+
+// Gray code over the used shifts, as in the transmitter: symbol value -> shift index and back
+static const uint8_t gray_shift[4] = {0, 1, 3, 2};
+
+// Folded-spectrum peak must stand this far above its mean for a symbol to count as a chirp (noise alone
+// gets there well under 1% of the time):
+static const float min_peak_ratio = 6.0f;
+
+// Aligned preamble chirps needed to lock, and weak symbols in a row that drop the lock:
+static const int symbols_to_lock = 2;
+static const int symbols_to_unlock = 8;
+
+// Fraction of the measured timing error (in samples) corrected per symbol once locked:
+static const float timing_loop_gain = 0.5f;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Prepares an unlocked demodulator.
+ */
+void initialize_chirp(chirp_state *c) {
+  c->fill = 0;
+  c->skip_samples = 0;
+  c->locked = false;
+  c->aligned_symbols = 0;
+  c->weak_symbols = 0;
+  c->timing_error = 0;
+  c->last_peak_ratio = 0;
+}
+
+/**
+ * Dechirps the window and finds the strongest cyclic shift. Returns its bin (0..CHIRP_CHIPS-1) and writes
+ * the peak's fractional offset from that bin (-0.5..0.5) and its peak-to-average ratio.
+ */
+static int find_chirp_shift(chirp_state *c, float *fraction, float *peak_ratio) {
+  arm_cmplx_mult_cmplx_f32(c->window, downchirp.values, spectrum, CHIRP_FFT_SIZE);
+  arm_cfft_f32(&arm_cfft_sR_f32_len128, spectrum, 0, 1);
+  arm_cmplx_mag_squared_f32(spectrum, power, CHIRP_FFT_SIZE);
+
+  // The sweep wraps partway through a shifted symbol; that part lands CHIRP_CHIPS bins away, so fold it back:
+  arm_add_f32(power, &power[CHIRP_CHIPS], power, CHIRP_CHIPS);
+
+  float peak, mean;
+  uint32_t index;
+  arm_max_f32(power, CHIRP_CHIPS, &peak, &index);
+  arm_mean_f32(power, CHIRP_CHIPS, &mean);
+  *peak_ratio = (mean > 0) ? peak / mean : 0;
+
+  // Centroid of the peak and its neighbours places it between bins:
+  float below = power[(index + CHIRP_CHIPS - 1) % CHIRP_CHIPS];
+  float above = power[(index + 1) % CHIRP_CHIPS];
+  *fraction = (above - below) / (below + peak + above);
+  return index;
+}
+
+/**
+ * Consumes one complex baseband sample. Whenever a whole symbol has arrived: while unlocked, slides the
+ * window onto the preamble's unshifted chirps; once locked, decodes the shift into MODEM_CSS_BITS_PER_SYMBOL
+ * bits (msb first) and tracks timing. Returns the number of bits written.
+ */
+int update_chirp(chirp_state *c, float x_i, float x_q, uint8_t *bits) {
+  if (c->skip_samples > 0) {
+    c->skip_samples--;
+    return 0;
+  }
+  c->window[2 * c->fill] = x_i;
+  c->window[2 * c->fill + 1] = x_q;
+  if (++c->fill < CHIRP_FFT_SIZE) {
+    return 0;
+  }
+  c->fill = 0;
+
+  float fraction, peak_ratio;
+  int shift = find_chirp_shift(c, &fraction, &peak_ratio);
+  c->last_peak_ratio = peak_ratio;
+
+  // A window starting late by d samples sees the chirp d/2 bins higher (20 Hz per sample at 40 Hz/bin):
+  if (!c->locked) {
+    if (peak_ratio < min_peak_ratio) {
+      c->aligned_symbols = 0;
+      return 0;
+    }
+    int offset_bins = (shift < CHIRP_CHIPS / 2) ? shift : shift - CHIRP_CHIPS;  // -32..31
+    if (offset_bins >= -1 && offset_bins <= 1) {
+      if (++c->aligned_symbols >= symbols_to_lock) {
+        c->locked = true;
+        c->weak_symbols = 0;
+        c->timing_error = 0;
+      }
+    } else {
+      // Assume this was a preamble chirp and jump the window onto the symbol boundary
+      c->skip_samples = (CHIRP_FFT_SIZE - 2 * offset_bins) % CHIRP_FFT_SIZE;
+      c->aligned_symbols = 0;
+    }
+    return 0;
+  }
+
+  c->weak_symbols = (peak_ratio < min_peak_ratio) ? c->weak_symbols + 1 : 0;
+  if (c->weak_symbols >= symbols_to_unlock) {
+    initialize_chirp(c);
+    return 0;
+  }
+
+  // Nearest used shift, and how far the peak sits from it:
+  int position = (shift + CHIRP_SHIFT_SPACING / 2) / CHIRP_SHIFT_SPACING;
+  float error_bins = shift + fraction - position * CHIRP_SHIFT_SPACING;
+  int symbol = gray_shift[position % (1 << MODEM_CSS_BITS_PER_SYMBOL)];
+  for (int b = 0; b < MODEM_CSS_BITS_PER_SYMBOL; b++) {
+    bits[b] = (symbol >> (MODEM_CSS_BITS_PER_SYMBOL - 1 - b)) & 1;
+  }
+
+  // Timing: a late window (peak above its shift) is pulled earlier by reusing the last sample, an early
+  // one pushed later by dropping the next
+  c->timing_error += timing_loop_gain * 2 * error_bins;
+  if (c->timing_error >= 1) {
+    c->timing_error -= 1;
+    memcpy(&c->window[0], &c->window[2 * (CHIRP_FFT_SIZE - 1)], 2 * sizeof(float));
+    c->fill = 1;
+  } else if (c->timing_error <= -1) {
+    c->timing_error += 1;
+    c->skip_samples = 1;
+  }
+  return MODEM_CSS_BITS_PER_SYMBOL;
+}
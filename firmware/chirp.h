@@ -0,0 +1,41 @@
+// ==================================================================
+// chirp.h
+// Defines the chirp spread spectrum (CSS) demodulator for long range
+// ==================================================================
+#ifndef CHIRP_H
+#define CHIRP_H
+
+#include <stdint.h>
+
+#include "modem_profile.h"
+
+//----------------------------------------
+// Chirp Configuration
+//----------------------------------------
+#define CHIRP_FFT_SIZE              MODEM_MAX_SYMBOL_SAMPLES                // Dechirp FFT covers one symbol
+#define CHIRP_CHIPS                 (CHIRP_FFT_SIZE / 2)                    // Sweep is half the baseband rate
+#define CHIRP_SHIFT_SPACING         (CHIRP_CHIPS >> MODEM_CSS_BITS_PER_SYMBOL)  // Chips between used shifts
+
+typedef struct {
+  // Symbol window, as interleaved complex (re, im) baseband samples
+  float window[2 * CHIRP_FFT_SIZE];
+  int fill;
+  int skip_samples;            // Input samples to drop before the window starts filling again
+
+  // Acquisition (on a run of unshifted preamble chirps) and lock
+  bool locked;
+  int aligned_symbols;
+  int weak_symbols;
+
+  // Symbol-timing tracking, in baseband samples
+  float timing_error;
+
+  // Peak-to-average ratio of the most recent symbol's folded spectrum
+  float last_peak_ratio;
+} chirp_state;
+
+void initialize_chirp(chirp_state *c);
+
+int update_chirp(chirp_state *c, float x_i, float x_q, uint8_t *bits);
+
+#endif
@@ -8,20 +8,29 @@
 #include <SPI.h>
 #include <Wire.h>
 
+#include "capture.h"
+#include "chat_logic.h"
 #include "comm.h"
 #include "config.h"
+#include "dds.h"
+#include "event_log.h"
 #include "hardware_config.h"
-#include "goertzel.h"
+#include "modem_profile.h"
+#include "profiler.h"
+#include "receiver.h"
 
 // ------------------------------------------------------------------
 // State
 // ------------------------------------------------------------------
 
 // ADC will sample at freq of 81.92 kHz:
-static const uint32_t adc_frequency = 81920;
+static const uint32_t adc_frequency = MODEM_SAMPLE_RATE;
 
-// Size of buffer where ADC data will be stored:
-static const uint32_t buffer_size = 10240;
+// Size of buffer where ADC data will be stored (one receiver block):
+static const uint32_t buffer_size = RECEIVER_BLOCK_SAMPLES;
+
+// DAC update rate while transmitting (matches the ADC so symbol lengths line up on both ends):
+static const uint32_t dac_frequency = MODEM_SAMPLE_RATE;
 
 char tx_display_buffer[MAX_TEXT_LENGTH];
 uint16_t tx_display_buffer_length = 0;
@@ -33,15 +42,12 @@ DMAChannel dma_ch1;
 DMAMEM static volatile uint16_t __attribute__((aligned(32))) dma_adc_buff1[buffer_size];
 uint16_t adc_buffer_copy[buffer_size];
 
-static uint8_t print_ctr = 0;
-static const uint8_t gs_len = 10;
-
-// An array that will store state for the Goertzel algo - each goertzel_state obj
-// holds data to compute G algo for that frequency:
-goertzel_state gs[gs_len];
-
-// Charge amplifier gain:
+// Charge amplifier gain, and the setting last written (tagged onto captured ADC blocks):
 static const int adg728_i2c_address = 76;
+static uint8_t charge_amplifier_gain_index = 0;
+
+// Peak DAC swing around DDS_DAC_MIDSCALE for the next transmission (see set_transmit_power_level()):
+static uint16_t transmit_amplitude = DDS_DAC_FULL_AMPLITUDE;
 
 // ------------------------------------------------------------------
 // Functions
@@ -68,37 +74,120 @@ void write_to_dac(uint8_t address, uint16_t value) {
 }
 
 /**
- * Transmits a message by modulating each character's bits into analog tones.
+ * Starts the DDS on the waveform for one symbol: a tone per value for FSK, a Gray-coded phase step of
+ * the carrier for DBPSK (0 / 180 degrees) and DQPSK (00 / 01 / 11 / 10 -> 0 / 90 / 180 / 270 degrees),
+ * or for CSS an up-chirp cyclically shifted by a Gray-coded fraction of the sweep (00 / 01 / 11 / 10 ->
+ * 0 / 1/4 / 2/4 / 3/4).
+ */
+static void start_tx_symbol(dds_state *dds, const tx_parameters_t *tx_parameters, uint32_t symbol,
+                            uint32_t phase_increment_low, uint32_t phase_increment_high) {
+  if (tx_parameters->modulation == MODEM_MODULATION_FSK) {
+    start_dds_symbol(dds, (symbol) ? phase_increment_high : phase_increment_low);
+    return;
+  }
+  static const uint32_t dqpsk_quarter_turns[4] = {0, 1, 3, 2};
+  if (tx_parameters->modulation == MODEM_MODULATION_CSS) {
+    uint32_t span = phase_increment_high - phase_increment_low;
+    start_dds_chirp(dds, phase_increment_low, span, (span >> tx_parameters->bits_per_symbol) * dqpsk_quarter_turns[symbol]);
+    return;
+  }
+  uint32_t quarter_turns = (tx_parameters->modulation == MODEM_MODULATION_DBPSK) ? 2 * symbol : dqpsk_quarter_turns[symbol];
+  start_dds_symbol(dds, phase_increment_low);
+  shift_dds_phase(dds, quarter_turns << 30);
+}
+
+/**
+ * Transmits a packet of length bytes by modulating each byte's bits into analog symbols (see start_tx_symbol()).
+ * A preamble of MODEM_PREAMBLE_SYMBOLS symbol transitions goes first so the receiver can find symbol
+ * timing; it also serves as the phase reference for differential PSK.
+ * Tones come from a DDS whose phase accumulator runs continuously across symbols, and samples are paced to
+ * dac_frequency with the cycle counter. The waveform swings around DDS_DAC_MIDSCALE over the DAC's full
+ * 12-bit range, optionally with raised-cosine fades at each symbol edge (tx_parameters->shape_symbol_edges).
  * Note: address of 0 --> writing to channel 0 of the DAC.
  * write_to_dac(address=0, val=0): DAC receives a 24-bit message that sets the output to the minimum voltage (0V)
  * write_to_dac(address=0, val=4095): DAC receives a 24-bit message that sets the output to the maximum voltage
+ * Returns micros() at the first DAC sample, which ranging measures round trips from.
  */
-void transmit_message(const char* message_to_transmit, const tx_parameters_t* tx_parameters) {
-  for (int i = 0; message_to_transmit[i] != '\0'; i++) {
-    Serial.print("Processing letter: ");
-    Serial.println(message_to_transmit[i]);
-    char letter = message_to_transmit[i];
-
-    // Translates each of char's 8 bits into a corresponding frequency starting with msb:
-    for (int j = 7; j >= 0; j--) {
-      int bit = (letter >> j) & 1;
-      // w is the angular frequency, wherein w = 2 * pi * f
-      float w = (bit) ? (2 * PI * tx_parameters->freq_high / 1e6)
-                      : (2 * PI * tx_parameters->freq_low / 1e6);
-      // Start time for the current bit period:
-      unsigned long bit_start = micros();
-      unsigned long time_usec;
-      uint16_t dac_value;
-      // Generates a sine wave for current bit for 10 ms:
-      while ((time_usec = micros() - bit_start) < tx_parameters->usec_per_bit) {
-        // Gets the phase angle at curr time in microsec and scales for 12 bit DAC:
-        dac_value = (uint16_t)(((sin(w * time_usec) + 1.0) / 2.0) * 409);
-        noInterrupts();
-        write_to_dac(0, dac_value);
-        interrupts();
+uint32_t transmit_message(const char* message_to_transmit, size_t length, const tx_parameters_t* tx_parameters) {
+  return transmit_message_at(message_to_transmit, length, tx_parameters, 0);
+}
+
+/**
+ * As transmit_message(), but the first sample goes out at micros() == start_us (busy-waiting until then),
+ * or straight away if start_us is 0 or already past. Used for ranging replies, which promise their
+ * turnaround (see link.h).
+ */
+uint32_t transmit_message_at(const char* message_to_transmit, size_t length, const tx_parameters_t* tx_parameters,
+                             uint32_t start_us) {
+  const uint32_t samples_per_symbol = (uint64_t)tx_parameters->usec_per_symbol * dac_frequency / 1000000;
+  const uint32_t ramp_samples = (tx_parameters->shape_symbol_edges) ? samples_per_symbol / MODEM_RAMP_FRACTION : 0;
+  const uint32_t phase_increment_low = dds_phase_increment(tx_parameters->freq_low, dac_frequency);
+  const uint32_t phase_increment_high = dds_phase_increment(tx_parameters->freq_high, dac_frequency);
+  const int bits_per_symbol = tx_parameters->bits_per_symbol;
+
+  dds_state dds;
+  initialize_dds(&dds, samples_per_symbol, ramp_samples, transmit_amplitude);
+
+  log_event(EVENT_TX_START, length, bits_per_symbol, tx_parameters->usec_per_symbol);
+  if (start_us != 0) {
+    while ((int32_t)(micros() - start_us) < 0) ;
+  }
+
+  // Sample n goes out at start_cycles + n * F_CPU_ACTUAL / dac_frequency:
+  noInterrupts();
+  const uint32_t start_cycles = ARM_DWT_CYCCNT;
+  start_us = micros();
+  interrupts();
+  uint64_t sample_count = 0;
+
+  // Preamble (FSK alternates tones, PSK flips 180 degrees every symbol, CSS repeats the unshifted chirp),
+  // then the message itself:
+  const int preamble_length = MODEM_PREAMBLE_SYMBOLS;
+  const int message_length = length * (8 / bits_per_symbol);
+  for (int k = 0; k < preamble_length + message_length; k++) {
+    uint32_t symbol;
+    if (k < preamble_length) {
+      if (tx_parameters->modulation == MODEM_MODULATION_FSK) {
+        symbol = k & 1;
+      } else if (tx_parameters->modulation == MODEM_MODULATION_CSS) {
+        symbol = 0;
+      } else {
+        symbol = (1U << bits_per_symbol) - 1;
       }
+    } else {
+      // Takes each char's bits bits_per_symbol at a time, starting with msb:
+      int bit_index = (k - preamble_length) * bits_per_symbol;
+      char letter = message_to_transmit[bit_index / 8];
+      if (bit_index % 8 == 0) {
+        log_event(EVENT_TX_CHARACTER, letter, (uint8_t)letter);
+      }
+      symbol = ((uint8_t)letter >> (8 - bits_per_symbol - bit_index % 8)) & ((1U << bits_per_symbol) - 1);
+    }
+
+    start_tx_symbol(&dds, tx_parameters, symbol, phase_increment_low, phase_increment_high);
+    for (uint32_t n = 0; n < samples_per_symbol; n++) {
+      uint16_t dac_value = next_dds_sample(&dds);
+      uint32_t deadline = start_cycles + (uint32_t)(sample_count++ * F_CPU_ACTUAL / dac_frequency);
+      // A whole sample period late means the waveform has already been distorted:
+      PROFILE_COUNT_IF(PROFILE_COUNTER_TX_UNDERRUN,
+                       (int32_t)(ARM_DWT_CYCCNT - deadline) > (int32_t)(F_CPU_ACTUAL / dac_frequency));
+      while ((int32_t)(ARM_DWT_CYCCNT - deadline) < 0) ;
+      noInterrupts();
+      write_to_dac(0, dac_value);
+      interrupts();
     }
   }
+  write_to_dac(0, DDS_DAC_MIDSCALE);
+  log_event(EVENT_TX_DONE, micros() - start_us);
+  return start_us;
+}
+
+/**
+ * Sets the power of the transmissions that follow: level 0 is the DAC's full swing, and each level above
+ * halves the amplitude (LINK_POWER_STEP_DB, about 6 dB, down).
+ */
+void set_transmit_power_level(uint8_t level) {
+  transmit_amplitude = DDS_DAC_FULL_AMPLITUDE >> level;
 }
 
 /**
@@ -106,6 +195,7 @@ void transmit_message(const char* message_to_transmit, const tx_parameters_t* tx
  * It shifts 1U left by gain_index to generate a specific binary pattern and writes this value to the amplifier's address.
  */
 void set_charge_amplifier_gain(uint8_t gain_index) {
+  charge_amplifier_gain_index = gain_index;
   Wire.beginTransmission(adg728_i2c_address);
   Wire.write(1U << gain_index);
   Wire.endTransmission();
@@ -135,11 +225,22 @@ void setup_transmitter() {
   write_to_dac(8, 1);          // 8 is address for VREF, 1 means use internal ref
 }
 
+
 /**
- * Deals with ADC data when DMA buffer is full, and processes the data with Goertzel filters and prints frequency domain data.
+ * Deals with ADC data when DMA buffer is full: hands a copy to any running capture, then runs it through
+ * the receive chain (see process_receiver_samples()). Every buffer is processed, since the front end
+ * filters need a contiguous stream.
  * Analog signals (voltages) --> digital values that can be processed by da Teensy
  */
 void adc_buffer_full_interrupt() {
+  // Latched before anything else (the copy and the rest take a while): the DMA buffer filled over the last
+  // buffer_size sample periods, ending at most an interrupt latency ago:
+  const uint32_t block_start_us = micros() - (uint32_t)((uint64_t)buffer_size * 1000000 / adc_frequency);
+  PROFILE_SCOPE(PROFILE_STAGE_ADC_ISR);
+  // DMA stops at the end of each buffer until re-enabled below, so an interrupt more than a few ms late
+  // (buffers are 125 ms apart) means lost samples:
+  PROFILE_CHECK_PERIOD(PROFILE_COUNTER_DMA_OVERRUN, (uint64_t)buffer_size * F_CPU_ACTUAL / adc_frequency,
+                       (uint64_t)buffer_size * F_CPU_ACTUAL / adc_frequency / 32);
   dma_ch1.clearInterrupt();
   // mempcy copies a block of memory from one location to another:
   memcpy((void *)adc_buffer_copy, (void *)dma_adc_buff1, sizeof(dma_adc_buff1));
@@ -148,25 +249,10 @@ void adc_buffer_full_interrupt() {
   // Re-enables the DMA channel for next read:
   dma_ch1.enable();
 
-  /**
-   * Processes data: uses Goertzel algorithm to analyze the frequency content of a series of ADC samples
-   */
-  if (print_ctr++ % SCAN_CHAIN_LENGTH == 0) {
-    for (size_t i = 0; i < buffer_size; i++) {
-      //Serial.printf("%d\n", adc_buffer_copy[i]);
-      for (int j = 0; j < gs_len; j++) {
-        goertzel_state *g = &gs[j];
-        update_goertzel(g, adc_buffer_copy[i]);
-      }
-    }
-    for (int j = 0; j < gs_len; j++) {
-      goertzel_state *g = &gs[j];
-      finalize_goertzel(g);
-      // Serial.printf("GS%d (%.0f Hz): %6.1f %6.1f \t %f %d\n",
-      //   j, g->w0/6.28 * adc_frequency, g->y_re, g->y_im, sqrt(pow(g->y_re, 2) + pow(g->y_im, 2)), adc_buffer_copy[j]);
-      reset_goertzel(g);
-    }
-  }
+  // Streams the raw block to the host first if a capture is running:
+  capture_adc_block(adc_buffer_copy, block_start_us, charge_amplifier_gain_index);
+
+  process_receiver_samples(adc_buffer_copy, buffer_size, block_start_us);
 }
 
 /**
@@ -177,11 +263,8 @@ void setup_receiver() {
   // Sets readPin_adc_0_pin as the input pin:
   pinMode(readPin_adc_0_pin, INPUT);
 
-  // Initializes Goertzel filters (TODO: Hardcoded frequencies here):
-  for (int j = 0; j < gs_len; j++) {
-    // The 2nd param sets the initial frequency for that filter: so 14000, 14200, 14400 etc
-    initialize_goertzel(&gs[j], 15000 + (j - 5) * 200, adc_frequency);
-  }
+  // Tunes the receive chain (front end, demodulators) to the active profile, passing bits to the deframer:
+  initialize_receiver(get_active_modem_profile(), receive_bit);
 
   // Sets gain on charge amplifier:
   set_charge_amplifier_gain(6);
@@ -211,3 +294,14 @@ void setup_receiver() {
   // This actually determines how fast to sample the signal, and starts timer to initiate dma transfer from adc to memory once 2x buffer size bytes reached
   adc->adc0->startTimer(adc_frequency);
 }
+
+/**
+ * Switches both TX and RX to the modem profile at index, retuning the front end and discarding any
+ * partially received symbol. Out-of-range indexes leave the current profile in place.
+ */
+void select_modem_profile(int index) {
+  noInterrupts();
+  set_active_modem_profile(index);
+  initialize_receiver(get_active_modem_profile(), receive_bit);
+  interrupts();
+}
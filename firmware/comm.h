@@ -5,16 +5,24 @@
 #ifndef COMM_H
 #define COMM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "config.h"
 
 extern uint16_t tx_display_buffer_length;
 
-void transmit_message(const char* message_to_transmit, const tx_parameters_t* tx_parameters);
+uint32_t transmit_message(const char* message_to_transmit, size_t length, const tx_parameters_t* tx_parameters);
+
+uint32_t transmit_message_at(const char* message_to_transmit, size_t length, const tx_parameters_t* tx_parameters,
+                             uint32_t start_us);
+
+void set_transmit_power_level(uint8_t level);
 
 void setup_receiver();
 
+void select_modem_profile(int index);
+
 void setup_transmitter();
 
 #endif
@@ -25,7 +25,7 @@
 #define CHAR_WIDTH                  7       // Width of each character in pixels
 #define MAX_CHAT_MESSAGES           50      // Maximum messages stored in chat history
 #define MAX_NAME_LENGTH             20      // Maximum length for sender/recipient names
-#define MAX_PACKET_SIZE             405     // Maximum packet size (including header/footer)
+#define MAX_PACKET_SIZE             411     // Maximum packet size (text, SOH STX, MAC header, ETX EOT)
 #define MAX_TEXT_LENGTH             400     // Maximum length of message text
 
 //----------------------------------------
@@ -43,6 +43,7 @@
 // Keyboard and Typing Configuration
 //----------------------------------------
 #define SCAN_CHAIN_LENGTH           56      // Number of keys to poll per cycle
+#define KEY_QUEUE_LENGTH            64      // Key presses held while loop() is busy (a fragment at fsk40 takes ~10 s)
 #define SEND_WRAP_LIMIT             30      // Wrap limit for outgoing messages
 #define TEXT_SIZE                   1       // Text size multiplier (depends on display)
 #define INCOMING_TIMESTAMP_START_X  10      // Horizontal offset for incoming timestamps
@@ -78,16 +79,27 @@
 #define SPACE_UNDER_BATTERY_WIDTH   15
 #define BATTERY_BOX_WIDTH           80
 #define SPACE_BESIDE_BATTERY_WIDTH  155     // Typically: CHAT_BOX_WIDTH - BATTERY_BOX_WIDTH
+#define LINK_STATUS_TEXT_LENGTH     26      // Link readout beside the battery, NUL included (25 chars fill the space)
 #define BORDER_PADDING_Y            6
 
 //----------------------------------------
 // Message and Test Constants
 //----------------------------------------
+#define MESSAGE_FLAG_INCOMING       0x01    // message_t.flags: received rather than sent by this node
+#define MESSAGE_FLAG_RELAYED        0x02    // message_t.flags: reached this node through another diver
+#define MESSAGE_FLAG_PARTIAL        0x04    // message_t.flags: fragments still missing (see fragment.h)
 #define RECIPIENT_UNKEY             "unkey"
 #define RECIPIENT_VOID              "the void"
 #define TEST_MESSAGE_TEXT           "Incoming from The Void"
 #define TESTING_MESSAGE_COUNT_LIMIT 2
 
+//----------------------------------------
+// Instrumentation
+//----------------------------------------
+#ifndef PROFILING_ENABLED
+#define PROFILING_ENABLED           1       // 0 compiles out every PROFILE_* timer and counter (see profiler.h)
+#endif
+
 //----------------------------------------
 // Type Definitions
 //----------------------------------------
@@ -96,12 +108,25 @@ typedef struct {
   char sender[MAX_NAME_LENGTH];
   char recipient[MAX_NAME_LENGTH];
   char text[MAX_TEXT_LENGTH];
+  uint8_t flags;               // MESSAGE_FLAG_*
+  uint8_t source;              // Received: the MAC header's source and sequence, which identify a message...
+  uint8_t sequence;            // ...whose fragments may still be filling in the entry
 } message_t;
 
+typedef enum {
+  MODEM_MODULATION_FSK,     // Binary FSK: freq_low sends a 0 bit, freq_high a 1 bit
+  MODEM_MODULATION_DBPSK,   // Differential BPSK on freq_low: 1 bit per symbol
+  MODEM_MODULATION_DQPSK,   // Differential QPSK on freq_low: 2 bits per symbol
+  MODEM_MODULATION_CSS,     // Chirp spread spectrum: cyclic shifts of an up-chirp from freq_low to freq_high
+} modem_modulation_t;
+
 typedef struct _tx_parameters {
-  float freq_low;
-  float freq_high;
-  uint32_t usec_per_bit;
+  float freq_low;           // FSK tone for a 0 bit, the PSK carrier, or the bottom of a chirp
+  float freq_high;          // FSK tone for a 1 bit (same as freq_low for PSK), or the top of a chirp
+  uint32_t usec_per_symbol;
+  bool shape_symbol_edges;  // Raised-cosine fade in/out at each symbol boundary
+  modem_modulation_t modulation;
+  uint8_t bits_per_symbol;
 } tx_parameters_t;
 
 typedef struct {
@@ -0,0 +1,221 @@
+// ==================================================================
+// console.cpp
+// Reads newline-terminated commands from USB serial and runs them
+// ==================================================================
+#include <Arduino.h>
+#include <stdlib.h>  // for strtoul
+#include <string.h>  // for strchr, strcmp, strlen, strncmp
+
+#include "capture.h"
+#include "chat_logic.h"
+#include "console.h"
+#include "event_log.h"
+#include "mac.h"
+#include "profiler.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+typedef struct {
+  const char *name;
+  const char *help;
+  void (*run)(const char *args);
+} console_command_t;
+
+// Longest command line kept; anything past it is dropped:
+static const int max_line_length = 64;
+
+static char line[max_line_length];
+static int line_length = 0;
+
+// ------------------------------------------------------------------
+// Commands
+// ------------------------------------------------------------------
+
+static void run_help(const char *args);
+
+/**
+ * "stats" prints the profiler snapshot; "stats reset" clears it.
+ */
+static void run_stats(const char *args) {
+  if (strcmp(args, "reset") == 0) {
+    reset_profile_stats();
+    Serial.println("Stats cleared");
+    return;
+  }
+  print_profile_stats();
+}
+
+/**
+ * "log verbose on|off" switches the high-rate (verbose) events in the event log; "log" shows the setting.
+ */
+static void run_log(const char *args) {
+  if (strcmp(args, "verbose on") == 0) {
+    set_event_log_verbose(true);
+  } else if (strcmp(args, "verbose off") == 0) {
+    set_event_log_verbose(false);
+  } else if (args[0] != '\0') {
+    Serial.println("Usage: log [verbose on|off]");
+    return;
+  }
+  Serial.printf("Verbose events are %s\n", get_event_log_verbose() ? "on" : "off");
+}
+
+/**
+ * "capture start [blocks]" streams raw ADC blocks (all of them until "capture stop" when no count is given);
+ * "capture" alone shows progress. Record with tools/capture_adc.py.
+ */
+static void run_capture(const char *args) {
+  if (strncmp(args, "start", 5) == 0 && (args[5] == '\0' || args[5] == ' ')) {
+    start_capture(strtoul(&args[5], NULL, 10));
+  } else if (strcmp(args, "stop") == 0) {
+    stop_capture();
+  } else if (args[0] != '\0') {
+    Serial.println("Usage: capture [start [blocks]|stop]");
+    return;
+  }
+  print_capture_status();
+}
+
+/**
+ * "mac addr N" sets this node's address, "mac to N|all" where messages go; "mac" alone shows the MAC state.
+ */
+static void run_mac(const char *args) {
+  if (strncmp(args, "addr ", 5) == 0) {
+    unsigned long address = strtoul(&args[5], NULL, 10);
+    if (address < MAC_MIN_ADDRESS || address > MAC_MAX_ADDRESS) {
+      Serial.printf("Addresses run from %d to %d\n", MAC_MIN_ADDRESS, MAC_MAX_ADDRESS);
+      return;
+    }
+    set_mac_address(address);
+  } else if (strcmp(args, "to all") == 0) {
+    set_message_destination(MAC_BROADCAST_ADDRESS);
+  } else if (strncmp(args, "to ", 3) == 0) {
+    unsigned long address = strtoul(&args[3], NULL, 10);
+    if (address < MAC_MIN_ADDRESS || address > MAC_MAX_ADDRESS) {
+      Serial.printf("Addresses run from %d to %d\n", MAC_MIN_ADDRESS, MAC_MAX_ADDRESS);
+      return;
+    }
+    set_message_destination(address);
+  } else if (args[0] != '\0') {
+    Serial.println("Usage: mac [addr N|to N|to all]");
+    return;
+  }
+  print_mac_status();
+}
+
+/**
+ * "tdma station on|off" makes this unit the boat station (sending beacons) or a follower; "tdma" alone shows
+ * the schedule.
+ */
+static void run_tdma(const char *args) {
+  if (strcmp(args, "station on") == 0) {
+    set_tdma_station_mode(true);
+  } else if (strcmp(args, "station off") == 0) {
+    set_tdma_station_mode(false);
+  } else if (args[0] != '\0') {
+    Serial.println("Usage: tdma [station on|off]");
+    return;
+  }
+  print_tdma_status();
+}
+
+/**
+ * "relay on|off" switches forwarding of other divers' messages; "relay" alone shows what it has done.
+ */
+static void run_relay(const char *args) {
+  if (strcmp(args, "on") == 0) {
+    set_relay_enabled(true);
+  } else if (strcmp(args, "off") == 0) {
+    set_relay_enabled(false);
+  } else if (args[0] != '\0') {
+    Serial.println("Usage: relay [on|off]");
+    return;
+  }
+  print_relay_status();
+}
+
+/**
+ * "link ping N" ranges to node N (the reply also reports how well each end hears the other); "link" alone
+ * shows range and link quality for every node heard.
+ */
+static void run_link(const char *args) {
+  if (strncmp(args, "ping ", 5) == 0) {
+    unsigned long address = strtoul(&args[5], NULL, 10);
+    if (address < MAC_MIN_ADDRESS || address > MAC_MAX_ADDRESS) {
+      Serial.printf("Addresses run from %d to %d\n", MAC_MIN_ADDRESS, MAC_MAX_ADDRESS);
+      return;
+    }
+    if (!send_link_ping(address)) {
+      Serial.println("Not sent: a ping is still waiting for its reply, or the queue is full");
+    }
+    return;
+  } else if (args[0] != '\0') {
+    Serial.println("Usage: link [ping N]");
+    return;
+  }
+  print_link_status();
+}
+
+static const console_command_t commands[] = {
+  {"help", "list commands", run_help},
+  {"stats", "print stage timings and fault counters ('stats reset' clears them)", run_stats},
+  {"log", "show or set event logging ('log verbose on|off')", run_log},
+  {"capture", "stream raw ADC blocks ('capture start [blocks]', 'capture stop')", run_capture},
+  {"mac", "show or set addressing ('mac addr N', 'mac to N|all')", run_mac},
+  {"tdma", "show the slot schedule, or run it ('tdma station on|off')", run_tdma},
+  {"relay", "show or set forwarding for out-of-range divers ('relay on|off')", run_relay},
+  {"link", "show range and link quality per node, or range to one ('link ping N')", run_link},
+};
+
+static const int command_count = sizeof(commands) / sizeof(commands[0]);
+
+static void run_help(const char *args) {
+  (void)args;
+  for (int i = 0; i < command_count; i++) {
+    Serial.printf("  %-8s %s\n", commands[i].name, commands[i].help);
+  }
+}
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Splits a line into the command name and its arguments and runs the matching command.
+ */
+static void run_line(char *text) {
+  char *args = strchr(text, ' ');
+  if (args) {
+    *args++ = '\0';
+  } else {
+    args = text + strlen(text);
+  }
+  if (text[0] == '\0') {
+    return;
+  }
+  for (int i = 0; i < command_count; i++) {
+    if (strcmp(text, commands[i].name) == 0) {
+      commands[i].run(args);
+      return;
+    }
+  }
+  Serial.printf("Unknown command '%s' (try 'help')\n", text);
+}
+
+/**
+ * Collects whatever serial input has arrived and runs each complete line as a command. Call from loop().
+ */
+void poll_console() {
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == '\r' || c == '\n') {
+      line[line_length] = '\0';
+      run_line(line);
+      line_length = 0;
+    } else if (line_length < max_line_length - 1) {
+      line[line_length++] = c;
+    }
+  }
+}
@@ -0,0 +1,10 @@
+// ==================================================================
+// console.h
+// Declarations for the USB serial command console
+// ==================================================================
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+void poll_console();
+
+#endif
@@ -0,0 +1,96 @@
+// ==================================================================
+// dds.cpp
+// Generates phase-continuous, optionally edge-shaped tones for the DAC
+// ==================================================================
+#include "dds.h"
+#include "sine_table.h"
+
+/**
+ * Converts a tone frequency to the 32-bit phase step per sample at sample rate fs (2^32 == one cycle).
+ */
+uint32_t dds_phase_increment(float f0, float fs) {
+  return (uint32_t)((double)f0 / fs * 4294967296.0);
+}
+
+/**
+ * Resets the generator to zero phase. ramp_samples (clamped to half a symbol) sets the length of the
+ * raised-cosine fade applied at both edges of every symbol; 0 keeps a constant envelope.
+ */
+void initialize_dds(dds_state *d, uint32_t samples_per_symbol, uint32_t ramp_samples, uint16_t amplitude) {
+  d->phase = 0;
+  d->phase_increment = 0;
+  d->samples_per_symbol = samples_per_symbol;
+  d->sample_in_symbol = 0;
+  d->ramp_samples = (ramp_samples > samples_per_symbol / 2) ? samples_per_symbol / 2 : ramp_samples;
+  d->amplitude = (amplitude > DDS_DAC_FULL_AMPLITUDE) ? DDS_DAC_FULL_AMPLITUDE : amplitude;
+  d->sweep_step = 0;
+  d->sweep_low = 0;
+  d->sweep_span = 0;
+}
+
+/**
+ * Begins a new symbol at the given tone. The accumulator is deliberately left alone so the waveform
+ * carries on from wherever the previous symbol ended.
+ */
+void start_dds_symbol(dds_state *d, uint32_t phase_increment) {
+  d->phase_increment = phase_increment;
+  d->sample_in_symbol = 0;
+  d->sweep_step = 0;
+}
+
+/**
+ * Begins a symbol that sweeps up through span_increment (in phase-increment units) over exactly one
+ * symbol, starting start_offset above low_increment and wrapping back to the bottom when it reaches the
+ * top: a cyclically shifted up-chirp. Phase stays continuous, as for tones.
+ */
+void start_dds_chirp(dds_state *d, uint32_t low_increment, uint32_t span_increment, uint32_t start_offset) {
+  d->sweep_low = low_increment;
+  d->sweep_span = span_increment;
+  d->sweep_step = span_increment / d->samples_per_symbol;
+  d->phase_increment = low_increment + start_offset % span_increment;
+  d->sample_in_symbol = 0;
+}
+
+/**
+ * Jumps the phase accumulator by phase_step (2^32 == 2π), for phase-shift keying. Call right after
+ * start_dds_symbol() so the jump lands on the symbol edge, where shaping has the envelope at zero.
+ */
+void shift_dds_phase(dds_state *d, uint32_t phase_step) {
+  d->phase += phase_step;
+}
+
+/**
+ * Raised-cosine gain (Q15) for a sample `distance` samples in from the nearest symbol edge:
+ * 0.5 * (1 - cos(pi * t)) == sin^2(pi * t / 2), read out of the first quarter of the sine table.
+ */
+static inline int32_t raised_cosine_gain(uint32_t distance, uint32_t ramp_samples) {
+  uint32_t index = (distance * SINE_TABLE_QUARTER) / ramp_samples;
+  int32_t s = sine_table.values[index];
+  return (s * s) >> 15;
+}
+
+/**
+ * Returns the next 12-bit DAC code and advances the phase accumulator.
+ */
+uint16_t next_dds_sample(dds_state *d) {
+  int32_t sample = (int32_t)sine_lookup(d->phase) * d->amplitude;  // Q15 * counts
+
+  if (d->ramp_samples > 0) {
+    uint32_t n = d->sample_in_symbol;
+    uint32_t from_end = d->samples_per_symbol - 1 - n;
+    uint32_t distance = (n < from_end) ? n : from_end;
+    if (distance < d->ramp_samples) {
+      sample = (int32_t)(((int64_t)sample * raised_cosine_gain(distance, d->ramp_samples)) >> 15);
+    }
+  }
+
+  d->phase += d->phase_increment;
+  d->sample_in_symbol++;
+  if (d->sweep_step != 0) {
+    d->phase_increment += d->sweep_step;
+    if (d->phase_increment - d->sweep_low >= d->sweep_span) {
+      d->phase_increment -= d->sweep_span;
+    }
+  }
+  return (uint16_t)(DDS_DAC_MIDSCALE + (sample >> 15));
+}
@@ -0,0 +1,46 @@
+// ==================================================================
+// dds.h
+// Defines the direct digital synthesis (DDS) waveform generator used for TX
+// ==================================================================
+#ifndef DDS_H
+#define DDS_H
+
+#include <stdint.h>
+
+//----------------------------------------
+// DAC Output Range
+//----------------------------------------
+#define DDS_DAC_MIDSCALE            2048    // 12-bit DAC code for the waveform's zero line
+#define DDS_DAC_FULL_AMPLITUDE      2047    // Largest peak that stays inside 0..4095
+
+typedef struct {
+  // Phase runs continuously across symbols: only the increment changes at a symbol boundary
+  uint32_t phase;
+  uint32_t phase_increment;
+
+  uint32_t samples_per_symbol;
+  uint32_t sample_in_symbol;
+  uint32_t ramp_samples;     // Raised-cosine edge length at each end of a symbol (0 = no shaping)
+
+  uint16_t amplitude;        // Peak deviation from DDS_DAC_MIDSCALE, in DAC counts
+
+  // Linear frequency sweep (chirp): the increment steps by sweep_step each sample and wraps within
+  // [sweep_low, sweep_low + sweep_span). sweep_step == 0 holds a steady tone.
+  uint32_t sweep_step;
+  uint32_t sweep_low;
+  uint32_t sweep_span;
+} dds_state;
+
+uint32_t dds_phase_increment(float f0, float fs);
+
+void initialize_dds(dds_state *d, uint32_t samples_per_symbol, uint32_t ramp_samples, uint16_t amplitude);
+
+void start_dds_symbol(dds_state *d, uint32_t phase_increment);
+
+void shift_dds_phase(dds_state *d, uint32_t phase_step);
+
+void start_dds_chirp(dds_state *d, uint32_t low_increment, uint32_t span_increment, uint32_t start_offset);
+
+uint16_t next_dds_sample(dds_state *d);
+
+#endif
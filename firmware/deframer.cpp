@@ -0,0 +1,74 @@
+// ==================================================================
+// deframer.cpp
+// Recovers packets from the demodulated bit stream
+// ==================================================================
+#include "deframer.h"
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Starts hunting for a header.
+ */
+void initialize_deframer(deframer_state *d) {
+  d->sync_shift_register = 0;
+  d->in_packet = false;
+  d->saw_etx = false;
+  d->bit_count = 0;
+  d->byte = 0;
+  d->header_length = 0;
+  d->text_length = 0;
+  d->text[0] = '\0';
+}
+
+/**
+ * Undoes packetize_message() one received bit at a time: hunts for the SOH STX header at any bit
+ * offset, takes the MAC header that follows, then exactly header.length payload bytes, which must be
+ * followed by ETX EOT. Returns true when the bit completes a message, which is then in d->header and
+ * d->text (d->text_length bytes, null-terminated) until the next call.
+ */
+bool update_deframer(deframer_state *d, int bit) {
+  if (!d->in_packet) {
+    d->sync_shift_register = (d->sync_shift_register << 1) | (bit & 1);
+    if (d->sync_shift_register == 0x0102) {
+      d->in_packet = true;
+      d->saw_etx = false;
+      d->bit_count = 0;
+      d->header_length = 0;
+      d->text_length = 0;
+    }
+    return false;
+  }
+
+  d->byte = (d->byte << 1) | (bit & 1);
+  if (++d->bit_count < 8) {
+    return false;
+  }
+  d->bit_count = 0;
+
+  if (d->header_length < sizeof(mac_header_t)) {
+    ((uint8_t *)&d->header)[d->header_length++] = d->byte;
+    if (d->header_length == sizeof(mac_header_t) && d->header.length > MAX_TEXT_LENGTH - 1) {
+      // Corrupt (or not a header at all): go back to hunting
+      d->in_packet = false;
+      d->sync_shift_register = 0;
+    }
+  } else if (d->text_length < d->header.length) {
+    d->text[d->text_length++] = d->byte;
+  } else if (!d->saw_etx) {
+    if (d->byte != 0x03) {
+      d->in_packet = false;
+      d->sync_shift_register = 0;
+      return false;
+    }
+    d->saw_etx = true;
+    d->text[d->text_length] = '\0';
+  } else {
+    // Only a message framed by ETX EOT is accepted:
+    d->in_packet = false;
+    d->sync_shift_register = 0;
+    return d->byte == 0x04;
+  }
+  return false;
+}
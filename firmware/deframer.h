@@ -0,0 +1,31 @@
+// ==================================================================
+// deframer.h
+// Defines the receive-side packet deframer (inverse of packetize_message)
+// ==================================================================
+#ifndef DEFRAMER_H
+#define DEFRAMER_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "mac.h"
+
+typedef struct {
+  uint16_t sync_shift_register;  // Last 16 bits seen while hunting for the SOH STX header
+  bool in_packet;
+  bool saw_etx;
+  uint8_t bit_count;
+  uint8_t byte;
+  uint8_t header_length;         // Header bytes taken so far
+
+  // Header and payload of the packet in progress; a complete message once update_deframer() returns true
+  mac_header_t header;
+  char text[MAX_TEXT_LENGTH];
+  int text_length;
+} deframer_state;
+
+void initialize_deframer(deframer_state *d);
+
+bool update_deframer(deframer_state *d, int bit);
+
+#endif
@@ -7,6 +7,7 @@
 #include "config.h"
 #include "display.h"
 #include "hardware_config.h"
+#include "profiler.h"
 
 // ------------------------------------------------------------------
 // State
@@ -15,6 +16,9 @@
 extern char tx_display_buffer[];
 bool screen_on;
 
+// Link readout beside the battery (see display_link_status()), kept to put back after the chat box clips:
+static char link_status_text[LINK_STATUS_TEXT_LENGTH] = "";
+
 // Initializes the display using pin numbers defined above, which get passed to the constructor:
 ILI9341_t3n tft = ILI9341_t3n(tft_cs_pin, tft_dc_pin, tft_reset_pin, tft_mosi_pin, tft_sck_pin, tft_miso_pin);
 
@@ -22,6 +26,19 @@ ILI9341_t3n tft = ILI9341_t3n(tft_cs_pin, tft_dc_pin, tft_reset_pin, tft_mosi_pi
 // Functions
 // ------------------------------------------------------------------
 
+/**
+ * Prints the link readout beside the battery display, over whatever was there.
+ */
+static void draw_link_status() {
+  tft.fillRect(BATTERY_BOX_WIDTH, 0, SPACE_BESIDE_BATTERY_WIDTH, BATTERY_BOX_HEIGHT, ILI9341_WHITE);
+  tft.setTextColor(ILI9341_BLACK, ILI9341_WHITE);
+  int16_t x, y;
+  tft.getCursor(&x, &y);
+  tft.setCursor(BATTERY_BOX_WIDTH + 2, 2);
+  tft.print(link_status_text);
+  tft.setCursor(x, y);
+}
+
 /**
  * Draws message character content (incorporating line breaks and text wrapping) in the chat history box for a given message.
  * A single message is defined as whatever text chars a user has entered into the text staging box when "send" is pressed.
@@ -76,6 +93,7 @@ void draw_message_text(int length_limit, const char *text_to_draw, int text_star
  * fillRect(rect_start_x, rect_start_y, rect_width, rect_height, rect_fill_color);
  */
 void display_chat_history(ChatBufferState* state) {
+  PROFILE_SCOPE(PROFILE_STAGE_CHAT_REDRAW);
   /*
     Note that curr_message_index points to the current message in the buffer being displayed or accessed, adjusted for the user's scroll position.
     So if message_scroll_offset is 0, that means the most recent message in the history is being shown at the bottom (UP has not been pressed).
@@ -119,10 +137,14 @@ void display_chat_history(ChatBufferState* state) {
     int draw_start_y = curr_message_pos - box_height + LINE_HEIGHT;
 
     // Draws message box and timestamp for incoming messages:
-    if (strcmp(state->chat_history[curr_message_index].recipient, RECIPIENT_UNKEY) == 0) {
+    if (state->chat_history[curr_message_index].flags & MESSAGE_FLAG_INCOMING) {
       // Draws timestamp at current line:
       tft.drawString(time_as_str, INCOMING_TIMESTAMP_START_X, draw_start_y);
-      tft.drawRect(INCOMING_BORDER_START_X, border_start_y, INCOMING_BORDER_WIDTH, border_height, ILI9341_BLUE);
+      // Grey while fragments are missing, orange for messages that came through a relaying diver:
+      uint8_t flags = state->chat_history[curr_message_index].flags;
+      uint16_t border_color = (flags & MESSAGE_FLAG_PARTIAL) ? ILI9341_DARKGREY
+                            : (flags & MESSAGE_FLAG_RELAYED) ? ILI9341_ORANGE : ILI9341_BLUE;
+      tft.drawRect(INCOMING_BORDER_START_X, border_start_y, INCOMING_BORDER_WIDTH, border_height, border_color);
 
     // Draws message box and timestamp for outgoing messages:
     } else {
@@ -131,7 +153,7 @@ void display_chat_history(ChatBufferState* state) {
     }
 
     // Draws text chars for incoming messages:
-    if (strcmp(state->chat_history[curr_message_index].recipient, RECIPIENT_UNKEY) == 0) {
+    if (state->chat_history[curr_message_index].flags & MESSAGE_FLAG_INCOMING) {
       draw_message_text(text_length, state->chat_history[curr_message_index].text, INCOMING_TEXT_START_X, draw_start_y, CHAT_WRAP_LIMIT);
     // Draws text chars for outgoing messages:
     } else {
@@ -149,6 +171,22 @@ void display_chat_history(ChatBufferState* state) {
     // Gets next most recent message from ring buffer:
     curr_message_index = (curr_message_index - 1 + MAX_CHAT_MESSAGES) % MAX_CHAT_MESSAGES;
   }
+  if (messages_to_display_count > 0 && link_status_text[0]) {
+    draw_link_status();
+  }
+}
+
+/**
+ * Shows status (e.g. "#12 43.5m 18dB", see update_link_display()) beside the battery display, redrawing only
+ * when it changes. An empty string clears it.
+ */
+void display_link_status(const char* status) {
+  if (strncmp(status, link_status_text, LINK_STATUS_TEXT_LENGTH - 1) == 0) {
+    return;
+  }
+  strncpy(link_status_text, status, LINK_STATUS_TEXT_LENGTH - 1);
+  link_status_text[LINK_STATUS_TEXT_LENGTH - 1] = '\0';
+  draw_link_status();
 }
 
 /**
@@ -156,6 +194,7 @@ void display_chat_history(ChatBufferState* state) {
  * It also reprints the current contents of the tx_display_buffer.
  */
 void redraw_typing_box() {
+  PROFILE_SCOPE(PROFILE_STAGE_TYPING_REDRAW);
   tft.fillRect(TYPING_BOX_START_X, TYPING_BOX_START_Y, CHAT_BOX_WIDTH, TYPING_BOX_HEIGHT, ILI9341_WHITE);
   tft.drawRect(TYPING_BOX_START_X, TYPING_BOX_START_Y, CHAT_BOX_WIDTH, TYPING_BOX_HEIGHT, ILI9341_RED);
   draw_message_text(tx_display_buffer_length, tx_display_buffer, TYPING_CURSOR_X, TYPING_CURSOR_Y, SEND_WRAP_LIMIT);
@@ -13,6 +13,8 @@ extern ILI9341_t3n tft;
 
 void display_chat_history(ChatBufferState* state);
 
+void display_link_status(const char* status);
+
 void reset_tx_display_buffer();
 
 void redraw_typing_box();
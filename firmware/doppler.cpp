@@ -0,0 +1,112 @@
+// ==================================================================
+// doppler.cpp
+// Estimates and compensates Doppler shift between moving divers/boats
+// ==================================================================
+#include <math.h>  // for fabsf, sqrtf
+
+#include "doppler.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// Smoothing applied to each new offset measurement:
+static const float residual_smoothing = 0.2f;
+
+// Measurements needed, and residual offset reached, before the front end is retuned (FSK only measures
+// symbols between two of their own tone, about one in four, so this is kept low enough to follow a swell):
+static const int min_measurements_to_retune = 4;
+static const float retune_threshold_hz = 0.5f;
+
+// 2 m/s at 15 kHz is 20 Hz; anything much past that is not Doppler:
+static const float max_offset_hz = 40.0f;
+
+// Symbols without a usable measurement before compensation is dropped (the link has gone quiet):
+static const int symbols_to_forget = 64;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Prepares a tracker for the given profile with no offset compensated.
+ */
+void initialize_doppler(doppler_state *d, const modem_profile_t *profile) {
+  d->center_hz = profile->center_hz;
+  d->bin_hz = (float)MODEM_BASEBAND_RATE / profile->symbol_samples;
+  d->window = profile->window;
+  d->residual_hz = 0;
+  d->residual_count = 0;
+  d->symbols_since_measurement = 0;
+  d->applied_hz = 0;
+}
+
+/**
+ * Estimates how far a tone sits from its detector bin (in Hz) from the magnitudes of that bin and its
+ * two neighbours (as written by detect_tone_bins). Uses the larger neighbour, with the closed-form
+ * ratio for a Hann window (Grandke) or for a (near-)rectangular one.
+ */
+float interpolate_tone_offset(const doppler_state *d, const float *bin_re, const float *bin_im) {
+  float below = sqrtf(bin_re[0] * bin_re[0] + bin_im[0] * bin_im[0]);
+  float center = sqrtf(bin_re[1] * bin_re[1] + bin_im[1] * bin_im[1]);
+  float above = sqrtf(bin_re[2] * bin_re[2] + bin_im[2] * bin_im[2]);
+  if (center <= 0) {
+    return 0;
+  }
+
+  float neighbour = (above > below) ? above : below;
+  float sign = (above > below) ? 1 : -1;
+  float fraction;
+  if (d->window == MODEM_WINDOW_HANN) {
+    float ratio = neighbour / center;
+    fraction = (2 * ratio - 1) / (ratio + 1);
+  } else {
+    fraction = neighbour / (center + neighbour);
+  }
+  if (fraction < 0) {
+    fraction = 0;
+  }
+  return sign * fraction * d->bin_hz;
+}
+
+/**
+ * Folds in one measurement of the offset remaining after compensation. Returns true when enough
+ * evidence has built up that applied_hz changed and the front end should be retuned.
+ */
+bool update_doppler(doppler_state *d, float measured_offset_hz) {
+  d->symbols_since_measurement = 0;
+  d->residual_hz += residual_smoothing * (measured_offset_hz - d->residual_hz);
+  d->residual_count++;
+  if (d->residual_count < min_measurements_to_retune || fabsf(d->residual_hz) < retune_threshold_hz) {
+    return false;
+  }
+
+  d->applied_hz += d->residual_hz;
+  if (d->applied_hz > max_offset_hz) d->applied_hz = max_offset_hz;
+  if (d->applied_hz < -max_offset_hz) d->applied_hz = -max_offset_hz;
+  d->residual_hz = 0;
+  d->residual_count = 0;
+  return true;
+}
+
+/**
+ * Records a symbol that gave no usable measurement. After a quiet spell, the compensation is dropped
+ * so the next sender (with its own Doppler) starts from nominal; returns true when that happens.
+ */
+bool miss_doppler(doppler_state *d) {
+  if (++d->symbols_since_measurement < symbols_to_forget || d->applied_hz == 0) {
+    return false;
+  }
+  d->applied_hz = 0;
+  d->residual_hz = 0;
+  d->residual_count = 0;
+  return true;
+}
+
+/**
+ * Fractional compression of the received signal implied by the compensated offset: symbols arrive
+ * (1 + scale) times faster than they were sent.
+ */
+float doppler_time_scale(const doppler_state *d) {
+  return d->applied_hz / d->center_hz;
+}
@@ -0,0 +1,34 @@
+// ==================================================================
+// doppler.h
+// Defines the Doppler (frequency offset / time scale) tracker for RX
+// ==================================================================
+#ifndef DOPPLER_H
+#define DOPPLER_H
+
+#include <stdint.h>
+
+#include "modem_profile.h"
+
+typedef struct {
+  float center_hz;             // Nominal carrier, to turn a frequency offset into a time scale
+  float bin_hz;                // Detector bin spacing of the profile being tracked
+  modem_window_t window;       // Detector window, which sets how neighbouring bins are interpolated
+
+  float residual_hz;           // Smoothed offset still present after compensation
+  int residual_count;          // Measurements folded into residual_hz since the last retune
+  int symbols_since_measurement;
+
+  float applied_hz;            // Offset currently removed by the front end NCO
+} doppler_state;
+
+void initialize_doppler(doppler_state *d, const modem_profile_t *profile);
+
+float interpolate_tone_offset(const doppler_state *d, const float *bin_re, const float *bin_im);
+
+bool update_doppler(doppler_state *d, float measured_offset_hz);
+
+bool miss_doppler(doppler_state *d);
+
+float doppler_time_scale(const doppler_state *d);
+
+#endif
@@ -0,0 +1,216 @@
+// ==================================================================
+// dpsk.cpp
+// Demodulates DBPSK/DQPSK from the phase of consecutive symbol outputs
+// ==================================================================
+#include <math.h>    // for sqrtf, fminf, fmaxf
+#include <string.h>  // for memmove
+
+#include "dpsk.h"
+#include "sine_table.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// Fraction of the early/late imbalance (scaled to samples) fed back into symbol timing per symbol:
+static const float timing_loop_gain = 0.5f;
+
+// Fraction of the residual phase error fed back into the per-symbol carrier rotation estimate:
+static const float carrier_loop_gain = 0.1f;
+
+// A flip only counts towards the equalizer's preamble when the decision is this clean:
+static const float max_preamble_error = 0.5f;
+
+static_assert(EQUALIZER_FEEDFORWARD_TAPS == 3, "equalizer is fed the early, on-time and late outputs");
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Prepares a demodulator for a DBPSK or DQPSK profile, with no timing or carrier estimate yet.
+ */
+void initialize_dpsk(dpsk_state *d, const modem_profile_t *profile) {
+  d->profile = profile;
+  d->fill = 0;
+  d->timing_offset = profile->symbol_samples / 8;
+  d->symbol_start = d->timing_offset;
+  d->timing_error = 0;
+  d->time_scale = 0;
+  d->prev_re = d->prev_im = 0;
+  d->have_prev = false;
+  d->rotation_re = 1;
+  d->rotation_im = 0;
+  d->last_error_magnitude = 0;
+  initialize_equalizer(&d->eq, profile->modulation);
+}
+
+/**
+ * Maps a de-rotated phase difference to the nearest constellation point (returned in s_re/s_im)
+ * and writes the bits it carries, msb first. Returns the number of bits written.
+ */
+static int decide_symbol(const dpsk_state *d, float z_re, float z_im, float *s_re, float *s_im, uint8_t *bits) {
+  if (d->profile->modulation == MODEM_MODULATION_DBPSK) {
+    // 0 bit: no phase change, 1 bit: 180 degrees
+    *s_re = (z_re >= 0) ? 1 : -1;
+    *s_im = 0;
+    bits[0] = (z_re < 0);
+    return 1;
+  }
+
+  // DQPSK, Gray coded by quarter turns: 0 -> 00, 90 -> 01, 180 -> 11, 270 -> 10
+  int quarter;
+  if (fabsf(z_re) >= fabsf(z_im)) {
+    quarter = (z_re >= 0) ? 0 : 2;
+  } else {
+    quarter = (z_im >= 0) ? 1 : 3;
+  }
+  static const float quarter_re[4] = {1, 0, -1, 0};
+  static const float quarter_im[4] = {0, 1, 0, -1};
+  static const uint8_t quarter_bits[4] = {0, 1, 3, 2};
+  *s_re = quarter_re[quarter];
+  *s_im = quarter_im[quarter];
+  bits[0] = quarter_bits[quarter] >> 1;
+  bits[1] = quarter_bits[quarter] & 1;
+  return 2;
+}
+
+/**
+ * Consumes one complex baseband sample. Whenever a full symbol (plus the late timing window) has
+ * arrived, decides it from the phase change since the previous symbol (or, for DQPSK after a preamble, from
+ * the multipath equalizer) and writes up to bits_per_symbol bits into bits. Returns the number of bits written.
+ */
+int update_dpsk(dpsk_state *d, float x_i, float x_q, uint8_t *bits) {
+  const int n = d->profile->symbol_samples;
+  const int offset = d->timing_offset;
+
+  if (d->fill >= DPSK_BUFFER_SIZE) {
+    // Can't happen while symbol_start advances normally; restart rather than overrun
+    initialize_dpsk(d, d->profile);
+  }
+  d->buf_i[d->fill] = x_i;
+  d->buf_q[d->fill] = x_q;
+  d->fill++;
+  if (d->fill < d->symbol_start + offset + n) {
+    return 0;
+  }
+
+  // Early, on-time and late detector outputs for the carrier:
+  float early_re[MODEM_TONE_COUNT], early_im[MODEM_TONE_COUNT];
+  float on_re[MODEM_TONE_COUNT], on_im[MODEM_TONE_COUNT];
+  float late_re[MODEM_TONE_COUNT], late_im[MODEM_TONE_COUNT];
+  const int s = d->symbol_start;
+  d->profile->detect_tones(&d->buf_i[s - offset], &d->buf_q[s - offset], early_re, early_im);
+  d->profile->detect_tones(&d->buf_i[s], &d->buf_q[s], on_re, on_im);
+  d->profile->detect_tones(&d->buf_i[s + offset], &d->buf_q[s + offset], late_re, late_im);
+
+  // Symbol-timing recovery: a window straddling a phase transition loses energy, so whichever of
+  // early/late is stronger is the direction the true symbol boundary lies in.
+  float early_mag = sqrtf(early_re[0] * early_re[0] + early_im[0] * early_im[0]);
+  float on_mag = sqrtf(on_re[0] * on_re[0] + on_im[0] * on_im[0]);
+  float late_mag = sqrtf(late_re[0] * late_re[0] + late_im[0] * late_im[0]);
+  if (on_mag > 0) {
+    d->timing_error += timing_loop_gain * offset * (late_mag - early_mag) / on_mag;
+  }
+  // Compressed (approaching) signals have shorter symbols, so start each one a little earlier:
+  d->timing_error -= d->time_scale * n;
+  int step = 0;
+  while (d->timing_error >= 0.5f && step < offset / 2) {
+    d->timing_error -= 1;
+    step++;
+  }
+  while (d->timing_error <= -0.5f && step > -offset / 2) {
+    d->timing_error += 1;
+    step--;
+  }
+  // Whatever the step limit left over is dropped, so a burst of wild estimates (e.g. from noise between
+  // transmissions) can't keep the timing slewing long after it has passed:
+  d->timing_error = fmaxf(-0.5f, fminf(0.5f, d->timing_error));
+
+  int bit_count = 0;
+  if (d->have_prev) {
+    // Phase change since the previous symbol, less the carrier rotation we expect per symbol:
+    float z_re = on_re[0] * d->prev_re + on_im[0] * d->prev_im;
+    float z_im = on_im[0] * d->prev_re - on_re[0] * d->prev_im;
+    float derotated_re = z_re * d->rotation_re + z_im * d->rotation_im;
+    float derotated_im = z_im * d->rotation_re - z_re * d->rotation_im;
+
+    float s_re, s_im;
+    bit_count = decide_symbol(d, derotated_re, derotated_im, &s_re, &s_im, bits);
+
+    // Carrier tracking: the residual angle after removing the decided symbol nudges the rotation estimate
+    float z_mag = sqrtf(derotated_re * derotated_re + derotated_im * derotated_im);
+    if (z_mag > 0) {
+      float error_re = derotated_re / z_mag - s_re;
+      float error_im = derotated_im / z_mag - s_im;
+      float phase_error = (derotated_im * s_re - derotated_re * s_im) / z_mag;  // ~sin(residual angle)
+      float r_re = d->rotation_re - carrier_loop_gain * phase_error * d->rotation_im;
+      float r_im = d->rotation_im + carrier_loop_gain * phase_error * d->rotation_re;
+      float r_mag = sqrtf(r_re * r_re + r_im * r_im);
+      d->rotation_re = r_re / r_mag;
+      d->rotation_im = r_im / r_mag;
+      d->last_error_magnitude = sqrtf(error_re * error_re + error_im * error_im);
+    }
+
+    // Equalizer input is the on-time output flanked by the early and late ones; once it has trained on
+    // a preamble its decisions overwrite bits. Only DQPSK is equalized: DBPSK's plain decisions, 180 degrees
+    // apart, ride through the echoes tools/echo_sim models, where the equalizer's own decisions make errors
+    if (d->profile->modulation == MODEM_MODULATION_DQPSK) {
+      const float eq_re[EQUALIZER_FEEDFORWARD_TAPS] = {early_re[0], on_re[0], late_re[0]};
+      const float eq_im[EQUALIZER_FEEDFORWARD_TAPS] = {early_im[0], on_im[0], late_im[0]};
+      bool preamble_flip = (s_re < 0 && s_im == 0 && d->last_error_magnitude < max_preamble_error);
+      update_equalizer(&d->eq, eq_re, eq_im, d->rotation_re, d->rotation_im, preamble_flip, bits);
+    }
+  }
+  d->prev_re = on_re[0];
+  d->prev_im = on_im[0];
+  d->have_prev = true;
+
+  // Advances to the next symbol and drops history the early window can no longer reach:
+  d->symbol_start += n + step;
+  if (d->symbol_start - offset >= n) {
+    d->fill -= n;
+    d->symbol_start -= n;
+    memmove(d->buf_i, &d->buf_i[n], d->fill * sizeof(float));
+    memmove(d->buf_q, &d->buf_q[n], d->fill * sizeof(float));
+  }
+  return bit_count;
+}
+
+/**
+ * Carrier frequency offset (Hz) implied by the tracked per-symbol rotation. Uses a polynomial arctangent,
+ * good to about 0.3 degrees, rather than atan2f().
+ */
+float dpsk_frequency_offset(const dpsk_state *d) {
+  float re = d->rotation_re;
+  float im = d->rotation_im;
+  float angle;
+  if (fabsf(im) <= fabsf(re)) {
+    float x = im / re;
+    angle = x * (0.7854f + 0.273f * (1 - fabsf(x)));
+    if (re < 0) angle += (im >= 0) ? 3.14159265f : -3.14159265f;
+  } else {
+    float x = re / im;
+    angle = ((im > 0) ? 1.5707963f : -1.5707963f) - x * (0.7854f + 0.273f * (1 - fabsf(x)));
+  }
+  float symbol_seconds = (float)d->profile->symbol_samples / MODEM_BASEBAND_RATE;
+  return angle / (2 * 3.14159265f * symbol_seconds);
+}
+
+/**
+ * Tells the demodulator the front end has just been retuned by shift_hz, so the rotation estimate is
+ * moved by the same amount (and the loop does not have to re-acquire), and sets the symbol-rate
+ * compression to feed forward into timing recovery.
+ */
+void retune_dpsk(dpsk_state *d, float shift_hz, float time_scale) {
+  float symbol_seconds = (float)d->profile->symbol_samples / MODEM_BASEBAND_RATE;
+  float cycles = -shift_hz * symbol_seconds;
+  uint32_t phase = (uint32_t)((cycles - floorf(cycles)) * 4294967296.0);
+  float c = cosine_lookup(phase) / (float)SINE_TABLE_AMPLITUDE;
+  float s = sine_lookup(phase) / (float)SINE_TABLE_AMPLITUDE;
+  float r_re = d->rotation_re * c - d->rotation_im * s;
+  float r_im = d->rotation_re * s + d->rotation_im * c;
+  d->rotation_re = r_re;
+  d->rotation_im = r_im;
+  d->time_scale = time_scale;
+}
@@ -0,0 +1,52 @@
+// ==================================================================
+// dpsk.h
+// Defines the differential PSK demodulator (DBPSK/DQPSK on one carrier)
+// ==================================================================
+#ifndef DPSK_H
+#define DPSK_H
+
+#include <stdint.h>
+
+#include "equalizer.h"
+#include "modem_profile.h"
+
+// Holds enough baseband history for the late timing window plus one symbol of slack:
+#define DPSK_BUFFER_SIZE            (3 * MODEM_MAX_SYMBOL_SAMPLES)
+
+typedef struct {
+  const modem_profile_t *profile;
+
+  // Baseband history; symbol_start is where the on-time window of the next symbol begins
+  float buf_i[DPSK_BUFFER_SIZE];
+  float buf_q[DPSK_BUFFER_SIZE];
+  int fill;
+  int symbol_start;
+  int timing_offset;           // Early/late windows sit this many samples either side of on-time
+
+  // Symbol-timing recovery (early-late gate), in fractions of a sample
+  float timing_error;
+  float time_scale;            // Known compression of the received signal (Doppler), fed forward into timing
+
+  // Previous symbol's detector output, the reference for the next phase difference
+  float prev_re, prev_im;
+  bool have_prev;
+
+  // Carrier tracking: estimated phase rotation per symbol, kept as a unit phasor
+  float rotation_re, rotation_im;
+
+  // Quality of the most recent decision: |error vector| relative to the symbol
+  float last_error_magnitude;
+
+  // Multipath equalizer (DQPSK only); its decisions replace the plain differential ones once it has trained
+  equalizer_state eq;
+} dpsk_state;
+
+void initialize_dpsk(dpsk_state *d, const modem_profile_t *profile);
+
+int update_dpsk(dpsk_state *d, float x_i, float x_q, uint8_t *bits);
+
+float dpsk_frequency_offset(const dpsk_state *d);
+
+void retune_dpsk(dpsk_state *d, float shift_hz, float time_scale);
+
+#endif
@@ -0,0 +1,228 @@
+// ==================================================================
+// equalizer.cpp
+// Cancels multipath echoes on PSK symbols with an NLMS-adapted DFE
+// ==================================================================
+#include <arm_math.h>
+#include <math.h>    // for sqrtf, fabsf
+#include <string.h>  // for memset, memmove
+
+#include "equalizer.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// Normalized LMS step while training and while decision-directed:
+static const float training_step = EQUALIZER_TRAINING_STEP;
+static const float tracking_step = EQUALIZER_TRACKING_STEP;
+
+// Fractions of the residual phase error fed back into the carrier phase and its per-symbol rotation:
+static const float phase_loop_gain = 0.2f;
+static const float rotation_loop_gain = 0.02f;
+
+// Smoothing of the mean square error, and the level at which the equalizer is judged to have lost lock:
+static const float error_smoothing = 0.1f;
+static const float max_mean_square_error = 0.4f;
+
+// On-time input amplitude, relative to its level at the start of training, outside which the signal is
+// taken to have ended or changed (otherwise the feedback taps can go on "predicting" their own decisions
+// through silence, or through the next transmission after training on noise):
+static const float min_signal_level = 0.25f;
+static const float max_signal_level = 4.0f;
+
+// Preamble flips needed before training starts (noise alone strings together a few), and training symbols
+// needed before its decisions are used:
+static const int flips_to_train = EQUALIZER_FLIPS_TO_TRAIN;
+static const int min_training_symbols = 6;
+
+// Keeps the NLMS normalization finite when the regressor is (nearly) all zeros:
+static const float regressor_power_floor = 1e-3f;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Prepares an idle equalizer for DBPSK or DQPSK.
+ */
+void initialize_equalizer(equalizer_state *eq, modem_modulation_t modulation) {
+  eq->modulation = modulation;
+  eq->mode = EQUALIZER_IDLE;
+  eq->preamble_flips = 0;
+}
+
+/**
+ * Resets the taps to a pass-through of the on-time input and locks the carrier phase and gain to the
+ * current symbol, which is taken to be +1 (the preamble only defines phase differences).
+ */
+static void start_training(equalizer_state *eq, float on_re, float on_im, float rotation_re, float rotation_im) {
+  memset(eq->taps, 0, sizeof(eq->taps));
+  memset(eq->regressor, 0, sizeof(eq->regressor));
+  eq->taps[2 * (EQUALIZER_FEEDFORWARD_TAPS / 2)] = 1;
+
+  float magnitude = sqrtf(on_re * on_re + on_im * on_im);
+  eq->phase_re = on_re / magnitude;
+  eq->phase_im = on_im / magnitude;
+  eq->input_gain = 1 / magnitude;
+  eq->rotation_re = rotation_re;
+  eq->rotation_im = rotation_im;
+  eq->symbol_re = -1;          // So that the first training reference (a flip) is +1
+  eq->symbol_im = 0;
+  eq->training_symbols = 0;
+  eq->mean_square_error = 0;
+  eq->mode = EQUALIZER_TRAINING;
+}
+
+/**
+ * Turns the unit phasor (re, im) by a small angle (radians), keeping it unit length.
+ */
+static void nudge_phasor(float *re, float *im, float angle) {
+  float p_re = *re - angle * *im;
+  float p_im = *im + angle * *re;
+  float p_mag = sqrtf(p_re * p_re + p_im * p_im);
+  *re = p_re / p_mag;
+  *im = p_im / p_mag;
+}
+
+/**
+ * Nearest constellation point to z: +-1 for DBPSK, +-1 / +-j for DQPSK.
+ */
+static void decide_point(const equalizer_state *eq, float z_re, float z_im, float *s_re, float *s_im) {
+  if (eq->modulation == MODEM_MODULATION_DBPSK || fabsf(z_re) >= fabsf(z_im)) {
+    *s_re = (z_re >= 0) ? 1 : -1;
+    *s_im = 0;
+  } else {
+    *s_re = 0;
+    *s_im = (z_im >= 0) ? 1 : -1;
+  }
+}
+
+/**
+ * Writes the bits carried by the phase change from the previous decision to s (Gray coded for DQPSK,
+ * as in the transmitter). Returns the number of bits written.
+ */
+static int differential_bits(const equalizer_state *eq, float s_re, float s_im, uint8_t *bits) {
+  float d_re = s_re * eq->symbol_re + s_im * eq->symbol_im;
+  float d_im = s_im * eq->symbol_re - s_re * eq->symbol_im;
+  if (eq->modulation == MODEM_MODULATION_DBPSK) {
+    bits[0] = (d_re < 0);
+    return 1;
+  }
+  // 0 -> 00, 90 -> 01, 180 -> 11, 270 -> 10
+  bits[0] = (d_re < 0) || (d_im < 0);
+  bits[1] = (d_im > 0) || (d_re < 0);
+  return 2;
+}
+
+/**
+ * Equalizes one symbol. input_re/input_im hold the EQUALIZER_FEEDFORWARD_TAPS detector outputs (early,
+ * on-time, late) for the symbol, rotation is the demodulator's estimate of the carrier rotation per
+ * symbol (used to seed the equalizer's own carrier loop when training starts), and preamble_flip says
+ * whether the plain differential decision was a 180 degree flip.
+ * Returns true, with the symbol's bits written to bits, once the equalizer has trained on a preamble and
+ * is tracking; otherwise the caller should use its own decision.
+ */
+bool update_equalizer(equalizer_state *eq, const float *input_re, const float *input_im,
+                      float rotation_re, float rotation_im, bool preamble_flip, uint8_t *bits) {
+  const int on_time = EQUALIZER_FEEDFORWARD_TAPS / 2;
+
+  // Looks for the preamble, or for its end:
+  if (eq->mode == EQUALIZER_IDLE) {
+    eq->preamble_flips = (preamble_flip) ? eq->preamble_flips + 1 : 0;
+    if (eq->preamble_flips < flips_to_train) {
+      return false;
+    }
+    start_training(eq, input_re[on_time], input_im[on_time], rotation_re, rotation_im);
+  } else {
+    if (eq->mode == EQUALIZER_TRAINING && !preamble_flip) {
+      eq->mode = (eq->training_symbols >= min_training_symbols) ? EQUALIZER_TRACKING : EQUALIZER_IDLE;
+      eq->preamble_flips = 0;
+      if (eq->mode == EQUALIZER_IDLE) {
+        return false;
+      }
+    }
+    // Carrier phase moves on by the estimated rotation per symbol:
+    float p_re = eq->phase_re * eq->rotation_re - eq->phase_im * eq->rotation_im;
+    float p_im = eq->phase_re * eq->rotation_im + eq->phase_im * eq->rotation_re;
+    eq->phase_re = p_re;
+    eq->phase_im = p_im;
+  }
+
+  // Feedforward inputs, de-rotated and normalized; the feedback part already holds past decisions:
+  float g_re = eq->phase_re * eq->input_gain;
+  float g_im = -eq->phase_im * eq->input_gain;
+  for (int k = 0; k < EQUALIZER_FEEDFORWARD_TAPS; k++) {
+    eq->regressor[2 * k] = input_re[k] * g_re - input_im[k] * g_im;
+    eq->regressor[2 * k + 1] = input_re[k] * g_im + input_im[k] * g_re;
+  }
+
+  float z_re, z_im;
+  arm_cmplx_dot_prod_f32(eq->taps, eq->regressor, EQUALIZER_TAPS, &z_re, &z_im);
+
+  // Reference symbol: known while training, decided afterwards
+  float s_re, s_im;
+  float step;
+  if (eq->mode == EQUALIZER_TRAINING) {
+    s_re = -eq->symbol_re;
+    s_im = -eq->symbol_im;
+    step = training_step;
+    eq->training_symbols++;
+  } else {
+    decide_point(eq, z_re, z_im, &s_re, &s_im);
+    step = tracking_step;
+  }
+
+  // NLMS: taps += step * error * conj(regressor) / |regressor|^2
+  float e_re = s_re - z_re;
+  float e_im = s_im - z_im;
+  float power;
+  arm_power_f32(eq->regressor, 2 * EQUALIZER_TAPS, &power);
+  float scale = step / (power + regressor_power_floor);
+  e_re *= scale;
+  e_im *= scale;
+  for (int k = 0; k < EQUALIZER_TAPS; k++) {
+    float u_re = eq->regressor[2 * k];
+    float u_im = eq->regressor[2 * k + 1];
+    eq->taps[2 * k] += e_re * u_re + e_im * u_im;
+    eq->taps[2 * k + 1] += e_im * u_re - e_re * u_im;
+  }
+
+  // Carrier tracking (second order): the residual angle between output and decision nudges both the
+  // de-rotation and the rotation per symbol
+  float z_mag = sqrtf(z_re * z_re + z_im * z_im);
+  if (z_mag > 0) {
+    float phase_error = (z_im * s_re - z_re * s_im) / z_mag;  // ~sin(residual angle)
+    nudge_phasor(&eq->phase_re, &eq->phase_im, phase_loop_gain * phase_error);
+    nudge_phasor(&eq->rotation_re, &eq->rotation_im, rotation_loop_gain * phase_error);
+  }
+
+  float error_power = (s_re - z_re) * (s_re - z_re) + (s_im - z_im) * (s_im - z_im);
+  eq->mean_square_error += error_smoothing * (error_power - eq->mean_square_error);
+
+  uint8_t decided_bits[2];
+  int bit_count = differential_bits(eq, s_re, s_im, decided_bits);
+  eq->symbol_re = s_re;
+  eq->symbol_im = s_im;
+
+  // Shifts the decision into the feedback taps' history:
+  float *feedback = &eq->regressor[2 * EQUALIZER_FEEDFORWARD_TAPS];
+  memmove(&feedback[2], feedback, 2 * (EQUALIZER_FEEDBACK_TAPS - 1) * sizeof(float));
+  feedback[0] = s_re;
+  feedback[1] = s_im;
+
+  const float *on = &eq->regressor[2 * on_time];
+  float signal_level_squared = on[0] * on[0] + on[1] * on[1];
+  if (eq->mode == EQUALIZER_TRACKING && (eq->mean_square_error > max_mean_square_error ||
+                                         signal_level_squared < min_signal_level * min_signal_level ||
+                                         signal_level_squared > max_signal_level * max_signal_level)) {
+    // Lost the signal (or it ended): back to the plain demodulator until the next preamble
+    eq->mode = EQUALIZER_IDLE;
+    eq->preamble_flips = 0;
+    return false;
+  }
+  if (eq->mode != EQUALIZER_TRACKING) {
+    return false;
+  }
+  memcpy(bits, decided_bits, bit_count);
+  return true;
+}
@@ -0,0 +1,63 @@
+// ==================================================================
+// equalizer.h
+// Defines the adaptive decision-feedback equalizer (DFE) for PSK modes
+// ==================================================================
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+//----------------------------------------
+// Equalizer Configuration
+//----------------------------------------
+#define EQUALIZER_FEEDFORWARD_TAPS  3       // Early, on-time and late detector outputs of the current symbol
+#define EQUALIZER_FEEDBACK_TAPS     8       // Past decisions: cancels echoes up to 8 symbols (50 ms at 6.25 ms)
+#define EQUALIZER_TAPS              (EQUALIZER_FEEDFORWARD_TAPS + EQUALIZER_FEEDBACK_TAPS)
+
+// Adaptation settings, overridable at build time so tools/echo_sim can compare others against these:
+#ifndef EQUALIZER_TRAINING_STEP
+#define EQUALIZER_TRAINING_STEP     0.5f    // Normalized LMS step on the known preamble
+#endif
+#ifndef EQUALIZER_TRACKING_STEP
+#define EQUALIZER_TRACKING_STEP     0.1f    // Normalized LMS step once decision-directed
+#endif
+#ifndef EQUALIZER_FLIPS_TO_TRAIN
+#define EQUALIZER_FLIPS_TO_TRAIN    6       // Preamble flips before training; the rest of the preamble trains it
+#endif
+
+typedef enum {
+  EQUALIZER_IDLE,              // Waiting for a preamble; the plain differential decisions are used
+  EQUALIZER_TRAINING,          // Adapting on the known preamble (a 180 degree flip every symbol)
+  EQUALIZER_TRACKING           // Adapting on its own decisions; the equalized decisions are used
+} equalizer_mode_t;
+
+typedef struct {
+  modem_modulation_t modulation;
+  equalizer_mode_t mode;
+
+  // Taps and regressor as interleaved complex (re, im) pairs: feedforward inputs first, then past decisions
+  float taps[2 * EQUALIZER_TAPS];
+  float regressor[2 * EQUALIZER_TAPS];
+
+  // Carrier phase removed from the feedforward inputs and its rotation per symbol (unit phasors), and
+  // the gain that normalizes the inputs
+  float phase_re, phase_im;
+  float rotation_re, rotation_im;
+  float input_gain;
+
+  // Most recent known/decided symbol, the reference for the next one
+  float symbol_re, symbol_im;
+
+  int preamble_flips;          // Consecutive 180 degree flips seen while idle
+  int training_symbols;
+  float mean_square_error;     // Smoothed |error|^2 relative to a unit symbol
+} equalizer_state;
+
+void initialize_equalizer(equalizer_state *eq, modem_modulation_t modulation);
+
+bool update_equalizer(equalizer_state *eq, const float *input_re, const float *input_im,
+                      float rotation_re, float rotation_im, bool preamble_flip, uint8_t *bits);
+
+#endif
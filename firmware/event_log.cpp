@@ -0,0 +1,158 @@
+// ==================================================================
+// event_log.cpp
+// Records events into a lock-free ring and streams them out from loop()
+// ==================================================================
+#include <Arduino.h>
+
+#include "event_log.h"
+#include "serial_frame.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+static_assert((EVENT_LOG_CAPACITY & (EVENT_LOG_CAPACITY - 1)) == 0, "ring indexes wrap with a mask");
+
+#define EVENT_LOG_VERBOSE_ENTRY(id, verbose, format) verbose,
+
+static const bool event_is_verbose[EVENT_COUNT] = {
+  EVENT_LOG_EVENTS(EVENT_LOG_VERBOSE_ENTRY)
+};
+
+/**
+ * A record plus the sequence number that hands it between producers and loop(): slot i is free for the
+ * write with ticket t when sequence == t, holds that write once sequence == t + 1, and is released for
+ * ticket t + EVENT_LOG_CAPACITY when drained.
+ */
+typedef struct {
+  volatile uint32_t sequence;
+  event_record_t record;
+} event_slot_t;
+
+static event_slot_t slots[EVENT_LOG_CAPACITY];
+
+// Next write ticket (claimed by any context, ISRs included) and next record to drain (loop() only):
+static volatile uint32_t write_ticket = 0;
+static uint32_t read_ticket = 0;
+
+// Records lost to a full ring since the last drain reported them:
+static volatile uint32_t dropped_records = 0;
+
+static volatile bool verbose_enabled = false;
+
+// Most records sent in one frame:
+static const int max_records_per_frame = 32;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Empties the ring, handing each slot to its first writer. Call in setup() before anything logs.
+ */
+void setup_event_log() {
+  for (uint32_t i = 0; i < EVENT_LOG_CAPACITY; i++) {
+    slots[i].sequence = i;
+  }
+  write_ticket = 0;
+  read_ticket = 0;
+  dropped_records = 0;
+}
+
+/**
+ * Records one event. Safe from any ISR or from loop(), never blocks and never masks interrupts: claiming a
+ * slot is a single compare-and-swap, retried only when an interrupt logged something in between. When
+ * the ring is full the event is counted as dropped instead.
+ */
+void log_event(event_id_t id, int32_t arg0, int32_t arg1, int32_t arg2) {
+  if (event_is_verbose[id] && !verbose_enabled) {
+    return;
+  }
+
+  uint32_t ticket = __atomic_load_n(&write_ticket, __ATOMIC_RELAXED);
+  event_slot_t *slot;
+  for (;;) {
+    slot = &slots[ticket & (EVENT_LOG_CAPACITY - 1)];
+    int32_t lag = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - ticket);
+    if (lag == 0) {
+      if (__atomic_compare_exchange_n(&write_ticket, &ticket, ticket + 1, false, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+      // ticket now holds the current value; try again with it
+    } else if (lag < 0) {
+      // Slot still holds an undrained record from the previous lap
+      __atomic_fetch_add(&dropped_records, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      ticket = __atomic_load_n(&write_ticket, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->record.timestamp_us = micros();
+  slot->record.id = id;
+  slot->record.reserved = 0;
+  slot->record.args[0] = arg0;
+  slot->record.args[1] = arg1;
+  slot->record.args[2] = arg2;
+  __atomic_store_n(&slot->sequence, ticket + 1, __ATOMIC_RELEASE);
+}
+
+void set_event_log_verbose(bool verbose) {
+  verbose_enabled = verbose;
+}
+
+bool get_event_log_verbose() {
+  return verbose_enabled;
+}
+
+/**
+ * Sends whatever has been logged to the host as SERIAL_FRAME_EVENT_LOG frames, as far as the USB buffer
+ * has room without blocking; the rest waits for the next call. Call from loop() only. A record whose
+ * writer was interrupted mid-way stops the drain until it is complete, so records go out in ticket order.
+ */
+void poll_event_log() {
+  event_record_t batch[max_records_per_frame];
+
+  for (;;) {
+    int capacity = serial_frame_space() / sizeof(event_record_t);
+    if (capacity > max_records_per_frame) {
+      capacity = max_records_per_frame;
+    }
+    if (capacity == 0) {
+      // No host listening, or the USB buffer is full: leave records in the ring
+      return;
+    }
+
+    int count = 0;
+    uint32_t dropped = __atomic_load_n(&dropped_records, __ATOMIC_RELAXED);
+    if (dropped != 0) {
+      __atomic_fetch_sub(&dropped_records, dropped, __ATOMIC_RELAXED);
+      batch[count].timestamp_us = micros();
+      batch[count].id = EVENT_LOG_DROPPED;
+      batch[count].reserved = 0;
+      batch[count].args[0] = dropped;
+      batch[count].args[1] = 0;
+      batch[count].args[2] = 0;
+      count++;
+    }
+
+    while (count < capacity) {
+      event_slot_t *slot = &slots[read_ticket & (EVENT_LOG_CAPACITY - 1)];
+      if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != read_ticket + 1) {
+        break;
+      }
+      batch[count++] = slot->record;
+      __atomic_store_n(&slot->sequence, read_ticket + EVENT_LOG_CAPACITY, __ATOMIC_RELEASE);
+      read_ticket++;
+    }
+
+    if (count == 0) {
+      return;
+    }
+    write_serial_frame(SERIAL_FRAME_EVENT_LOG, batch, count * sizeof(event_record_t));
+    if (count < capacity) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,96 @@
+// ==================================================================
+// event_log.h
+// Declares the deferred binary event log drained to USB serial
+// ==================================================================
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+#include <string.h>  // for memcpy
+
+//----------------------------------------
+// Event Log Configuration
+//----------------------------------------
+// The busiest source is the verbose per-symbol RX event: the ring holds 1.6 s of it at fsk160 (160 symbols/s)
+#define EVENT_LOG_CAPACITY          256     // Records the ring holds (power of two)
+#define EVENT_LOG_ARGS              3       // 32-bit arguments per record
+
+// Every event: X(id, verbose, format). Verbose events are only recorded after "log verbose on".
+// Formats are printf-style with one conversion per argument (%d, %u, %x, %c, or %f for a float passed
+// through event_float_arg()); tools/decode_log.py reads this list, so append new events at the end.
+#define EVENT_LOG_EVENTS(X) \
+  X(EVENT_LOG_DROPPED,          false, "event log full: %u records dropped") \
+  X(EVENT_TX_START,             false, "tx start: %d bytes, %d bits/symbol, %u us/symbol") \
+  X(EVENT_TX_CHARACTER,         false, "tx char '%c' (0x%x)") \
+  X(EVENT_TX_DONE,              false, "tx done: %u us") \
+  X(EVENT_KEY_PRESS,            false, "key %d '%c'") \
+  X(EVENT_KEY_CAPS,             false, "key CAPS") \
+  X(EVENT_KEY_SYM,              false, "key SYM") \
+  X(EVENT_KEY_UP,               false, "key UP: scroll offset %d") \
+  X(EVENT_KEY_DOWN,             false, "key DOWN: scroll offset %d") \
+  X(EVENT_KEY_MENU,             false, "key MENU: modem profile is now %d") \
+  X(EVENT_KEY_BACKSPACE,        false, "key BACKSPACE: %d chars typed") \
+  X(EVENT_KEY_RETURN,           false, "key RETURN: %d chars typed") \
+  X(EVENT_KEY_SEND,             false, "key SEND: message length %d") \
+  X(EVENT_KEY_SEND_EMPTY,       false, "key SEND: no message to send") \
+  X(EVENT_RX_FRAME,             false, "rx frame: %d chars") \
+  X(EVENT_RX_FRAME_DROPPED,     false, "rx frame dropped: %d chars, previous one not yet displayed") \
+  X(EVENT_DOPPLER_RETUNE,       false, "doppler: compensating %f Hz") \
+  X(EVENT_RX_FSK_SYMBOL,        true,  "fsk symbol: low tone %f, high tone %f") \
+  X(EVENT_MAC_QUEUED,           false, "mac: queued %d chars for %d") \
+  X(EVENT_MAC_QUEUE_FULL,       false, "mac: queue full, %d chars not sent") \
+  X(EVENT_MAC_TRANSMIT,         false, "mac: sending %d chars to %d, contention window %d slots") \
+  X(EVENT_MAC_FILTERED,         false, "mac: ignored frame from %d to %d") \
+  X(EVENT_TDMA_BEACON,          false, "tdma: beacon %d, %d slots, %u ms cycle") \
+  X(EVENT_TDMA_SYNC,            false, "tdma: synced to beacon %d, clock stepped %d ms, range %d ms") \
+  X(EVENT_TDMA_SYNC_LOST,       false, "tdma: no beacon for %u ms, back to CSMA") \
+  X(EVENT_TDMA_REQUEST,         false, "tdma: request from %d, range %d ms, %d ms queued") \
+  X(EVENT_RELAY_QUEUED,         false, "relay: forwarding %d/%d as hop %d") \
+  X(EVENT_RELAY_QUEUE_FULL,     false, "relay: queue full, %d/%d not forwarded") \
+  X(EVENT_RELAY_DUPLICATE,      false, "relay: dropped duplicate of %d/%d") \
+  X(EVENT_RELAY_CANCELLED,      false, "relay: %d/%d already forwarded by another relay") \
+  X(EVENT_FRAGMENT_RECEIVED,    false, "fragment: %d of %d from %d") \
+  X(EVENT_FRAGMENT_REJECTED,    false, "fragment: from %d rejected, %d payload bytes") \
+  X(EVENT_LINK_PING,            false, "link: ping %d from %d, %d bit errors") \
+  X(EVENT_LINK_REPLY_LATE,      false, "link: reply to %d missed its time by %d ms") \
+  X(EVENT_LINK_RANGE,           false, "link: range to %d is %d cm, round trip %d us") \
+  X(EVENT_RX_SYMBOL_TIMING,     false, "rx: FSK symbol timing %d -> %d samples in, clock strength %f") \
+  X(EVENT_KEY_DROPPED,          false, "key %d dropped: key queue full")
+
+#define EVENT_LOG_ENUM_ENTRY(id, verbose, format) id,
+
+typedef enum {
+  EVENT_LOG_EVENTS(EVENT_LOG_ENUM_ENTRY)
+  EVENT_COUNT,
+} event_id_t;
+
+// One record as stored and as sent (little-endian, packed; see serial_frame.h for the framing):
+typedef struct {
+  uint32_t timestamp_us;       // micros() when logged
+  uint16_t id;                 // event_id_t
+  uint16_t reserved;
+  int32_t args[EVENT_LOG_ARGS];
+} event_record_t;
+
+static_assert(sizeof(event_record_t) == 20, "decode_log.py expects 20-byte records");
+
+/**
+ * Passes a float as an event argument bit for bit (decoded by %f).
+ */
+static inline int32_t event_float_arg(float value) {
+  int32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+void setup_event_log();
+
+void log_event(event_id_t id, int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0);
+
+void set_event_log_verbose(bool verbose);
+
+bool get_event_log_verbose();
+
+void poll_event_log();
+
+#endif
@@ -6,13 +6,34 @@
 #include <Wire.h>
 
 #include "battery.h"
+#include "capture.h"
+#include "carrier_sense.h"
 #include "chat_logic.h"
+#include "chirp.h"
 #include "comm.h"
 #include "config.h"
+#include "console.h"
+#include "dds.h"
+#include "deframer.h"
 #include "display.h"
+#include "doppler.h"
+#include "dpsk.h"
+#include "equalizer.h"
+#include "event_log.h"
+#include "frontend.h"
 #include "goertzel.h"
 #include "hardware_config.h"
 #include "keyboard.h"
+#include "link.h"
+#include "mac.h"
+#include "modem_profile.h"
+#include "profiler.h"
+#include "receiver.h"
+#include "relay.h"
+#include "sdft.h"
+#include "serial_frame.h"
+#include "sine_table.h"
+#include "tdma.h"
 
 void setup() {
   // Initializes serial communication with Teensy at baud rate of 9600 bps:
@@ -22,6 +43,9 @@ void setup() {
   delay(100);
   Serial.println("============================\nStarting setup()");
 
+  // Event log first, since the modules below may log from their interrupts:
+  setup_event_log();
+
   // SPI commuincation bus for keyboard/display etc:
   SPI.begin();
   // I2C communication bus for charge amplifier:
@@ -34,6 +58,7 @@ void setup() {
 
   // Module setup:
   setup_screen();
+  setup_mac();
   setup_receiver();
   setup_transmitter();
   setup_keyboard_poller();
@@ -45,4 +70,10 @@ void loop() {
   // uint16_t val = 2048 + 2047 * sin(2*3.14159*micros()/1e6 * 1.5e3);
 
   poll_battery();
+  poll_keyboard(get_chat_buffer_state());
+  poll_incoming_messages();
+  poll_outgoing_messages();
+  poll_console();
+  poll_event_log();
+  poll_capture();
 }
@@ -0,0 +1,193 @@
+// ==================================================================
+// fragment.cpp
+// Splits text into checksummed fragments and reassembles them as they arrive (no hardware access)
+// ==================================================================
+#include <string.h>  // for memcpy, memset, strlen
+
+#include "event_log.h"
+#include "fragment.h"
+#include "modem_profile.h"
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Fletcher-16 of a fragment as sent: the MAC header, the fragment header with its checksum field zeroed,
+ * and the text (the same sum serial_frame.cpp uses).
+ */
+static uint16_t fragment_checksum(const mac_header_t *header, const fragment_header_t *fragment_header,
+                                  const char *text, size_t text_length) {
+  fragment_header_t zeroed = *fragment_header;
+  zeroed.checksum = 0;
+  uint32_t sum1 = 0, sum2 = 0;
+  const uint8_t *parts[3] = {(const uint8_t *)header, (const uint8_t *)&zeroed, (const uint8_t *)text};
+  const size_t lengths[3] = {sizeof(*header), sizeof(zeroed), text_length};
+  for (int p = 0; p < 3; p++) {
+    for (size_t i = 0; i < lengths[p]; i++) {
+      sum1 = (sum1 + parts[p][i]) % 255;
+      sum2 = (sum2 + sum1) % 255;
+    }
+  }
+  return sum1 | (sum2 << 8);
+}
+
+/**
+ * Fragments a message of message_length chars goes out as (an empty message still takes one).
+ */
+int count_fragments(size_t message_length) {
+  return (message_length == 0) ? 1 : (message_length + FRAGMENT_TEXT_LENGTH - 1) / FRAGMENT_TEXT_LENGTH;
+}
+
+/**
+ * Writes fragment index of a queued text message into fragment, ready for packetize_message(). The MAC
+ * header is the message's, with type MAC_FRAME_TEXT_FRAGMENT and the fragment's length.
+ */
+void build_fragment(const mac_frame_t *message, int index, mac_frame_t *fragment) {
+  const size_t offset = index * FRAGMENT_TEXT_LENGTH;
+  size_t text_length = message->header.length - offset;
+  if (text_length > FRAGMENT_TEXT_LENGTH) {
+    text_length = FRAGMENT_TEXT_LENGTH;
+  }
+
+  fragment->header = message->header;
+  fragment->header.type = MAC_FRAME_TEXT_FRAGMENT;
+  fragment->header.length = sizeof(fragment_header_t) + text_length;
+
+  fragment_header_t fragment_header;
+  fragment_header.index = index;
+  fragment_header.count = count_fragments(message->header.length);
+  fragment_header.message_length = message->header.length;
+  fragment_header.checksum = 0;
+  fragment_header.checksum = fragment_checksum(&fragment->header, &fragment_header, &message->text[offset], text_length);
+  memcpy(fragment->text, &fragment_header, sizeof(fragment_header));
+  memcpy(&fragment->text[sizeof(fragment_header)], &message->text[offset], text_length);
+}
+
+/**
+ * Airtime of a message of message_length chars sent as fragments back to back, each with its own preamble.
+ */
+uint32_t fragmented_airtime_ms(const tx_parameters_t *tx, size_t message_length) {
+  const int count = count_fragments(message_length);
+  const size_t last_length = message_length - (count - 1) * FRAGMENT_TEXT_LENGTH;
+  const size_t overhead = MAC_PACKET_OVERHEAD + sizeof(fragment_header_t);
+  return (count - 1) * modem_packet_airtime_ms(tx, overhead + FRAGMENT_TEXT_LENGTH) +
+         modem_packet_airtime_ms(tx, overhead + last_length);
+}
+
+/**
+ * Airtime of fragment index alone, of a message of message_length chars.
+ */
+uint32_t fragment_airtime_ms(const tx_parameters_t *tx, size_t message_length, int index) {
+  const size_t offset = index * FRAGMENT_TEXT_LENGTH;
+  const size_t text_length = (message_length - offset > FRAGMENT_TEXT_LENGTH) ? FRAGMENT_TEXT_LENGTH
+                                                                             : message_length - offset;
+  return modem_packet_airtime_ms(tx, MAC_PACKET_OVERHEAD + sizeof(fragment_header_t) + text_length);
+}
+
+void initialize_reassembly(reassembly_state *r) {
+  memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Takes a received fragment. Returns the slot of the message it belongs to, or NULL if it fails its
+ * checksum or adds nothing new (a copy of a fragment already in). The first fragment heard of a
+ * message takes a free slot, or the one that has gone longest without a fragment.
+ */
+fragment_slot_t *add_fragment(reassembly_state *r, const mac_header_t *header, const void *payload, uint32_t now_ms) {
+  fragment_header_t fragment_header;
+  if (header->length < sizeof(fragment_header)) {
+    r->fragments_rejected++;
+    log_event(EVENT_FRAGMENT_REJECTED, header->source, header->length);
+    return NULL;
+  }
+  memcpy(&fragment_header, payload, sizeof(fragment_header));
+  const char *text = (const char *)payload + sizeof(fragment_header);
+  const size_t text_length = header->length - sizeof(fragment_header);
+  const size_t offset = fragment_header.index * FRAGMENT_TEXT_LENGTH;
+  const bool consistent = fragment_header.message_length < MAX_TEXT_LENGTH &&
+                          fragment_header.count == count_fragments(fragment_header.message_length) &&
+                          fragment_header.index < fragment_header.count &&
+                          offset + text_length <= fragment_header.message_length &&
+                          (text_length == FRAGMENT_TEXT_LENGTH || offset + text_length == fragment_header.message_length);
+  if (!consistent || fragment_checksum(header, &fragment_header, text, text_length) != fragment_header.checksum) {
+    r->fragments_rejected++;
+    log_event(EVENT_FRAGMENT_REJECTED, header->source, header->length);
+    return NULL;
+  }
+  r->fragments_received++;
+  log_event(EVENT_FRAGMENT_RECEIVED, fragment_header.index + 1, fragment_header.count, header->source);
+
+  fragment_slot_t *slot = NULL;
+  for (int i = 0; i < FRAGMENT_REASSEMBLY_SLOTS && !slot; i++) {
+    fragment_slot_t *s = &r->slots[i];
+    if (s->used && s->header.source == header->source && s->header.sequence == header->sequence &&
+        s->header.length == fragment_header.message_length) {
+      slot = s;
+    }
+  }
+  if (!slot) {
+    for (int i = 0; i < FRAGMENT_REASSEMBLY_SLOTS; i++) {
+      fragment_slot_t *s = &r->slots[i];
+      if (!slot || !s->used || (slot->used && (int32_t)(s->last_fragment_ms - slot->last_fragment_ms) < 0)) {
+        slot = s;
+      }
+    }
+    memset(slot, 0, sizeof(*slot));
+    slot->used = true;
+    slot->header = *header;
+    slot->header.type = MAC_FRAME_TEXT;
+    slot->header.length = fragment_header.message_length;
+    slot->count = fragment_header.count;
+    slot->history_index = -1;
+  }
+  if (slot->received & (1u << fragment_header.index)) {
+    return NULL;
+  }
+
+  memcpy(&slot->text[offset], text, text_length);
+  slot->received |= 1u << fragment_header.index;
+  slot->last_fragment_ms = now_ms;
+  // The fewest relays any copy came through:
+  if (header->hops < slot->header.hops) {
+    slot->header.hops = header->hops;
+    slot->header.ttl = header->ttl;
+  }
+  if (slot->received == (1u << slot->count) - 1) {
+    slot->complete = true;
+    slot->text[slot->header.length] = '\0';
+    r->messages_completed++;
+  }
+  return slot;
+}
+
+/**
+ * Writes the message as received so far into text (null-terminated, at most size - 1 chars), with
+ * FRAGMENT_MISSING_MARKER in place of each run of fragments not yet (or never) received. Returns its length.
+ */
+size_t render_fragments(const fragment_slot_t *slot, char *text, size_t size) {
+  size_t length = 0;
+  bool in_gap = false;
+  for (int i = 0; i < slot->count; i++) {
+    const char *part;
+    size_t part_length;
+    if (slot->received & (1u << i)) {
+      part = &slot->text[i * FRAGMENT_TEXT_LENGTH];
+      part_length = (i == slot->count - 1) ? slot->header.length - i * FRAGMENT_TEXT_LENGTH : FRAGMENT_TEXT_LENGTH;
+      in_gap = false;
+    } else if (!in_gap) {
+      part = FRAGMENT_MISSING_MARKER;
+      part_length = strlen(FRAGMENT_MISSING_MARKER);
+      in_gap = true;
+    } else {
+      continue;
+    }
+    if (length + part_length > size - 1) {
+      part_length = size - 1 - length;
+    }
+    memcpy(&text[length], part, part_length);
+    length += part_length;
+  }
+  text[length] = '\0';
+  return length;
+}
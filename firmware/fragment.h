@@ -0,0 +1,67 @@
+// ==================================================================
+// fragment.h
+// Declares splitting text messages into independently decodable fragments, and putting them back together
+// ==================================================================
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "mac.h"
+
+//----------------------------------------
+// Fragment Configuration
+//----------------------------------------
+#define FRAGMENT_TEXT_LENGTH        32      // Text per fragment: about 2.5 s on air at 160 bit/s
+#define FRAGMENT_MAX_COUNT          ((MAX_TEXT_LENGTH - 1 + FRAGMENT_TEXT_LENGTH - 1) / FRAGMENT_TEXT_LENGTH)
+#define FRAGMENT_REASSEMBLY_SLOTS   3       // Messages being put back together at once
+#define FRAGMENT_MISSING_MARKER     "[...]" // Stands in for each run of missing fragments in a partial message
+
+// Starts the payload of every MAC_FRAME_TEXT_FRAGMENT, followed by the fragment's text. The MAC header's
+// source and sequence identify the message the fragment belongs to:
+typedef struct __attribute__((packed)) {
+  uint8_t index;               // Fragment i holds text from i * FRAGMENT_TEXT_LENGTH
+  uint8_t count;
+  uint16_t message_length;     // Whole message, in chars
+  uint16_t checksum;           // Fletcher-16 of the MAC header, this header (checksum 0) and the text
+} fragment_header_t;
+
+static_assert(FRAGMENT_MAX_COUNT <= 16, "fragment_slot_t.received has a bit per fragment");
+
+typedef struct {
+  bool used;
+  bool complete;
+  mac_header_t header;         // The whole message's (type MAC_FRAME_TEXT, length message_length)
+  uint8_t count;
+  uint16_t received;           // Bit i set once fragment i is in text
+  char text[MAX_TEXT_LENGTH];
+  uint32_t last_fragment_ms;
+  int history_index;           // Chat history entry showing the message, or -1 (kept by chat_logic.cpp)
+} fragment_slot_t;
+
+typedef struct {
+  fragment_slot_t slots[FRAGMENT_REASSEMBLY_SLOTS];
+
+  // Counters for the console:
+  uint32_t fragments_received;
+  uint32_t fragments_rejected; // Bad checksum or inconsistent header
+  uint32_t messages_completed;
+} reassembly_state;
+
+int count_fragments(size_t message_length);
+
+void build_fragment(const mac_frame_t *message, int index, mac_frame_t *fragment);
+
+uint32_t fragmented_airtime_ms(const tx_parameters_t *tx, size_t message_length);
+
+uint32_t fragment_airtime_ms(const tx_parameters_t *tx, size_t message_length, int index);
+
+void initialize_reassembly(reassembly_state *r);
+
+fragment_slot_t *add_fragment(reassembly_state *r, const mac_header_t *header, const void *payload, uint32_t now_ms);
+
+size_t render_fragments(const fragment_slot_t *slot, char *text, size_t size);
+
+#endif
@@ -0,0 +1,136 @@
+// ==================================================================
+// frontend.cpp
+// Mixes the band of interest to complex baseband and decimates it
+// ==================================================================
+#include "frontend.h"
+#include "sine_table.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// Converts the CIC output back to ADC counts: 2^10 from the mixer shift below, times CIC gain R^N = 512:
+static const float cic_output_scale = 1.0f / (1024.0f * 512.0f);
+
+// update_frontend_chunk() keeps the integrators in registers, one per stage:
+static_assert(FRONTEND_CIC_ORDER == 3, "integrator loop is written out for a third-order CIC");
+
+// Shift applied to the Q15 mixer product so that the CIC's R^N = 512 growth cannot overflow 32 bits:
+static const int mixer_shift = 5;
+
+/**
+ * Lowpass for the 10.24 kHz -> 5.12 kHz stage. Flat (+-0.03 dB including the CIC droop it compensates)
+ * out to 1.6 kHz either side of the center frequency, >60 dB down from 2.9 kHz, so everything that can
+ * alias back into the passband after decimation is rejected.
+ */
+static const float fir_coeffs[FRONTEND_FIR_TAPS] = {
+  +4.445289617e-04f, +5.892944689e-05f, -2.201476768e-03f, -2.110441432e-03f,
+  +4.681374553e-03f, +8.597536360e-03f, -4.922063026e-03f, -2.139604716e-02f,
+  -3.471642778e-03f, +3.940256137e-02f, +3.093970205e-02f, -5.604822375e-02f,
+  -9.911459166e-02f, +4.853664607e-02f, +3.236006624e-01f, +4.657167375e-01f,
+  +3.236006624e-01f, +4.853664607e-02f, -9.911459166e-02f, -5.604822375e-02f,
+  +3.093970205e-02f, +3.940256137e-02f, -3.471642778e-03f, -2.139604716e-02f,
+  -4.922063026e-03f, +8.597536360e-03f, +4.681374553e-03f, -2.110441432e-03f,
+  -2.201476768e-03f, +5.892944689e-05f, +4.445289617e-04f,
+};
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Returns the complex sample rate produced by a front end fed at fs.
+ */
+float frontend_output_rate(float fs) {
+  return fs / FRONTEND_DECIMATION;
+}
+
+/**
+ * Prepares a front end that shifts center_hz down to 0 Hz and decimates by FRONTEND_DECIMATION.
+ */
+void initialize_frontend(frontend_state *fe, float center_hz, float fs) {
+  fe->nco_phase = 0;
+  retune_frontend(fe, center_hz, fs);
+
+  for (int k = 0; k < FRONTEND_CIC_ORDER; k++) {
+    fe->integrator_i[k] = fe->integrator_q[k] = 0;
+    fe->comb_z1_i[k] = fe->comb_z1_q[k] = 0;
+  }
+
+  arm_fir_decimate_init_f32(&fe->fir_i, FRONTEND_FIR_TAPS, FRONTEND_FIR_DECIMATION,
+                            fir_coeffs, fe->fir_state_i, FRONTEND_CHUNK_CIC_SIZE);
+  arm_fir_decimate_init_f32(&fe->fir_q, FRONTEND_FIR_TAPS, FRONTEND_FIR_DECIMATION,
+                            fir_coeffs, fe->fir_state_q, FRONTEND_CHUNK_CIC_SIZE);
+}
+
+/**
+ * Moves the NCO to a new center frequency without disturbing the filters or the NCO phase,
+ * so the baseband stream stays continuous (used for Doppler compensation).
+ */
+void retune_frontend(frontend_state *fe, float center_hz, float fs) {
+  fe->nco_phase_increment = (uint32_t)((double)center_hz / fs * 4294967296.0);
+}
+
+/**
+ * Runs one comb section over a decimated integrator output. Differences are taken in unsigned
+ * arithmetic so that integrator wraparound cancels out exactly.
+ */
+static inline int32_t cic_comb(uint32_t *comb_z1, uint32_t x) {
+  for (int k = 0; k < FRONTEND_CIC_ORDER; k++) {
+    uint32_t y = x - comb_z1[k];
+    comb_z1[k] = x;
+    x = y;
+  }
+  return (int32_t)x;
+}
+
+/**
+ * Mixes, CIC-decimates and FIR-decimates one chunk of FRONTEND_CHUNK_SIZE ADC samples,
+ * writing FRONTEND_CHUNK_OUTPUT_SIZE complex samples.
+ */
+static void update_frontend_chunk(frontend_state *fe, const uint16_t *x, float *out_i, float *out_q) {
+  uint32_t phase = fe->nco_phase;
+  const uint32_t phase_increment = fe->nco_phase_increment;
+  uint32_t i0 = fe->integrator_i[0], i1 = fe->integrator_i[1], i2 = fe->integrator_i[2];
+  uint32_t q0 = fe->integrator_q[0], q1 = fe->integrator_q[1], q2 = fe->integrator_q[2];
+
+  for (int m = 0; m < FRONTEND_CHUNK_CIC_SIZE; m++) {
+    for (int r = 0; r < FRONTEND_CIC_DECIMATION; r++) {
+      int32_t sample = (int32_t)x[m * FRONTEND_CIC_DECIMATION + r] - FRONTEND_ADC_MIDSCALE;
+      uint32_t index = phase >> (32 - SINE_TABLE_BITS);
+      // Mixes down by e^(-jwt): I = x*cos = x*sin(wt + pi/2), Q = -x*sin = x*sin(wt + pi)
+      int32_t cos_wt = sine_table.values[(index + SINE_TABLE_QUARTER) & SINE_TABLE_MASK];
+      int32_t neg_sin_wt = sine_table.values[(index + 2 * SINE_TABLE_QUARTER) & SINE_TABLE_MASK];
+      phase += phase_increment;
+
+      i0 += (uint32_t)((sample * cos_wt) >> mixer_shift);
+      i1 += i0;
+      i2 += i1;
+      q0 += (uint32_t)((sample * neg_sin_wt) >> mixer_shift);
+      q1 += q0;
+      q2 += q1;
+    }
+    fe->cic_out_i[m] = cic_comb(fe->comb_z1_i, i2) * cic_output_scale;
+    fe->cic_out_q[m] = cic_comb(fe->comb_z1_q, q2) * cic_output_scale;
+  }
+
+  fe->nco_phase = phase;
+  fe->integrator_i[0] = i0; fe->integrator_i[1] = i1; fe->integrator_i[2] = i2;
+  fe->integrator_q[0] = q0; fe->integrator_q[1] = q1; fe->integrator_q[2] = q2;
+
+  arm_fir_decimate_f32(&fe->fir_i, fe->cic_out_i, out_i, FRONTEND_CHUNK_CIC_SIZE);
+  arm_fir_decimate_f32(&fe->fir_q, fe->cic_out_q, out_q, FRONTEND_CHUNK_CIC_SIZE);
+}
+
+/**
+ * Feeds n raw ADC samples (n must be a multiple of FRONTEND_CHUNK_SIZE) through the front end and
+ * returns the number of complex baseband samples written to out_i/out_q (n / FRONTEND_DECIMATION).
+ */
+size_t update_frontend(frontend_state *fe, const uint16_t *x, size_t n, float *out_i, float *out_q) {
+  size_t output_count = 0;
+  for (size_t offset = 0; offset + FRONTEND_CHUNK_SIZE <= n; offset += FRONTEND_CHUNK_SIZE) {
+    update_frontend_chunk(fe, &x[offset], &out_i[output_count], &out_q[output_count]);
+    output_count += FRONTEND_CHUNK_OUTPUT_SIZE;
+  }
+  return output_count;
+}
@@ -0,0 +1,54 @@
+// ==================================================================
+// frontend.h
+// Defines the decimating receive front end (NCO mixer, CIC and FIR)
+// ==================================================================
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arm_math.h>
+
+//----------------------------------------
+// Decimation Chain Configuration
+//----------------------------------------
+#define FRONTEND_CIC_ORDER          3       // Number of integrator/comb stages
+#define FRONTEND_CIC_DECIMATION     8       // CIC rate change (81.92 kHz -> 10.24 kHz)
+#define FRONTEND_FIR_DECIMATION     2       // FIR rate change (10.24 kHz -> 5.12 kHz)
+#define FRONTEND_FIR_TAPS           31
+#define FRONTEND_DECIMATION         (FRONTEND_CIC_DECIMATION * FRONTEND_FIR_DECIMATION)
+#define FRONTEND_CHUNK_SIZE         1024    // Input samples processed per FIR call
+#define FRONTEND_CHUNK_CIC_SIZE     (FRONTEND_CHUNK_SIZE / FRONTEND_CIC_DECIMATION)
+#define FRONTEND_CHUNK_OUTPUT_SIZE  (FRONTEND_CHUNK_SIZE / FRONTEND_DECIMATION)
+#define FRONTEND_ADC_MIDSCALE       2048    // 12-bit ADC code for 0V input after biasing
+
+typedef struct {
+  // NCO: 32-bit phase accumulator indexing into the shared sine table
+  uint32_t nco_phase;
+  uint32_t nco_phase_increment;
+
+  // CIC integrators and comb delays, kept in wrapping unsigned arithmetic
+  uint32_t integrator_i[FRONTEND_CIC_ORDER];
+  uint32_t integrator_q[FRONTEND_CIC_ORDER];
+  uint32_t comb_z1_i[FRONTEND_CIC_ORDER];
+  uint32_t comb_z1_q[FRONTEND_CIC_ORDER];
+
+  // Compensating FIR decimators (one per rail), run through CMSIS-DSP
+  arm_fir_decimate_instance_f32 fir_i;
+  arm_fir_decimate_instance_f32 fir_q;
+  float fir_state_i[FRONTEND_FIR_TAPS + FRONTEND_CHUNK_CIC_SIZE - 1];
+  float fir_state_q[FRONTEND_FIR_TAPS + FRONTEND_CHUNK_CIC_SIZE - 1];
+  float cic_out_i[FRONTEND_CHUNK_CIC_SIZE];
+  float cic_out_q[FRONTEND_CHUNK_CIC_SIZE];
+} frontend_state;
+
+void initialize_frontend(frontend_state *fe, float center_hz, float fs);
+
+void retune_frontend(frontend_state *fe, float center_hz, float fs);
+
+size_t update_frontend(frontend_state *fe, const uint16_t *x, size_t n, float *out_i, float *out_q);
+
+float frontend_output_rate(float fs);
+
+#endif
@@ -8,8 +8,11 @@
 #include "comm.h"
 #include "config.h"
 #include "display.h"
+#include "event_log.h"
 #include "hardware_config.h"
 #include "keyboard.h"
+#include "modem_profile.h"
+#include "profiler.h"
 
 // ------------------------------------------------------------------
 // State
@@ -30,6 +33,12 @@ static const unsigned long screen_timeout_ms = 10000;
 // Useful for debouncing/long presses:
 static uint32_t time_of_last_press_ms;
 
+// Key presses waiting for loop() (see poll_keyboard()). The scan interrupt only appends here, so the
+// history, the typing buffer and the screen are only ever changed from loop():
+static volatile uint8_t key_queue[KEY_QUEUE_LENGTH];
+static volatile uint32_t key_queue_head = 0;  // Next press to handle (loop())
+static volatile uint32_t key_queue_tail = 0;  // Next place to fill (interrupt)
+
 // Runs poller at 100 Hz:
 static const int keyboard_poller_period_usec = 1000;
 
@@ -52,10 +61,15 @@ static int ilog2(uint64_t x) {
 
 /**
  * Reads the state of the keyboard by polling shift registers.
- * Detects new key presses, updates the screen, and processes
- * actions for CAPS, SYM, SEND, arrow keys, and printable keys.
+ * Detects new key presses, wakes the screen, and queues the key
+ * for poll_keyboard() to act on. Runs in the keyboard timer interrupt.
  */
-void poll_keyboard(ChatBufferState* state) {
+static void scan_keyboard() {
+  PROFILE_SCOPE(PROFILE_STAGE_KEYBOARD_POLL);
+  // A scan more than half a period late is taken to have been skipped (the timer was starved):
+  PROFILE_CHECK_PERIOD(PROFILE_COUNTER_MISSED_KEYBOARD_SCAN,
+                       (uint64_t)keyboard_poller_period_usec * F_CPU_ACTUAL / 1000000,
+                       (uint64_t)keyboard_poller_period_usec * F_CPU_ACTUAL / 2000000);
   // static int modifier = 0;
 
   // Latches keyboard state into shift registers
@@ -87,73 +101,11 @@ void poll_keyboard(ChatBufferState* state) {
     if (!screen_on) {
       screen_on = true;
       digitalWrite(tft_led_pin, HIGH);
+    } else if (key_queue_tail - key_queue_head < KEY_QUEUE_LENGTH) {
+      key_queue[key_queue_tail % KEY_QUEUE_LENGTH] = ilog2(new_press) - 1;
+      key_queue_tail++;
     } else {
-      uint8_t key_index = ilog2(new_press) - 1;
-
-      switch (key_index) {
-        case CAP_KEY_INDEX:
-          Serial.println("You pressed CAPS");
-          break;
-        case SYM_KEY_INDEX:
-          Serial.println("You pressed SYM");
-          break;
-        case UP_KEY_INDEX:
-          Serial.println("You pressed UP");
-          /*
-          Pressing "up" increments message_scroll_offset, which is used to determine which
-          message should be displayed at the bottom of the history box. Any older messages are just
-          redrawn above that message, and any content that exceeds the heigh of the box should be cut
-          off anyway. Note: message_scroll_offset should never exceed (chat_history_message_count - 1)
-          even if the user keeps pressing 'up'
-          if (message_scroll_offset == chat_history_message_count - 1), that means the oldest message is
-          currently displayed at the bottom of the history box
-          */
-          if (state->message_scroll_offset < state->chat_history_message_count - 1) {
-            state->message_scroll_offset++;
-            display_chat_history(state);
-          }
-          break;
-        case DOWN_KEY_INDEX:
-          Serial.println("You pressed DOWN");
-          if (state->message_scroll_offset > 0) {
-            state->message_scroll_offset--;
-            display_chat_history(state);
-          }
-          break;
-        case BACK_KEY_INDEX:
-          Serial.println("You pressed BACKSPACE");
-          tx_display_buffer[tx_display_buffer_length] = '\0';
-          tx_display_buffer_length--;
-          redraw_typing_box();
-          break;
-        case RET_KEY_INDEX:
-          Serial.println("You pressed RETURN");
-          if (tx_display_buffer_length < MAX_TEXT_LENGTH - 1) {
-            tx_display_buffer[tx_display_buffer_length] = '\n';
-            tx_display_buffer_length++;
-          }
-          redraw_typing_box();
-          break;
-        case SEND_KEY_INDEX:
-          Serial.println("You pressed SEND");
-          Serial.printf("Current message length: %d\n", tx_display_buffer_length);
-          if (tx_display_buffer_length == 0) {
-            Serial.println("No message to send");
-            break;
-          }
-          send_message(tx_display_buffer);
-          reset_tx_display_buffer();
-          redraw_typing_box();
-          break;
-        default:
-          char key = KEYBOARD_LAYOUT[key_index];
-          tx_display_buffer[tx_display_buffer_length] = key;
-          tx_display_buffer_length++;
-          // Serial.printf("Read buffer %ul\n", ~read_buffer);
-          Serial.printf("You pressed key_index=%d, key=\'%c\'\n", key_index, key);
-          redraw_typing_box();
-          // modifier = 0; // reset modifier keys
-      }
+      log_event(EVENT_KEY_DROPPED, ilog2(new_press) - 1);
     }
   } else if (screen_on && millis() - time_of_last_press_ms > screen_timeout_ms) {
     screen_on = false;
@@ -161,9 +113,98 @@ void poll_keyboard(ChatBufferState* state) {
   }
 }
 
+/**
+ * Acts on one key press: scrolls the chat history, edits or sends the typed message, or cycles the modem
+ * profile, redrawing whatever changed.
+ */
+static void handle_key(ChatBufferState* state, uint8_t key_index) {
+  switch (key_index) {
+    case CAP_KEY_INDEX:
+      log_event(EVENT_KEY_CAPS);
+      break;
+    case SYM_KEY_INDEX:
+      log_event(EVENT_KEY_SYM);
+      break;
+    case UP_KEY_INDEX:
+      /*
+      Pressing "up" increments message_scroll_offset, which is used to determine which
+      message should be displayed at the bottom of the history box. Any older messages are just
+      redrawn above that message, and any content that exceeds the heigh of the box should be cut
+      off anyway. Note: message_scroll_offset should never exceed (chat_history_message_count - 1)
+      even if the user keeps pressing 'up'
+      if (message_scroll_offset == chat_history_message_count - 1), that means the oldest message is
+      currently displayed at the bottom of the history box
+      */
+      if (state->message_scroll_offset < state->chat_history_message_count - 1) {
+        state->message_scroll_offset++;
+        log_event(EVENT_KEY_UP, state->message_scroll_offset);
+        display_chat_history(state);
+      }
+      break;
+    case DOWN_KEY_INDEX:
+      if (state->message_scroll_offset > 0) {
+        state->message_scroll_offset--;
+        log_event(EVENT_KEY_DOWN, state->message_scroll_offset);
+        display_chat_history(state);
+      }
+      break;
+    case MENU_KEY_INDEX:
+      // Cycles through the compiled-in modem profiles (both ends must use the same one):
+      select_modem_profile((get_active_modem_profile_index() + 1) % get_modem_profile_count());
+      log_event(EVENT_KEY_MENU, get_active_modem_profile_index());
+      break;
+    case BACK_KEY_INDEX:
+      tx_display_buffer[tx_display_buffer_length] = '\0';
+      tx_display_buffer_length--;
+      log_event(EVENT_KEY_BACKSPACE, tx_display_buffer_length);
+      redraw_typing_box();
+      break;
+    case RET_KEY_INDEX:
+      if (tx_display_buffer_length < MAX_TEXT_LENGTH - 1) {
+        tx_display_buffer[tx_display_buffer_length] = '\n';
+        tx_display_buffer_length++;
+      }
+      log_event(EVENT_KEY_RETURN, tx_display_buffer_length);
+      redraw_typing_box();
+      break;
+    case SEND_KEY_INDEX:
+      if (tx_display_buffer_length == 0) {
+        log_event(EVENT_KEY_SEND_EMPTY);
+        break;
+      }
+      log_event(EVENT_KEY_SEND, tx_display_buffer_length);
+      // Keeps the text in the typing box if the MAC queue is full, so SEND can be tried again:
+      if (!send_message(tx_display_buffer)) {
+        break;
+      }
+      reset_tx_display_buffer();
+      redraw_typing_box();
+      break;
+    default:
+      char key = KEYBOARD_LAYOUT[key_index];
+      tx_display_buffer[tx_display_buffer_length] = key;
+      tx_display_buffer_length++;
+      log_event(EVENT_KEY_PRESS, key_index, key);
+      redraw_typing_box();
+      // modifier = 0; // reset modifier keys
+  }
+}
+
+/**
+ * Handles the key presses scan_keyboard() has queued since the last call. Call from loop(): this is where
+ * the chat history is scrolled and messages are sent, so it never runs partway through another redraw.
+ */
+void poll_keyboard(ChatBufferState* state) {
+  while (key_queue_head != key_queue_tail) {
+    uint8_t key_index = key_queue[key_queue_head % KEY_QUEUE_LENGTH];
+    key_queue_head++;
+    handle_key(state, key_index);
+  }
+}
+
 /**
  * Configures the keyboard polling mechanism by setting up input/output pins
- * and starting a timer that calls poll_keyboard at regular intervals.
+ * and starting a timer that calls scan_keyboard at regular intervals.
  */
 void setup_keyboard_poller() {
   switch_state = 0;
@@ -175,7 +216,7 @@ void setup_keyboard_poller() {
   pinMode(kb_data_pin, INPUT);
 
   // Starts timer:
-  if (!keyboard_poller_timer.begin([]() { poll_keyboard(get_chat_buffer_state()); }, keyboard_poller_period_usec)) {
+  if (!keyboard_poller_timer.begin(scan_keyboard, keyboard_poller_period_usec)) {
     Serial.println("Failed setting up poller");
   }
 }
@@ -9,4 +9,6 @@
 
 void setup_keyboard_poller();
 
+void poll_keyboard(ChatBufferState* state);
+
 #endif
@@ -0,0 +1,345 @@
+// ==================================================================
+// link.cpp
+// Two-way acoustic ranging and rolling link quality for each node heard (no hardware access)
+// ==================================================================
+#include <math.h>    // for floorf, log10f
+#include <string.h>  // for memcpy, memset
+
+#include "event_log.h"
+#include "link.h"
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * The known pattern every ping and reply carries: bytes from a maximal-length 16-bit LFSR, so bit errors
+ * show up whatever the modulation does with runs of equal bits.
+ */
+static void make_link_pattern(uint8_t *pattern) {
+  uint16_t lfsr = 0xACE1u;
+  for (int i = 0; i < LINK_PATTERN_LENGTH; i++) {
+    uint8_t byte = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      const uint16_t feedback = (lfsr ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5)) & 1;
+      lfsr = (lfsr >> 1) | (feedback << 15);
+      byte = (byte << 1) | (lfsr & 1);
+    }
+    pattern[i] = byte;
+  }
+}
+
+static int count_pattern_errors(const link_ping_t *ping) {
+  uint8_t pattern[LINK_PATTERN_LENGTH];
+  make_link_pattern(pattern);
+  int errors = 0;
+  for (int i = 0; i < LINK_PATTERN_LENGTH; i++) {
+    errors += __builtin_popcount((uint8_t)(ping->pattern[i] ^ pattern[i]));
+  }
+  return errors;
+}
+
+static float snr_to_db(float snr) {
+  return (snr > 0.01f) ? 10.0f * log10f(snr) : -20.0f;
+}
+
+/**
+ * The entry for address, taking a free one (or the one heard from longest ago) if it has none.
+ */
+static link_node_t *get_link_node(link_state *link, uint8_t address, uint32_t now_ms) {
+  link_node_t *node = NULL;
+  for (int i = 0; i < LINK_MAX_NODES; i++) {
+    link_node_t *n = &link->nodes[i];
+    if (n->used && n->address == address) {
+      return n;
+    }
+    if (!node || !n->used || (node->used && (int32_t)(n->last_heard_ms - node->last_heard_ms) < 0)) {
+      node = n;
+    }
+  }
+  memset(node, 0, sizeof(*node));
+  node->used = true;
+  node->address = address;
+  node->last_heard_ms = now_ms;
+  return node;
+}
+
+static void count_link_bits(link_node_t *node, int bits, int errors) {
+  node->bits += bits;
+  node->bit_errors += errors;
+  if (node->bits > LINK_WINDOW_BITS) {
+    node->bits /= 2;
+    node->bit_errors /= 2;
+  }
+}
+
+static void count_link_packet(link_node_t *node, bool ok) {
+  node->packets++;
+  node->packets_lost += (ok) ? 0 : 1;
+  if (node->packets > LINK_WINDOW_PACKETS) {
+    node->packets /= 2;
+    node->packets_lost /= 2;
+  }
+}
+
+void initialize_link(link_state *link, uint8_t address) {
+  memset(link, 0, sizeof(*link));
+  link->address = address;
+}
+
+/**
+ * Builds a ping to destination, sent at power_level, for the caller to queue with the MAC. Returns false
+ * while another ping is still waiting for its reply.
+ */
+bool start_link_ping(link_state *link, uint8_t destination, uint8_t power_level, mac_frame_t *ping) {
+  if (link->ping_pending) {
+    return false;
+  }
+  link_ping_t payload;
+  memset(&payload, 0, sizeof(payload));
+  payload.id = ++link->ping_id;
+  payload.power_level = power_level;
+  make_link_pattern(payload.pattern);
+
+  ping->header.type = MAC_FRAME_RANGE_PING;
+  ping->header.destination = destination;
+  ping->header.source = link->address;
+  ping->header.sequence = payload.id;
+  ping->header.hops = 0;
+  ping->header.ttl = 0;
+  ping->header.length = sizeof(payload);
+  memcpy(ping->text, &payload, sizeof(payload));
+
+  link->ping_pending = true;
+  link->ping_sent = false;
+  link->ping_destination = destination;
+  link->ping_power_level = power_level;
+  return true;
+}
+
+/**
+ * Records when the ping went out: start_us is micros() at its first DAC sample (see transmit_message()).
+ */
+void note_link_ping_sent(link_state *link, const mac_header_t *header, uint32_t start_us, uint32_t now_ms) {
+  if (!link->ping_pending || header->sequence != link->ping_id) {
+    return;
+  }
+  link->ping_sent = true;
+  link->ping_sent_us = start_us;
+  link->ping_sent_ms = now_ms;
+  link->pings_sent++;
+}
+
+/**
+ * Answers a ping addressed to this node, reporting the SNR (-1 if unknown) and pattern bit errors it arrived
+ * with. When its arrival was timed (arrival_valid), the reply is promised for LINK_REPLY_DELAY_MS after now
+ * (the ping has only just been decoded, a whole airtime after it arrived) and the turnaround from the ping's
+ * arrival to then goes in the reply, so the pinger can take it out of the round trip. Otherwise the reply
+ * goes out untimed (turnaround 0) as soon as it can, for the link statistics alone. Returns whether the
+ * ping was taken (one of the right length, addressed here).
+ */
+bool handle_link_ping(link_state *link, const mac_header_t *header, const void *payload, bool arrival_valid,
+                      uint32_t arrival_us, float snr, uint32_t now_us, uint32_t now_ms) {
+  if (header->length != sizeof(link_ping_t) || header->destination != link->address) {
+    return false;
+  }
+  link_ping_t ping;
+  memcpy(&ping, payload, sizeof(ping));
+  link_node_t *node = get_link_node(link, header->source, now_ms);
+  const int errors = count_pattern_errors(&ping);
+  count_link_bits(node, 8 * LINK_PATTERN_LENGTH, errors);
+  log_event(EVENT_LINK_PING, ping.id, header->source, errors);
+
+  const float snr_db = snr_to_db(snr);
+  link_ping_t reply;
+  memset(&reply, 0, sizeof(reply));
+  reply.id = ping.id;
+  reply.power_level = choose_link_power_level(link, header->source, now_ms);
+  reply.snr_db = (snr < 0) ? LINK_SNR_UNKNOWN : (snr_db > 127) ? 127 : (snr_db < -127) ? -127 : (int8_t)snr_db;
+  reply.bit_errors = errors;
+  reply.turnaround_us = (arrival_valid) ? (now_us - arrival_us) + LINK_REPLY_DELAY_MS * 1000u : 0;
+  make_link_pattern(reply.pattern);
+
+  link->reply.header.type = MAC_FRAME_RANGE_REPLY;
+  link->reply.header.destination = header->source;
+  link->reply.header.source = link->address;
+  link->reply.header.sequence = ping.id;
+  link->reply.header.hops = 0;
+  link->reply.header.ttl = 0;
+  link->reply.header.length = sizeof(reply);
+  memcpy(link->reply.text, &reply, sizeof(reply));
+  link->reply_start_us = arrival_us + reply.turnaround_us;
+  link->reply_pending = true;
+  return true;
+}
+
+/**
+ * Hands over the pending reply once its start time is under 50 ms away (the transmitter waits out the rest,
+ * see transmit_message_at()), with *start_us set to that time, or 0 for an untimed reply. A timed reply whose
+ * time has already passed is dropped.
+ */
+bool take_link_reply(link_state *link, uint32_t now_us, mac_frame_t *reply, uint32_t *start_us) {
+  if (!link->reply_pending) {
+    return false;
+  }
+  link_ping_t payload;
+  memcpy(&payload, link->reply.text, sizeof(payload));
+  if (payload.turnaround_us == 0) {
+    *start_us = 0;
+  } else {
+    const int32_t wait_us = (int32_t)(link->reply_start_us - now_us);
+    if (wait_us < 0) {
+      link->reply_pending = false;
+      link->replies_late++;
+      log_event(EVENT_LINK_REPLY_LATE, link->reply.header.destination, -wait_us / 1000);
+      return false;
+    }
+    if (wait_us > 50000) {
+      return false;
+    }
+    *start_us = link->reply_start_us;
+  }
+  *reply = link->reply;
+  link->reply_pending = false;
+  link->replies_sent++;
+  return true;
+}
+
+/**
+ * Takes the reply to our ping: the far end's report on the ping (SNR scaled up to full power, bit errors),
+ * the reply's own pattern errors, and, when both ends timed their arrivals, the range: half the round trip
+ * less the promised turnaround, at the speed of sound. Returns whether the reply was taken (it answers the
+ * ping pending here, so its source is the node pinged).
+ */
+bool handle_link_reply(link_state *link, const mac_header_t *header, const void *payload, bool arrival_valid,
+                       uint32_t arrival_us, uint32_t now_ms) {
+  if (header->length != sizeof(link_ping_t) || header->destination != link->address) {
+    return false;
+  }
+  link_ping_t reply;
+  memcpy(&reply, payload, sizeof(reply));
+  if (!link->ping_pending || !link->ping_sent || header->source != link->ping_destination || reply.id != link->ping_id) {
+    return false;
+  }
+  link->ping_pending = false;
+  link_node_t *node = get_link_node(link, header->source, now_ms);
+  count_link_bits(node, 8 * LINK_PATTERN_LENGTH, reply.bit_errors);
+  count_link_bits(node, 8 * LINK_PATTERN_LENGTH, count_pattern_errors(&reply));
+  if (reply.snr_db != LINK_SNR_UNKNOWN) {
+    const float far_snr_db = reply.snr_db + link->ping_power_level * LINK_POWER_STEP_DB;
+    node->far_snr_db = (node->far_snr_known) ? node->far_snr_db + LINK_SNR_SMOOTHING * (far_snr_db - node->far_snr_db)
+                                             : far_snr_db;
+    node->far_snr_known = true;
+  }
+
+  const int32_t round_trip_us = (int32_t)(arrival_us - link->ping_sent_us) - (int32_t)reply.turnaround_us;
+  if (!arrival_valid || reply.turnaround_us == 0 || round_trip_us < 0) {
+    link->ranges_rejected += (arrival_valid && reply.turnaround_us != 0) ? 1 : 0;
+    return true;
+  }
+  node->range_m = round_trip_us * 0.5e-6f * LINK_SOUND_SPEED_M_PER_S;
+  node->range_ms = now_ms;
+  node->ranged = true;
+  log_event(EVENT_LINK_RANGE, header->source, (int32_t)(node->range_m * 100), round_trip_us);
+  return true;
+}
+
+/**
+ * Counts a packet from source: decoded (ok, with the SNR it arrived with, or -1 if that wasn't measured) or
+ * failing its checksum. Only frames whose source can be trusted should be passed in (the MAC header itself
+ * has no checksum).
+ */
+void note_link_packet(link_state *link, uint8_t source, bool ok, float snr, uint32_t now_ms) {
+  if (source == link->address || source == MAC_BROADCAST_ADDRESS) {
+    return;
+  }
+  link_node_t *node = get_link_node(link, source, now_ms);
+  node->last_heard_ms = now_ms;
+  count_link_packet(node, ok);
+  if (ok && snr >= 0) {
+    const float snr_db = snr_to_db(snr);
+    node->snr_db = (node->snr_known) ? node->snr_db + LINK_SNR_SMOOTHING * (snr_db - node->snr_db) : snr_db;
+    node->snr_known = true;
+  }
+}
+
+/**
+ * Gives up on a ping whose reply is overdue, counting the exchange as lost and forgetting the far end's
+ * SNR, so power control goes back to full power until a reply comes through. Call from loop().
+ */
+void update_link(link_state *link, uint32_t now_ms) {
+  if (!link->ping_pending || !link->ping_sent || now_ms - link->ping_sent_ms < LINK_PING_TIMEOUT_MS) {
+    return;
+  }
+  link->ping_pending = false;
+  link_node_t *node = get_link_node(link, link->ping_destination, now_ms);
+  count_link_packet(node, false);
+  node->far_snr_known = false;
+}
+
+/**
+ * The entry for address, or NULL if it hasn't been heard from (or pinged).
+ */
+const link_node_t *find_link_node(const link_state *link, uint8_t address) {
+  for (int i = 0; i < LINK_MAX_NODES; i++) {
+    if (link->nodes[i].used && link->nodes[i].address == address) {
+      return &link->nodes[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Transmit power level (0 = full, each level LINK_POWER_STEP_DB down) for a frame to destination: as low
+ * as keeps LINK_TARGET_SNR_DB at the far end, going by what its replies report. A broadcast has to reach the
+ * worst-placed node heard within LINK_STALE_MS; any node (or destination) without a report gets full power.
+ */
+uint8_t choose_link_power_level(const link_state *link, uint8_t destination, uint32_t now_ms) {
+  float worst_snr_db = 0;
+  bool any = false;
+  for (int i = 0; i < LINK_MAX_NODES; i++) {
+    const link_node_t *node = &link->nodes[i];
+    if (!node->used || (destination != MAC_BROADCAST_ADDRESS && node->address != destination) ||
+        (destination == MAC_BROADCAST_ADDRESS && now_ms - node->last_heard_ms > LINK_STALE_MS)) {
+      continue;
+    }
+    if (!node->far_snr_known) {
+      return 0;
+    }
+    if (!any || node->far_snr_db < worst_snr_db) {
+      worst_snr_db = node->far_snr_db;
+      any = true;
+    }
+  }
+  if (!any) {
+    return 0;
+  }
+  const int level = (int)floorf((worst_snr_db - LINK_TARGET_SNR_DB) / LINK_POWER_STEP_DB);
+  return (level < 0) ? 0 : (level >= LINK_POWER_LEVELS) ? LINK_POWER_LEVELS - 1 : level;
+}
+
+/**
+ * Whether the link would do better at another rate. Only a hint: both ends have to change profile together
+ * (MENU key), so it isn't applied on its own.
+ */
+link_rate_hint_t link_rate_hint(const link_node_t *node) {
+  if (node->packets < LINK_WINDOW_PACKETS / 4) {
+    return LINK_RATE_HOLD;
+  }
+  if (link_packet_error_rate(node) > LINK_SLOWER_PER) {
+    return LINK_RATE_SLOWER;
+  }
+  if (node->packets_lost == 0 && node->snr_db > LINK_FASTER_SNR_DB &&
+      (!node->far_snr_known || node->far_snr_db > LINK_FASTER_SNR_DB)) {
+    return LINK_RATE_FASTER;
+  }
+  return LINK_RATE_HOLD;
+}
+
+float link_bit_error_rate(const link_node_t *node) {
+  return (node->bits > 0) ? (float)node->bit_errors / node->bits : 0;
+}
+
+float link_packet_error_rate(const link_node_t *node) {
+  return (node->packets > 0) ? (float)node->packets_lost / node->packets : 0;
+}
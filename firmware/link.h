@@ -0,0 +1,128 @@
+// ==================================================================
+// link.h
+// Declares two-way acoustic ranging and per-node link quality (SNR, bit and packet errors)
+// ==================================================================
+#ifndef LINK_H
+#define LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "mac.h"
+
+//----------------------------------------
+// Link Configuration
+//----------------------------------------
+#define LINK_MAX_NODES              8       // Nodes tracked at once; the one heard from longest ago makes way
+#define LINK_SOUND_SPEED_M_PER_S    1500.0f
+#define LINK_REPLY_DELAY_MS         400     // A reply starts this long after its ping is decoded (turnaround sent back)
+#define LINK_PING_TIMEOUT_MS        12000   // No reply this long after a ping ends: lost (fsk40 reply, ~3 km away)
+#define LINK_PATTERN_LENGTH         16      // Known bytes in every ping and reply, for counting bit errors
+#define LINK_WINDOW_BITS            8192    // Rolling windows: counts halve once they pass these...
+#define LINK_WINDOW_PACKETS         32      // ...so old traffic fades out
+#define LINK_SNR_SMOOTHING          0.25f   // Weight of each new packet in the SNR average
+#define LINK_SNR_UNKNOWN            -128    // Reported SNR when the ping's arrival wasn't timed
+#define LINK_STALE_MS               300000  // Nodes not heard for this long don't count for power control
+#define LINK_POWER_LEVELS           4       // Transmit power levels: 0 is full power...
+#define LINK_POWER_STEP_DB          6       // ...and each one after halves the amplitude
+#define LINK_TARGET_SNR_DB          15.0f   // Power control keeps at least this at the far end
+#define LINK_SLOWER_PER             0.2f    // Rate hint: packet error rate that calls for a slower profile...
+#define LINK_FASTER_SNR_DB          25.0f   // ...and SNR (with no recent losses) that leaves room for a faster one
+
+// Payload of MAC_FRAME_RANGE_PING and MAC_FRAME_RANGE_REPLY. A ping's report fields are 0:
+typedef struct __attribute__((packed)) {
+  uint8_t id;                  // Matches a reply to its ping
+  uint8_t power_level;         // The sender's transmit power level for this frame
+  int8_t snr_db;               // Reply: SNR the ping arrived with (LINK_SNR_UNKNOWN if not measured)
+  uint8_t bit_errors;          // Reply: bits of the ping's pattern that arrived wrong
+  uint32_t turnaround_us;      // Reply: from the ping's arrival to the reply's first DAC sample
+  uint8_t pattern[LINK_PATTERN_LENGTH];
+} link_ping_t;
+
+static_assert(sizeof(link_ping_t) < MAX_TEXT_LENGTH, "a ping fits in one frame");
+
+typedef enum {
+  LINK_RATE_HOLD,              // The profile in use suits the link
+  LINK_RATE_SLOWER,            // Too many packets lost: a slower profile would get more through
+  LINK_RATE_FASTER,            // Plenty of SNR and nothing lost: a faster profile would likely work
+} link_rate_hint_t;
+
+typedef struct {
+  uint8_t address;
+  bool used;
+  uint32_t last_heard_ms;
+
+  // Two-way ranging (range_ms is when it was last measured, locally):
+  bool ranged;
+  float range_m;
+  uint32_t range_ms;
+
+  // Its transmissions as heard here, and ours as heard there (from its replies, scaled to full power):
+  bool snr_known;
+  float snr_db;
+  bool far_snr_known;
+  float far_snr_db;
+
+  // Rolling counts: pattern bits both ways, and packets from it (good, or failing a checksum) and
+  // ping exchanges with it (answered, or lost):
+  uint32_t bits;
+  uint32_t bit_errors;
+  uint32_t packets;
+  uint32_t packets_lost;
+} link_node_t;
+
+typedef struct {
+  uint8_t address;
+  link_node_t nodes[LINK_MAX_NODES];
+
+  // The ping in flight (sent_us is when its first DAC sample went out, 0 until it has):
+  bool ping_pending;
+  uint8_t ping_destination;
+  uint8_t ping_id;
+  uint8_t ping_power_level;
+  bool ping_sent;
+  uint32_t ping_sent_us;
+  uint32_t ping_sent_ms;
+
+  // A reply waiting for its start time:
+  bool reply_pending;
+  mac_frame_t reply;
+  uint32_t reply_start_us;
+
+  // Counters for the console:
+  uint32_t pings_sent;
+  uint32_t replies_sent;
+  uint32_t replies_late;       // Couldn't go out at their promised time (the loop was busy)
+  uint32_t ranges_rejected;    // Reply arrival not lined up with the frame it decoded as
+} link_state;
+
+void initialize_link(link_state *link, uint8_t address);
+
+bool start_link_ping(link_state *link, uint8_t destination, uint8_t power_level, mac_frame_t *ping);
+
+void note_link_ping_sent(link_state *link, const mac_header_t *header, uint32_t start_us, uint32_t now_ms);
+
+bool handle_link_ping(link_state *link, const mac_header_t *header, const void *payload, bool arrival_valid,
+                      uint32_t arrival_us, float snr, uint32_t now_us, uint32_t now_ms);
+
+bool take_link_reply(link_state *link, uint32_t now_us, mac_frame_t *reply, uint32_t *start_us);
+
+bool handle_link_reply(link_state *link, const mac_header_t *header, const void *payload, bool arrival_valid,
+                       uint32_t arrival_us, uint32_t now_ms);
+
+void note_link_packet(link_state *link, uint8_t source, bool ok, float snr, uint32_t now_ms);
+
+void update_link(link_state *link, uint32_t now_ms);
+
+const link_node_t *find_link_node(const link_state *link, uint8_t address);
+
+uint8_t choose_link_power_level(const link_state *link, uint8_t destination, uint32_t now_ms);
+
+link_rate_hint_t link_rate_hint(const link_node_t *node);
+
+float link_bit_error_rate(const link_node_t *node);
+
+float link_packet_error_rate(const link_node_t *node);
+
+#endif
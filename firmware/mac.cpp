@@ -0,0 +1,246 @@
+// ==================================================================
+// mac.cpp
+// Decides when queued frames may go out on the shared channel (no hardware access, so it also builds on a host)
+// ==================================================================
+#include <stdio.h>   // for snprintf
+#include <string.h>  // for memset, strlen, strncpy
+
+#include "fragment.h"
+#include "mac.h"
+#include "modem_profile.h"
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Next value of the node's xorshift32 generator, for backoff draws.
+ */
+static uint32_t next_mac_random(mac_state *mac) {
+  uint32_t x = mac->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  mac->random_state = x;
+  return x;
+}
+
+/**
+ * Starts a node with address (MAC_MIN_ADDRESS..MAC_MAX_ADDRESS) and an empty queue. seed should differ
+ * between nodes (e.g. from a chip ID), or nodes that queue together back off in lockstep.
+ */
+void initialize_mac(mac_state *mac, uint8_t address, uint32_t seed, uint32_t now_ms) {
+  memset(mac, 0, sizeof(*mac));
+  mac->address = address;
+  mac->random_state = (seed != 0) ? seed : 0x9E3779B9u;
+  // Not from 0, or relays would take a restarted node's first frames for ones they already saw:
+  mac->next_sequence = seed >> 24;
+  mac->mode = MAC_IDLE;
+  mac->contention_slots = MAC_MIN_CONTENTION_SLOTS;
+  mac->clear_since_ms = now_ms;
+}
+
+/**
+ * Adds a text frame from this node to the back of the queue. Returns false (and drops it) when the queue is full.
+ */
+bool queue_mac_frame(mac_state *mac, uint8_t destination, const char *text) {
+  if (mac->queue_count >= MAC_QUEUE_LENGTH) {
+    mac->frames_rejected++;
+    return false;
+  }
+  mac_frame_t *frame = &mac->queue[(mac->queue_head + mac->queue_count) % MAC_QUEUE_LENGTH];
+  frame->header.type = MAC_FRAME_TEXT;
+  frame->header.destination = destination;
+  frame->header.source = mac->address;
+  frame->header.sequence = mac->next_sequence++;
+  frame->header.hops = 0;
+  frame->header.ttl = MAC_DEFAULT_TTL;
+  strncpy(frame->text, text, MAX_TEXT_LENGTH - 1);
+  frame->text[MAX_TEXT_LENGTH - 1] = '\0';
+  frame->header.length = strlen(frame->text);
+  mac->queue_count++;
+  return true;
+}
+
+/**
+ * Adds another node's frame, header and all, to the back of the queue (see take_relay_frame()). Returns
+ * false (and drops it) when the queue is full.
+ */
+bool forward_mac_frame(mac_state *mac, const mac_frame_t *frame) {
+  if (mac->queue_count >= MAC_QUEUE_LENGTH) {
+    mac->frames_rejected++;
+    return false;
+  }
+  mac->queue[(mac->queue_head + mac->queue_count) % MAC_QUEUE_LENGTH] = *frame;
+  mac->queue_count++;
+  return true;
+}
+
+/**
+ * Drops the relayed frame (hops > 0) from source with sequence if it is still waiting in the queue, as
+ * another relay has forwarded it (see note_relay_frame()). The head frame stays once a fragment of it has
+ * gone out, since the recipient would only lose the rest. Returns whether a frame was dropped.
+ */
+bool cancel_mac_frame(mac_state *mac, uint8_t source, uint8_t sequence) {
+  for (int i = (mac->head_fragments_sent > 0) ? 1 : 0; i < mac->queue_count; i++) {
+    const mac_header_t *header = &mac->queue[(mac->queue_head + i) % MAC_QUEUE_LENGTH].header;
+    if (header->hops > 0 && header->source == source && header->sequence == sequence) {
+      // Closes the gap, keeping the rest in order:
+      for (int k = i; k < mac->queue_count - 1; k++) {
+        mac->queue[(mac->queue_head + k) % MAC_QUEUE_LENGTH] = mac->queue[(mac->queue_head + k + 1) % MAC_QUEUE_LENGTH];
+      }
+      mac->queue_count--;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Runs the access rules; call often (every few ms) with whether carrier sense finds the channel busy.
+ * The frame at the head of the queue goes out at once if the channel has been clear for a slot; otherwise
+ * it draws a backoff of 0 .. contention window - 1 slots. Backoff slots only count down while the
+ * channel stays clear, and a count interrupted by traffic waits for a clear slot before resuming (with
+ * the window doubled for later draws, since traffic means other nodes are contending).
+ * A text frame goes out a fragment per call: the next one goes as soon as carrier sense reads clear, ahead
+ * of anyone waiting for a clear slot. If the channel stays busy for a slot after our own fragment, someone
+ * else has it, and the rest of the frame contends like a new frame.
+ * Returns the frame to transmit now, or NULL; after sending one fragment of it call finish_mac_fragment().
+ */
+const mac_frame_t *update_mac(mac_state *mac, uint32_t now_ms, bool channel_busy) {
+  if (channel_busy) {
+    mac->clear_since_ms = now_ms;
+  }
+  if (mac->queue_count == 0) {
+    mac->mode = MAC_IDLE;
+    return NULL;
+  }
+  const bool clear_for_a_slot = now_ms - mac->clear_since_ms >= MAC_SLOT_MS;
+
+  if (mac->mode == MAC_CONTINUING) {
+    // Carrier sense lags by up to two ADC blocks, so for a while it may still be hearing our own fragment:
+    if (now_ms - mac->slot_start_ms < MAC_SLOT_MS) {
+      return (channel_busy) ? NULL : &mac->queue[mac->queue_head];
+    }
+    mac->mode = MAC_IDLE;
+  }
+  if (mac->mode == MAC_IDLE) {
+    mac->backoff_slots = (clear_for_a_slot) ? 0 : next_mac_random(mac) % mac->contention_slots;
+    mac->mode = MAC_DEFERRING;
+  }
+  if (mac->mode == MAC_BACKOFF && channel_busy) {
+    mac->backoffs_interrupted++;
+    mac->contention_slots *= 2;
+    if (mac->contention_slots > MAC_MAX_CONTENTION_SLOTS) {
+      mac->contention_slots = MAC_MAX_CONTENTION_SLOTS;
+    }
+    mac->mode = MAC_DEFERRING;
+  }
+  if (mac->mode == MAC_DEFERRING) {
+    if (!clear_for_a_slot) {
+      return NULL;
+    }
+    mac->mode = MAC_BACKOFF;
+    mac->slot_start_ms = now_ms;
+  }
+
+  while (now_ms - mac->slot_start_ms >= MAC_SLOT_MS && mac->backoff_slots > 0) {
+    mac->slot_start_ms += MAC_SLOT_MS;
+    mac->backoff_slots--;
+  }
+  return (mac->backoff_slots == 0) ? &mac->queue[mac->queue_head] : NULL;
+}
+
+/**
+ * The frame at the head of the queue (NULL if empty), for sending without contention when a schedule
+ * grants the channel (see update_tdma()). Finish it a fragment at a time, as for update_mac().
+ */
+const mac_frame_t *peek_mac_frame(const mac_state *mac) {
+  return (mac->queue_count > 0) ? &mac->queue[mac->queue_head] : NULL;
+}
+
+/**
+ * Transmissions a frame goes out as: a text frame's fragments, or 1 for any other.
+ */
+static int count_frame_fragments(const mac_frame_t *frame) {
+  return (frame->header.type == MAC_FRAME_TEXT) ? count_fragments(frame->header.length) : 1;
+}
+
+/**
+ * Removes the frame at the head of the queue once all of it has been sent, and narrows the contention window.
+ */
+static void finish_mac_transmission(mac_state *mac, uint32_t now_ms) {
+  mac->head_fragments_sent = 0;
+  mac->queue_head = (mac->queue_head + 1) % MAC_QUEUE_LENGTH;
+  mac->queue_count--;
+  mac->frames_sent++;
+  mac->contention_slots /= 2;
+  if (mac->contention_slots < MAC_MIN_CONTENTION_SLOTS) {
+    mac->contention_slots = MAC_MIN_CONTENTION_SLOTS;
+  }
+  // Our own transmission held the channel, so the next frame contends like everyone else's:
+  mac->clear_since_ms = now_ms;
+  mac->mode = MAC_IDLE;
+}
+
+/**
+ * Records that fragment head_fragments_sent of the frame update_mac() or peek_mac_frame() handed out has
+ * been sent (any frame other than text is one fragment). Finishes the frame with its last fragment, and
+ * then returns true.
+ */
+bool finish_mac_fragment(mac_state *mac, uint32_t now_ms) {
+  if (++mac->head_fragments_sent < count_frame_fragments(&mac->queue[mac->queue_head])) {
+    mac->mode = MAC_CONTINUING;
+    mac->slot_start_ms = now_ms;
+    return false;
+  }
+  finish_mac_transmission(mac, now_ms);
+  return true;
+}
+
+/**
+ * Whether a received frame is for this node: addressed to it or broadcast, and not its own echo.
+ */
+bool accept_mac_frame(mac_state *mac, const mac_header_t *header) {
+  if (header->source == mac->address ||
+      (header->destination != mac->address && header->destination != MAC_BROADCAST_ADDRESS)) {
+    mac->frames_filtered++;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Airtime of everything in the queue still to send with tx (text as fragments). The next transmission that
+ * can go on its own, the head frame or for text its next fragment, goes in *next_airtime_ms (0 when the
+ * queue is empty).
+ */
+uint32_t mac_queue_airtime_ms(const mac_state *mac, const tx_parameters_t *tx, uint32_t *next_airtime_ms) {
+  uint32_t total_ms = 0;
+  *next_airtime_ms = 0;
+  for (int i = 0; i < mac->queue_count; i++) {
+    const mac_frame_t *frame = &mac->queue[(mac->queue_head + i) % MAC_QUEUE_LENGTH];
+    const int first = (i == 0) ? mac->head_fragments_sent : 0;
+    for (int f = first; f < count_frame_fragments(frame); f++) {
+      const uint32_t airtime_ms = (frame->header.type == MAC_FRAME_TEXT)
+                                ? fragment_airtime_ms(tx, frame->header.length, f)
+                                : modem_packet_airtime_ms(tx, MAC_PACKET_OVERHEAD + frame->header.length);
+      if (i == 0 && f == first) {
+        *next_airtime_ms = airtime_ms;
+      }
+      total_ms += airtime_ms;
+    }
+  }
+  return total_ms;
+}
+
+/**
+ * Writes a name for address as shown in the chat history ("diver 7", or "all" for broadcast).
+ */
+void format_mac_address(uint8_t address, char *name, size_t size) {
+  if (address == MAC_BROADCAST_ADDRESS) {
+    snprintf(name, size, "all");
+  } else {
+    snprintf(name, size, "diver %u", (unsigned)address);
+  }
+}
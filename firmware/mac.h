@@ -0,0 +1,106 @@
+// ==================================================================
+// mac.h
+// Declares the carrier-sense multiple access (CSMA) layer shared by every node on the channel
+// ==================================================================
+#ifndef MAC_H
+#define MAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+//----------------------------------------
+// MAC Configuration
+//----------------------------------------
+#define MAC_BROADCAST_ADDRESS       0xFF    // Destination every node accepts
+#define MAC_MIN_ADDRESS             1       // Node addresses run 1..254 (0 is never assigned)
+#define MAC_MAX_ADDRESS             254
+#define MAC_QUEUE_LENGTH            4       // Outgoing frames waiting for the channel...
+#define MAC_RELAY_QUEUE_LENGTH      3       // ...of which relayed frames may take this many (the rest is kept for ours)
+#define MAC_SLOT_MS                 500     // Backoff slot: carrier sense latency (2 ADC blocks) + ~350 m of sound
+#define MAC_MIN_CONTENTION_SLOTS    8       // Backoff is drawn from 0 .. contention window - 1 slots
+#define MAC_MAX_CONTENTION_SLOTS    128
+#define MAC_DEFAULT_TTL             2       // Relays a new text frame may pass through (see relay.h)
+
+typedef enum {
+  MAC_FRAME_TEXT,              // A chat message
+  MAC_FRAME_TDMA_BEACON,       // Station clock and slot schedule (see tdma.h)
+  MAC_FRAME_TDMA_REQUEST,      // A node's ranging timestamp and queued airtime, for the station
+  MAC_FRAME_TEXT_FRAGMENT,     // Part of a chat message: how text goes on air (see fragment.h)
+  MAC_FRAME_RANGE_PING,        // Two-way ranging and link quality probe (see link.h)
+  MAC_FRAME_RANGE_REPLY,       // Its answer, sent a known turnaround after the ping arrived
+} mac_frame_type_t;
+
+// Sent between the STX header and the payload of every packet (see packetize_message()):
+typedef struct __attribute__((packed)) {
+  uint8_t type;                // mac_frame_type_t
+  uint8_t destination;         // A node address or MAC_BROADCAST_ADDRESS
+  uint8_t source;
+  uint8_t sequence;            // Per source, so relays and receivers can tell copies of a frame apart
+  uint8_t hops;                // Relays the frame has passed through
+  uint8_t ttl;                 // Relays it may still pass through
+  uint16_t length;             // Payload bytes between this header and ETX (little-endian)
+} mac_header_t;
+
+// SOH STX, the header, then ETX EOT around each payload:
+#define MAC_PACKET_OVERHEAD         (4 + sizeof(mac_header_t))
+static_assert(MAC_PACKET_OVERHEAD + MAX_TEXT_LENGTH - 1 <= MAX_PACKET_SIZE, "a full text frame fits in a packet");
+static_assert(MAC_RELAY_QUEUE_LENGTH < MAC_QUEUE_LENGTH, "relayed frames leave room for our own");
+
+typedef struct {
+  mac_header_t header;
+  char text[MAX_TEXT_LENGTH];  // Payload; null-terminated as well for text frames
+} mac_frame_t;
+
+typedef enum {
+  MAC_IDLE,                    // Nothing queued
+  MAC_DEFERRING,               // Waiting for the channel to stay clear for a slot
+  MAC_BACKOFF,                 // Counting down backoff slots while the channel stays clear
+  MAC_CONTINUING,              // Between fragments of the head frame: the next goes once the channel reads clear
+} mac_mode_t;
+
+typedef struct {
+  uint8_t address;
+  uint32_t random_state;       // xorshift32, never 0
+  uint8_t next_sequence;
+
+  mac_frame_t queue[MAC_QUEUE_LENGTH];
+  int queue_head;
+  int queue_count;
+
+  mac_mode_t mode;
+  uint32_t contention_slots;   // Current window: doubles when a countdown is interrupted, halves per frame sent
+  uint32_t backoff_slots;      // Slots still to count down for the frame at the head of the queue
+  uint32_t slot_start_ms;      // Start of the slot being counted (continuing: when the last fragment ended)
+  uint32_t clear_since_ms;     // When the channel was last sensed busy (clear ever since)
+  int head_fragments_sent;     // Fragments of the head frame already out on their own (see finish_mac_fragment())
+
+  // Counters for the console and simulations:
+  uint32_t frames_sent;
+  uint32_t frames_rejected;    // Queue was full
+  uint32_t backoffs_interrupted;
+  uint32_t frames_filtered;    // Received, but for another node (or our own, heard back)
+} mac_state;
+
+void initialize_mac(mac_state *mac, uint8_t address, uint32_t seed, uint32_t now_ms);
+
+bool queue_mac_frame(mac_state *mac, uint8_t destination, const char *text);
+
+bool forward_mac_frame(mac_state *mac, const mac_frame_t *frame);
+
+bool cancel_mac_frame(mac_state *mac, uint8_t source, uint8_t sequence);
+
+const mac_frame_t *update_mac(mac_state *mac, uint32_t now_ms, bool channel_busy);
+
+const mac_frame_t *peek_mac_frame(const mac_state *mac);
+
+bool finish_mac_fragment(mac_state *mac, uint32_t now_ms);
+
+bool accept_mac_frame(mac_state *mac, const mac_header_t *header);
+
+uint32_t mac_queue_airtime_ms(const mac_state *mac, const tx_parameters_t *tx, uint32_t *next_airtime_ms);
+
+void format_mac_address(uint8_t address, char *name, size_t size);
+
+#endif
@@ -0,0 +1,91 @@
+// ==================================================================
+// modem_profile.cpp
+// Instantiates the compiled-in modem profiles and tracks the active one
+// ==================================================================
+#include "modem_profile.h"
+
+// ------------------------------------------------------------------
+// Profiles
+// ------------------------------------------------------------------
+
+// 80 bit/s: 12.5 ms symbols, tones two bins either side of 15 kHz
+typedef ModemProfile<15000, 14840, 15160, 64, MODEM_WINDOW_HANN> Fsk80Profile;
+
+// 160 bit/s: 6.25 ms symbols, for short range with little multipath
+typedef ModemProfile<15000, 14680, 15320, 32, MODEM_WINDOW_HANN> Fsk160Profile;
+
+// 40 bit/s: 25 ms symbols, for long range or heavy multipath
+typedef ModemProfile<15000, 14920, 15080, 128, MODEM_WINDOW_HANN> Fsk40Profile;
+
+// 160 bit/s DBPSK and 320 bit/s DQPSK: 6.25 ms shaped symbols on a carrier at the center frequency,
+// occupying roughly the bandwidth of a single fsk160 tone. DQPSK decisions come from the multipath equalizer
+// after each preamble, but it only goes so far: an echo 0.5 as strong as the direct path at 25-50 ms still
+// costs 2-4% of the bits, and one 0.7 as strong 12-13% (tools/echo_sim). DBPSK is not equalized and
+// rides through both without error, so it is the PSK profile for strong multipath.
+typedef ModemProfile<15000, 15000, 15000, 32, MODEM_WINDOW_TAPERED, MODEM_MODULATION_DBPSK> Dbpsk160Profile;
+typedef ModemProfile<15000, 15000, 15000, 32, MODEM_WINDOW_TAPERED, MODEM_MODULATION_DQPSK> Dqpsk320Profile;
+
+// 80 bit/s chirp spread spectrum: 25 ms up-chirps sweeping 13.72-16.28 kHz (64 chips), 2 bits per symbol.
+// 18 dB of spreading gain (bandwidth x symbol time), for long range when nothing else gets through
+typedef ModemProfile<15000, 13720, 16280, 128, MODEM_WINDOW_RECTANGULAR, MODEM_MODULATION_CSS> Css80Profile;
+
+static const modem_profile_t modem_profiles[] = {
+  make_modem_profile<Fsk80Profile>("fsk80", false),
+  make_modem_profile<Fsk160Profile>("fsk160", false),
+  make_modem_profile<Fsk40Profile>("fsk40", false),
+  make_modem_profile<Dbpsk160Profile>("dbpsk160", true),
+  make_modem_profile<Dqpsk320Profile>("dqpsk320", true),
+  make_modem_profile<Css80Profile>("css80", false),
+};
+
+static const int modem_profile_count = sizeof(modem_profiles) / sizeof(modem_profiles[0]);
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+static volatile int active_profile_index = 0;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+int get_modem_profile_count() {
+  return modem_profile_count;
+}
+
+/**
+ * Returns the profile at index, or nullptr if there is no such profile.
+ */
+const modem_profile_t* get_modem_profile(int index) {
+  if (index < 0 || index >= modem_profile_count) {
+    return nullptr;
+  }
+  return &modem_profiles[index];
+}
+
+const modem_profile_t* get_active_modem_profile() {
+  return &modem_profiles[active_profile_index];
+}
+
+int get_active_modem_profile_index() {
+  return active_profile_index;
+}
+
+/**
+ * Makes the profile at index the one used for both TX and RX. Out-of-range indexes are ignored.
+ * Callers that own receive state (see select_modem_profile() in comm.cpp) must reset it afterwards.
+ */
+void set_active_modem_profile(int index) {
+  if (index >= 0 && index < modem_profile_count) {
+    active_profile_index = index;
+  }
+}
+
+/**
+ * How long transmit_message() takes to send packet_bytes with tx, preamble included, rounded up to a ms.
+ */
+uint32_t modem_packet_airtime_ms(const tx_parameters_t *tx, size_t packet_bytes) {
+  uint32_t symbols = MODEM_PREAMBLE_SYMBOLS + packet_bytes * (8 / tx->bits_per_symbol);
+  return (uint32_t)(((uint64_t)symbols * tx->usec_per_symbol + 999) / 1000);
+}
@@ -0,0 +1,250 @@
+// ==================================================================
+// modem_profile.h
+// Compile-time modem profiles: tones, rates, window and detector tables
+// ==================================================================
+#ifndef MODEM_PROFILE_H
+#define MODEM_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "frontend.h"
+#include "sine_table.h"
+
+//----------------------------------------
+// Shared Modem Parameters
+//----------------------------------------
+#define MODEM_SAMPLE_RATE           81920   // ADC and DAC sample rate (Hz)
+#define MODEM_BASEBAND_RATE         (MODEM_SAMPLE_RATE / FRONTEND_DECIMATION)
+#define MODEM_TONE_COUNT            2       // Most tones any profile detects (FSK: 0 bit, 1 bit; PSK: carrier only)
+#define MODEM_MAX_SYMBOL_SAMPLES    128     // Longest symbol of any profile, in baseband samples
+#define MODEM_PASSBAND_HZ           1600    // Front end is flat out to +-this far from the center
+#define MODEM_RAMP_FRACTION         8       // Shaped symbols fade over 1/8 of the symbol at each edge
+#define MODEM_PREAMBLE_SYMBOLS      16      // Symbol transitions sent ahead of every packet for RX sync
+#define MODEM_BINS_PER_TONE         3       // Each tone's bin plus one neighbour either side (for Doppler)
+#define MODEM_CSS_BITS_PER_SYMBOL   2       // Chirp profiles use 4 widely spaced cyclic shifts per symbol
+
+typedef enum {
+  MODEM_WINDOW_RECTANGULAR,
+  MODEM_WINDOW_HANN,
+  MODEM_WINDOW_TAPERED,                     // Matched to shaped TX symbols (MODEM_RAMP_FRACTION edges)
+} modem_window_t;
+
+/**
+ * Runtime view of one compiled-in profile. Everything in here is generated from a ModemProfile<>
+ * instantiation, so the transmitter and receiver cannot drift apart.
+ */
+typedef struct {
+  const char *name;
+  uint32_t center_hz;                     // Front end NCO frequency
+  uint32_t tone_hz[MODEM_TONE_COUNT];
+  uint32_t tone_count;
+  uint32_t symbol_samples;                // Baseband samples per symbol
+  modem_window_t window;
+  modem_modulation_t modulation;
+  uint32_t bits_per_symbol;
+  tx_parameters_t tx;
+
+  // Windowed Goertzel over one symbol of baseband samples; writes one complex output per tone
+  void (*detect_tones)(const float *x_i, const float *x_q, float *y_re, float *y_im);
+
+  // As detect_tones, but writes MODEM_BINS_PER_TONE outputs per tone (bins at -1, 0, +1 bin spacing)
+  void (*detect_tone_bins)(const float *x_i, const float *x_q, float *y_re, float *y_im);
+} modem_profile_t;
+
+// ------------------------------------------------------------------
+// Compile-time profile definition
+// ------------------------------------------------------------------
+
+/**
+ * A modem profile is fixed entirely by its template parameters. Derived quantities are constexpr and
+ * the static_asserts below reject any profile whose TX and RX sides would not agree.
+ * PSK profiles use a single carrier, passed as both Tone0Hz and Tone1Hz. Chirp (CSS) profiles sweep from
+ * Tone0Hz to Tone1Hz over each symbol; the tone detectors are still generated but go unused.
+ */
+template <uint32_t CenterHz, uint32_t Tone0Hz, uint32_t Tone1Hz, uint32_t SymbolSamples, modem_window_t Window,
+          modem_modulation_t Modulation = MODEM_MODULATION_FSK>
+struct ModemProfile {
+  static constexpr uint32_t center_hz = CenterHz;
+  static constexpr uint32_t symbol_samples = SymbolSamples;
+  static constexpr modem_window_t window = Window;
+  static constexpr modem_modulation_t modulation = Modulation;
+  static constexpr uint32_t tone_count = (Modulation == MODEM_MODULATION_FSK) ? 2 : 1;
+  static constexpr uint32_t bits_per_symbol = (Modulation == MODEM_MODULATION_DQPSK) ? 2 :
+                                              (Modulation == MODEM_MODULATION_CSS) ? MODEM_CSS_BITS_PER_SYMBOL : 1;
+  static constexpr uint32_t tx_samples_per_symbol = SymbolSamples * FRONTEND_DECIMATION;
+  static constexpr uint32_t usec_per_symbol = (uint64_t)tx_samples_per_symbol * 1000000 / MODEM_SAMPLE_RATE;
+
+  static constexpr uint32_t tone_hz(int k) {
+    return (k == 0) ? Tone0Hz : Tone1Hz;
+  }
+
+  // Detector bin spacing: one cycle per symbol
+  static constexpr double bin_hz = (double)MODEM_BASEBAND_RATE / SymbolSamples;
+
+  // Tone frequency, shifted by bin_offset detector bins, relative to the front end center, in radians per baseband sample:
+  static constexpr double baseband_w0(int k, int bin_offset = 0) {
+    return 2 * 3.14159265358979323846 * ((double)tone_hz(k) - CenterHz + bin_offset * bin_hz) / MODEM_BASEBAND_RATE;
+  }
+
+  // DAC phase step for a tone, and the frequency the DAC will actually produce with it:
+  static constexpr uint32_t tx_phase_increment(int k) {
+    return (uint32_t)((double)tone_hz(k) / MODEM_SAMPLE_RATE * 4294967296.0);
+  }
+  static constexpr double tx_tone_hz(int k) {
+    return tx_phase_increment(k) * (double)MODEM_SAMPLE_RATE / 4294967296.0;
+  }
+
+  static_assert(SymbolSamples > 0 && SymbolSamples <= MODEM_MAX_SYMBOL_SAMPLES, "symbol does not fit the receive buffer");
+  static_assert((uint64_t)usec_per_symbol * MODEM_SAMPLE_RATE == (uint64_t)tx_samples_per_symbol * 1000000,
+                "TX symbol duration must be a whole number of microseconds and RX samples");
+  static_assert((Modulation == MODEM_MODULATION_FSK || Modulation == MODEM_MODULATION_CSS) ? (Tone0Hz < Tone1Hz)
+                                                                                           : (Tone0Hz == Tone1Hz),
+                "FSK sends tone 0 as freq_low and tone 1 as freq_high; PSK has a single carrier");
+  static_assert(Modulation != MODEM_MODULATION_CSS ||
+                (2 * (Tone1Hz - Tone0Hz) == MODEM_BASEBAND_RATE && SymbolSamples == MODEM_MAX_SYMBOL_SAMPLES),
+                "chirp tables and dechirp FFT assume a sweep of half the baseband rate over the longest symbol");
+  static_assert(Window != MODEM_WINDOW_TAPERED || SymbolSamples % MODEM_RAMP_FRACTION == 0,
+                "tapered window must line up with the TX symbol ramps");
+  static_assert((int32_t)(Tone0Hz - CenterHz) * (int32_t)SymbolSamples % MODEM_BASEBAND_RATE == 0 &&
+                (int32_t)(Tone1Hz - CenterHz) * (int32_t)SymbolSamples % MODEM_BASEBAND_RATE == 0,
+                "tones must sit on detector bins so each symbol holds whole cycles");
+  static_assert((int32_t)(Tone0Hz - CenterHz) <= MODEM_PASSBAND_HZ && (int32_t)(CenterHz - Tone0Hz) <= MODEM_PASSBAND_HZ &&
+                (int32_t)(Tone1Hz - CenterHz) <= MODEM_PASSBAND_HZ && (int32_t)(CenterHz - Tone1Hz) <= MODEM_PASSBAND_HZ,
+                "tones must lie inside the front end passband");
+  static_assert(tx_tone_hz(0) - Tone0Hz < 0.01 && Tone0Hz - tx_tone_hz(0) < 0.01 &&
+                tx_tone_hz(1) - Tone1Hz < 0.01 && Tone1Hz - tx_tone_hz(1) < 0.01,
+                "TX tones must match the RX detector frequencies");
+};
+
+/**
+ * Detector tables for one profile: the symbol window, and Goertzel coefficients for each tone's bin and
+ * its neighbours, indexed [tone][bin] with the tone itself at bin 1.
+ */
+template <typename Profile>
+struct modem_tables_t {
+  float window[Profile::symbol_samples];
+  float window_gain;                      // Sum of the window, for normalizing outputs
+  float a1[MODEM_TONE_COUNT][MODEM_BINS_PER_TONE];      // 2*cos(w0)
+  float cos_w0[MODEM_TONE_COUNT][MODEM_BINS_PER_TONE];
+  float sin_w0[MODEM_TONE_COUNT][MODEM_BINS_PER_TONE];
+};
+
+template <typename Profile>
+constexpr modem_tables_t<Profile> make_modem_tables() {
+  modem_tables_t<Profile> t = {};
+  t.window_gain = 0;
+  for (uint32_t n = 0; n < Profile::symbol_samples; n++) {
+    double w = 1.0;
+    if (Profile::window == MODEM_WINDOW_HANN) {
+      w = 0.5 * (1 - constexpr_cos(2 * 3.14159265358979323846 * (n + 0.5) / Profile::symbol_samples));
+    } else if (Profile::window == MODEM_WINDOW_TAPERED) {
+      // Same sin^2 edge as the DDS applies to shaped symbols:
+      const uint32_t ramp = Profile::symbol_samples / MODEM_RAMP_FRACTION;
+      const uint32_t from_end = Profile::symbol_samples - 1 - n;
+      const uint32_t distance = (n < from_end) ? n : from_end;
+      if (distance < ramp) {
+        double s = constexpr_sin(3.14159265358979323846 / 2 * (distance + 0.5) / ramp);
+        w = s * s;
+      }
+    }
+    t.window[n] = (float)w;
+    t.window_gain += (float)w;
+  }
+  for (uint32_t k = 0; k < Profile::tone_count; k++) {
+    for (int b = 0; b < MODEM_BINS_PER_TONE; b++) {
+      t.cos_w0[k][b] = (float)constexpr_cos(Profile::baseband_w0(k, b - 1));
+      t.sin_w0[k][b] = (float)constexpr_sin(Profile::baseband_w0(k, b - 1));
+      t.a1[k][b] = 2 * t.cos_w0[k][b];
+    }
+  }
+  return t;
+}
+
+template <typename Profile>
+constexpr modem_tables_t<Profile> modem_tables = make_modem_tables<Profile>();
+
+/**
+ * Windowed complex Goertzel over exactly one symbol, for bins FirstBin..FirstBin+BinCount-1 of every tone
+ * of a profile (outputs are tone-major). All loop bounds are compile-time constants, so each
+ * instantiation unrolls completely with coefficients folded in.
+ */
+template <typename Profile, uint32_t FirstBin, uint32_t BinCount>
+void detect_profile_bins(const float *x_i, const float *x_q, float *y_re, float *y_im) {
+  const modem_tables_t<Profile> &t = modem_tables<Profile>;
+  const uint32_t tones = Profile::tone_count;
+  float s_re[tones][BinCount] = {}, s_z1_re[tones][BinCount] = {};
+  float s_im[tones][BinCount] = {}, s_z1_im[tones][BinCount] = {};
+
+#pragma GCC unroll 128
+  for (uint32_t n = 0; n < Profile::symbol_samples; n++) {
+    float xr = x_i[n] * t.window[n];
+    float xq = x_q[n] * t.window[n];
+#pragma GCC unroll 2
+    for (uint32_t k = 0; k < tones; k++) {
+#pragma GCC unroll 3
+      for (uint32_t b = 0; b < BinCount; b++) {
+        float sr = xr + t.a1[k][FirstBin + b] * s_re[k][b] - s_z1_re[k][b];
+        float sq = xq + t.a1[k][FirstBin + b] * s_im[k][b] - s_z1_im[k][b];
+        s_z1_re[k][b] = s_re[k][b];
+        s_re[k][b] = sr;
+        s_z1_im[k][b] = s_im[k][b];
+        s_im[k][b] = sq;
+      }
+    }
+  }
+
+  // Each rail finalizes like finalize_goertzel(); the complex result is re + j*im:
+#pragma GCC unroll 2
+  for (uint32_t k = 0; k < tones; k++) {
+#pragma GCC unroll 3
+    for (uint32_t b = 0; b < BinCount; b++) {
+      float a_re = s_re[k][b] - t.cos_w0[k][FirstBin + b] * s_z1_re[k][b];
+      float b_re = t.sin_w0[k][FirstBin + b] * s_z1_re[k][b];
+      float a_im = s_im[k][b] - t.cos_w0[k][FirstBin + b] * s_z1_im[k][b];
+      float b_im = t.sin_w0[k][FirstBin + b] * s_z1_im[k][b];
+      y_re[k * BinCount + b] = (a_re - b_im) / t.window_gain;
+      y_im[k * BinCount + b] = (b_re + a_im) / t.window_gain;
+    }
+  }
+}
+
+/**
+ * Builds the runtime descriptor for a profile.
+ */
+template <typename Profile>
+constexpr modem_profile_t make_modem_profile(const char *name, bool shape_symbol_edges) {
+  return {
+    name,
+    Profile::center_hz,
+    {Profile::tone_hz(0), Profile::tone_hz(1)},
+    Profile::tone_count,
+    Profile::symbol_samples,
+    Profile::window,
+    Profile::modulation,
+    Profile::bits_per_symbol,
+    {(float)Profile::tone_hz(0), (float)Profile::tone_hz(1), Profile::usec_per_symbol, shape_symbol_edges,
+     Profile::modulation, (uint8_t)Profile::bits_per_symbol},
+    &detect_profile_bins<Profile, 1, 1>,
+    &detect_profile_bins<Profile, 0, MODEM_BINS_PER_TONE>,
+  };
+}
+
+// ------------------------------------------------------------------
+// Runtime profile selection
+// ------------------------------------------------------------------
+
+int get_modem_profile_count();
+
+const modem_profile_t* get_modem_profile(int index);
+
+const modem_profile_t* get_active_modem_profile();
+
+int get_active_modem_profile_index();
+
+void set_active_modem_profile(int index);
+
+uint32_t modem_packet_airtime_ms(const tx_parameters_t *tx, size_t packet_bytes);
+
+#endif
@@ -0,0 +1,153 @@
+// ==================================================================
+// profiler.cpp
+// Collects and reports stage timings and fault counters
+// ==================================================================
+#include <Arduino.h>
+#include <string.h>  // for memset, memcpy
+
+#include "profiler.h"
+
+#if PROFILING_ENABLED
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+static const char *const stage_names[PROFILE_STAGE_COUNT] = {
+  "adc isr",
+  "front end",
+  "demodulator",
+  "keyboard poll",
+  "chat redraw",
+  "typing redraw",
+};
+
+static const char *const counter_names[PROFILE_COUNTER_COUNT] = {
+  "dma overruns",
+  "missed keyboard scans",
+  "tx underruns",
+};
+
+// Written from ISRs and loop() alike, so updates run with interrupts masked:
+static profile_stage_stats_t stage_stats[PROFILE_STAGE_COUNT];
+static uint32_t counters[PROFILE_COUNTER_COUNT];
+
+// When the stats were last cleared, for turning total cycles into a CPU share:
+static uint32_t stats_start_ms = 0;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Masks interrupts and returns the previous mask, so calls nest correctly inside ISRs.
+ */
+static inline uint32_t mask_interrupts() {
+  uint32_t primask;
+  __asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r"(primask) : : "memory");
+  return primask;
+}
+
+static inline void restore_interrupts(uint32_t primask) {
+  __asm__ volatile("msr primask, %0" : : "r"(primask) : "memory");
+}
+
+/**
+ * Adds one timed run of a stage.
+ */
+void record_profile_stage(profile_stage_t stage, uint32_t cycles) {
+  int bin = (cycles == 0) ? 0 : 31 - __builtin_clz(cycles);
+
+  uint32_t primask = mask_interrupts();
+  profile_stage_stats_t *s = &stage_stats[stage];
+  if (s->count == 0 || cycles < s->min_cycles) s->min_cycles = cycles;
+  if (cycles > s->max_cycles) s->max_cycles = cycles;
+  s->count++;
+  s->total_cycles += cycles;
+  s->histogram[bin]++;
+  restore_interrupts(primask);
+}
+
+void increment_profile_counter(profile_counter_t counter, uint32_t amount) {
+  uint32_t primask = mask_interrupts();
+  counters[counter] += amount;
+  restore_interrupts(primask);
+}
+
+/**
+ * For code that should run every period_cycles: counts the runs missed since *last_cycles when this one is
+ * more than tolerance_cycles late, then moves *last_cycles to now. The first call only starts the clock.
+ */
+void check_profile_period(profile_counter_t counter, uint32_t *last_cycles, uint32_t period_cycles,
+                          uint32_t tolerance_cycles) {
+  uint32_t now = ARM_DWT_CYCCNT;
+  if (*last_cycles != 0) {
+    uint32_t elapsed = now - *last_cycles;
+    if (elapsed > period_cycles + tolerance_cycles) {
+      increment_profile_counter(counter, (elapsed - 1) / period_cycles);
+    }
+  }
+  *last_cycles = now;
+}
+
+#endif
+
+/**
+ * Clears every stage and counter.
+ */
+void reset_profile_stats() {
+#if PROFILING_ENABLED
+  noInterrupts();
+  memset(stage_stats, 0, sizeof(stage_stats));
+  memset(counters, 0, sizeof(counters));
+  stats_start_ms = millis();
+  interrupts();
+#endif
+}
+
+/**
+ * Prints a snapshot of every stage (runs, min/mean/max in cycles and microseconds, share of the CPU since
+ * the last reset, and the non-empty histogram bins) and every counter to serial.
+ */
+void print_profile_stats() {
+#if PROFILING_ENABLED
+  // Copies first so the (slow) printing doesn't hold interrupts off:
+  static profile_stage_stats_t snapshot[PROFILE_STAGE_COUNT];
+  uint32_t counter_snapshot[PROFILE_COUNTER_COUNT];
+  noInterrupts();
+  memcpy(snapshot, stage_stats, sizeof(snapshot));
+  memcpy(counter_snapshot, counters, sizeof(counter_snapshot));
+  uint32_t elapsed_ms = millis() - stats_start_ms;
+  interrupts();
+
+  const float cycles_per_usec = F_CPU_ACTUAL / 1e6f;
+  const float elapsed_cycles = (float)elapsed_ms * (F_CPU_ACTUAL / 1000);
+  Serial.printf("Profile over %lu ms (cycles @ %lu MHz):\n", (unsigned long)elapsed_ms,
+                (unsigned long)(F_CPU_ACTUAL / 1000000));
+  Serial.printf("%-14s %8s %10s %10s %10s %10s %7s\n", "stage", "runs", "min", "mean", "max", "max us", "cpu %");
+  for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+    const profile_stage_stats_t *s = &snapshot[i];
+    if (s->count == 0) {
+      Serial.printf("%-14s %8s\n", stage_names[i], "-");
+      continue;
+    }
+    uint32_t mean = (uint32_t)(s->total_cycles / s->count);
+    float cpu = (elapsed_cycles > 0) ? 100 * (float)s->total_cycles / elapsed_cycles : 0;
+    Serial.printf("%-14s %8lu %10lu %10lu %10lu %10.1f %7.2f\n", stage_names[i], (unsigned long)s->count,
+                  (unsigned long)s->min_cycles, (unsigned long)mean, (unsigned long)s->max_cycles,
+                  s->max_cycles / cycles_per_usec, cpu);
+    Serial.print("  histogram (log2 cycles: runs):");
+    for (int b = 0; b < PROFILE_HISTOGRAM_BINS; b++) {
+      if (s->histogram[b]) {
+        Serial.printf(" %d:%lu", b, (unsigned long)s->histogram[b]);
+      }
+    }
+    Serial.println();
+  }
+  for (int i = 0; i < PROFILE_COUNTER_COUNT; i++) {
+    Serial.printf("%-22s %lu\n", counter_names[i], (unsigned long)counter_snapshot[i]);
+  }
+#else
+  Serial.println("Profiling is compiled out (PROFILING_ENABLED is 0 in config.h)");
+#endif
+}
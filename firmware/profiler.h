@@ -0,0 +1,97 @@
+// ==================================================================
+// profiler.h
+// Declares cycle-counter instrumentation for ISRs and DSP stages
+// ==================================================================
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+//----------------------------------------
+// Profiler Configuration
+//----------------------------------------
+#define PROFILE_HISTOGRAM_BINS      32      // One bin per power of two of cycles
+
+typedef enum {
+  PROFILE_STAGE_ADC_ISR,                  // adc_buffer_full_interrupt(), end to end
+  PROFILE_STAGE_FRONTEND,                 // Mixer + decimation of one DMA buffer
+  PROFILE_STAGE_DEMODULATOR,              // Symbol detection/decisions on one buffer of baseband
+  PROFILE_STAGE_KEYBOARD_POLL,            // One scan_keyboard() pass (keys are acted on later, from loop())
+  PROFILE_STAGE_CHAT_REDRAW,              // display_chat_history()
+  PROFILE_STAGE_TYPING_REDRAW,            // redraw_typing_box()
+  PROFILE_STAGE_COUNT,
+} profile_stage_t;
+
+typedef enum {
+  PROFILE_COUNTER_DMA_OVERRUN,            // ADC buffers whose interrupt came too late to restart DMA in time
+  PROFILE_COUNTER_MISSED_KEYBOARD_SCAN,   // 1 kHz keyboard polls that never ran
+  PROFILE_COUNTER_TX_UNDERRUN,            // DAC samples written after their deadline had passed
+  PROFILE_COUNTER_COUNT,
+} profile_counter_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+  uint32_t histogram[PROFILE_HISTOGRAM_BINS];  // Bin b counts durations of 2^b .. 2^(b+1)-1 cycles
+} profile_stage_stats_t;
+
+#if PROFILING_ENABLED
+
+#include <Arduino.h>  // for ARM_DWT_CYCCNT
+
+void record_profile_stage(profile_stage_t stage, uint32_t cycles);
+
+void increment_profile_counter(profile_counter_t counter, uint32_t amount);
+
+void check_profile_period(profile_counter_t counter, uint32_t *last_cycles, uint32_t period_cycles,
+                          uint32_t tolerance_cycles);
+
+/**
+ * Times the enclosing scope with the DWT cycle counter and records it against a stage on exit.
+ */
+class ProfileScope {
+ public:
+  explicit ProfileScope(profile_stage_t stage) : stage_(stage), start_cycles_(ARM_DWT_CYCCNT) {}
+  ~ProfileScope() {
+    record_profile_stage(stage_, ARM_DWT_CYCCNT - start_cycles_);
+  }
+
+ private:
+  profile_stage_t stage_;
+  uint32_t start_cycles_;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// Times from here to the end of the enclosing scope:
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+
+// Counts one event when cond holds (cond is not evaluated at all when profiling is disabled):
+#define PROFILE_COUNT_IF(counter, cond) \
+  do { if (cond) increment_profile_counter((counter), 1); } while (0)
+
+// Counts the periods missed since the last time this line ran, if it is late by more than tolerance_cycles:
+#define PROFILE_CHECK_PERIOD(counter, period_cycles, tolerance_cycles) \
+  do { \
+    static uint32_t profile_last_cycles_ = 0; \
+    check_profile_period((counter), &profile_last_cycles_, (period_cycles), (tolerance_cycles)); \
+  } while (0)
+
+#else
+
+#define PROFILE_SCOPE(stage) do { } while (0)
+#define PROFILE_COUNT_IF(counter, cond) do { } while (0)
+#define PROFILE_CHECK_PERIOD(counter, period_cycles, tolerance_cycles) do { } while (0)
+
+#endif
+
+void reset_profile_stats();
+
+void print_profile_stats();
+
+#endif
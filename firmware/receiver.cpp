@@ -0,0 +1,447 @@
+// ==================================================================
+// receiver.cpp
+// Turns blocks of raw ADC samples into demodulated bits (no hardware access, so it also builds on a host)
+// ==================================================================
+#include <string.h>  // for memcpy
+
+#include "carrier_sense.h"
+#include "chirp.h"
+#include "doppler.h"
+#include "dpsk.h"
+#include "event_log.h"
+#include "frontend.h"
+#include "modem_profile.h"
+#include "profiler.h"
+#include "receiver.h"
+#include "sdft.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// Complex samples out of the front end for one block of RECEIVER_BLOCK_SAMPLES:
+#define RECEIVER_BASEBAND_SAMPLES   (RECEIVER_BLOCK_SAMPLES / FRONTEND_DECIMATION)
+static_assert(RECEIVER_BLOCK_SAMPLES % FRONTEND_CHUNK_SIZE == 0, "front end consumes whole chunks");
+
+// Mixer/decimator state, and its complex output for the block in progress:
+static frontend_state fe;
+static float baseband_i[RECEIVER_BASEBAND_SAMPLES];
+static float baseband_q[RECEIVER_BASEBAND_SAMPLES];
+
+// Profile the receiver is currently tuned to, and the baseband samples of the symbol in progress:
+static const modem_profile_t *rx_profile;
+static float symbol_i[MODEM_MAX_SYMBOL_SAMPLES];
+static float symbol_q[MODEM_MAX_SYMBOL_SAMPLES];
+static uint32_t symbol_fill = 0;
+
+// FSK symbol timing: a sliding DFT of both tones at every sample, whose symbol clock realigns the symbol
+// boundaries RECEIVER_TIMING_SYMBOLS symbols into each packet (counting down until then, 0 when done):
+static sdft_state tone_tracker;
+static uint32_t symbol_timing_countdown = 0;
+
+// Demodulators used instead of the symbol-synchronous tone detector when the profile is DBPSK/DQPSK or CSS:
+static dpsk_state dpsk;
+static chirp_state chirp;
+
+// Doppler tracking: the front end is retuned by doppler.applied_hz, and FSK symbol boundaries slip by
+// whole samples as the time-scale error (in samples) builds up in symbol_slip:
+static doppler_state doppler;
+static float symbol_slip = 0;
+static bool skip_next_sample = false;
+
+// A tone must beat the other by this power ratio before its bins are trusted for a Doppler measurement,
+// and only once this many symbols in a row have (noise alone clears the ratio about one time in six):
+static const float doppler_min_power_ratio = 10.0f;
+static const int doppler_min_clear_symbols = 4;
+static int clear_fsk_symbols = 0;
+
+// A symbol window that overlaps a neighbour of the other tone picks up its skirt and pulls the interpolated
+// offset towards it (by tens of Hz at fsk160 a few samples off), so only a symbol with the same tone on both
+// sides is measured: the last symbol's bins wait here until the one after it has been decided.
+static float previous_tone_re[MODEM_TONE_COUNT * MODEM_BINS_PER_TONE];
+static float previous_tone_im[MODEM_TONE_COUNT * MODEM_BINS_PER_TONE];
+static uint8_t recent_fsk_bits = 0;  // Last three decisions, newest in bit 0
+
+// DPSK decisions feed the Doppler tracker only once this many in a row have had an error vector below this
+// (a minute of noise alone still strings together runs of eight). Waiting for a trained equalizer instead
+// kept the tracker from pulling in an offset too large for the equalizer to train through:
+static const float doppler_max_dpsk_error = 0.5f;
+static const int doppler_min_clean_symbols = 16;
+static int clean_dpsk_symbols = 0;
+
+// Mean in-band power of the last block and the noise floor, for carrier sense and for timing arrivals:
+static carrier_sense_state channel_sense;
+
+// micros() at the first ADC sample of the block being demodulated, and the baseband sample in hand, so the
+// bit sink can timestamp what it receives:
+static uint32_t block_timestamp_us = 0;
+static size_t baseband_index = 0;
+
+// Leading-edge timing of each packet, for ranging: smoothed baseband power over the last
+// RECEIVER_ARRIVAL_HISTORY samples (indexed by baseband sample number since initialize_receiver()), where the
+// rise that set off the search was, and the last arrival found, with its mean power until now:
+typedef enum {
+  ARRIVAL_ARMED,               // Quiet: waiting for power to rise past RECEIVER_CARRIER_SENSE_RATIO x floor
+  ARRIVAL_SETTLING,            // Risen: waiting RECEIVER_ARRIVAL_SETTLE samples to measure the level reached
+  ARRIVAL_HELD,                // Timed: waiting for the power to fall back before looking again
+} arrival_mode_t;
+
+static float arrival_history[RECEIVER_ARRIVAL_HISTORY];
+static float smoothed_power = 0;
+static uint32_t baseband_sample_number = 0;
+static arrival_mode_t arrival_mode = ARRIVAL_ARMED;
+static uint32_t arrival_rise_number;
+static float arrival_floor;
+static uint32_t arrival_delay_us;        // RECEIVER_ARRIVAL_DELAY_US, plus the fade-in for shaped symbols
+static bool arrival_found = false;
+static uint32_t arrival_time_us;
+static float arrival_power_sum;
+static uint32_t arrival_power_samples;
+static uint32_t arrival_quiet_samples;
+
+// Where demodulated bits go:
+static void (*bit_sink)(int bit);
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Clears Doppler compensation and symbol alignment, e.g. after changing profile.
+ */
+static void reset_doppler_tracking() {
+  initialize_doppler(&doppler, rx_profile);
+  initialize_sdft_tones(&tone_tracker, rx_profile);
+  symbol_timing_countdown = 0;
+  symbol_fill = 0;
+  clear_fsk_symbols = 0;
+  recent_fsk_bits = 0;
+  clean_dpsk_symbols = 0;
+  symbol_slip = 0;
+  skip_next_sample = false;
+}
+
+/**
+ * Moves the front end (and the DPSK carrier estimate) to the compensation doppler.applied_hz now asks for.
+ */
+static void apply_doppler_compensation(float previous_applied_hz) {
+  log_event(EVENT_DOPPLER_RETUNE, event_float_arg(doppler.applied_hz));
+  retune_frontend(&fe, rx_profile->center_hz + doppler.applied_hz, MODEM_SAMPLE_RATE);
+  if (rx_profile->modulation != MODEM_MODULATION_FSK) {
+    retune_dpsk(&dpsk, doppler.applied_hz - previous_applied_hz, doppler_time_scale(&doppler));
+  }
+}
+
+/**
+ * Times the leading edge of each packet from the smoothed baseband power, for two-way ranging. Once the power
+ * has risen past the carrier sense threshold and had RECEIVER_ARRIVAL_SETTLE samples to level off, the edge
+ * is where it crossed halfway from the noise floor to that level, interpolated between samples: unlike the
+ * threshold crossing itself, this point doesn't move with the signal's strength. Then it waits for the power
+ * to stay down near the floor, so one packet is timed once.
+ */
+static void track_arrival(size_t i) {
+  const float power = baseband_i[i] * baseband_i[i] + baseband_q[i] * baseband_q[i];
+  smoothed_power += 0.5f * (power - smoothed_power);
+  const uint32_t n = baseband_sample_number++;
+  arrival_history[n % RECEIVER_ARRIVAL_HISTORY] = smoothed_power;
+  if (!channel_sense.measured) {
+    return;
+  }
+
+  switch (arrival_mode) {
+    case ARRIVAL_ARMED:
+      if (smoothed_power > RECEIVER_CARRIER_SENSE_RATIO * channel_sense.floor) {
+        arrival_mode = ARRIVAL_SETTLING;
+        arrival_rise_number = n;
+        arrival_floor = channel_sense.floor;
+      }
+      break;
+
+    case ARRIVAL_SETTLING: {
+      if (n - arrival_rise_number < RECEIVER_ARRIVAL_SETTLE) {
+        break;
+      }
+      float level = 0;
+      for (uint32_t k = n - RECEIVER_ARRIVAL_SETTLE / 2 + 1; k <= n; k++) {
+        level += arrival_history[k % RECEIVER_ARRIVAL_HISTORY];
+      }
+      level /= RECEIVER_ARRIVAL_SETTLE / 2;
+      if (level < RECEIVER_CARRIER_SENSE_RATIO * arrival_floor) {
+        // A burst of noise rather than a packet
+        arrival_mode = ARRIVAL_ARMED;
+        break;
+      }
+      // Finds the samples either side of the half-power point, starting from the rise:
+      const float half_level = arrival_floor + 0.5f * (level - arrival_floor);
+      const uint32_t oldest = n - RECEIVER_ARRIVAL_HISTORY + 1;
+      uint32_t k = arrival_rise_number;
+      if (arrival_history[k % RECEIVER_ARRIVAL_HISTORY] >= half_level) {
+        while (k > oldest + 1 && arrival_history[(k - 1) % RECEIVER_ARRIVAL_HISTORY] >= half_level) {
+          k--;
+        }
+      } else {
+        while (k < n && arrival_history[k % RECEIVER_ARRIVAL_HISTORY] < half_level) {
+          k++;
+        }
+      }
+      const float before = arrival_history[(k - 1) % RECEIVER_ARRIVAL_HISTORY];
+      const float after = arrival_history[k % RECEIVER_ARRIVAL_HISTORY];
+      const float fraction = (after > before) ? (half_level - before) / (after - before) : 0;
+      // Sample k - 1 + fraction, counted back from the one in hand (which was taken at get_receiver_sample_time_us()):
+      const float samples_ago = (float)(n - k) + 1 - fraction;
+      arrival_time_us = get_receiver_sample_time_us() -
+                        (uint32_t)(samples_ago * FRONTEND_DECIMATION * 1000000.0f / MODEM_SAMPLE_RATE + 0.5f) -
+                        arrival_delay_us;
+      arrival_found = true;
+      arrival_power_sum = 0;
+      arrival_power_samples = 0;
+      for (k = arrival_rise_number; k <= n; k++) {
+        arrival_power_sum += arrival_history[k % RECEIVER_ARRIVAL_HISTORY];
+        arrival_power_samples++;
+      }
+      arrival_quiet_samples = 0;
+      arrival_mode = ARRIVAL_HELD;
+      break;
+    }
+
+    case ARRIVAL_HELD:
+      // Quiet for a whole history's worth of samples, longer than the dip between shaped symbols:
+      if (smoothed_power >= RECEIVER_ARRIVAL_REARM_RATIO * arrival_floor) {
+        arrival_quiet_samples = 0;
+      } else if (++arrival_quiet_samples >= RECEIVER_ARRIVAL_HISTORY) {
+        arrival_mode = ARRIVAL_ARMED;
+        break;
+      }
+      arrival_power_sum += power;
+      arrival_power_samples++;
+      break;
+  }
+}
+
+/**
+ * Moves the FSK symbol boundaries to where the tone tracker's symbol clock puts them, unless it is too weak
+ * to trust: the symbol in progress restarts with the samples since the last boundary.
+ */
+static void align_fsk_symbols() {
+  float samples_ago = 0, strength = 0;
+  if (!get_sdft_symbol_end(&tone_tracker, &samples_ago, &strength) || strength < RECEIVER_TIMING_MIN_STRENGTH) {
+    log_event(EVENT_RX_SYMBOL_TIMING, symbol_fill, symbol_fill, event_float_arg(strength));
+    return;
+  }
+  uint32_t fill = (uint32_t)(samples_ago + 0.5f) % rx_profile->symbol_samples;
+  log_event(EVENT_RX_SYMBOL_TIMING, symbol_fill, fill, event_float_arg(strength));
+  copy_sdft_history(&tone_tracker, fill, symbol_i, symbol_q);
+  symbol_fill = fill;
+  skip_next_sample = false;
+}
+
+/**
+ * Demodulates one block's worth of baseband: for FSK, gathers baseband samples into symbols and runs
+ * the active profile's tone detector (windowed Goertzel) on each one, then decides the bit from whichever
+ * tone is stronger. Symbol boundaries are set early in each packet from a sliding DFT of the tones, which
+ * sees every alignment at once (see align_fsk_symbols()).
+ * DBPSK/DQPSK samples go to the DPSK demodulator and CSS samples to the dechirp/FFT demodulator; both
+ * find their own symbol timing.
+ * Both paths measure the residual carrier offset (FSK: interpolating between the stronger tone's
+ * neighbouring bins; PSK: from the tracked carrier rotation) and feed the Doppler tracker, which
+ * retunes the front end and stretches/compresses symbol timing to match.
+ */
+static void demodulate_baseband(size_t baseband_count) {
+  PROFILE_SCOPE(PROFILE_STAGE_DEMODULATOR);
+  for (size_t i = 0; i < baseband_count; i++) {
+    baseband_index = i;
+    const arrival_mode_t previous_arrival_mode = arrival_mode;
+    track_arrival(i);
+    if (rx_profile->modulation == MODEM_MODULATION_CSS) {
+      uint8_t bits[MODEM_CSS_BITS_PER_SYMBOL];
+      int bit_count = update_chirp(&chirp, baseband_i[i], baseband_q[i], bits);
+      for (int b = 0; b < bit_count; b++) {
+        bit_sink(bits[b]);
+      }
+      continue;
+    }
+    if (rx_profile->modulation != MODEM_MODULATION_FSK) {
+      uint8_t bits[2];
+      int bit_count = update_dpsk(&dpsk, baseband_i[i], baseband_q[i], bits);
+      for (int b = 0; b < bit_count; b++) {
+        bit_sink(bits[b]);
+      }
+      if (bit_count > 0) {
+        float previous_applied_hz = doppler.applied_hz;
+        clean_dpsk_symbols = (dpsk.last_error_magnitude < doppler_max_dpsk_error) ? clean_dpsk_symbols + 1 : 0;
+        bool retune = (clean_dpsk_symbols >= doppler_min_clean_symbols)
+                    ? update_doppler(&doppler, dpsk_frequency_offset(&dpsk))
+                    : miss_doppler(&doppler);
+        if (retune) {
+          apply_doppler_compensation(previous_applied_hz);
+        }
+      }
+      continue;
+    }
+
+    update_sdft(&tone_tracker, baseband_i[i], baseband_q[i]);
+    if (previous_arrival_mode == ARRIVAL_ARMED && arrival_mode == ARRIVAL_SETTLING) {
+      // Something is starting: time it from here, in case it turns out to be a packet
+      reset_sdft_timing(&tone_tracker);
+    } else if (previous_arrival_mode == ARRIVAL_SETTLING && arrival_mode == ARRIVAL_HELD) {
+      // It is a packet (RECEIVER_ARRIVAL_SETTLE samples in): its preamble sets the symbol timing
+      symbol_timing_countdown = RECEIVER_TIMING_SYMBOLS * rx_profile->symbol_samples - RECEIVER_ARRIVAL_SETTLE;
+    } else if (symbol_timing_countdown > 0 && --symbol_timing_countdown == 0) {
+      // This sample is already in the realigned symbol (or ended the one before, which is dropped: it is
+      // still preamble):
+      align_fsk_symbols();
+      continue;
+    }
+
+    if (skip_next_sample) {
+      // Received signal is stretched: this sample belongs to no symbol
+      skip_next_sample = false;
+      continue;
+    }
+    symbol_i[symbol_fill] = baseband_i[i];
+    symbol_q[symbol_fill] = baseband_q[i];
+    if (++symbol_fill < rx_profile->symbol_samples) {
+      continue;
+    }
+    symbol_fill = 0;
+
+    float y_re[MODEM_TONE_COUNT * MODEM_BINS_PER_TONE], y_im[MODEM_TONE_COUNT * MODEM_BINS_PER_TONE];
+    rx_profile->detect_tone_bins(symbol_i, symbol_q, y_re, y_im);
+    const int low = 1, high = MODEM_BINS_PER_TONE + 1;  // Center bin of each tone
+    float power_low = y_re[low] * y_re[low] + y_im[low] * y_im[low];
+    float power_high = y_re[high] * y_re[high] + y_im[high] * y_im[high];
+    log_event(EVENT_RX_FSK_SYMBOL, event_float_arg(power_low), event_float_arg(power_high));
+    bit_sink(power_high > power_low);
+
+    float previous_applied_hz = doppler.applied_hz;
+    bool retune;
+    bool clear = power_high > doppler_min_power_ratio * power_low || power_low > doppler_min_power_ratio * power_high;
+    clear_fsk_symbols = (clear) ? clear_fsk_symbols + 1 : 0;
+    recent_fsk_bits = ((recent_fsk_bits << 1) | (power_high > power_low)) & 0x07;
+    if (clear_fsk_symbols < doppler_min_clear_symbols || (recent_fsk_bits != 0x00 && recent_fsk_bits != 0x07)) {
+      retune = miss_doppler(&doppler);
+    } else {
+      // The last symbol, between two of its own tone
+      const int first_bin = (recent_fsk_bits & 1) ? high - 1 : low - 1;
+      retune = update_doppler(&doppler,
+                              interpolate_tone_offset(&doppler, &previous_tone_re[first_bin], &previous_tone_im[first_bin]));
+    }
+    memcpy(previous_tone_re, y_re, sizeof(previous_tone_re));
+    memcpy(previous_tone_im, y_im, sizeof(previous_tone_im));
+    if (retune) {
+      apply_doppler_compensation(previous_applied_hz);
+    }
+
+    // Compressed signal: the next symbol began one sample ago, so it starts with the last one we kept
+    symbol_slip += doppler_time_scale(&doppler) * rx_profile->symbol_samples;
+    if (symbol_slip >= 1) {
+      symbol_slip -= 1;
+      symbol_i[0] = symbol_i[rx_profile->symbol_samples - 1];
+      symbol_q[0] = symbol_q[rx_profile->symbol_samples - 1];
+      symbol_fill = 1;
+    } else if (symbol_slip <= -1) {
+      symbol_slip += 1;
+      skip_next_sample = true;
+    }
+  }
+}
+
+/**
+ * Takes one block's baseband power (the front end has already filtered it down to the profile's band) to the
+ * carrier sense noise floor tracker.
+ */
+static void measure_channel_power(size_t baseband_count) {
+  if (baseband_count == 0) {
+    return;
+  }
+  float power_i, power_q;
+  arm_power_f32(baseband_i, baseband_count, &power_i);
+  arm_power_f32(baseband_q, baseband_count, &power_q);
+  update_carrier_sense(&channel_sense, (power_i + power_q) / baseband_count);
+}
+
+/**
+ * Tunes the whole receive chain to profile and clears it: front end, demodulators, symbol alignment and
+ * Doppler compensation. Each demodulated bit is passed to sink as it is decided.
+ */
+void initialize_receiver(const modem_profile_t *profile, void (*sink)(int bit)) {
+  rx_profile = profile;
+  bit_sink = sink;
+  initialize_frontend(&fe, rx_profile->center_hz, MODEM_SAMPLE_RATE);
+  initialize_dpsk(&dpsk, rx_profile);
+  initialize_chirp(&chirp);
+  reset_doppler_tracking();
+  initialize_carrier_sense(&channel_sense);
+  smoothed_power = 0;
+  baseband_sample_number = 0;
+  arrival_mode = ARRIVAL_ARMED;
+  arrival_found = false;
+  // A raised-cosine fade-in reaches half power 0.64 of the way through:
+  arrival_delay_us = RECEIVER_ARRIVAL_DELAY_US +
+                     ((profile->tx.shape_symbol_edges) ? profile->tx.usec_per_symbol * 64 / (100 * MODEM_RAMP_FRACTION) : 0);
+}
+
+/**
+ * Runs count contiguous ADC samples (taken at MODEM_SAMPLE_RATE, a multiple of FRONTEND_CHUNK_SIZE, the first
+ * at micros() == timestamp_us) through the front end and demodulator, RECEIVER_BLOCK_SAMPLES at a time. The
+ * filters and symbol timing carry over between calls, so successive calls must continue the same stream.
+ */
+void process_receiver_samples(const uint16_t *samples, size_t count, uint32_t timestamp_us) {
+  while (count > 0) {
+    size_t block = (count < RECEIVER_BLOCK_SAMPLES) ? count : RECEIVER_BLOCK_SAMPLES;
+    // Mixes the band of interest to 0 Hz and decimates by 16:
+    size_t baseband_count;
+    {
+      PROFILE_SCOPE(PROFILE_STAGE_FRONTEND);
+      baseband_count = update_frontend(&fe, samples, block, baseband_i, baseband_q);
+    }
+    block_timestamp_us = timestamp_us;
+    measure_channel_power(baseband_count);
+    demodulate_baseband(baseband_count);
+    samples += block;
+    count -= block;
+    timestamp_us += (uint32_t)((uint64_t)block * 1000000 / MODEM_SAMPLE_RATE);
+  }
+}
+
+/**
+ * When (in micros()) the baseband sample being demodulated was taken at the ADC, for timestamping bits from
+ * inside the bit sink. Later than the sound's arrival by the front end and demodulator delay, which is the
+ * same for every packet of a profile.
+ */
+uint32_t get_receiver_sample_time_us() {
+  return block_timestamp_us +
+         (uint32_t)((uint64_t)baseband_index * FRONTEND_DECIMATION * 1000000 / MODEM_SAMPLE_RATE);
+}
+
+/**
+ * Reports the last block's in-band power and the current noise floor (both in baseband units squared).
+ */
+void get_receiver_channel_power(float *power, float *floor_power) {
+  *power = channel_sense.power;
+  *floor_power = channel_sense.floor;
+}
+
+/**
+ * Energy-detect carrier sense: whether the last block's in-band power stood RECEIVER_CARRIER_SENSE_RATIO
+ * above the noise floor. It reacts within a block (125 ms) of a signal arriving.
+ */
+bool receiver_channel_busy() {
+  return carrier_sense_busy(&channel_sense);
+}
+
+/**
+ * When (in micros()) the leading edge of the last packet heard reached the ADC, to within a fraction of a
+ * baseband sample, and its signal-to-noise power ratio since then (signal power over the noise floor it
+ * rose from). The time is corrected for the front end's delay, so it compares directly with when a
+ * transmission's first DAC sample went out. Returns false until a packet has been heard.
+ */
+bool get_receiver_arrival(uint32_t *arrival_us, float *snr) {
+  if (!arrival_found) {
+    return false;
+  }
+  *arrival_us = arrival_time_us;
+  const float power = (arrival_power_samples > 0) ? arrival_power_sum / arrival_power_samples : 0;
+  *snr = (arrival_floor > 0 && power > arrival_floor) ? (power - arrival_floor) / arrival_floor : 0;
+  return true;
+}
@@ -0,0 +1,39 @@
+// ==================================================================
+// receiver.h
+// Declares the receive chain from raw ADC samples to demodulated bits
+// ==================================================================
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "modem_profile.h"
+
+//----------------------------------------
+// Receiver Configuration
+//----------------------------------------
+#define RECEIVER_BLOCK_SAMPLES      10240   // ADC samples per DMA buffer (125 ms at MODEM_SAMPLE_RATE)
+#define RECEIVER_CARRIER_SENSE_RATIO 4.0f   // In-band power over the noise floor (6 dB) that means the channel is busy
+#define RECEIVER_NOISE_FLOOR_RISE   1.01f   // Per block the floor may creep up when no quieter block comes along
+#define RECEIVER_NOISE_FLOOR_HOLD   1200    // Busy blocks the floor holds through (150 s; the longest fsk40 message: 132 s)
+#define RECEIVER_ARRIVAL_HISTORY    32      // Baseband power samples (6.25 ms) kept for finding a packet's leading edge
+#define RECEIVER_ARRIVAL_SETTLE     16      // Samples after the power first rises that its level is measured over
+#define RECEIVER_ARRIVAL_REARM_RATIO 2.0f   // Power over the floor it must fall below before the next arrival is timed
+#define RECEIVER_ARRIVAL_DELAY_US   1560    // Front end and smoothing delay to the edge's half-power point (unshaped)
+#define RECEIVER_TIMING_SYMBOLS     6       // FSK: preamble symbols the symbol clock measures before realigning
+#define RECEIVER_TIMING_MIN_STRENGTH 0.15f  // Symbol clock strength (see get_sdft_symbol_end()) worth realigning to
+
+void initialize_receiver(const modem_profile_t *profile, void (*sink)(int bit));
+
+void process_receiver_samples(const uint16_t *samples, size_t count, uint32_t timestamp_us);
+
+uint32_t get_receiver_sample_time_us();
+
+void get_receiver_channel_power(float *power, float *floor_power);
+
+bool receiver_channel_busy();
+
+bool get_receiver_arrival(uint32_t *arrival_us, float *snr);
+
+#endif
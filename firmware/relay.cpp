@@ -0,0 +1,129 @@
+// ==================================================================
+// relay.cpp
+// Forwards text frames for divers out of each other's range, suppressing duplicates (no hardware access)
+// ==================================================================
+#include <string.h>  // for memcpy, memset
+
+#include "event_log.h"
+#include "relay.h"
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static uint32_t next_relay_random(relay_state *relay) {
+  uint32_t x = relay->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  relay->random_state = x;
+  return x;
+}
+
+/**
+ * Starts with relaying off (duplicate suppression still runs) and nothing seen or queued.
+ */
+void initialize_relay(relay_state *relay, uint8_t address, uint32_t seed) {
+  memset(relay, 0, sizeof(*relay));
+  relay->address = address;
+  relay->random_state = (seed != 0) ? seed : 0x6C078965u;
+}
+
+/**
+ * Whether this node would forward a frame it isn't the destination of: relaying is on, it is text (or a
+ * fragment of it) from another node, and it may still pass through another relay. Safe to call from the
+ * receive interrupt, to keep frames the MAC would filter.
+ */
+bool wants_relay_frame(const relay_state *relay, const mac_header_t *header) {
+  return relay->enabled && (header->type == MAC_FRAME_TEXT || header->type == MAC_FRAME_TEXT_FRAGMENT) &&
+         header->ttl > 0 && header->source != relay->address && header->destination != relay->address;
+}
+
+/**
+ * Whether a frame from the same source with the same sequence number has been noted (see note_relay_frame()).
+ */
+bool relay_frame_seen(const relay_state *relay, const mac_header_t *header) {
+  for (int i = 0; i < RELAY_SEEN_ENTRIES; i++) {
+    const relay_seen_t *seen = &relay->seen[i];
+    if (seen->valid && seen->source == header->source && seen->sequence == header->sequence) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Records a received text frame as seen. Returns false for a copy of one seen recently (heard directly and
+ * again through a relay, or from two relays), which also cancels this node's own pending forward of it:
+ * another relay has already covered the area. The forward is cancelled whether it is still waiting out its
+ * delay here or already in mac's queue (see cancel_mac_frame()), so call with interrupts off, as for the
+ * MAC's other calls.
+ */
+bool note_relay_frame(relay_state *relay, const mac_header_t *header, mac_state *mac) {
+  if (relay_frame_seen(relay, header)) {
+    relay->duplicates_dropped++;
+    log_event(EVENT_RELAY_DUPLICATE, header->source, header->sequence);
+    bool cancelled = cancel_mac_frame(mac, header->source, header->sequence);
+    for (int k = 0; k < relay->queue_count && !cancelled; k++) {
+      const mac_header_t *pending = &relay->queue[k].frame.header;
+      if (pending->source == header->source && pending->sequence == header->sequence) {
+        relay->queue[k] = relay->queue[--relay->queue_count];
+        cancelled = true;
+      }
+    }
+    if (cancelled) {
+      relay->forwards_cancelled++;
+      log_event(EVENT_RELAY_CANCELLED, header->source, header->sequence);
+    }
+    return false;
+  }
+
+  relay_seen_t *seen = &relay->seen[relay->seen_next];
+  seen->source = header->source;
+  seen->sequence = header->sequence;
+  seen->valid = true;
+  relay->seen_next = (relay->seen_next + 1) % RELAY_SEEN_ENTRIES;
+  return true;
+}
+
+/**
+ * Holds a newly seen (whole) text message for forwarding, if wants_relay_frame(), with one hop more and one
+ * less to go.
+ * It waits RELAY_MIN_DELAY_MS plus a random jitter, so relays that heard the same frame spread out and
+ * usually hear each other (see note_relay_frame()) instead of colliding. Dropped if the queue is full.
+ */
+void offer_relay_frame(relay_state *relay, const mac_header_t *header, const char *payload, uint32_t now_ms) {
+  if (!wants_relay_frame(relay, header)) {
+    return;
+  }
+  if (relay->queue_count >= RELAY_QUEUE_LENGTH) {
+    relay->frames_rejected++;
+    log_event(EVENT_RELAY_QUEUE_FULL, header->source, header->sequence);
+    return;
+  }
+  relay_pending_t *pending = &relay->queue[relay->queue_count++];
+  pending->frame.header = *header;
+  pending->frame.header.hops++;
+  pending->frame.header.ttl--;
+  size_t length = (header->length < MAX_TEXT_LENGTH) ? header->length : MAX_TEXT_LENGTH - 1;
+  memcpy(pending->frame.text, payload, length);
+  pending->frame.text[length] = '\0';
+  pending->due_ms = now_ms + RELAY_MIN_DELAY_MS + next_relay_random(relay) % RELAY_JITTER_MS;
+  log_event(EVENT_RELAY_QUEUED, header->source, header->sequence, pending->frame.header.hops);
+}
+
+/**
+ * Moves a frame whose delay is up into frame, for the MAC to send (see forward_mac_frame()). Returns
+ * false when none is due.
+ */
+bool take_relay_frame(relay_state *relay, uint32_t now_ms, mac_frame_t *frame) {
+  for (int i = 0; i < relay->queue_count; i++) {
+    if ((int32_t)(now_ms - relay->queue[i].due_ms) >= 0) {
+      *frame = relay->queue[i].frame;
+      relay->queue[i] = relay->queue[--relay->queue_count];
+      relay->frames_forwarded++;
+      return true;
+    }
+  }
+  return false;
+}
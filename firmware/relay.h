@@ -0,0 +1,61 @@
+// ==================================================================
+// relay.h
+// Declares store-and-forward relaying of text frames through intermediate divers
+// ==================================================================
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+
+#include "mac.h"
+
+//----------------------------------------
+// Relay Configuration
+//----------------------------------------
+#define RELAY_SEEN_ENTRIES          32      // (source, sequence) pairs remembered for duplicate suppression
+#define RELAY_QUEUE_LENGTH          4       // Frames waiting out their forwarding delay
+#define RELAY_MIN_DELAY_MS          500     // Forwarding waits at least this long after the frame ends...
+#define RELAY_JITTER_MS             4000    // ...plus a random share of this, so relays rarely collide
+
+typedef struct {
+  uint8_t source;
+  uint8_t sequence;
+  bool valid;
+} relay_seen_t;
+
+typedef struct {
+  mac_frame_t frame;
+  uint32_t due_ms;
+} relay_pending_t;
+
+typedef struct {
+  bool enabled;                // Forwards frames for others; duplicate suppression runs either way
+  uint8_t address;
+  uint32_t random_state;       // xorshift32, never 0
+
+  relay_seen_t seen[RELAY_SEEN_ENTRIES];
+  int seen_next;               // Oldest entry, overwritten next
+
+  relay_pending_t queue[RELAY_QUEUE_LENGTH];
+  int queue_count;
+
+  // Counters for the console:
+  uint32_t frames_forwarded;
+  uint32_t duplicates_dropped;
+  uint32_t forwards_cancelled; // Another relay got there first
+  uint32_t frames_rejected;    // Queue was full
+} relay_state;
+
+void initialize_relay(relay_state *relay, uint8_t address, uint32_t seed);
+
+bool wants_relay_frame(const relay_state *relay, const mac_header_t *header);
+
+bool relay_frame_seen(const relay_state *relay, const mac_header_t *header);
+
+bool note_relay_frame(relay_state *relay, const mac_header_t *header, mac_state *mac);
+
+void offer_relay_frame(relay_state *relay, const mac_header_t *header, const char *payload, uint32_t now_ms);
+
+bool take_relay_frame(relay_state *relay, uint32_t now_ms, mac_frame_t *frame);
+
+#endif
@@ -0,0 +1,174 @@
+// ==================================================================
+// sdft.cpp
+// Modulated sliding DFT: O(1) per sample per bin, with a symbol clock for FSK timing recovery
+// ==================================================================
+#include <math.h>    // for atan2f, cos, fabsf, sin, sqrtf
+
+#include "sdft.h"
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Prepares a tracker for bin_count bins (signed bin indices, e.g. -2 for two bins below center) of an
+ * N = window_samples point DFT, with an empty window and no symbol clock.
+ */
+void initialize_sdft(sdft_state *s, uint32_t window_samples, const int32_t *bins, uint32_t bin_count) {
+  const int32_t n = (int32_t)window_samples;
+  s->window_samples = window_samples;
+  s->bin_count = (bin_count < SDFT_MAX_BINS) ? bin_count : SDFT_MAX_BINS;
+  for (uint32_t b = 0; b < s->bin_count; b++) {
+    s->bin[b] = (uint32_t)(((bins[b] % n) + n) % n);
+    s->phase[b] = 0;
+    s->sum_re[b] = s->sum_im[b] = 0;
+    s->fresh_re[b] = s->fresh_im[b] = 0;
+  }
+  for (uint32_t m = 0; m < window_samples; m++) {
+    const double w = 2 * M_PI * m / window_samples;
+    s->twiddle_re[m] = (float)cos(w);
+    s->twiddle_im[m] = (float)-sin(w);
+    s->history_i[m] = s->history_q[m] = 0;
+  }
+  s->position = 0;
+  reset_sdft_timing(s);
+}
+
+/**
+ * Tracks the tones of a profile (bin 0 is tone 0, bin 1 tone 1) over a one-symbol window. Tones sit on
+ * whole bins of that window (see ModemProfile), so their bin indices are exact.
+ */
+void initialize_sdft_tones(sdft_state *s, const modem_profile_t *profile) {
+  int32_t bins[SDFT_MAX_BINS];
+  for (uint32_t k = 0; k < profile->tone_count && k < SDFT_MAX_BINS; k++) {
+    bins[k] = ((int32_t)profile->tone_hz[k] - (int32_t)profile->center_hz) * (int32_t)profile->symbol_samples /
+              MODEM_BASEBAND_RATE;
+  }
+  initialize_sdft(s, profile->symbol_samples, bins, profile->tone_count);
+}
+
+/**
+ * Takes one baseband sample. Each bin's running sum gains the new sample and loses the one leaving the
+ * window, both modulated by the same twiddle (x(n - N) was modulated by W^-k(n-N) = W^-kn), so a bin costs
+ * two complex multiply-adds however long the window: one for the running sum and one for the fresh sum
+ * rebuilt beside it. The sums are kept unrotated (the modulated SDFT); get_sdft_bin() rotates on demand.
+ */
+void update_sdft(sdft_state *s, float x_i, float x_q) {
+  const uint32_t n = s->window_samples;
+  const uint32_t position = s->position;
+  const float d_i = x_i - s->history_i[position];
+  const float d_q = x_q - s->history_q[position];
+  s->history_i[position] = x_i;
+  s->history_q[position] = x_q;
+
+  float power[SDFT_MAX_BINS];
+  for (uint32_t b = 0; b < s->bin_count; b++) {
+    const float w_re = s->twiddle_re[s->phase[b]], w_im = s->twiddle_im[s->phase[b]];
+    s->sum_re[b] += d_i * w_re - d_q * w_im;
+    s->sum_im[b] += d_i * w_im + d_q * w_re;
+    s->fresh_re[b] += x_i * w_re - x_q * w_im;
+    s->fresh_im[b] += x_i * w_im + x_q * w_re;
+    s->phase[b] += s->bin[b];
+    if (s->phase[b] >= n) {
+      s->phase[b] -= n;
+    }
+    power[b] = s->sum_re[b] * s->sum_re[b] + s->sum_im[b] * s->sum_im[b];
+  }
+
+  // The window now ends at sample n == position (mod N); the contrast between the tones peaks when it
+  // holds exactly one symbol and falls to nothing halfway between:
+  if (s->clock_wait > 0) {
+    s->clock_wait--;
+  } else if (s->bin_count >= 2) {
+    const float contrast = fabsf(power[1] - power[0]) / ((float)n * n);
+    s->clock_re += contrast * s->twiddle_re[position];
+    s->clock_im += contrast * s->twiddle_im[position];
+    s->clock_dc += contrast;
+    s->clock_samples++;
+  }
+
+  if (++s->position == n) {
+    s->position = 0;
+    for (uint32_t b = 0; b < s->bin_count; b++) {
+      s->sum_re[b] = s->fresh_re[b];
+      s->sum_im[b] = s->fresh_im[b];
+      s->fresh_re[b] = s->fresh_im[b] = 0;
+      s->phase[b] = 0;
+    }
+  }
+}
+
+/**
+ * Bin b's DFT of the last N samples, as if the window started at time 0, scaled like the Goertzel
+ * detector's output (divided by N): a tone of amplitude A on the bin gives magnitude A.
+ */
+void get_sdft_bin(const sdft_state *s, uint32_t b, float *re, float *im) {
+  // The window starts at sample n - N + 1, whose modulation phase is k * position:
+  const uint32_t m = (uint32_t)(((uint64_t)s->bin[b] * s->position) % s->window_samples);
+  const float w_re = s->twiddle_re[m], w_im = -s->twiddle_im[m];
+  *re = (s->sum_re[b] * w_re - s->sum_im[b] * w_im) / s->window_samples;
+  *im = (s->sum_re[b] * w_im + s->sum_im[b] * w_re) / s->window_samples;
+}
+
+/**
+ * |get_sdft_bin()|^2, which needs no rotation.
+ */
+float sdft_bin_power(const sdft_state *s, uint32_t b) {
+  const float scale = 1.0f / ((float)s->window_samples * s->window_samples);
+  return (s->sum_re[b] * s->sum_re[b] + s->sum_im[b] * s->sum_im[b]) * scale;
+}
+
+/**
+ * Starts the symbol clock afresh, e.g. when a packet starts arriving. The clock waits for the window to
+ * refill first: contrast from a window straddling the reset (noise, then the first symbol) only ramps up,
+ * and would pull the peak late.
+ */
+void reset_sdft_timing(sdft_state *s) {
+  s->clock_re = s->clock_im = 0;
+  s->clock_dc = 0;
+  s->clock_samples = 0;
+  s->clock_wait = s->window_samples - 1;
+}
+
+/**
+ * Where the symbol clock puts the end of the last whole symbol: *samples_ago (0 .. N, fractional) before the
+ * newest sample, and *strength, its symbol-rate component relative to the mean contrast (about 0.4 for a
+ * clean alternating preamble, falling towards 0 for noise or long runs of one tone). Returns false before
+ * a symbol's worth of samples has been measured.
+ */
+bool get_sdft_symbol_end(const sdft_state *s, float *samples_ago, float *strength) {
+  if (s->clock_samples < s->window_samples) {
+    return false;
+  }
+  // The clock accumulated contrast(n) * e^(-j 2 pi n / N), so its angle is -2 pi (peak position) / N:
+  const float n = (float)s->window_samples;
+  float peak = -atan2f(s->clock_im, s->clock_re) * n / (2 * (float)M_PI);
+  const float newest = (s->position == 0) ? n - 1 : (float)(s->position - 1);
+  float ago = newest - peak;
+  while (ago < 0) {
+    ago += n;
+  }
+  while (ago >= n) {
+    ago -= n;
+  }
+  *samples_ago = ago;
+
+  *strength = (s->clock_dc > 0) ? sqrtf(s->clock_re * s->clock_re + s->clock_im * s->clock_im) / s->clock_dc : 0;
+  return true;
+}
+
+/**
+ * Copies the newest count samples (count <= N), oldest first, e.g. to restart a symbol buffer on a new
+ * boundary.
+ */
+void copy_sdft_history(const sdft_state *s, uint32_t count, float *x_i, float *x_q) {
+  const uint32_t n = s->window_samples;
+  uint32_t m = (s->position + n - count) % n;
+  for (uint32_t j = 0; j < count; j++) {
+    x_i[j] = s->history_i[m];
+    x_q[j] = s->history_q[m];
+    if (++m == n) {
+      m = 0;
+    }
+  }
+}
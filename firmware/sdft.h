@@ -0,0 +1,60 @@
+// ==================================================================
+// sdft.h
+// Defines the sliding DFT tone tracker: a fresh DFT output for each tone at every baseband sample
+// ==================================================================
+#ifndef SDFT_H
+#define SDFT_H
+
+#include <stdint.h>
+
+#include "modem_profile.h"
+
+#define SDFT_MAX_BINS               MODEM_TONE_COUNT
+
+typedef struct {
+  uint32_t window_samples;     // N: the DFT spans the last N samples (one symbol)
+  uint32_t bin_count;
+  uint32_t bin[SDFT_MAX_BINS]; // Bin index k of each tracked bin, mod N (tone offset from center / bin spacing)
+
+  // e^(-j 2 pi m / N) for m = 0 .. N-1. Bin k's modulation sequence steps k entries per sample, and the
+  // same entries come round every N samples, so unlike a rotating recursion there is no twiddle to drift:
+  float twiddle_re[MODEM_MAX_SYMBOL_SAMPLES];
+  float twiddle_im[MODEM_MAX_SYMBOL_SAMPLES];
+
+  // The last N samples (ring; position is the oldest, next to be replaced, and n mod N for sample n):
+  float history_i[MODEM_MAX_SYMBOL_SAMPLES];
+  float history_q[MODEM_MAX_SYMBOL_SAMPLES];
+  uint32_t position;
+  uint32_t phase[SDFT_MAX_BINS];  // k * position mod N, kept by adding k each sample
+
+  // Running sums of the modulated input over the window, and the same sums rebuilt from nothing over the
+  // window in progress, which replace them each time position wraps so rounding never builds up:
+  float sum_re[SDFT_MAX_BINS], sum_im[SDFT_MAX_BINS];
+  float fresh_re[SDFT_MAX_BINS], fresh_im[SDFT_MAX_BINS];
+
+  // Symbol clock (two-tone FSK): the symbol-rate component of |power(bin 0) - power(bin 1)|, which peaks
+  // whenever the window lines up with a symbol, accumulated since reset_sdft_timing(), and the plain sum
+  // of the contrast (its DC term) to compare it with:
+  float clock_re, clock_im;
+  float clock_dc;
+  uint32_t clock_samples;
+  uint32_t clock_wait;         // Samples until the window holds only samples taken since the reset
+} sdft_state;
+
+void initialize_sdft(sdft_state *s, uint32_t window_samples, const int32_t *bins, uint32_t bin_count);
+
+void initialize_sdft_tones(sdft_state *s, const modem_profile_t *profile);
+
+void update_sdft(sdft_state *s, float x_i, float x_q);
+
+void get_sdft_bin(const sdft_state *s, uint32_t b, float *re, float *im);
+
+float sdft_bin_power(const sdft_state *s, uint32_t b);
+
+void reset_sdft_timing(sdft_state *s);
+
+bool get_sdft_symbol_end(const sdft_state *s, float *samples_ago, float *strength);
+
+void copy_sdft_history(const sdft_state *s, uint32_t count, float *x_i, float *x_q);
+
+#endif
@@ -0,0 +1,42 @@
+// ==================================================================
+// serial_frame.cpp
+// Wraps binary payloads in checksummed frames on the USB serial port
+// ==================================================================
+#include <Arduino.h>
+
+#include "serial_frame.h"
+
+/**
+ * Largest payload that can be written right now without blocking, or 0 with no host listening.
+ */
+size_t serial_frame_space() {
+  if (!Serial) {
+    return 0;
+  }
+  int available = Serial.availableForWrite();
+  return (available > SERIAL_FRAME_OVERHEAD) ? available - SERIAL_FRAME_OVERHEAD : 0;
+}
+
+/**
+ * Sends one frame. Call only from loop(): it may block while the USB buffer drains.
+ */
+void write_serial_frame(serial_frame_type_t type, const void *payload, uint16_t length) {
+  uint8_t header[5] = {SERIAL_FRAME_SYNC_0, SERIAL_FRAME_SYNC_1, (uint8_t)type, (uint8_t)length, (uint8_t)(length >> 8)};
+
+  // Fletcher-16 over everything after the sync bytes:
+  uint32_t sum1 = 0, sum2 = 0;
+  for (int i = 2; i < 5; i++) {
+    sum1 = (sum1 + header[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  const uint8_t *bytes = (const uint8_t *)payload;
+  for (uint16_t i = 0; i < length; i++) {
+    sum1 = (sum1 + bytes[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  uint8_t checksum[2] = {(uint8_t)sum1, (uint8_t)sum2};
+
+  Serial.write(header, sizeof(header));
+  Serial.write(bytes, length);
+  Serial.write(checksum, sizeof(checksum));
+}
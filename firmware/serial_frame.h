@@ -0,0 +1,30 @@
+// ==================================================================
+// serial_frame.h
+// Defines the binary framing used for data sent to a host over USB serial
+// ==================================================================
+#ifndef SERIAL_FRAME_H
+#define SERIAL_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//----------------------------------------
+// Frame Layout
+//----------------------------------------
+// sync (2) | type (1) | payload length (2, little-endian) | payload | Fletcher-16 of type..payload (2)
+// Frames share the port with plain-text output; host tools skip anything that doesn't check out.
+#define SERIAL_FRAME_SYNC_0         0xA5
+#define SERIAL_FRAME_SYNC_1         0x5A
+#define SERIAL_FRAME_OVERHEAD       7
+#define SERIAL_FRAME_MAX_PAYLOAD    1024
+
+typedef enum {
+  SERIAL_FRAME_EVENT_LOG = 1,             // Batch of event_record_t (see event_log.h)
+  SERIAL_FRAME_ADC_CAPTURE = 2,           // capture_chunk_header_t and packed raw ADC samples (see capture.h)
+} serial_frame_type_t;
+
+size_t serial_frame_space();
+
+void write_serial_frame(serial_frame_type_t type, const void *payload, uint16_t length);
+
+#endif
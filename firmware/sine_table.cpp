@@ -0,0 +1,11 @@
+// ==================================================================
+// sine_table.cpp
+// Instantiates the compile-time sine lookup table
+// ==================================================================
+#include "sine_table.h"
+
+extern constexpr sine_table_t sine_table = make_sine_table();
+
+static_assert(sine_table.values[0] == 0, "sine table starts at zero phase");
+static_assert(sine_table.values[SINE_TABLE_QUARTER] == SINE_TABLE_AMPLITUDE, "sine table peaks at a quarter cycle");
+static_assert(sine_table.values[3 * SINE_TABLE_QUARTER] == -SINE_TABLE_AMPLITUDE, "sine table is symmetric");
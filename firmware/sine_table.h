@@ -0,0 +1,69 @@
+// ==================================================================
+// sine_table.h
+// Compile-time sine lookup table shared by the NCO and DDS
+// ==================================================================
+#ifndef SINE_TABLE_H
+#define SINE_TABLE_H
+
+#include <stdint.h>
+
+//----------------------------------------
+// Table Configuration
+//----------------------------------------
+#define SINE_TABLE_BITS             10      // Table has 2^bits entries over one full cycle
+#define SINE_TABLE_SIZE             (1 << SINE_TABLE_BITS)
+#define SINE_TABLE_MASK             (SINE_TABLE_SIZE - 1)
+#define SINE_TABLE_QUARTER          (SINE_TABLE_SIZE / 4)
+#define SINE_TABLE_AMPLITUDE        32767   // Q15 full scale
+
+/**
+ * Sine for constant expressions: folds x into [-pi/2, pi/2] and sums the Taylor series there,
+ * which is accurate to well under one Q15 LSB.
+ */
+constexpr double constexpr_sin(double x) {
+  const double pi = 3.14159265358979323846;
+  while (x > pi) x -= 2 * pi;
+  while (x < -pi) x += 2 * pi;
+  if (x > pi / 2) x = pi - x;
+  if (x < -pi / 2) x = -pi - x;
+  double term = x;
+  double sum = x;
+  for (int k = 1; k < 10; k++) {
+    term *= -x * x / ((2 * k) * (2 * k + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double constexpr_cos(double x) {
+  return constexpr_sin(x + 3.14159265358979323846 / 2);
+}
+
+typedef struct {
+  int16_t values[SINE_TABLE_SIZE];
+} sine_table_t;
+
+constexpr sine_table_t make_sine_table() {
+  sine_table_t table = {};
+  for (int i = 0; i < SINE_TABLE_SIZE; i++) {
+    double v = SINE_TABLE_AMPLITUDE * constexpr_sin(2 * 3.14159265358979323846 * i / SINE_TABLE_SIZE);
+    table.values[i] = (int16_t)(v < 0 ? v - 0.5 : v + 0.5);
+  }
+  return table;
+}
+
+// One Q15 cycle, built at compile time and stored in flash (see sine_table.cpp):
+extern const sine_table_t sine_table;
+
+/**
+ * Looks up sin() for the top SINE_TABLE_BITS of a 32-bit phase (2^32 == 2π).
+ */
+inline int16_t sine_lookup(uint32_t phase) {
+  return sine_table.values[phase >> (32 - SINE_TABLE_BITS)];
+}
+
+inline int16_t cosine_lookup(uint32_t phase) {
+  return sine_lookup(phase + (1UL << 30));
+}
+
+#endif
@@ -0,0 +1,420 @@
+// ==================================================================
+// tdma.cpp
+// Beacon-synchronized TDMA: a station hands out slots, nodes follow its clock (no hardware access)
+// ==================================================================
+#include <string.h>  // for memcpy, memset
+
+#include "event_log.h"
+#include "modem_profile.h"
+#include "tdma.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// A cycle (the beacon's uint16_t fields) never runs past this; nodes that don't fit wait for the next one:
+static const uint32_t max_cycle_ms = 60000;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static uint32_t next_tdma_random(tdma_state *t) {
+  uint32_t x = t->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  t->random_state = x;
+  return x;
+}
+
+static uint32_t control_airtime_ms(const tdma_state *t, size_t payload_length) {
+  return modem_packet_airtime_ms(t->tx, MAC_PACKET_OVERHEAD + payload_length);
+}
+
+/**
+ * Fletcher-16 of a beacon or request as sent: the MAC header and the payload's first length bytes, with the
+ * payload's checksum field (at checksum_offset) taken as 0 (the same sum fragment.cpp uses).
+ */
+static uint16_t tdma_checksum(const mac_header_t *header, const void *payload, size_t length,
+                              size_t checksum_offset) {
+  uint32_t sum1 = 0, sum2 = 0;
+  const uint8_t *parts[2] = {(const uint8_t *)header, (const uint8_t *)payload};
+  const size_t lengths[2] = {sizeof(*header), length};
+  for (int p = 0; p < 2; p++) {
+    for (size_t i = 0; i < lengths[p]; i++) {
+      const bool checksum_byte = p == 1 && i >= checksum_offset && i < checksum_offset + sizeof(uint16_t);
+      sum1 = (sum1 + ((checksum_byte) ? 0 : parts[p][i])) % 255;
+      sum2 = (sum2 + sum1) % 255;
+    }
+  }
+  return sum1 | (sum2 << 8);
+}
+
+/**
+ * Writes the checksum of the control frame's payload (see tdma_checksum()) into it, once the rest is in.
+ */
+static void seal_tdma_control(mac_frame_t *control, size_t checksum_offset) {
+  const uint16_t checksum = tdma_checksum(&control->header, control->text, control->header.length, checksum_offset);
+  memcpy(control->text + checksum_offset, &checksum, sizeof(checksum));
+}
+
+/**
+ * Whether the payload of a received beacon or request (length bytes of it) checks out.
+ */
+static bool tdma_payload_intact(const mac_header_t *header, const void *payload, size_t length,
+                                size_t checksum_offset) {
+  uint16_t checksum;
+  memcpy(&checksum, (const uint8_t *)payload + checksum_offset, sizeof(checksum));
+  return tdma_checksum(header, payload, length, checksum_offset) == checksum;
+}
+
+/**
+ * Whether a received beacon or request is whole and passes its checksum, so its MAC header (which has no
+ * checksum of its own) can be believed too.
+ */
+bool tdma_frame_intact(const mac_header_t *header, const void *payload) {
+  if (header->type == MAC_FRAME_TDMA_BEACON) {
+    tdma_beacon_t beacon;
+    if (header->length < sizeof(beacon)) {
+      return false;
+    }
+    memcpy(&beacon, payload, sizeof(beacon));
+    const size_t length = sizeof(beacon) + beacon.slot_count * sizeof(tdma_slot_t);
+    return header->length >= length && tdma_payload_intact(header, payload, length, offsetof(tdma_beacon_t, checksum));
+  }
+  return header->type == MAC_FRAME_TDMA_REQUEST && header->length >= sizeof(tdma_request_t) &&
+         tdma_payload_intact(header, payload, sizeof(tdma_request_t), offsetof(tdma_request_t, checksum));
+}
+
+/**
+ * Whether a time (ms, either clock) has been reached, allowing for wraparound.
+ */
+static inline bool reached(uint32_t now, uint32_t time) {
+  return (int32_t)(now - time) >= 0;
+}
+
+/**
+ * Starts a node that follows whatever station it hears (see set_tdma_station() for running one).
+ */
+void initialize_tdma(tdma_state *t, uint8_t address, const tx_parameters_t *tx, uint32_t seed) {
+  memset(t, 0, sizeof(*t));
+  t->address = address;
+  t->tx = tx;
+  t->random_state = (seed != 0) ? seed : 0x2545F491u;
+}
+
+/**
+ * Makes this unit the station (sending its first beacon at now_ms), or goes back to following one.
+ */
+void set_tdma_station(tdma_state *t, bool station, uint32_t now_ms) {
+  t->station = station;
+  t->synced = station;
+  t->node_count = 0;
+  t->clock_offset_ms = 0;
+  t->range_ms = 0;
+  t->station_address = t->address;
+  t->next_beacon_ms = now_ms;
+  t->slot_length_ms = 0;
+}
+
+/**
+ * Guard time between slots. Slots are timed to arrive back to back at the station, so a diver hears two
+ * neighbouring slots misaligned by up to twice its own range; the longest range covers everyone.
+ */
+uint32_t tdma_guard_ms(const tdma_state *t) {
+  uint32_t max_range_ms = t->range_ms;
+  for (int i = 0; i < t->node_count; i++) {
+    if (t->nodes[i].range_ms > max_range_ms) {
+      max_range_ms = t->nodes[i].range_ms;
+    }
+  }
+  return 2 * max_range_ms + TDMA_SYNC_MARGIN_MS;
+}
+
+/**
+ * Station: drops nodes not heard from lately, then lays out the next cycle: the beacon, a slot for each node
+ * with queued airtime (its last request's demand, plus room for the request it opens the slot with) and one
+ * for the station's own queue, guard times between them, and the request minislots at the end (filling
+ * whatever a short cycle has spare). Writes the beacon into control, or returns false if even a cycle with
+ * no slots wouldn't fit the beacon's fields.
+ */
+static bool build_tdma_beacon(tdma_state *t, uint32_t now_ms, uint32_t demand_ms, mac_frame_t *control) {
+  t->cycle++;
+  for (int i = 0; i < t->node_count;) {
+    if ((uint8_t)(t->cycle - t->nodes[i].last_heard_cycle) > TDMA_NODE_TIMEOUT_CYCLES) {
+      t->nodes[i] = t->nodes[--t->node_count];
+    } else {
+      i++;
+    }
+  }
+
+  const uint32_t guard_ms = tdma_guard_ms(t);
+  const uint32_t request_ms = control_airtime_ms(t, sizeof(tdma_request_t));
+  const uint32_t minislot_ms = request_ms + guard_ms;
+  const int entry_count = t->node_count + ((demand_ms > 0) ? 1 : 0);
+  const uint32_t beacon_ms = control_airtime_ms(t, sizeof(tdma_beacon_t) + entry_count * sizeof(tdma_slot_t));
+  const uint32_t minislots_ms = TDMA_REQUEST_MINISLOTS * minislot_ms;
+
+  // Slots only go where the cycle stays within max_cycle_ms, so the cycle fits unless the rest doesn't.
+  // With ranges held to TDMA_MAX_RANGE_MS that takes a profile slower than fsk40 (55 s at 3 s range):
+  if (beacon_ms + guard_ms + minislots_ms > 0xFFFF) {
+    t->next_beacon_ms = now_ms + TDMA_MIN_CYCLE_MS;
+    return false;
+  }
+  const uint32_t last_slot_end_ms = (max_cycle_ms > minislots_ms) ? max_cycle_ms - minislots_ms : 0;
+
+  tdma_slot_t *slots = (tdma_slot_t *)(control->text + sizeof(tdma_beacon_t));
+  uint32_t offset_ms = beacon_ms + guard_ms;
+  int slot_count = 0;
+  t->slot_length_ms = 0;
+  for (int i = -1; i < t->node_count; i++) {
+    tdma_slot_t *slot = &slots[slot_count];
+    uint32_t want_ms;
+    if (i < 0) {
+      // The station's own traffic goes first:
+      if (demand_ms == 0) {
+        continue;
+      }
+      slot->address = t->address;
+      slot->range_ms = 0;
+      want_ms = demand_ms;
+    } else {
+      slot->address = t->nodes[i].address;
+      slot->range_ms = t->nodes[i].range_ms;
+      want_ms = (t->nodes[i].demand_ms > 0) ? request_ms + t->nodes[i].demand_ms : 0;
+    }
+    if (want_ms > TDMA_MAX_SLOT_MS) {
+      want_ms = TDMA_MAX_SLOT_MS;
+    }
+    if (offset_ms + want_ms + guard_ms > last_slot_end_ms) {
+      want_ms = 0;
+    }
+    slot->start_ms = offset_ms;
+    slot->length_ms = want_ms;
+    if (want_ms > 0) {
+      offset_ms += want_ms + guard_ms;
+      if (i >= 0) {
+        // Granted: the node reports what's left when it opens the slot
+        t->nodes[i].demand_ms = 0;
+      }
+    }
+    if (i < 0) {
+      t->slot_start_ms = now_ms + slot->start_ms;
+      t->slot_length_ms = want_ms;
+    }
+    slot_count++;
+  }
+
+  uint32_t cycle_ms = offset_ms + minislots_ms;
+  int minislot_count = TDMA_REQUEST_MINISLOTS;
+  if (cycle_ms < TDMA_MIN_CYCLE_MS) {
+    // Time a short cycle would leave idle lets more nodes ask at once, rather than collide in three minislots:
+    minislot_count += (TDMA_MIN_CYCLE_MS - cycle_ms) / minislot_ms;
+    cycle_ms = TDMA_MIN_CYCLE_MS;
+  }
+  tdma_beacon_t beacon;
+  beacon.time_ms = now_ms;
+  beacon.cycle_ms = cycle_ms;
+  beacon.minislot_ms = minislot_ms;
+  beacon.cycle = t->cycle;
+  beacon.slot_count = slot_count;
+  beacon.minislot_count = minislot_count;
+  beacon.checksum = 0;
+  memcpy(control->text, &beacon, sizeof(beacon));
+
+  control->header.type = MAC_FRAME_TDMA_BEACON;
+  control->header.destination = MAC_BROADCAST_ADDRESS;
+  control->header.source = t->address;
+  control->header.sequence = t->cycle;
+  control->header.hops = 0;
+  control->header.ttl = 0;
+  control->header.length = sizeof(tdma_beacon_t) + slot_count * sizeof(tdma_slot_t);
+  seal_tdma_control(control, offsetof(tdma_beacon_t, checksum));
+
+  t->cycle_start_ms = now_ms;
+  t->cycle_ms = cycle_ms;
+  t->minislot_ms = minislot_ms;
+  t->minislot_count = minislot_count;
+  t->next_beacon_ms = now_ms + cycle_ms;
+  t->beacons++;
+  log_event(EVENT_TDMA_BEACON, t->cycle, slot_count, cycle_ms);
+  return true;
+}
+
+/**
+ * Node: writes a request carrying this node's estimate of the station clock (for ranging) and the airtime
+ * it will still have queued once remaining_slot_ms more has gone out (for the next cycle's schedule).
+ */
+static void build_tdma_request(tdma_state *t, uint32_t station_now_ms, uint32_t demand_ms,
+                               uint32_t remaining_slot_ms, mac_frame_t *control) {
+  tdma_request_t request;
+  request.time_ms = station_now_ms;
+  request.applied_range_ms = t->range_ms;
+  uint32_t left_ms = (demand_ms > remaining_slot_ms) ? demand_ms - remaining_slot_ms : 0;
+  request.demand_ms = (left_ms > 0xFFFF) ? 0xFFFF : left_ms;
+  request.checksum = 0;
+  memcpy(control->text, &request, sizeof(request));
+
+  control->header.type = MAC_FRAME_TDMA_REQUEST;
+  control->header.destination = t->station_address;
+  control->header.source = t->address;
+  control->header.sequence = t->requests;
+  control->header.hops = 0;
+  control->header.ttl = 0;
+  control->header.length = sizeof(request);
+  seal_tdma_control(control, offsetof(tdma_request_t, checksum));
+  t->request_sent = true;
+  t->last_request_cycle = t->cycle;
+  t->requests++;
+}
+
+/**
+ * Runs the schedule; call often (every few ms) with the airtime of the next transmission at the head of the
+ * MAC queue (see mac_queue_airtime_ms(); 0 if none) and of the whole queue. A station sends beacons on time
+ * and its own traffic in its own slot. A node synced to a station sends, in its slot, as much queued traffic
+ * as fits (text a fragment at a time, so no message is too long for a slot), opened by a request if
+ * traffic will be left over. One that isn't listed yet, or has traffic but no slot, sends a request in a
+ * random minislot at the end of the cycle. Either way a node requests every few cycles to stay listed.
+ * Node transmissions start early by the node's range, so they arrive at the station on time.
+ * Returns what to send now; for TDMA_SEND_CONTROL the frame is in control.
+ */
+tdma_action_t update_tdma(tdma_state *t, uint32_t now_ms, uint32_t next_airtime_ms, uint32_t demand_ms,
+                          mac_frame_t *control) {
+  if (!t->synced) {
+    return TDMA_USE_CSMA;
+  }
+  if (t->station && reached(now_ms, t->next_beacon_ms)) {
+    return (build_tdma_beacon(t, now_ms, demand_ms, control)) ? TDMA_SEND_CONTROL : TDMA_WAIT;
+  }
+  if (!t->station && now_ms - t->last_beacon_ms > TDMA_LOST_BEACONS * t->cycle_ms) {
+    t->synced = false;
+    log_event(EVENT_TDMA_SYNC_LOST, now_ms - t->last_beacon_ms);
+    return TDMA_USE_CSMA;
+  }
+
+  const uint32_t station_now_ms = now_ms + t->clock_offset_ms;
+  const uint32_t arrival_ms = station_now_ms + t->range_ms;
+  const uint32_t request_ms = control_airtime_ms(t, sizeof(tdma_request_t));
+  const uint32_t slot_end_ms = t->slot_start_ms + t->slot_length_ms;
+
+  // Requests are only worth their airtime with traffic left for the next cycle, or to stay listed:
+  const bool keep_alive = (uint8_t)(t->cycle - t->last_request_cycle) >= TDMA_NODE_TIMEOUT_CYCLES / 2;
+
+  if (t->slot_length_ms > 0 && reached(arrival_ms, t->slot_start_ms) && !reached(arrival_ms, slot_end_ms)) {
+    // What is left of the slot, and of it after a request (only subtracted once the request is known to fit,
+    // as the difference would wrap):
+    const uint32_t left_ms = slot_end_ms - arrival_ms;
+    const bool request_fits = request_ms <= left_ms;
+    if (!t->station && !t->request_sent && request_fits && (keep_alive || demand_ms > left_ms - request_ms)) {
+      // The rest of the slot only carries traffic if the next transmission fits in it (reporting it as
+      // sent would get a slot too short for that transmission, cycle after cycle):
+      const uint32_t remaining_ms = left_ms - request_ms;
+      const uint32_t sent_ms = (next_airtime_ms <= remaining_ms) ? remaining_ms : 0;
+      build_tdma_request(t, station_now_ms, demand_ms, sent_ms, control);
+      return TDMA_SEND_CONTROL;
+    }
+    if (next_airtime_ms > 0 && next_airtime_ms <= left_ms) {
+      return TDMA_SEND_QUEUED;
+    }
+    return TDMA_WAIT;
+  }
+
+  const bool want_request = !t->station && !t->request_sent &&
+                            (!t->listed || keep_alive || (demand_ms > 0 && t->slot_length_ms == 0));
+  if (want_request) {
+    uint32_t minislot_start_ms = t->cycle_start_ms + t->cycle_ms -
+                                 (t->minislot_count - t->request_minislot) * t->minislot_ms;
+    if (reached(arrival_ms, minislot_start_ms) &&
+        !reached(arrival_ms + request_ms, minislot_start_ms + t->minislot_ms + 1)) {
+      build_tdma_request(t, station_now_ms, demand_ms, 0, control);
+      return TDMA_SEND_CONTROL;
+    }
+  }
+  return TDMA_WAIT;
+}
+
+/**
+ * Node: takes a beacon that started arriving at local time arrival_ms. Sets the clock to the station's
+ * (its timestamp, plus the range the station reports for this node once it has measured one), and takes
+ * this node's slot and the request minislots for the cycle.
+ */
+void handle_tdma_beacon(tdma_state *t, const mac_header_t *header, const void *payload, uint32_t arrival_ms) {
+  tdma_beacon_t beacon;
+  if (t->station || !tdma_frame_intact(header, payload)) {
+    return;
+  }
+  memcpy(&beacon, payload, sizeof(beacon));
+  if (beacon.minislot_count == 0) {
+    return;
+  }
+
+  t->listed = false;
+  t->slot_length_ms = 0;
+  for (int i = 0; i < beacon.slot_count; i++) {
+    tdma_slot_t slot;
+    memcpy(&slot, (const uint8_t *)payload + sizeof(beacon) + i * sizeof(slot), sizeof(slot));
+    if (slot.address == t->address) {
+      t->listed = true;
+      t->range_ms = slot.range_ms;
+      t->slot_start_ms = beacon.time_ms + slot.start_ms;
+      t->slot_length_ms = slot.length_ms;
+    }
+  }
+
+  int32_t previous_offset_ms = t->clock_offset_ms;
+  t->clock_offset_ms = (int32_t)(beacon.time_ms + t->range_ms - arrival_ms);
+  bool was_synced = t->synced;
+  t->synced = true;
+  t->station_address = header->source;
+  t->last_beacon_ms = arrival_ms;
+  t->cycle = beacon.cycle;
+  t->cycle_start_ms = beacon.time_ms;
+  t->cycle_ms = beacon.cycle_ms;
+  t->minislot_ms = beacon.minislot_ms;
+  t->minislot_count = beacon.minislot_count;
+  t->request_sent = false;
+  t->request_minislot = next_tdma_random(t) % beacon.minislot_count;
+  t->beacons++;
+  log_event(EVENT_TDMA_SYNC, beacon.cycle, (was_synced) ? t->clock_offset_ms - previous_offset_ms : 0, t->range_ms);
+}
+
+/**
+ * Station: takes a request that started arriving at arrival_ms. The node stamped it with its estimate of
+ * the station clock, corrected by applied_range_ms; what is left of the gap is the round trip less that
+ * correction, which gives the range. Records the range and the node's queued airtime for the next cycle.
+ */
+void handle_tdma_request(tdma_state *t, const mac_header_t *header, const void *payload, uint32_t arrival_ms) {
+  tdma_request_t request;
+  if (!t->station || header->destination != t->address || !tdma_frame_intact(header, payload)) {
+    return;
+  }
+  memcpy(&request, payload, sizeof(request));
+
+  // A node whose clock is off (it missed beacons) can make the gap come out longer than any real range:
+  int32_t range_ms = ((int32_t)(arrival_ms - request.time_ms) + request.applied_range_ms) / 2;
+  if (range_ms < 0) {
+    range_ms = 0;
+  } else if (range_ms > TDMA_MAX_RANGE_MS) {
+    range_ms = TDMA_MAX_RANGE_MS;
+  }
+
+  tdma_node_t *node = NULL;
+  for (int i = 0; i < t->node_count; i++) {
+    if (t->nodes[i].address == header->source) {
+      node = &t->nodes[i];
+    }
+  }
+  if (!node) {
+    if (t->node_count >= TDMA_MAX_NODES) {
+      return;
+    }
+    node = &t->nodes[t->node_count++];
+    node->address = header->source;
+  }
+  node->range_ms = range_ms;
+  node->demand_ms = request.demand_ms;
+  node->last_heard_cycle = t->cycle;
+  t->requests++;
+  log_event(EVENT_TDMA_REQUEST, header->source, range_ms, request.demand_ms);
+}
@@ -0,0 +1,119 @@
+// ==================================================================
+// tdma.h
+// Declares beacon-synchronized TDMA scheduling, run by a boat station and followed by divers
+// ==================================================================
+#ifndef TDMA_H
+#define TDMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "mac.h"
+
+//----------------------------------------
+// TDMA Configuration
+//----------------------------------------
+#define TDMA_MAX_NODES              8       // Divers a station schedules (slot table entries per beacon)
+#define TDMA_MIN_CYCLE_MS           20000   // Beacons go out at most this often
+#define TDMA_MAX_SLOT_MS            20000   // Longest slot granted to one node in a cycle
+#define TDMA_REQUEST_MINISLOTS      3       // Contention minislots closing each cycle (at least), to join or ask
+#define TDMA_SYNC_MARGIN_MS         100     // Guard on top of propagation: timestamp error, drift, DAC start-up
+#define TDMA_MAX_RANGE_MS           3000    // Longest one-way delay a request can measure (4.5 km at 1500 m/s)
+#define TDMA_LOST_BEACONS           3       // Cycles without a beacon before a node falls back to CSMA
+#define TDMA_NODE_TIMEOUT_CYCLES    8       // Cycles a station keeps a node it no longer hears from
+
+// MAC_FRAME_TDMA_BEACON payload, followed by slot_count tdma_slot_t:
+typedef struct __attribute__((packed)) {
+  uint32_t time_ms;            // Station clock when the beacon started
+  uint16_t cycle_ms;           // The next beacon starts this long after this one
+  uint16_t minislot_ms;        // The cycle ends with minislot_count of these
+  uint8_t cycle;
+  uint8_t slot_count;
+  uint8_t minislot_count;      // TDMA_REQUEST_MINISLOTS, and more in a cycle stretched to TDMA_MIN_CYCLE_MS
+  uint16_t checksum;           // Fletcher-16 of the MAC header, this header (checksum 0) and the slots
+} tdma_beacon_t;
+
+// Times are as the station hears them, from the start of the beacon:
+typedef struct __attribute__((packed)) {
+  uint8_t address;
+  uint16_t start_ms;
+  uint16_t length_ms;          // 0 when the node has nothing queued (its entry still carries its range)
+  uint16_t range_ms;           // One-way propagation delay the station measured to the node
+} tdma_slot_t;
+
+// MAC_FRAME_TDMA_REQUEST payload:
+typedef struct __attribute__((packed)) {
+  uint32_t time_ms;            // Sender's estimate of the station clock when the request started
+  uint16_t applied_range_ms;   // Range that estimate was corrected by
+  uint16_t demand_ms;          // Airtime of the frames the sender has queued
+  uint16_t checksum;           // Fletcher-16 of the MAC header and this request (checksum 0)
+} tdma_request_t;
+
+#define TDMA_MAX_BEACON_LENGTH      (sizeof(tdma_beacon_t) + TDMA_MAX_NODES * sizeof(tdma_slot_t))
+static_assert(TDMA_MAX_BEACON_LENGTH < MAX_TEXT_LENGTH, "a beacon fits in one frame");
+
+typedef enum {
+  TDMA_USE_CSMA,               // No schedule to follow: contend with update_mac()
+  TDMA_WAIT,                   // Coordinated, but nothing may go out now
+  TDMA_SEND_CONTROL,           // Send the beacon or request update_tdma() wrote
+  TDMA_SEND_QUEUED,            // Send the next transmission at the head of the MAC queue (a fragment, for text)
+} tdma_action_t;
+
+typedef struct {
+  uint8_t address;
+  uint16_t range_ms;
+  uint16_t demand_ms;
+  uint8_t last_heard_cycle;
+} tdma_node_t;
+
+typedef struct {
+  uint8_t address;
+  bool station;                // Sends beacons and schedules; otherwise follows any station it hears
+  const tx_parameters_t *tx;   // For airtimes
+  uint32_t random_state;
+
+  // Station: nodes heard from, and the cycle in progress
+  tdma_node_t nodes[TDMA_MAX_NODES];
+  int node_count;
+  uint8_t cycle;
+  uint32_t next_beacon_ms;
+
+  // Both: the schedule being followed, in station time (a station's own clock)
+  bool synced;
+  int32_t clock_offset_ms;     // Station time minus local time
+  uint16_t range_ms;           // One-way delay to the station, from its last beacon (0 until measured)
+  uint8_t station_address;
+  uint32_t last_beacon_ms;     // Local time the last beacon arrived
+  uint32_t cycle_start_ms;
+  uint32_t cycle_ms;
+  uint32_t minislot_ms;
+  int minislot_count;
+  uint32_t slot_start_ms;      // This node's slot, as it should arrive at the station
+  uint32_t slot_length_ms;
+  bool listed;                 // The station knows this node (it has an entry in the beacon)
+  bool request_sent;           // Already sent a request this cycle
+  uint8_t last_request_cycle;  // Requests also keep the station's entry (and range) fresh
+  int request_minislot;
+
+  // Counters for the console and simulations:
+  uint32_t beacons;
+  uint32_t requests;
+} tdma_state;
+
+void initialize_tdma(tdma_state *t, uint8_t address, const tx_parameters_t *tx, uint32_t seed);
+
+void set_tdma_station(tdma_state *t, bool station, uint32_t now_ms);
+
+tdma_action_t update_tdma(tdma_state *t, uint32_t now_ms, uint32_t next_airtime_ms, uint32_t demand_ms,
+                          mac_frame_t *control);
+
+bool tdma_frame_intact(const mac_header_t *header, const void *payload);
+
+void handle_tdma_beacon(tdma_state *t, const mac_header_t *header, const void *payload, uint32_t arrival_ms);
+
+void handle_tdma_request(tdma_state *t, const mac_header_t *header, const void *payload, uint32_t arrival_ms);
+
+uint32_t tdma_guard_ms(const tdma_state *t);
+
+#endif
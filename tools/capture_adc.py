@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Records raw ADC blocks from the firmware for replaying through the receive chain on a host.
+
+Sends the console command "capture start N" and writes every SERIAL_FRAME_ADC_CAPTURE frame it gets back,
+byte for byte, to the output file (see firmware/capture.h for the chunk layout). Text and event log frames
+arriving in the meantime are printed as decode_log.py would. Stops after N blocks, on Ctrl-C (sending
+"capture stop"), or when the capture has gone quiet for a few seconds.
+
+Usage:
+    stty -F /dev/ttyACM0 raw && tools/capture_adc.py /dev/ttyACM0 recording.bin --blocks 80
+    tools/replay/replay recording.bin
+"""
+import argparse
+import os
+import select
+import struct
+import sys
+import time
+
+from decode_log import DEFAULT_HEADER, FRAME_EVENT_LOG, RECORD, SYNC, FrameReader, fletcher16, format_event, \
+    load_events
+
+FRAME_ADC_CAPTURE = 2
+CHUNK_HEADER = struct.Struct("<IIIHHHBB")
+QUIET_SECONDS = 3.0
+
+
+def frame_bytes(frame_type, payload):
+    body = bytes([frame_type, len(payload) & 0xFF, len(payload) >> 8]) + payload
+    return SYNC + body + fletcher16(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("device", help="the firmware's USB serial device")
+    parser.add_argument("output", help="file to write the capture frames to")
+    parser.add_argument("--blocks", type=int, default=80, help="blocks to record, 0 to run until Ctrl-C")
+    parser.add_argument("--header", default=DEFAULT_HEADER, help="event_log.h to take event formats from")
+    parser.add_argument("--no-text", action="store_true", help="hide plain-text serial output")
+    args = parser.parse_args()
+
+    events = load_events(args.header)
+    out = sys.stdout
+    state = {"chunks": 0, "blocks": 0, "last_block": None, "dropped": 0, "done": False, "last_data": time.time()}
+
+    def on_text(data):
+        if not args.no_text:
+            out.write(data.decode("utf-8", "replace"))
+            out.flush()
+
+    def on_frame(frame_type, payload):
+        if frame_type == FRAME_EVENT_LOG:
+            for offset in range(0, len(payload) - RECORD.size + 1, RECORD.size):
+                timestamp_us, event_id, _, a0, a1, a2 = RECORD.unpack_from(payload, offset)
+                out.write("[%12.6f] %s\n" % (timestamp_us / 1e6, format_event(events, event_id, (a0, a1, a2))))
+            out.flush()
+            return
+        if frame_type != FRAME_ADC_CAPTURE or len(payload) < CHUNK_HEADER.size:
+            return
+        recording.write(frame_bytes(frame_type, payload))
+        state["chunks"] += 1
+        state["last_data"] = time.time()
+        block, _, _, block_samples, first_sample, sample_count, _, _ = CHUNK_HEADER.unpack_from(payload)
+        if first_sample + sample_count < block_samples:
+            return
+        if state["last_block"] is not None and block > state["last_block"] + 1:
+            state["dropped"] += block - state["last_block"] - 1
+        state["last_block"] = block
+        state["blocks"] += 1
+        if args.blocks and block + 1 >= args.blocks:
+            state["done"] = True
+
+    fd = os.open(args.device, os.O_RDWR | os.O_NOCTTY)
+    recording = open(args.output, "wb")
+    reader = FrameReader(on_text, on_frame)
+    command = "capture start %d\n" % args.blocks if args.blocks else "capture start\n"
+    os.write(fd, command.encode())
+    try:
+        while not state["done"] and time.time() - state["last_data"] < QUIET_SECONDS:
+            ready, _, _ = select.select([fd], [], [], 0.5)
+            if ready:
+                reader.feed(os.read(fd, 4096))
+    except KeyboardInterrupt:
+        os.write(fd, b"capture stop\n")
+    recording.close()
+    os.close(fd)
+    sys.stderr.write("%d blocks (%d chunks) written to %s, %d blocks dropped by the firmware\n"
+                     % (state["blocks"], state["chunks"], args.output, state["dropped"]))
+    if reader.bad_frames:
+        sys.stderr.write("%d bad frames skipped\n" % reader.bad_frames)
+
+
+if __name__ == "__main__":
+    main()
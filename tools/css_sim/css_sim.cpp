@@ -0,0 +1,221 @@
+// ==================================================================
+// css_sim.cpp
+// Bit error rate of the chirp spread spectrum (css80) receive path against SNR and carrier offset
+// ==================================================================
+//
+// Sends a preamble of unshifted chirps and random data symbols with the firmware's own DDS (as comm.cpp's
+// start_tx_symbol() sends them), shifts every chirp by a fixed carrier offset, adds white noise scaled to
+// the requested SNR and runs the result through frontend.cpp and chirp.cpp. SNR is the chirp's power over
+// the noise in the band it sweeps (2560 Hz); the wideband SNR over the ADC's whole Nyquist band is 12 dB
+// lower. Prints a table of bit errors per SNR (rows) and offset (columns), summed over the trials.
+//
+// Build from the repo root, with CMSIS-DSP as for tools/replay:
+//
+//   CMSIS="-I$CMSIS_DSP/Include -I$CMSIS_DSP/PrivateInclude -I$CMSIS_CORE/Include"
+//   FIRMWARE="frontend chirp modem_profile sine_table dds"
+//   DSP="BasicMath ComplexMath Filtering Statistics Transform FastMath"
+//   g++ -std=gnu++14 -O2 -DPROFILING_ENABLED=0 -Ifirmware $CMSIS tools/css_sim/css_sim.cpp
+//       $(for f in $FIRMWARE; do echo firmware/$f.cpp; done)
+//       $(for d in $DSP; do echo $CMSIS_DSP/Source/${d}Functions/${d}Functions.c; done)
+//       $CMSIS_DSP/Source/CommonTables/CommonTables.c -lm -o css_sim
+//   (the g++ command is one line, wrapped here)
+//
+// Usage: css_sim [--snr DB] [--offset HZ] [--symbols N] [--trials N] [--seed N]
+//   --snr         only this in-band SNR (default: -12 to +3 dB in 3 dB steps)
+//   --offset      only this carrier offset (default: 0, 5, 10 and 20 Hz)
+//   --symbols     data symbols per trial (default 200)
+//   --trials      trials per point, each with its own symbols, noise and start time (default 4)
+//   --seed        random seed (default 1)
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chirp.h"
+#include "dds.h"
+#include "frontend.h"
+#include "modem_profile.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define SIM_AMPLITUDE               300     // Chirp peak, in ADC counts
+#define SIM_TAIL_SAMPLES            4096    // Silence after the last symbol, so the receiver finishes it
+#define SIM_MAX_LEAD_SAMPLES        4096    // Silence before the preamble, a random length up to this
+#define SIM_MAX_SHIFT               64      // Bits searched when lining up the output (acquisition latency)
+
+typedef struct {
+  double snr_db;
+  double offset_hz;
+  int symbols;
+  int trials;
+} sim_point_t;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static double gauss() {
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/**
+ * Fewest bit errors between the bits sent and what came out, over every offset up to SIM_MAX_SHIFT bits
+ * (bits never produced count as errors).
+ */
+static int count_bit_errors(const uint8_t *sent, int sent_count, const uint8_t *received, int received_count) {
+  int best = sent_count;
+  for (int shift = 0; shift <= SIM_MAX_SHIFT; shift++) {
+    int errors = 0;
+    for (int i = 0; i < sent_count && errors < best; i++) {
+      const int j = i + shift;
+      errors += (j >= received_count || received[j] != sent[i]);
+    }
+    if (errors < best) {
+      best = errors;
+    }
+  }
+  return best;
+}
+
+/**
+ * Sends one trial's symbols at the point's SNR and offset and returns its bit errors.
+ */
+static int run_trial(const modem_profile_t *profile, const sim_point_t *point, uint8_t *sent, uint8_t *received) {
+  const tx_parameters_t *tx = &profile->tx;
+  const int bits_per_symbol = tx->bits_per_symbol;
+  const uint32_t samples_per_symbol = (uint64_t)tx->usec_per_symbol * MODEM_SAMPLE_RATE / 1000000;
+  const uint32_t lead = (uint32_t)rand() % SIM_MAX_LEAD_SAMPLES;
+  const uint32_t count = lead + (MODEM_PREAMBLE_SYMBOLS + point->symbols) * samples_per_symbol + SIM_TAIL_SAMPLES;
+  const uint32_t padded = (count + FRONTEND_DECIMATION - 1) / FRONTEND_DECIMATION * FRONTEND_DECIMATION;
+  float *x = (float *)calloc(padded, sizeof(float));
+  uint16_t *codes = (uint16_t *)malloc(padded * sizeof(uint16_t));
+  float *baseband_i = (float *)malloc(padded / FRONTEND_DECIMATION * sizeof(float));
+  float *baseband_q = (float *)malloc(padded / FRONTEND_DECIMATION * sizeof(float));
+
+  const uint32_t low = dds_phase_increment(tx->freq_low + point->offset_hz, MODEM_SAMPLE_RATE);
+  const uint32_t high = dds_phase_increment(tx->freq_high + point->offset_hz, MODEM_SAMPLE_RATE);
+  const uint32_t span = high - low;
+  static const uint32_t gray_shifts[4] = {0, 1, 3, 2};
+  dds_state dds;
+  initialize_dds(&dds, samples_per_symbol, 0, DDS_DAC_FULL_AMPLITUDE);
+  uint32_t m = lead;
+  int sent_count = 0;
+  double power = 0;
+  for (int k = 0; k < MODEM_PREAMBLE_SYMBOLS + point->symbols; k++) {
+    uint32_t symbol = 0;
+    if (k >= MODEM_PREAMBLE_SYMBOLS) {
+      symbol = (uint32_t)rand() & ((1U << bits_per_symbol) - 1);
+      for (int b = bits_per_symbol - 1; b >= 0; b--) {
+        sent[sent_count++] = (symbol >> b) & 1;
+      }
+    }
+    start_dds_chirp(&dds, low, span, (span >> bits_per_symbol) * gray_shifts[symbol]);
+    for (uint32_t n = 0; n < samples_per_symbol; n++, m++) {
+      x[m] = ((float)next_dds_sample(&dds) - DDS_DAC_MIDSCALE) * SIM_AMPLITUDE / DDS_DAC_FULL_AMPLITUDE;
+      power += (double)x[m] * x[m];
+    }
+  }
+  power /= m - lead;
+
+  // Noise spreads evenly over the Nyquist band, of which the chirp sweeps (freq_high - freq_low):
+  const double band_fraction = (double)(tx->freq_high - tx->freq_low) / (MODEM_SAMPLE_RATE / 2);
+  const double noise = sqrt(power / pow(10, point->snr_db / 10) / band_fraction);
+  for (uint32_t n = 0; n < padded; n++) {
+    const double value = DDS_DAC_MIDSCALE + x[n] + noise * gauss();
+    codes[n] = (uint16_t)((value < 0) ? 0 : (value > 4095) ? 4095 : lround(value));
+  }
+
+  static frontend_state frontend;
+  static chirp_state chirp;
+  initialize_frontend(&frontend, profile->center_hz, MODEM_SAMPLE_RATE);
+  const size_t baseband_count = update_frontend(&frontend, codes, padded, baseband_i, baseband_q);
+  initialize_chirp(&chirp);
+  int received_count = 0;
+  for (size_t i = 0; i < baseband_count; i++) {
+    uint8_t bits[MODEM_CSS_BITS_PER_SYMBOL];
+    const int bit_count = update_chirp(&chirp, baseband_i[i], baseband_q[i], bits);
+    for (int b = 0; b < bit_count && received_count < sent_count + SIM_MAX_SHIFT; b++) {
+      received[received_count++] = bits[b];
+    }
+  }
+
+  free(x);
+  free(codes);
+  free(baseband_i);
+  free(baseband_q);
+  return count_bit_errors(sent, sent_count, received, received_count);
+}
+
+int main(int argc, char **argv) {
+  double snrs[] = {-12, -9, -6, -3, 0, 3};
+  double offsets[] = {0, 5, 10, 20};
+  int snr_count = 6, offset_count = 4;
+  sim_point_t point = {0, 0, 200, 4};
+  unsigned seed = 1;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--snr") == 0 && i + 1 < argc) {
+      snrs[0] = atof(argv[++i]);
+      snr_count = 1;
+    } else if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+      offsets[0] = atof(argv[++i]);
+      offset_count = 1;
+    } else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc) {
+      point.symbols = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+      point.trials = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = (unsigned)atoi(argv[++i]);
+    } else {
+      usage = true;
+      break;
+    }
+  }
+  if (usage || point.symbols < 1 || point.trials < 1) {
+    fprintf(stderr, "usage: %s [--snr DB] [--offset HZ] [--symbols N] [--trials N] [--seed N]\n", argv[0]);
+    return 2;
+  }
+
+  const modem_profile_t *profile = NULL;
+  for (int p = 0; p < get_modem_profile_count(); p++) {
+    if (get_modem_profile(p)->modulation == MODEM_MODULATION_CSS) {
+      profile = get_modem_profile(p);
+    }
+  }
+  if (profile == NULL) {
+    fprintf(stderr, "no CSS profile\n");
+    return 2;
+  }
+  const int bits = point.symbols * profile->tx.bits_per_symbol;
+  uint8_t *sent = (uint8_t *)malloc(bits);
+  uint8_t *received = (uint8_t *)malloc(bits + SIM_MAX_SHIFT);
+  srand(seed);
+
+  printf("%s: bit errors in %d bits per point\n", profile->name, bits * point.trials);
+  printf("in-band SNR  wideband");
+  for (int o = 0; o < offset_count; o++) {
+    printf("  %5.1f Hz", offsets[o]);
+  }
+  printf("\n");
+  const double wideband_db = 10 * log10((double)(profile->tx.freq_high - profile->tx.freq_low) / (MODEM_SAMPLE_RATE / 2));
+  for (int s = 0; s < snr_count; s++) {
+    point.snr_db = snrs[s];
+    printf("   %+5.1f dB  %+5.1f dB", snrs[s], snrs[s] + wideband_db);
+    for (int o = 0; o < offset_count; o++) {
+      point.offset_hz = offsets[o];
+      int errors = 0;
+      for (int t = 0; t < point.trials; t++) {
+        errors += run_trial(profile, &point, sent, received);
+      }
+      printf("  %8d", errors);
+    }
+    printf("\n");
+  }
+  free(sent);
+  free(received);
+  return 0;
+}
@@ -0,0 +1,342 @@
+// ==================================================================
+// dds_bench.cpp
+// Measures the TX DDS: spectral occupancy of each profile's waveform, tone purity and cost per sample
+// ==================================================================
+//
+// Runs firmware/dds.cpp exactly as transmit_message() drives it (preamble, then random message bytes,
+// symbols started as comm.cpp's start_tx_symbol() does) and looks at the DAC codes it produces:
+// - Occupancy: Welch power spectrum of a whole packet at MODEM_SAMPLE_RATE, for the waveform restarted at
+//   zero phase every symbol (what transmit_message() did before the DDS), for the phase-continuous DDS,
+//   and for the DDS with raised-cosine symbol edges. Prints the bandwidth holding 99% of the power and
+//   the share of the power outside the receiver's passband (center +-MODEM_PASSBAND_HZ).
+// - Purity: the largest spur next to a steady tone (10-bit sine table, 12-bit DAC codes), in dBc.
+// - Cost: time per next_dds_sample() on this host, steady and shaped tones and chirps, against one
+//   sinf() per sample; at MODEM_SAMPLE_RATE the transmitter has 12.2 us per sample.
+//
+// Build from the repo root, with CMSIS-DSP headers for modem_profile.h:
+//
+//   CMSIS="-I$CMSIS_DSP/Include -I$CMSIS_DSP/PrivateInclude -I$CMSIS_CORE/Include"
+//   g++ -std=gnu++14 -O2 -Ifirmware $CMSIS tools/dds_bench/dds_bench.cpp
+//       firmware/{dds,sine_table,modem_profile}.cpp -o dds_bench
+//   (the g++ command is one line, wrapped here)
+//
+// Usage: dds_bench [--profile NAME] [--bytes N] [--seed N]
+//   --profile  only this profile (default: every profile)
+//   --bytes    random message bytes after the preamble (default 32)
+//   --seed     random seed (default 1)
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dds.h"
+#include "modem_profile.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define BENCH_FFT_BITS              13      // Welch segment: 8192 samples, 10 Hz bins at 81.92 kHz
+#define BENCH_FFT_SIZE              (1 << BENCH_FFT_BITS)
+#define BENCH_PURITY_BITS           16      // One long transform for the steady tone's spurs
+#define BENCH_PURITY_GUARD_BINS     8       // Bins either side of the tone that belong to it (window skirt)
+#define BENCH_COST_SAMPLES          20000000
+#define BENCH_AMPLITUDE             DDS_DAC_FULL_AMPLITUDE
+
+typedef enum {
+  BENCH_PHASE_RESET,                        // Restarted at zero phase every symbol, unshaped
+  BENCH_CONTINUOUS,                         // Phase-continuous DDS, unshaped
+  BENCH_SHAPED,                             // Phase-continuous DDS, raised-cosine edges
+  BENCH_VARIANT_COUNT
+} bench_variant_t;
+
+static const char *const bench_variant_names[BENCH_VARIANT_COUNT] = {"phase reset", "DDS", "DDS shaped"};
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static double now_seconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * In-place radix-2 FFT of size 2^bits (re, im interleaved as two arrays).
+ */
+static void fft(double *re, double *im, int bits) {
+  const uint32_t n = 1U << bits;
+  for (uint32_t i = 1, j = 0; i < n; i++) {
+    uint32_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      double t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  for (uint32_t len = 2; len <= n; len <<= 1) {
+    const double angle = -2 * M_PI / len;
+    for (uint32_t i = 0; i < n; i += len) {
+      for (uint32_t k = 0; k < len / 2; k++) {
+        const double w_re = cos(angle * k), w_im = sin(angle * k);
+        const uint32_t a = i + k, b = i + k + len / 2;
+        const double t_re = re[b] * w_re - im[b] * w_im, t_im = re[b] * w_im + im[b] * w_re;
+        re[b] = re[a] - t_re;
+        im[b] = im[a] - t_im;
+        re[a] += t_re;
+        im[a] += t_im;
+      }
+    }
+  }
+}
+
+/**
+ * Starts one symbol the way comm.cpp's start_tx_symbol() does (FSK tone, DBPSK/DQPSK Gray-coded phase step,
+ * CSS cyclically shifted up-chirp).
+ */
+static void start_symbol(dds_state *dds, const tx_parameters_t *tx, uint32_t symbol, uint32_t low, uint32_t high) {
+  static const uint32_t dqpsk_quarter_turns[4] = {0, 1, 3, 2};
+  if (tx->modulation == MODEM_MODULATION_FSK) {
+    start_dds_symbol(dds, (symbol) ? high : low);
+  } else if (tx->modulation == MODEM_MODULATION_CSS) {
+    start_dds_chirp(dds, low, high - low, ((high - low) >> tx->bits_per_symbol) * dqpsk_quarter_turns[symbol]);
+  } else {
+    uint32_t quarter_turns = (tx->modulation == MODEM_MODULATION_DBPSK) ? 2 * symbol : dqpsk_quarter_turns[symbol];
+    start_dds_symbol(dds, low);
+    shift_dds_phase(dds, quarter_turns << 30);
+  }
+}
+
+/**
+ * Writes a whole packet (preamble, then message_bytes random bytes) as DAC codes less DDS_DAC_MIDSCALE.
+ * Returns the sample count.
+ */
+static uint32_t generate_packet(const tx_parameters_t *tx, bench_variant_t variant, const uint8_t *message,
+                                int message_bytes, double **samples) {
+  const uint32_t samples_per_symbol = (uint64_t)tx->usec_per_symbol * MODEM_SAMPLE_RATE / 1000000;
+  const uint32_t ramp_samples = (variant == BENCH_SHAPED) ? samples_per_symbol / MODEM_RAMP_FRACTION : 0;
+  const uint32_t low = dds_phase_increment(tx->freq_low, MODEM_SAMPLE_RATE);
+  const uint32_t high = dds_phase_increment(tx->freq_high, MODEM_SAMPLE_RATE);
+  const int bits = tx->bits_per_symbol;
+  const int symbol_count = MODEM_PREAMBLE_SYMBOLS + message_bytes * (8 / bits);
+  const uint32_t count = symbol_count * samples_per_symbol;
+  *samples = (double *)malloc(count * sizeof(double));
+
+  dds_state dds;
+  initialize_dds(&dds, samples_per_symbol, ramp_samples, BENCH_AMPLITUDE);
+  uint32_t m = 0;
+  for (int k = 0; k < symbol_count; k++) {
+    uint32_t symbol;
+    if (k < MODEM_PREAMBLE_SYMBOLS) {
+      symbol = (tx->modulation == MODEM_MODULATION_FSK) ? (k & 1)
+             : (tx->modulation == MODEM_MODULATION_CSS) ? 0 : (1U << bits) - 1;
+    } else {
+      const int bit_index = (k - MODEM_PREAMBLE_SYMBOLS) * bits;
+      symbol = (message[bit_index / 8] >> (8 - bits - bit_index % 8)) & ((1U << bits) - 1);
+    }
+    if (variant == BENCH_PHASE_RESET) {
+      dds.phase = 0;
+    }
+    start_symbol(&dds, tx, symbol, low, high);
+    for (uint32_t n = 0; n < samples_per_symbol; n++) {
+      (*samples)[m++] = (double)next_dds_sample(&dds) - DDS_DAC_MIDSCALE;
+    }
+  }
+  return count;
+}
+
+/**
+ * Welch power spectrum (Hann segments, half overlapped) of count samples into psd[BENCH_FFT_SIZE / 2].
+ */
+static void welch_spectrum(const double *samples, uint32_t count, double *psd) {
+  static double re[BENCH_FFT_SIZE], im[BENCH_FFT_SIZE];
+  memset(psd, 0, BENCH_FFT_SIZE / 2 * sizeof(double));
+  for (uint32_t start = 0; start + BENCH_FFT_SIZE <= count; start += BENCH_FFT_SIZE / 2) {
+    for (uint32_t j = 0; j < BENCH_FFT_SIZE; j++) {
+      re[j] = samples[start + j] * (0.5 - 0.5 * cos(2 * M_PI * j / BENCH_FFT_SIZE));
+      im[j] = 0;
+    }
+    fft(re, im, BENCH_FFT_BITS);
+    for (uint32_t k = 0; k < BENCH_FFT_SIZE / 2; k++) {
+      psd[k] += re[k] * re[k] + im[k] * im[k];
+    }
+  }
+}
+
+/**
+ * Prints, for each variant, the bandwidth around center_hz holding 99% of the packet's power and the
+ * share of it outside center_hz +-MODEM_PASSBAND_HZ.
+ */
+static void run_occupancy(const modem_profile_t *profile, int message_bytes) {
+  uint8_t *message = (uint8_t *)malloc(message_bytes);
+  for (int b = 0; b < message_bytes; b++) {
+    message[b] = (uint8_t)rand();
+  }
+  static double psd[BENCH_FFT_SIZE / 2];
+  const double bin_hz = (double)MODEM_SAMPLE_RATE / BENCH_FFT_SIZE;
+  const uint32_t center = (uint32_t)(profile->center_hz / bin_hz + 0.5);
+
+  printf("%s occupancy (%d-symbol preamble + %d random bytes):\n", profile->name, MODEM_PREAMBLE_SYMBOLS,
+         message_bytes);
+  for (int v = 0; v < BENCH_VARIANT_COUNT; v++) {
+    if (v == BENCH_PHASE_RESET && profile->modulation != MODEM_MODULATION_FSK) {
+      continue;  // Only FSK was ever sent that way
+    }
+    double *samples;
+    const uint32_t count = generate_packet(&profile->tx, (bench_variant_t)v, message, message_bytes, &samples);
+    welch_spectrum(samples, count, psd);
+    free(samples);
+
+    double total = 0, outside = 0;
+    for (uint32_t k = 1; k < BENCH_FFT_SIZE / 2; k++) {
+      total += psd[k];
+      if (fabs((double)k - center) * bin_hz > MODEM_PASSBAND_HZ) {
+        outside += psd[k];
+      }
+    }
+    // Widens symmetrically about the center until 99% of the power is inside:
+    double inside = psd[center];
+    uint32_t half = 0;
+    while (inside < 0.99 * total && half < BENCH_FFT_SIZE / 2) {
+      half++;
+      inside += (center + half < BENCH_FFT_SIZE / 2) ? psd[center + half] : 0;
+      inside += (center >= half) ? psd[center - half] : 0;
+    }
+    printf("  %-12s 99%% bandwidth %7.0f Hz   outside passband %7.1f dB\n", bench_variant_names[v],
+           (2 * half + 1) * bin_hz, 10 * log10(outside / total + 1e-30));
+  }
+  free(message);
+}
+
+/**
+ * Prints the largest spur beside a steady tone at the profile's low tone, relative to the tone.
+ */
+static void run_purity(const modem_profile_t *profile) {
+  const uint32_t n = 1U << BENCH_PURITY_BITS;
+  double *re = (double *)malloc(n * sizeof(double)), *im = (double *)malloc(n * sizeof(double));
+  dds_state dds;
+  initialize_dds(&dds, n, 0, BENCH_AMPLITUDE);
+  start_dds_symbol(&dds, dds_phase_increment(profile->tx.freq_low, MODEM_SAMPLE_RATE));
+  for (uint32_t j = 0; j < n; j++) {
+    // Blackman-Harris: sidelobes well under the spurs being looked for
+    const double x = 2 * M_PI * j / n;
+    const double w = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+    re[j] = ((double)next_dds_sample(&dds) - DDS_DAC_MIDSCALE) * w;
+    im[j] = 0;
+  }
+  fft(re, im, BENCH_PURITY_BITS);
+  uint32_t peak = 1;
+  for (uint32_t k = 1; k < n / 2; k++) {
+    if (re[k] * re[k] + im[k] * im[k] > re[peak] * re[peak] + im[peak] * im[peak]) {
+      peak = k;
+    }
+  }
+  double spur = 0;
+  uint32_t spur_bin = 0;
+  for (uint32_t k = 1; k < n / 2; k++) {
+    const double p = re[k] * re[k] + im[k] * im[k];
+    const bool beside_tone = k + BENCH_PURITY_GUARD_BINS >= peak && k <= peak + BENCH_PURITY_GUARD_BINS;
+    if (!beside_tone && k > BENCH_PURITY_GUARD_BINS && p > spur) {  // Not the tone, nor DC (midscale rounding)
+      spur = p;
+      spur_bin = k;
+    }
+  }
+  const double carrier = re[peak] * re[peak] + im[peak] * im[peak];
+  printf("%s purity: %.0f Hz tone, largest spur %.1f dBc at %.0f Hz\n", profile->name, profile->tx.freq_low,
+         10 * log10(spur / carrier), spur_bin * (double)MODEM_SAMPLE_RATE / n);
+  free(re);
+  free(im);
+}
+
+/**
+ * Prints the time per sample of the DDS in each mode and of sinf() per sample.
+ */
+static void run_cost() {
+  const uint32_t samples_per_symbol = 512;
+  dds_state dds;
+  volatile uint32_t sink = 0;
+  const struct {
+    const char *name;
+    uint32_t ramp_samples;
+    bool chirp;
+  } modes[] = {
+    {"DDS steady tone", 0, false},
+    {"DDS shaped edges", samples_per_symbol / MODEM_RAMP_FRACTION, false},
+    {"DDS chirp", 0, true},
+  };
+
+  printf("cost per sample (this host; %.1f us per sample at %d Hz):\n", 1e6 / MODEM_SAMPLE_RATE, MODEM_SAMPLE_RATE);
+  for (const auto &mode : modes) {
+    initialize_dds(&dds, samples_per_symbol, mode.ramp_samples, BENCH_AMPLITUDE);
+    const uint32_t low = dds_phase_increment(24000, MODEM_SAMPLE_RATE);
+    const uint32_t span = dds_phase_increment(2000, MODEM_SAMPLE_RATE);
+    double start = now_seconds();
+    uint32_t sum = 0;
+    for (uint32_t m = 0; m < BENCH_COST_SAMPLES; m += samples_per_symbol) {
+      if (mode.chirp) {
+        start_dds_chirp(&dds, low, span, 0);
+      } else {
+        start_dds_symbol(&dds, low);
+      }
+      for (uint32_t n = 0; n < samples_per_symbol; n++) {
+        sum += next_dds_sample(&dds);
+      }
+    }
+    sink = sink + sum;
+    printf("  %-20s %6.2f ns\n", mode.name, (now_seconds() - start) * 1e9 / BENCH_COST_SAMPLES);
+  }
+
+  // What transmit_message() used to do: a sinf() per sample, scaled to DAC codes
+  double start = now_seconds();
+  uint32_t sum = 0;
+  const float step = 2 * (float)M_PI * 24000 / MODEM_SAMPLE_RATE;
+  for (uint32_t m = 0; m < BENCH_COST_SAMPLES; m++) {
+    sum += (uint16_t)(DDS_DAC_MIDSCALE + BENCH_AMPLITUDE * sinf(step * (m % samples_per_symbol)));
+  }
+  sink = sink + sum;
+  printf("  %-20s %6.2f ns\n", "sinf() per sample", (now_seconds() - start) * 1e9 / BENCH_COST_SAMPLES);
+  (void)sink;
+}
+
+int main(int argc, char **argv) {
+  const char *only = NULL;
+  int message_bytes = 32;
+  unsigned seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      only = argv[++i];
+    } else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc) {
+      message_bytes = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = (unsigned)atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--profile NAME] [--bytes N] [--seed N]\n", argv[0]);
+      return 2;
+    }
+  }
+  srand(seed);
+
+  bool any = false;
+  for (int p = 0; p < get_modem_profile_count(); p++) {
+    const modem_profile_t *profile = get_modem_profile(p);
+    if (only && strcmp(only, profile->name) != 0) {
+      continue;
+    }
+    any = true;
+    run_occupancy(profile, message_bytes);
+    run_purity(profile);
+    printf("\n");
+  }
+  if (!any) {
+    fprintf(stderr, "no profile named %s\n", only);
+    return 2;
+  }
+  run_cost();
+  return 0;
+}
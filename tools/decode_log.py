@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""Decodes the firmware's binary event log back into readable lines.
+
+The firmware interleaves checksummed binary frames (see firmware/serial_frame.h) with ordinary text on
+its USB serial port. This prints the text as-is and each logged event as
+
+    [   12.345678] tx char 'h' (0x68)
+
+Event names and formats are read from firmware/event_log.h, so the two stay in step.
+
+Usage:
+    stty -F /dev/ttyACM0 raw && tools/decode_log.py /dev/ttyACM0
+    tools/decode_log.py capture.bin          # a file saved with e.g. cat /dev/ttyACM0 > capture.bin
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+FRAME_EVENT_LOG = 1
+MAX_PAYLOAD = 1024
+RECORD = struct.Struct("<IHH3i")
+
+DEFAULT_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "firmware", "event_log.h")
+
+
+def load_events(header_path):
+    """Returns [(name, format)] in event ID order from the EVENT_LOG_EVENTS list."""
+    with open(header_path) as f:
+        text = f.read()
+    entries = re.findall(r'X\((\w+),\s*(?:true|false),\s*"((?:[^"\\]|\\.)*)"\)', text)
+    if not entries:
+        sys.exit("no events found in %s" % header_path)
+    return [(name, fmt.encode().decode("unicode_escape")) for name, fmt in entries]
+
+
+def fletcher16(data):
+    sum1 = sum2 = 0
+    for b in data:
+        sum1 = (sum1 + b) % 255
+        sum2 = (sum2 + sum1) % 255
+    return bytes([sum1, sum2])
+
+
+CONVERSION = re.compile(r"%([-+ 0#]*\d*(?:\.\d+)?)([duxcf%])")
+
+
+def format_event(events, event_id, args):
+    if event_id >= len(events):
+        return "unknown event %d %r" % (event_id, args)
+    name, fmt = events[event_id]
+    remaining = list(args)
+
+    def convert(match):
+        flags, kind = match.groups()
+        if kind == "%":
+            return "%"
+        value = remaining.pop(0) if remaining else 0
+        if kind == "f":
+            value = struct.unpack("<f", struct.pack("<i", value))[0]
+            return ("%" + (flags or ".2") + "f") % value
+        if kind == "u" or kind == "x":
+            value &= 0xFFFFFFFF
+            return ("%" + flags + ("d" if kind == "u" else "x")) % value
+        if kind == "c":
+            return chr(value & 0xFF) if 32 <= (value & 0xFF) < 127 else "\\x%02x" % (value & 0xFF)
+        return ("%" + flags + "d") % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+class FrameReader:
+    """Splits a byte stream into text and frames. Calls on_text(bytes) and on_frame(type, payload)."""
+
+    def __init__(self, on_text, on_frame):
+        self.buffer = bytearray()
+        self.on_text = on_text
+        self.on_frame = on_frame
+        self.bad_frames = 0
+
+    def feed(self, data):
+        self.buffer += data
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                # Keep a trailing first sync byte in case the second is still on its way
+                keep = 1 if self.buffer.endswith(SYNC[:1]) else 0
+                self._text(len(self.buffer) - keep)
+                return
+            self._text(start)
+            if len(self.buffer) < 5:
+                return
+            frame_type = self.buffer[2]
+            length = self.buffer[3] | (self.buffer[4] << 8)
+            if length > MAX_PAYLOAD:
+                self.bad_frames += 1
+                self._text(1)
+                continue
+            if len(self.buffer) < 7 + length:
+                return
+            body = bytes(self.buffer[2:5 + length])
+            if fletcher16(body) != bytes(self.buffer[5 + length:7 + length]):
+                # Not a frame after all (or a corrupted one): treat the sync byte as text and move on
+                self.bad_frames += 1
+                self._text(1)
+                continue
+            del self.buffer[:7 + length]
+            self.on_frame(frame_type, body[3:])
+
+    def _text(self, count):
+        if count > 0:
+            self.on_text(bytes(self.buffer[:count]))
+            del self.buffer[:count]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="serial device or captured file ('-' for stdin)")
+    parser.add_argument("--header", default=DEFAULT_HEADER, help="event_log.h to take event formats from")
+    parser.add_argument("--no-text", action="store_true", help="hide plain-text serial output")
+    args = parser.parse_args()
+
+    events = load_events(args.header)
+    out = sys.stdout
+
+    def on_text(data):
+        if not args.no_text:
+            out.write(data.decode("utf-8", "replace"))
+            out.flush()
+
+    def on_frame(frame_type, payload):
+        if frame_type != FRAME_EVENT_LOG:
+            return
+        for offset in range(0, len(payload) - RECORD.size + 1, RECORD.size):
+            timestamp_us, event_id, _, a0, a1, a2 = RECORD.unpack_from(payload, offset)
+            out.write("[%12.6f] %s\n" % (timestamp_us / 1e6, format_event(events, event_id, (a0, a1, a2))))
+        out.flush()
+
+    reader = FrameReader(on_text, on_frame)
+    source = sys.stdin.buffer if args.source == "-" else open(args.source, "rb", buffering=0)
+    try:
+        while True:
+            data = source.read(4096)
+            if not data:
+                break
+            reader.feed(data)
+    except KeyboardInterrupt:
+        pass
+    if reader.bad_frames:
+        sys.stderr.write("%d bad frames skipped\n" % reader.bad_frames)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,385 @@
+// ==================================================================
+// ILI9341_t3n.cpp
+// Host framebuffer and SPI traffic model behind the fake ILI9341_t3n (see ILI9341_t3n.h)
+// ==================================================================
+#include "ILI9341_t3n.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define ILI9341_CASET               0x2A
+#define ILI9341_PASET               0x2B
+#define ILI9341_RAMWR               0x2C
+
+#define GLYPH_FIRST                 0x20    // Printable ASCII only; anything else draws as a blank cell
+#define GLYPH_LAST                  0x7E
+
+// The library's classic 5x7 font: five columns per glyph, bit 0 at the top. Cells are 6x8 with the
+// sixth column and eighth row left as spacing.
+static const uint8_t glyphs[(GLYPH_LAST - GLYPH_FIRST + 1) * 5] = {
+  0x00, 0x00, 0x00, 0x00, 0x00,  // ' '
+  0x00, 0x00, 0x5F, 0x00, 0x00,  // !
+  0x00, 0x07, 0x00, 0x07, 0x00,  // "
+  0x14, 0x7F, 0x14, 0x7F, 0x14,  // #
+  0x24, 0x2A, 0x7F, 0x2A, 0x12,  // $
+  0x23, 0x13, 0x08, 0x64, 0x62,  // %
+  0x36, 0x49, 0x56, 0x20, 0x50,  // &
+  0x00, 0x08, 0x07, 0x03, 0x00,  // '
+  0x00, 0x1C, 0x22, 0x41, 0x00,  // (
+  0x00, 0x41, 0x22, 0x1C, 0x00,  // )
+  0x2A, 0x1C, 0x7F, 0x1C, 0x2A,  // *
+  0x08, 0x08, 0x3E, 0x08, 0x08,  // +
+  0x00, 0x80, 0x70, 0x30, 0x00,  // ,
+  0x08, 0x08, 0x08, 0x08, 0x08,  // -
+  0x00, 0x00, 0x60, 0x60, 0x00,  // .
+  0x20, 0x10, 0x08, 0x04, 0x02,  // /
+  0x3E, 0x51, 0x49, 0x45, 0x3E,  // 0
+  0x00, 0x42, 0x7F, 0x40, 0x00,  // 1
+  0x72, 0x49, 0x49, 0x49, 0x46,  // 2
+  0x21, 0x41, 0x49, 0x4D, 0x33,  // 3
+  0x18, 0x14, 0x12, 0x7F, 0x10,  // 4
+  0x27, 0x45, 0x45, 0x45, 0x39,  // 5
+  0x3C, 0x4A, 0x49, 0x49, 0x31,  // 6
+  0x41, 0x21, 0x11, 0x09, 0x07,  // 7
+  0x36, 0x49, 0x49, 0x49, 0x36,  // 8
+  0x46, 0x49, 0x49, 0x29, 0x1E,  // 9
+  0x00, 0x00, 0x14, 0x00, 0x00,  // :
+  0x00, 0x40, 0x34, 0x00, 0x00,  // ;
+  0x00, 0x08, 0x14, 0x22, 0x41,  // <
+  0x14, 0x14, 0x14, 0x14, 0x14,  // =
+  0x00, 0x41, 0x22, 0x14, 0x08,  // >
+  0x02, 0x01, 0x59, 0x09, 0x06,  // ?
+  0x3E, 0x41, 0x5D, 0x59, 0x4E,  // @
+  0x7C, 0x12, 0x11, 0x12, 0x7C,  // A
+  0x7F, 0x49, 0x49, 0x49, 0x36,  // B
+  0x3E, 0x41, 0x41, 0x41, 0x22,  // C
+  0x7F, 0x41, 0x41, 0x41, 0x3E,  // D
+  0x7F, 0x49, 0x49, 0x49, 0x41,  // E
+  0x7F, 0x09, 0x09, 0x09, 0x01,  // F
+  0x3E, 0x41, 0x41, 0x51, 0x73,  // G
+  0x7F, 0x08, 0x08, 0x08, 0x7F,  // H
+  0x00, 0x41, 0x7F, 0x41, 0x00,  // I
+  0x20, 0x40, 0x41, 0x3F, 0x01,  // J
+  0x7F, 0x08, 0x14, 0x22, 0x41,  // K
+  0x7F, 0x40, 0x40, 0x40, 0x40,  // L
+  0x7F, 0x02, 0x1C, 0x02, 0x7F,  // M
+  0x7F, 0x04, 0x08, 0x10, 0x7F,  // N
+  0x3E, 0x41, 0x41, 0x41, 0x3E,  // O
+  0x7F, 0x09, 0x09, 0x09, 0x06,  // P
+  0x3E, 0x41, 0x51, 0x21, 0x5E,  // Q
+  0x7F, 0x09, 0x19, 0x29, 0x46,  // R
+  0x26, 0x49, 0x49, 0x49, 0x32,  // S
+  0x03, 0x01, 0x7F, 0x01, 0x03,  // T
+  0x3F, 0x40, 0x40, 0x40, 0x3F,  // U
+  0x1F, 0x20, 0x40, 0x20, 0x1F,  // V
+  0x3F, 0x40, 0x38, 0x40, 0x3F,  // W
+  0x63, 0x14, 0x08, 0x14, 0x63,  // X
+  0x03, 0x04, 0x78, 0x04, 0x03,  // Y
+  0x61, 0x59, 0x49, 0x4D, 0x43,  // Z
+  0x00, 0x7F, 0x41, 0x41, 0x41,  // [
+  0x02, 0x04, 0x08, 0x10, 0x20,  // backslash
+  0x00, 0x41, 0x41, 0x41, 0x7F,  // ]
+  0x04, 0x02, 0x01, 0x02, 0x04,  // ^
+  0x40, 0x40, 0x40, 0x40, 0x40,  // _
+  0x00, 0x03, 0x07, 0x08, 0x00,  // `
+  0x20, 0x54, 0x54, 0x78, 0x40,  // a
+  0x7F, 0x28, 0x44, 0x44, 0x38,  // b
+  0x38, 0x44, 0x44, 0x44, 0x28,  // c
+  0x38, 0x44, 0x44, 0x28, 0x7F,  // d
+  0x38, 0x54, 0x54, 0x54, 0x18,  // e
+  0x00, 0x08, 0x7E, 0x09, 0x02,  // f
+  0x18, 0xA4, 0xA4, 0x9C, 0x78,  // g
+  0x7F, 0x08, 0x04, 0x04, 0x78,  // h
+  0x00, 0x44, 0x7D, 0x40, 0x00,  // i
+  0x20, 0x40, 0x40, 0x3D, 0x00,  // j
+  0x7F, 0x10, 0x28, 0x44, 0x00,  // k
+  0x00, 0x41, 0x7F, 0x40, 0x00,  // l
+  0x7C, 0x04, 0x78, 0x04, 0x78,  // m
+  0x7C, 0x08, 0x04, 0x04, 0x78,  // n
+  0x38, 0x44, 0x44, 0x44, 0x38,  // o
+  0xFC, 0x18, 0x24, 0x24, 0x18,  // p
+  0x18, 0x24, 0x24, 0x18, 0xFC,  // q
+  0x7C, 0x08, 0x04, 0x04, 0x08,  // r
+  0x48, 0x54, 0x54, 0x54, 0x24,  // s
+  0x04, 0x04, 0x3F, 0x44, 0x24,  // t
+  0x3C, 0x40, 0x40, 0x20, 0x7C,  // u
+  0x1C, 0x20, 0x40, 0x20, 0x1C,  // v
+  0x3C, 0x40, 0x30, 0x40, 0x3C,  // w
+  0x44, 0x28, 0x10, 0x28, 0x44,  // x
+  0x4C, 0x90, 0x90, 0x90, 0x7C,  // y
+  0x44, 0x64, 0x54, 0x4C, 0x44,  // z
+  0x00, 0x08, 0x36, 0x41, 0x00,  // {
+  0x00, 0x00, 0x77, 0x00, 0x00,  // |
+  0x00, 0x41, 0x36, 0x08, 0x00,  // }
+  0x02, 0x01, 0x02, 0x04, 0x02,  // ~
+};
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Column c (0..5) of glyph ch, bit 0 at the top. Column 5 is the spacing between cells.
+ */
+static uint8_t glyph_column(unsigned char ch, int c) {
+  if (c >= 5 || ch < GLYPH_FIRST || ch > GLYPH_LAST) {
+    return 0;
+  }
+  return glyphs[(ch - GLYPH_FIRST) * 5 + c];
+}
+
+ILI9341_t3n::ILI9341_t3n(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t)
+    : width_(ILI9341_TFTWIDTH), height_(ILI9341_TFTHEIGHT), cursor_x_(0), cursor_y_(0),
+      text_color_(ILI9341_WHITE), text_background_(ILI9341_WHITE), text_size_(1) {
+  memset(framebuffer_, 0, sizeof(framebuffer_));
+  reset_stats();
+}
+
+/**
+ * Power-up leaves the panel's memory as it was; the firmware clears it with fillScreen() straight after.
+ * The initialization commands themselves aren't counted.
+ */
+void ILI9341_t3n::begin() {
+  window_x0_ = window_x1_ = window_y0_ = window_y1_ = -1;
+}
+
+/**
+ * Rotations 0 and 2 are portrait, 1 and 3 landscape. The framebuffer holds the screen as the viewer sees it,
+ * so only the dimensions change (the panel itself remaps addresses through MADCTL).
+ */
+void ILI9341_t3n::setRotation(uint8_t rotation) {
+  stats_.commands++;
+  stats_.spi_bytes += 2;  // MADCTL and its parameter
+  if (rotation & 1) {
+    width_ = ILI9341_TFTHEIGHT;
+    height_ = ILI9341_TFTWIDTH;
+  } else {
+    width_ = ILI9341_TFTWIDTH;
+    height_ = ILI9341_TFTHEIGHT;
+  }
+  window_x0_ = window_x1_ = window_y0_ = window_y1_ = -1;
+}
+
+void ILI9341_t3n::reset_stats() {
+  memset(&stats_, 0, sizeof(stats_));
+  window_x0_ = window_x1_ = window_y0_ = window_y1_ = -1;
+}
+
+double ILI9341_t3n::bus_time_ms() const {
+  return stats_.spi_bytes * 8 * 1000.0 / ILI9341_EMU_SPI_CLOCK_HZ;
+}
+
+uint16_t ILI9341_t3n::pixel(int x, int y) const {
+  return framebuffer_[y * width_ + x];
+}
+
+/**
+ * Counts opening an address window (already clipped to the screen) the way the library's setAddr() sends it.
+ */
+void ILI9341_t3n::set_window(int x0, int y0, int x1, int y1) {
+  if (x0 != window_x0_ || x1 != window_x1_) {
+    stats_.commands++;
+    stats_.spi_bytes += 5;
+    window_x0_ = x0;
+    window_x1_ = x1;
+  }
+  if (y0 != window_y0_ || y1 != window_y1_) {
+    stats_.commands++;
+    stats_.spi_bytes += 5;
+    window_y0_ = y0;
+    window_y1_ = y1;
+  }
+  stats_.commands++;
+  stats_.spi_bytes += 1;
+  stats_.windows++;
+}
+
+/**
+ * Fills a rectangle as one address window, after clipping it to the screen.
+ */
+void ILI9341_t3n::fill_clipped(int x, int y, int w, int h, uint16_t color) {
+  int x1 = x + w, y1 = y + h;
+  if (x < 0) x = 0;
+  if (y < 0) y = 0;
+  if (x1 > width_) x1 = width_;
+  if (y1 > height_) y1 = height_;
+  if (x >= x1 || y >= y1) {
+    return;
+  }
+  set_window(x, y, x1 - 1, y1 - 1);
+  const uint32_t pixels = (uint32_t)(x1 - x) * (y1 - y);
+  stats_.pixels += pixels;
+  stats_.spi_bytes += 2 * pixels;
+  for (int row = y; row < y1; row++) {
+    for (int col = x; col < x1; col++) {
+      framebuffer_[row * width_ + col] = color;
+    }
+  }
+}
+
+void ILI9341_t3n::fillScreen(uint16_t color) {
+  stats_.draw_calls++;
+  fill_clipped(0, 0, width_, height_, color);
+}
+
+void ILI9341_t3n::drawPixel(int16_t x, int16_t y, uint16_t color) {
+  stats_.draw_calls++;
+  fill_clipped(x, y, 1, 1, color);
+}
+
+void ILI9341_t3n::drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
+  stats_.draw_calls++;
+  fill_clipped(x, y, w, 1, color);
+}
+
+void ILI9341_t3n::drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
+  stats_.draw_calls++;
+  fill_clipped(x, y, 1, h, color);
+}
+
+void ILI9341_t3n::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+  stats_.draw_calls++;
+  fill_clipped(x, y, w, h, color);
+}
+
+/**
+ * Outlines a rectangle as the library does: top and bottom lines, then the sides between them.
+ */
+void ILI9341_t3n::drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+  stats_.draw_calls++;
+  fill_clipped(x, y, w, 1, color);
+  fill_clipped(x, y + h - 1, w, 1, color);
+  fill_clipped(x, y + 1, 1, h - 2, color);
+  fill_clipped(x + w - 1, y + 1, 1, h - 2, color);
+}
+
+/**
+ * Draws a 6x8 character cell scaled by size_x and size_y. With a background colour the whole cell goes out
+ * as one window; with color == bg (transparent), each run of lit pixels in a row goes out as its own.
+ */
+void ILI9341_t3n::drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size_x,
+                           uint8_t size_y) {
+  stats_.draw_calls++;
+  const int cell_w = 6 * size_x, cell_h = 8 * size_y;
+  if (x >= width_ || y >= height_ || x + cell_w <= 0 || y + cell_h <= 0) {
+    return;
+  }
+
+  if (color == bg) {
+    for (int row = 0; row < 8; row++) {
+      int run = 0;
+      for (int col = 0; col <= 5; col++) {
+        if (glyph_column(c, col) & (1 << row)) {
+          run++;
+        } else if (run) {
+          fill_clipped(x + (col - run) * size_x, y + row * size_y, run * size_x, size_y, color);
+          run = 0;
+        }
+      }
+    }
+    return;
+  }
+
+  // Opaque: one window over the visible part of the cell, every pixel written.
+  const int x0 = (x < 0) ? 0 : x, y0 = (y < 0) ? 0 : y;
+  const int x1 = (x + cell_w > width_) ? width_ : x + cell_w;
+  const int y1 = (y + cell_h > height_) ? height_ : y + cell_h;
+  set_window(x0, y0, x1 - 1, y1 - 1);
+  const uint32_t pixels = (uint32_t)(x1 - x0) * (y1 - y0);
+  stats_.pixels += pixels;
+  stats_.spi_bytes += 2 * pixels;
+  for (int py = y0; py < y1; py++) {
+    for (int px = x0; px < x1; px++) {
+      const int col = (px - x) / size_x, row = (py - y) / size_y;
+      framebuffer_[py * width_ + px] = ((row < 8) && (glyph_column(c, col) & (1 << row))) ? color : bg;
+    }
+  }
+}
+
+void ILI9341_t3n::setCursor(int16_t x, int16_t y) {
+  cursor_x_ = x;
+  cursor_y_ = y;
+}
+
+void ILI9341_t3n::getCursor(int16_t *x, int16_t *y) const {
+  *x = cursor_x_;
+  *y = cursor_y_;
+}
+
+void ILI9341_t3n::setTextColor(uint16_t color) {
+  text_color_ = color;
+  text_background_ = color;
+}
+
+void ILI9341_t3n::setTextColor(uint16_t color, uint16_t background) {
+  text_color_ = color;
+  text_background_ = background;
+}
+
+void ILI9341_t3n::setTextSize(uint8_t size) {
+  text_size_ = (size > 0) ? size : 1;
+}
+
+/**
+ * Prints one character at the cursor in the text colours, wrapping at the right edge like the library.
+ */
+size_t ILI9341_t3n::write(uint8_t c) {
+  if (c == '\n') {
+    cursor_y_ += 8 * text_size_;
+    cursor_x_ = 0;
+  } else if (c != '\r') {
+    if (cursor_x_ + 6 * text_size_ > width_) {
+      cursor_y_ += 8 * text_size_;
+      cursor_x_ = 0;
+    }
+    drawChar(cursor_x_, cursor_y_, c, text_color_, text_background_, text_size_, text_size_);
+    cursor_x_ += 6 * text_size_;
+  }
+  return 1;
+}
+
+size_t ILI9341_t3n::print(const char *text) {
+  size_t n = 0;
+  while (text[n]) {
+    write(text[n++]);
+  }
+  return n;
+}
+
+int ILI9341_t3n::printf(const char *format, ...) {
+  char text[128];
+  va_list args;
+  va_start(args, format);
+  const int length = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  print(text);
+  return length;
+}
+
+/**
+ * Prints text with its top left corner at (x, y) and returns its width in pixels.
+ */
+int16_t ILI9341_t3n::drawString(const char *text, int x, int y) {
+  setCursor(x, y);
+  return print(text) * 6 * text_size_;
+}
+
+/**
+ * Writes the screen as a binary PPM, expanding RGB565 to 8 bits per channel.
+ */
+bool ILI9341_t3n::write_ppm(const char *path) const {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+  fprintf(file, "P6\n%d %d\n255\n", width_, height_);
+  for (int i = 0; i < width_ * height_; i++) {
+    const uint16_t c = framebuffer_[i];
+    const uint8_t r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+    const uint8_t rgb[3] = {(uint8_t)((r << 3) | (r >> 2)), (uint8_t)((g << 2) | (g >> 4)),
+                            (uint8_t)((b << 3) | (b >> 2))};
+    fwrite(rgb, 1, sizeof(rgb), file);
+  }
+  return fclose(file) == 0;
+}
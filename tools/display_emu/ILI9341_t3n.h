@@ -0,0 +1,116 @@
+// ==================================================================
+// ILI9341_t3n.h
+// Stands in for the ILI9341_t3n library on a host: draws into a memory framebuffer and models the SPI traffic
+// ==================================================================
+//
+// Put tools/display_emu ahead of firmware on the include path and firmware/display.cpp builds against this
+// instead of the real library. Only the calls the firmware makes are here. Each one draws what the panel
+// would show (in screen coordinates, after rotation) and adds up the bytes the real library would clock out
+// for it, the same way it would send them:
+// - Every fill, line and opaque glyph opens an address window: CASET and PASET (a command byte and four data
+//   bytes each, skipped when the columns or rows are those of the previous window) and RAMWR, then two bytes
+//   per pixel.
+// - A transparent glyph (text colour == background colour) goes out as one window per horizontal run of lit
+//   pixels.
+// - Anything fully outside the screen sends nothing; anything partly outside is clipped first.
+#ifndef ILI9341_T3N_H
+#define ILI9341_T3N_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>  // for memset, strnlen (display.cpp gets these through Arduino.h on the Teensy)
+
+//---- Panel Configuration ----
+#define ILI9341_TFTWIDTH            240
+#define ILI9341_TFTHEIGHT           320
+#define ILI9341_EMU_SPI_CLOCK_HZ    30000000  // ILI9341_SPICLOCK, the library's default write clock
+
+#define ILI9341_BLACK               0x0000
+#define ILI9341_NAVY                0x000F
+#define ILI9341_DARKGREEN           0x03E0
+#define ILI9341_DARKCYAN            0x03EF
+#define ILI9341_MAROON              0x7800
+#define ILI9341_PURPLE              0x780F
+#define ILI9341_OLIVE               0x7BE0
+#define ILI9341_LIGHTGREY           0xC618
+#define ILI9341_DARKGREY            0x7BEF
+#define ILI9341_BLUE                0x001F
+#define ILI9341_GREEN               0x07E0
+#define ILI9341_CYAN                0x07FF
+#define ILI9341_RED                 0xF800
+#define ILI9341_MAGENTA             0xF81F
+#define ILI9341_YELLOW              0xFFE0
+#define ILI9341_WHITE               0xFFFF
+#define ILI9341_ORANGE              0xFD20
+#define ILI9341_GREENYELLOW         0xAFE5
+#define ILI9341_PINK                0xF81F
+
+// Arduino pin calls display.cpp makes (no-ops here):
+#define OUTPUT                      1
+#define HIGH                        1
+#define LOW                         0
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+// What the panel has been sent since the counters were last reset:
+typedef struct {
+  uint32_t draw_calls;         // Fills, lines, rects and glyphs (a string counts once per char)
+  uint32_t windows;            // Address windows opened (each ends in a RAMWR)
+  uint32_t commands;           // Command bytes (CASET, PASET, RAMWR)
+  uint32_t pixels;             // Pixels written
+  uint64_t spi_bytes;          // Commands, their parameters and pixel data
+} ili9341_emu_stats_t;
+
+class ILI9341_t3n {
+ public:
+  ILI9341_t3n(uint8_t cs, uint8_t dc, uint8_t rst = 255, uint8_t mosi = 11, uint8_t sclk = 13, uint8_t miso = 12);
+
+  void begin();
+  void setRotation(uint8_t rotation);
+  int16_t width() const { return width_; }
+  int16_t height() const { return height_; }
+
+  void fillScreen(uint16_t color);
+  void drawPixel(int16_t x, int16_t y, uint16_t color);
+  void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color);
+  void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color);
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+  void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size_x, uint8_t size_y);
+
+  void setCursor(int16_t x, int16_t y);
+  void getCursor(int16_t *x, int16_t *y) const;
+  void setTextColor(uint16_t color);
+  void setTextColor(uint16_t color, uint16_t background);
+  void setTextSize(uint8_t size);
+  size_t write(uint8_t c);
+  size_t print(const char *text);
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  int16_t drawString(const char *text, int x, int y);
+
+  // Emulator only:
+  const ili9341_emu_stats_t &stats() const { return stats_; }
+  void reset_stats();
+  // Modeled time to clock stats().spi_bytes out at ILI9341_EMU_SPI_CLOCK_HZ:
+  double bus_time_ms() const;
+  uint16_t pixel(int x, int y) const;
+  // Writes the screen as a binary PPM (P6), 8 bits per channel. Returns false if the file can't be written.
+  bool write_ppm(const char *path) const;
+
+ private:
+  void set_window(int x0, int y0, int x1, int y1);
+  void fill_clipped(int x, int y, int w, int h, uint16_t color);
+
+  uint16_t framebuffer_[ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT];  // Row-major, as the viewer sees the screen
+  int16_t width_, height_;
+  int16_t cursor_x_, cursor_y_;
+  uint16_t text_color_, text_background_;
+  uint8_t text_size_;
+  // Last window sent, so unchanged CASET/PASET can be skipped like the library does (-1 until the first):
+  int window_x0_, window_x1_, window_y0_, window_y1_;
+  ili9341_emu_stats_t stats_;
+};
+
+#endif
@@ -0,0 +1,304 @@
+// ==================================================================
+// display_bench.cpp
+// Measures the SPI traffic of each UI redraw and snapshots the screen, using firmware/display.cpp on a host
+// ==================================================================
+//
+// Links the firmware's display.cpp against the fake ILI9341_t3n in this directory, fills the chat history
+// with MAX_CHAT_MESSAGES messages and drives the redraws the firmware makes for each UI event: a message
+// arriving (or a fragment filling in), scrolling to every position, typing each character of a full typing
+// box, sending, and the battery readout. For each it prints the draw calls and bytes sent, and the bus time
+// they take at the library's SPI clock, worst case and mean over the event's variations. It runs a history
+// of mixed lengths and one of full-length messages.
+//
+// With --snapshots the screen after a fixed set of events is written as PPM files; with --compare each is
+// compared against a set written earlier instead and the exit status is 1 if any pixel differs. No set is
+// kept in the repo: write one from the tree before a change to display.cpp, then compare after it.
+//
+// Build from the repo root:
+//
+//   g++ -std=gnu++14 -O2 -DPROFILING_ENABLED=0 -Itools/display_emu -Ifirmware
+//       tools/display_emu/{display_bench,ILI9341_t3n}.cpp firmware/display.cpp -o display_bench
+//   (the g++ command is one line, wrapped here)
+//
+// Usage: display_bench [--snapshots DIR | --compare DIR]
+//   --snapshots  write boot.ppm, history.ppm, scrolled.ppm, typing.ppm and long.ppm to DIR
+//   --compare    compare against those files in DIR instead
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "display.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+// Defined by comm.cpp in the firmware:
+char tx_display_buffer[MAX_TEXT_LENGTH];
+uint16_t tx_display_buffer_length = 0;
+
+#define BENCH_START_TIME            1700000000  // First message's timestamp (UTC)
+#define BENCH_MESSAGE_INTERVAL_S    97          // Between messages, so timestamps vary
+
+static const char *const phrases[] = {
+  "ok", "low on air", "turning back", "look left", "ascending now", "meet at the anchor line",
+  "turtle under the ledge!", "how much air?", "100 bar", "stay with your buddy", "safety stop 3 min",
+};
+#define PHRASE_COUNT (sizeof(phrases) / sizeof(phrases[0]))
+
+// Message lengths in the mixed history, cycled through:
+static const int mixed_lengths[] = {12, 40, 5, 90, 28, 160, 16, 60, 3, 33, 250, 20};
+#define MIXED_LENGTH_COUNT (sizeof(mixed_lengths) / sizeof(mixed_lengths[0]))
+
+typedef struct {
+  const char *name;
+  int variations;
+  uint32_t max_draw_calls;
+  uint32_t max_windows;
+  uint64_t max_spi_bytes;
+  double max_ms;
+  double total_ms;
+} bench_event_t;
+
+static ChatBufferState state;
+static bool snapshots_failed = false;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+/**
+ * Fills text with length chars of phrases, starting at phrase first.
+ */
+static void fill_text(char *text, int length, int first) {
+  int n = 0;
+  for (int p = first; n < length; p++) {
+    const char *phrase = phrases[p % PHRASE_COUNT];
+    for (int i = 0; phrase[i] && n < length; i++) {
+      text[n++] = phrase[i];
+    }
+    if (n < length) {
+      text[n++] = ' ';
+    }
+  }
+  text[n] = '\0';
+}
+
+/**
+ * Fills the chat history with MAX_CHAT_MESSAGES messages: mostly incoming, some relayed, and the newest one
+ * still missing fragments. With longest, every message is as long as a message can be.
+ */
+static void fill_history(bool longest) {
+  memset(&state, 0, sizeof(state));
+  for (int i = 0; i < MAX_CHAT_MESSAGES; i++) {
+    message_t *m = &state.chat_history[i];
+    m->timestamp = BENCH_START_TIME + i * BENCH_MESSAGE_INTERVAL_S;
+    fill_text(m->text, longest ? MAX_TEXT_LENGTH - 1 : mixed_lengths[i % MIXED_LENGTH_COUNT], i);
+    if (i % 3 != 0) {
+      m->flags |= MESSAGE_FLAG_INCOMING;
+      if (i % 7 == 3) {
+        m->flags |= MESSAGE_FLAG_RELAYED;
+      }
+    }
+  }
+  state.chat_history[MAX_CHAT_MESSAGES - 1].flags = MESSAGE_FLAG_INCOMING | MESSAGE_FLAG_PARTIAL;
+  state.chat_history_message_count = MAX_CHAT_MESSAGES;
+  state.message_buffer_write_index = 0;
+}
+
+/**
+ * Sets the typing box contents to the first length chars a diver might type (with a line break or two).
+ */
+static void set_typing_text(int length) {
+  fill_text(tx_display_buffer, length, 4);
+  for (int i = 45; i < length; i += 70) {
+    tx_display_buffer[i] = '\n';
+  }
+  tx_display_buffer_length = length;
+}
+
+/**
+ * Mirrors poll_battery(), which prints over the top left corner once a second.
+ */
+static void draw_battery() {
+  tft.setTextColor(ILI9341_BLACK, ILI9341_WHITE);
+  int16_t x, y;
+  tft.getCursor(&x, &y);
+  tft.setCursor(2, 2);
+  tft.printf("battery %.2fV", 3.87);
+  tft.setCursor(x, y);
+}
+
+static void begin_measurement() {
+  tft.reset_stats();
+}
+
+static void end_measurement(bench_event_t *event) {
+  const ili9341_emu_stats_t &stats = tft.stats();
+  const double ms = tft.bus_time_ms();
+  if (ms > event->max_ms) {
+    event->max_ms = ms;
+    event->max_draw_calls = stats.draw_calls;
+    event->max_windows = stats.windows;
+    event->max_spi_bytes = stats.spi_bytes;
+  }
+  event->total_ms += ms;
+  event->variations++;
+}
+
+static void print_event(const bench_event_t *event) {
+  printf("  %-16s %5d %10u %8u %10.1f %9.2f %9.2f\n", event->name, event->variations, event->max_draw_calls,
+         event->max_windows, event->max_spi_bytes / 1024.0, event->max_ms, event->total_ms / event->variations);
+}
+
+/**
+ * Writes the screen to dir/name.ppm, or with compare compares it against that file and reports any difference.
+ */
+static void snapshot(const char *dir, bool compare, const char *name) {
+  if (!dir) {
+    return;
+  }
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s.ppm", dir, name);
+  if (!compare) {
+    if (!tft.write_ppm(path)) {
+      fprintf(stderr, "can't write %s\n", path);
+      snapshots_failed = true;
+    }
+    return;
+  }
+
+  FILE *file = fopen(path, "rb");
+  int width = 0, height = 0, max_value = 0;
+  if (!file || fscanf(file, "P6 %d %d %d", &width, &height, &max_value) != 3 || fgetc(file) == EOF ||
+      width != tft.width() || height != tft.height() || max_value != 255) {
+    printf("  %-12s missing or not a %dx%d PPM\n", name, tft.width(), tft.height());
+    snapshots_failed = true;
+    if (file) {
+      fclose(file);
+    }
+    return;
+  }
+  int differing = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t rgb[3];
+      if (fread(rgb, 1, sizeof(rgb), file) != sizeof(rgb)) {
+        differing++;
+        continue;
+      }
+      const uint16_t c = tft.pixel(x, y);
+      const uint8_t r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+      if (rgb[0] != ((r << 3) | (r >> 2)) || rgb[1] != ((g << 2) | (g >> 4)) || rgb[2] != ((b << 3) | (b >> 2))) {
+        differing++;
+      }
+    }
+  }
+  fclose(file);
+  printf("  %-12s %s", name, differing ? "DIFFERS" : "matches");
+  if (differing) {
+    printf(" (%d pixels)", differing);
+    snapshots_failed = true;
+  }
+  printf("\n");
+}
+
+/**
+ * Runs every UI event over one history and prints what each costs on the bus.
+ */
+static void run_bench(bool longest, const char *snapshot_dir, bool compare) {
+  bench_event_t boot = {"boot"}, arrive = {"message arrives"}, scroll = {"scroll"}, key = {"keypress"},
+                send = {"send"}, battery = {"battery"};
+
+  begin_measurement();
+  setup_screen();
+  draw_battery();
+  end_measurement(&boot);
+  if (!longest) {
+    snapshot(snapshot_dir, compare, "boot");
+  }
+
+  fill_history(longest);
+  begin_measurement();
+  display_chat_history(&state);
+  end_measurement(&arrive);
+  snapshot(snapshot_dir, compare, longest ? "long" : "history");
+
+  for (int offset = 1; offset < state.chat_history_message_count; offset++) {
+    state.message_scroll_offset = offset;
+    begin_measurement();
+    display_chat_history(&state);
+    end_measurement(&scroll);
+    if (offset == 10 && !longest) {
+      snapshot(snapshot_dir, compare, "scrolled");
+    }
+  }
+  state.message_scroll_offset = 0;
+  display_chat_history(&state);
+
+  for (int length = 1; length < MAX_TEXT_LENGTH; length++) {
+    set_typing_text(length);
+    begin_measurement();
+    redraw_typing_box();
+    end_measurement(&key);
+    if (length == 100 && !longest) {
+      snapshot(snapshot_dir, compare, "typing");
+    }
+  }
+
+  // Sending adds the message to the history and redraws it, then clears the typing box:
+  for (int length = 1; length < MAX_TEXT_LENGTH; length += 37) {
+    set_typing_text(length);
+    message_t *m = &state.chat_history[state.message_buffer_write_index];
+    m->timestamp = BENCH_START_TIME + MAX_CHAT_MESSAGES * BENCH_MESSAGE_INTERVAL_S;
+    memcpy(m->text, tx_display_buffer, length + 1);
+    m->flags = 0;
+    state.message_buffer_write_index = (state.message_buffer_write_index + 1) % MAX_CHAT_MESSAGES;
+    begin_measurement();
+    display_chat_history(&state);
+    reset_tx_display_buffer();
+    redraw_typing_box();
+    end_measurement(&send);
+  }
+
+  begin_measurement();
+  draw_battery();
+  end_measurement(&battery);
+
+  printf("%s history, %d messages (bus time at %d MHz SPI):\n", longest ? "full-length" : "mixed-length",
+         state.chat_history_message_count, ILI9341_EMU_SPI_CLOCK_HZ / 1000000);
+  printf("  %-16s %5s %10s %8s %10s %9s %9s\n", "event", "runs", "draw calls", "windows", "KiB", "worst ms", "mean ms");
+  print_event(&boot);
+  print_event(&arrive);
+  print_event(&scroll);
+  print_event(&key);
+  print_event(&send);
+  print_event(&battery);
+}
+
+int main(int argc, char **argv) {
+  const char *snapshot_dir = NULL;
+  bool compare = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--snapshots") == 0 && i + 1 < argc) {
+      snapshot_dir = argv[++i];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      snapshot_dir = argv[++i];
+      compare = true;
+    } else {
+      fprintf(stderr, "usage: %s [--snapshots DIR | --compare DIR]\n", argv[0]);
+      return 2;
+    }
+  }
+  // Timestamps render the same wherever the snapshots are made:
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  run_bench(false, snapshot_dir, compare);
+  printf("\n");
+  run_bench(true, snapshot_dir, compare);
+  return snapshots_failed ? 1 : 0;
+}
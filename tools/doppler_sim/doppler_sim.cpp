@@ -0,0 +1,329 @@
+// ==================================================================
+// doppler_sim.cpp
+// Drives the receiver's Doppler tracker with time-varying Doppler and reports how closely it follows
+// ==================================================================
+//
+// Transmits back-to-back text packets with the firmware's own DDS, time-warps the waveform as a sender
+// moving at v(t) would (received time runs at 1 + v/c of transmitted time, so tones and symbol rate scale
+// together), adds noise, and runs the result through the same receiver.cpp the firmware runs. Every
+// EVENT_DOPPLER_RETUNE is compared with the true offset, center * v/c, at each block:
+// - ramp: v goes from -speed to +speed over the run (steady acceleration, e.g. a boat passing)
+// - sine: v = speed * sin(2 pi t / period) (e.g. swell heaving a diver or a hull)
+// Prints the tracking error (mean, RMS and largest, after the first few seconds of acquisition) next to
+// the RMS offset with no compensation at all, and how many packets still decoded.
+//
+// Build from the repo root, with CMSIS-DSP as for tools/replay:
+//
+//   CMSIS="-I$CMSIS_DSP/Include -I$CMSIS_DSP/PrivateInclude -I$CMSIS_CORE/Include"
+//   FIRMWARE="receiver carrier_sense frontend dpsk equalizer chirp doppler sdft deframer"
+//   FIRMWARE="$FIRMWARE modem_profile goertzel sine_table dds"
+//   DSP="BasicMath ComplexMath Filtering Statistics Transform FastMath"
+//   g++ -std=gnu++14 -O2 -DPROFILING_ENABLED=0 -Ifirmware $CMSIS tools/doppler_sim/doppler_sim.cpp
+//       $(for f in $FIRMWARE; do echo firmware/$f.cpp; done)
+//       $(for d in $DSP; do echo $CMSIS_DSP/Source/${d}Functions/${d}Functions.c; done)
+//       $CMSIS_DSP/Source/CommonTables/CommonTables.c -lm -o doppler_sim
+//   (the g++ command is one line, wrapped here)
+//
+// Usage: doppler_sim [--profile NAME] [--trajectory ramp|sine] [--speed M_PER_S] [--period S] [--seconds S]
+//                    [--noise COUNTS] [--stagger] [--seed N] [--trace]
+//   --profile     only this profile (default: every FSK and PSK profile; CSS does not track Doppler)
+//   --trajectory  only this trajectory (default: both)
+//   --speed       peak radial speed (default 1.5 m/s: 15 Hz at 15 kHz)
+//   --period      sine period (default 8 s)
+//   --seconds     length of the run (default 60)
+//   --noise       RMS noise added to the ADC codes (default 60; the signal peaks at 300)
+//   --stagger     leave SIM_STAGGER_GAP_S between packets (so the noise floor and each packet's arrival are
+//                 measured, as between real packets) and start each a random fraction of a symbol late, off
+//                 the receiver's symbol grid (e.g. --speed 0 --stagger --noise 200 for FSK symbol timing)
+//   --seed        random seed (default 1)
+//   --trace       also print time, true offset and compensation for every block
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dds.h"
+#include "deframer.h"
+#include "event_log.h"
+#include "link.h"
+#include "modem_profile.h"
+#include "receiver.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define SIM_AMPLITUDE               300     // Received peak, in ADC counts
+#define SIM_INTERPOLATION_TAPS      16      // Windowed-sinc taps for the time warp
+#define SIM_ACQUISITION_S           3.0     // Left out of the error statistics
+#define SIM_PACKET_GAP_S            0.05    // Silence between packets (well inside the tracker's memory)
+#define SIM_STAGGER_GAP_S           0.3     // With --stagger: more than two ADC blocks, so one is all noise
+
+static const char sim_text[] = "doppler sim: packet payload text";
+
+typedef enum {
+  SIM_RAMP,
+  SIM_SINE,
+  SIM_TRAJECTORY_COUNT
+} sim_trajectory_t;
+
+static const char *const sim_trajectory_names[SIM_TRAJECTORY_COUNT] = {"ramp", "sine"};
+
+typedef struct {
+  sim_trajectory_t trajectory;
+  double speed;
+  double period;
+  double seconds;
+  double noise;
+  bool stagger;
+  bool trace;
+} sim_options_t;
+
+static deframer_state deframer;
+static int packets_decoded = 0;
+static float applied_hz = 0;
+
+// ------------------------------------------------------------------
+// Firmware hooks
+// ------------------------------------------------------------------
+
+/**
+ * Stands in for the firmware's event ring: keeps the compensation the receiver last applied.
+ */
+void log_event(event_id_t id, int32_t arg0, int32_t arg1, int32_t arg2) {
+  (void)arg1;
+  (void)arg2;
+  if (id == EVENT_DOPPLER_RETUNE) {
+    memcpy(&applied_hz, &arg0, sizeof(applied_hz));
+  }
+}
+
+static void receive_bit(int bit) {
+  if (update_deframer(&deframer, bit) && deframer.header.type == MAC_FRAME_TEXT &&
+      deframer.text_length == (int)strlen(sim_text) && memcmp(deframer.text, sim_text, deframer.text_length) == 0) {
+    packets_decoded++;
+  }
+}
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static double gauss() {
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double sender_speed(const sim_options_t *options, double t) {
+  if (options->trajectory == SIM_RAMP) {
+    return options->speed * (2 * t / options->seconds - 1);
+  }
+  return options->speed * sin(2 * M_PI * t / options->period);
+}
+
+/**
+ * Appends one packet's waveform (preamble, then SOH STX, MAC header, text, ETX EOT, as packetize_message()
+ * lays it out) to x at MODEM_SAMPLE_RATE, DAC codes less DDS_DAC_MIDSCALE scaled to SIM_AMPLITUDE. Symbols
+ * start as comm.cpp's start_tx_symbol() starts them.
+ */
+static uint32_t append_packet(const modem_profile_t *profile, uint8_t sequence, float *x) {
+  const tx_parameters_t *tx = &profile->tx;
+  uint8_t packet[MAC_PACKET_OVERHEAD + sizeof(sim_text)];
+  mac_header_t header = {};
+  header.type = MAC_FRAME_TEXT;
+  header.destination = MAC_BROADCAST_ADDRESS;
+  header.source = 1;
+  header.sequence = sequence;
+  header.length = (uint16_t)strlen(sim_text);
+  packet[0] = 0x01;
+  packet[1] = 0x02;
+  memcpy(&packet[2], &header, sizeof(header));
+  memcpy(&packet[2 + sizeof(header)], sim_text, header.length);
+  packet[2 + sizeof(header) + header.length] = 0x03;
+  packet[3 + sizeof(header) + header.length] = 0x04;
+  const int length = 4 + sizeof(header) + header.length;
+
+  const uint32_t samples_per_symbol = (uint64_t)tx->usec_per_symbol * MODEM_SAMPLE_RATE / 1000000;
+  const uint32_t low = dds_phase_increment(tx->freq_low, MODEM_SAMPLE_RATE);
+  const uint32_t high = dds_phase_increment(tx->freq_high, MODEM_SAMPLE_RATE);
+  const int bits = tx->bits_per_symbol;
+  static const uint32_t dqpsk_quarter_turns[4] = {0, 1, 3, 2};
+  dds_state dds;
+  initialize_dds(&dds, samples_per_symbol, (tx->shape_symbol_edges) ? samples_per_symbol / MODEM_RAMP_FRACTION : 0,
+                 DDS_DAC_FULL_AMPLITUDE);
+
+  uint32_t m = 0;
+  for (int k = 0; k < MODEM_PREAMBLE_SYMBOLS + length * (8 / bits); k++) {
+    uint32_t symbol;
+    if (k < MODEM_PREAMBLE_SYMBOLS) {
+      symbol = (tx->modulation == MODEM_MODULATION_FSK) ? (k & 1) : (1U << bits) - 1;
+    } else {
+      const int bit_index = (k - MODEM_PREAMBLE_SYMBOLS) * bits;
+      symbol = (packet[bit_index / 8] >> (8 - bits - bit_index % 8)) & ((1U << bits) - 1);
+    }
+    if (tx->modulation == MODEM_MODULATION_FSK) {
+      start_dds_symbol(&dds, (symbol) ? high : low);
+    } else {
+      start_dds_symbol(&dds, low);
+      shift_dds_phase(&dds, ((tx->modulation == MODEM_MODULATION_DBPSK) ? 2 * symbol : dqpsk_quarter_turns[symbol]) << 30);
+    }
+    for (uint32_t n = 0; n < samples_per_symbol; n++) {
+      x[m++] = ((float)next_dds_sample(&dds) - DDS_DAC_MIDSCALE) * SIM_AMPLITUDE / DDS_DAC_FULL_AMPLITUDE;
+    }
+  }
+  return m;
+}
+
+/**
+ * The transmitted waveform at fractional sample time tau, by Blackman-windowed sinc interpolation.
+ */
+static float interpolate(const float *x, uint32_t count, double tau) {
+  const int32_t base = (int32_t)floor(tau);
+  const double fraction = tau - base;
+  double sum = 0;
+  for (int j = 1 - SIM_INTERPOLATION_TAPS / 2; j <= SIM_INTERPOLATION_TAPS / 2; j++) {
+    const int32_t at = base + j;
+    if (at < 0 || at >= (int32_t)count) {
+      continue;
+    }
+    const double d = j - fraction;
+    const double sinc = (fabs(d) < 1e-9) ? 1 : sin(M_PI * d) / (M_PI * d);
+    const double w = 0.42 + 0.5 * cos(M_PI * d / (SIM_INTERPOLATION_TAPS / 2)) +
+                     0.08 * cos(2 * M_PI * d / (SIM_INTERPOLATION_TAPS / 2));
+    sum += x[at] * sinc * w;
+  }
+  return (float)sum;
+}
+
+/**
+ * Runs one profile along one trajectory and prints the tracking error and packets decoded.
+ */
+static void run(const modem_profile_t *profile, const sim_options_t *options) {
+  // The transmitter sends for a little longer than the run, since an approaching sender's signal is
+  // compressed into less receive time:
+  const double max_scale = 1 + options->speed / LINK_SOUND_SPEED_M_PER_S;
+  const uint32_t tx_count = (uint32_t)(options->seconds * max_scale * MODEM_SAMPLE_RATE) + MODEM_SAMPLE_RATE;
+  float *tx = (float *)calloc(tx_count, sizeof(float));
+  const uint32_t packet_samples = append_packet(profile, 0, tx);
+  const uint32_t gap = (uint32_t)(((options->stagger) ? SIM_STAGGER_GAP_S : SIM_PACKET_GAP_S) * MODEM_SAMPLE_RATE);
+  int packets_sent = 0;
+  uint32_t tx_end = 0;
+  const uint32_t symbol_samples = (uint64_t)profile->tx.usec_per_symbol * MODEM_SAMPLE_RATE / 1000000;
+  for (uint32_t at = 0; at + packet_samples <= (uint32_t)(options->seconds * MODEM_SAMPLE_RATE);
+       at += packet_samples + gap) {
+    if (options->stagger) {
+      at += (uint32_t)rand() % symbol_samples;
+      if (at + packet_samples > (uint32_t)(options->seconds * MODEM_SAMPLE_RATE)) {
+        break;
+      }
+    }
+    append_packet(profile, (uint8_t)packets_sent++, &tx[at]);
+    tx_end = at + packet_samples;
+  }
+
+  initialize_receiver(profile, receive_bit);
+  initialize_deframer(&deframer);
+  packets_decoded = 0;
+  applied_hz = 0;
+
+  static uint16_t block[RECEIVER_BLOCK_SAMPLES];
+  const uint32_t block_count = (uint32_t)(options->seconds * MODEM_SAMPLE_RATE / RECEIVER_BLOCK_SAMPLES);
+  double tau = 0;
+  double error_sum = 0, error_sum2 = 0, error_max = 0, truth_sum2 = 0;
+  int measured = 0;
+  for (uint32_t b = 0; b < block_count; b++) {
+    for (uint32_t n = 0; n < RECEIVER_BLOCK_SAMPLES; n++) {
+      const double t = (double)(b * RECEIVER_BLOCK_SAMPLES + n) / MODEM_SAMPLE_RATE;
+      // Approaching (v > 0) compresses: more transmitted time passes per received sample
+      tau += 1 + sender_speed(options, t) / LINK_SOUND_SPEED_M_PER_S;
+      double value = DDS_DAC_MIDSCALE + interpolate(tx, tx_count, tau) + options->noise * gauss();
+      block[n] = (uint16_t)((value < 0) ? 0 : (value > 4095) ? 4095 : lround(value));
+    }
+    const uint32_t timestamp_us = (uint32_t)((uint64_t)b * RECEIVER_BLOCK_SAMPLES * 1000000 / MODEM_SAMPLE_RATE);
+    process_receiver_samples(block, RECEIVER_BLOCK_SAMPLES, timestamp_us);
+
+    const double t = (double)(b + 1) * RECEIVER_BLOCK_SAMPLES / MODEM_SAMPLE_RATE;
+    const double truth_hz = profile->center_hz * sender_speed(options, t) / LINK_SOUND_SPEED_M_PER_S;
+    if (options->trace) {
+      printf("  %8.3f s  true %7.2f Hz  compensating %7.2f Hz\n", t, truth_hz, applied_hz);
+    }
+    if (t < SIM_ACQUISITION_S || tau >= tx_end) {
+      continue;  // Still acquiring, or the last packet has ended (and compensation rightly lapses)
+    }
+    const double error = applied_hz - truth_hz;
+    error_sum += error;
+    error_sum2 += error * error;
+    error_max = fmax(error_max, fabs(error));
+    truth_sum2 += truth_hz * truth_hz;
+    measured++;
+  }
+  free(tx);
+
+  const double mean = error_sum / measured;
+  printf("%-9s %s %.1f m/s", profile->name, sim_trajectory_names[options->trajectory], options->speed);
+  if (options->trajectory == SIM_SINE) {
+    printf(" every %.0f s", options->period);
+  }
+  printf(": tracking error mean %+5.2f  rms %5.2f  max %5.2f Hz (uncompensated rms %5.2f Hz), %d/%d packets\n",
+         mean, sqrt(error_sum2 / measured), error_max, sqrt(truth_sum2 / measured), packets_decoded, packets_sent);
+}
+
+int main(int argc, char **argv) {
+  const char *only_profile = NULL;
+  int only_trajectory = -1;
+  sim_options_t options = {SIM_RAMP, 1.5, 8, 60, 60, false, false};
+  unsigned seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      only_profile = argv[++i];
+    } else if (strcmp(argv[i], "--trajectory") == 0 && i + 1 < argc) {
+      i++;
+      only_trajectory = (strcmp(argv[i], "ramp") == 0) ? SIM_RAMP : (strcmp(argv[i], "sine") == 0) ? SIM_SINE : -2;
+    } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      options.speed = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--period") == 0 && i + 1 < argc) {
+      options.period = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      options.seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--noise") == 0 && i + 1 < argc) {
+      options.noise = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--stagger") == 0) {
+      options.stagger = true;
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = (unsigned)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      options.trace = true;
+    } else {
+      only_trajectory = -2;
+      break;
+    }
+  }
+  if (only_trajectory == -2 || options.seconds <= SIM_ACQUISITION_S) {
+    fprintf(stderr, "usage: %s [--profile NAME] [--trajectory ramp|sine] [--speed M_PER_S] [--period S] "
+                    "[--seconds S] [--noise COUNTS] [--stagger] [--seed N] [--trace]\n", argv[0]);
+    return 2;
+  }
+  srand(seed);
+
+  bool any = false;
+  for (int p = 0; p < get_modem_profile_count(); p++) {
+    const modem_profile_t *profile = get_modem_profile(p);
+    if (profile->modulation == MODEM_MODULATION_CSS || (only_profile && strcmp(only_profile, profile->name) != 0)) {
+      continue;
+    }
+    any = true;
+    for (int trajectory = 0; trajectory < SIM_TRAJECTORY_COUNT; trajectory++) {
+      if (only_trajectory >= 0 && trajectory != only_trajectory) {
+        continue;
+      }
+      options.trajectory = (sim_trajectory_t)trajectory;
+      run(profile, &options);
+    }
+  }
+  if (!any) {
+    fprintf(stderr, "no FSK or PSK profile named %s\n", only_profile);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,306 @@
+// ==================================================================
+// echo_sim.cpp
+// Runs the PSK demodulator and its equalizer through a two-path echo channel and reports convergence
+// ==================================================================
+//
+// Transmits a preamble and random data symbols with the firmware's own DDS, adds a delayed copy of the
+// waveform (a surface or bottom bounce) and noise, and runs the result through frontend.cpp and dpsk.cpp,
+// once with the equalizer and once held idle so the plain differential decisions are used. For each
+// channel it prints the bit errors both ways and the equalizer's mean square error at points from the
+// start of training, averaged over the trials:
+//   profile  echo gain/delay  errors (eq / plain)  trainings  MSE at symbol 1, 2, 4 ... 512 of training
+// The MSE is the equalizer's own smoothed one (mean_square_error, the figure it drops lock on), so it reads
+// low over the first twenty or so symbols while the smoothing fills; the preamble trains it for about ten,
+// and it is decision-directed after that. Each point averages the packets still locked there (one that
+// loses lock falls back to the plain decisions, whose errors still count). The firmware only equalizes
+// DQPSK, so the dbpsk160 lines report the plain decisions twice and no training.
+//
+// Build from the repo root, with CMSIS-DSP as for tools/replay:
+//
+//   CMSIS="-I$CMSIS_DSP/Include -I$CMSIS_DSP/PrivateInclude -I$CMSIS_CORE/Include"
+//   FIRMWARE="frontend dpsk equalizer modem_profile sine_table dds"
+//   DSP="BasicMath ComplexMath Filtering Statistics Transform FastMath"
+//   g++ -std=gnu++14 -O2 -DPROFILING_ENABLED=0 -Ifirmware $CMSIS tools/echo_sim/echo_sim.cpp
+//       $(for f in $FIRMWARE; do echo firmware/$f.cpp; done)
+//       $(for d in $DSP; do echo $CMSIS_DSP/Source/${d}Functions/${d}Functions.c; done)
+//       $CMSIS_DSP/Source/CommonTables/CommonTables.c -lm -o echo_sim
+//   (the g++ command is one line, wrapped here)
+//
+// The NLMS steps and the number of preamble flips before training are taken from equalizer.h; add e.g.
+// -DEQUALIZER_TRAINING_STEP=0.3f, -DEQUALIZER_TRACKING_STEP=0.05f or -DEQUALIZER_FLIPS_TO_TRAIN=10 to
+// the g++ line to compare other settings on the same channels (same --seed, same symbols and noise).
+//
+// Usage: echo_sim [--profile NAME] [--gain G] [--delay MS] [--noise COUNTS] [--trials N] [--seed N]
+//   --profile     only this profile (default: every PSK profile)
+//   --gain        only this echo amplitude relative to the direct path (default: 0, 0.5 and 0.7)
+//   --delay       only this echo delay (default: 8, 25 and 50 ms; 50 ms is the feedback taps' reach)
+//   --noise       RMS noise added to the ADC codes (default 30; the direct path peaks at 300)
+//   --trials      packets per channel, each with its own symbols, noise and echo phase (default 8)
+//   --seed        random seed (default 1)
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dds.h"
+#include "dpsk.h"
+#include "frontend.h"
+#include "modem_profile.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define SIM_AMPLITUDE               300     // Direct path peak, in ADC counts
+#define SIM_DATA_SYMBOLS            600     // Random symbols after the preamble
+#define SIM_LEAD_SAMPLES            4096    // Silence before the preamble, so the front end has settled
+#define SIM_MAX_BITS                (SIM_DATA_SYMBOLS * 2)
+#define SIM_MAX_SHIFT               96      // Bits searched when lining up the output (lead noise, preamble, latency)
+
+// Symbols from the start of training at which the mean square error is reported:
+static const int report_points[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512};
+#define SIM_REPORT_POINTS           ((int)(sizeof(report_points) / sizeof(report_points[0])))
+
+typedef struct {
+  double gain;
+  double delay_ms;
+  double noise;
+  int trials;
+} sim_channel_t;
+
+typedef struct {
+  int errors;                  // Bit errors, summed over the trials
+  int bits;
+  int trainings;               // Times the equalizer started training (more than once a trial if noise set it off)
+  double mse_sum[SIM_REPORT_POINTS];
+  int mse_count[SIM_REPORT_POINTS];
+} sim_result_t;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static double gauss() {
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/**
+ * Writes the preamble and count random data symbols to x at MODEM_SAMPLE_RATE (as comm.cpp's
+ * start_tx_symbol() sends them, less DDS_DAC_MIDSCALE and scaled to SIM_AMPLITUDE) and their bits, most
+ * significant first, to bits. Returns the number of samples written.
+ */
+static uint32_t generate_symbols(const modem_profile_t *profile, int count, float *x, uint8_t *bits) {
+  const tx_parameters_t *tx = &profile->tx;
+  const uint32_t samples_per_symbol = (uint64_t)tx->usec_per_symbol * MODEM_SAMPLE_RATE / 1000000;
+  const uint32_t carrier = dds_phase_increment(tx->freq_low, MODEM_SAMPLE_RATE);
+  const int bits_per_symbol = tx->bits_per_symbol;
+  static const uint32_t dqpsk_quarter_turns[4] = {0, 1, 3, 2};
+  dds_state dds;
+  initialize_dds(&dds, samples_per_symbol, (tx->shape_symbol_edges) ? samples_per_symbol / MODEM_RAMP_FRACTION : 0,
+                 DDS_DAC_FULL_AMPLITUDE);
+
+  uint32_t m = 0;
+  int bit_count = 0;
+  for (int k = 0; k < MODEM_PREAMBLE_SYMBOLS + count; k++) {
+    uint32_t symbol = (1U << bits_per_symbol) - 1;
+    if (k >= MODEM_PREAMBLE_SYMBOLS) {
+      symbol = (uint32_t)rand() & ((1U << bits_per_symbol) - 1);
+      for (int b = bits_per_symbol - 1; b >= 0; b--) {
+        bits[bit_count++] = (symbol >> b) & 1;
+      }
+    }
+    start_dds_symbol(&dds, carrier);
+    shift_dds_phase(&dds, ((tx->modulation == MODEM_MODULATION_DBPSK) ? 2 * symbol : dqpsk_quarter_turns[symbol])
+                              << 30);
+    for (uint32_t n = 0; n < samples_per_symbol; n++) {
+      x[m++] = ((float)next_dds_sample(&dds) - DDS_DAC_MIDSCALE) * SIM_AMPLITUDE / DDS_DAC_FULL_AMPLITUDE;
+    }
+  }
+  return m;
+}
+
+/**
+ * Fewest bit errors between the data bits sent and what came out, over every offset up to SIM_MAX_SHIFT bits
+ * (decisions on the lead-in noise and the preamble come first; bits never produced count as errors).
+ */
+static int count_bit_errors(const uint8_t *sent, int sent_count, const uint8_t *received, int received_count) {
+  int best = sent_count;
+  for (int shift = 0; shift <= SIM_MAX_SHIFT; shift++) {
+    int errors = 0;
+    for (int i = 0; i < sent_count && errors < best; i++) {
+      const int j = i + shift;
+      errors += (j >= received_count || received[j] != sent[i]);
+    }
+    if (errors < best) {
+      best = errors;
+    }
+  }
+  return best;
+}
+
+/**
+ * Sends one packet through the channel and the demodulator, adding its bit errors and (with the
+ * equalizer on) its mean square error curve to result.
+ */
+static void run_trial(const modem_profile_t *profile, const sim_channel_t *channel, bool equalize,
+                      unsigned seed, sim_result_t *result) {
+  srand(seed);
+  const uint32_t samples_per_symbol = (uint64_t)profile->tx.usec_per_symbol * MODEM_SAMPLE_RATE / 1000000;
+  const uint32_t delay = (uint32_t)lround(channel->delay_ms * MODEM_SAMPLE_RATE / 1000);
+  const uint32_t count = SIM_LEAD_SAMPLES + (MODEM_PREAMBLE_SYMBOLS + SIM_DATA_SYMBOLS) * samples_per_symbol + delay +
+                         SIM_LEAD_SAMPLES;
+  const uint32_t padded = (count + FRONTEND_DECIMATION - 1) / FRONTEND_DECIMATION * FRONTEND_DECIMATION;
+  float *x = (float *)calloc(padded, sizeof(float));
+  uint16_t *codes = (uint16_t *)malloc(padded * sizeof(uint16_t));
+  float *baseband_i = (float *)malloc(padded / FRONTEND_DECIMATION * sizeof(float));
+  float *baseband_q = (float *)malloc(padded / FRONTEND_DECIMATION * sizeof(float));
+  static uint8_t sent[SIM_MAX_BITS], received[SIM_MAX_BITS + 2 * SIM_MAX_SHIFT];
+
+  generate_symbols(profile, SIM_DATA_SYMBOLS, &x[SIM_LEAD_SAMPLES], sent);
+  const int sent_count = SIM_DATA_SYMBOLS * profile->tx.bits_per_symbol;
+  // A sub-sample change of path length turns the echo's carrier phase a long way, so each trial's echo
+  // arrives with its own phase: a fraction of a carrier cycle is added to the delay.
+  const double echo_delay = delay + (double)rand() / RAND_MAX * MODEM_SAMPLE_RATE / profile->center_hz;
+  const uint32_t echo_whole = (uint32_t)echo_delay;
+  const float echo_fraction = (float)(echo_delay - echo_whole);
+  for (uint32_t n = padded; n-- > echo_whole + 1;) {
+    x[n] += (float)channel->gain * ((1 - echo_fraction) * x[n - echo_whole] + echo_fraction * x[n - echo_whole - 1]);
+  }
+  for (uint32_t n = 0; n < padded; n++) {
+    const double value = DDS_DAC_MIDSCALE + x[n] + channel->noise * gauss();
+    codes[n] = (uint16_t)((value < 0) ? 0 : (value > 4095) ? 4095 : lround(value));
+  }
+
+  static frontend_state frontend;
+  static dpsk_state dpsk;
+  initialize_frontend(&frontend, profile->center_hz, MODEM_SAMPLE_RATE);
+  const size_t baseband_count = update_frontend(&frontend, codes, padded, baseband_i, baseband_q);
+  initialize_dpsk(&dpsk, profile);
+  int received_count = 0;
+  int since_training = -1;
+  for (size_t i = 0; i < baseband_count; i++) {
+    uint8_t bits[2];
+    const int bit_count = update_dpsk(&dpsk, baseband_i[i], baseband_q[i], bits);
+    if (bit_count == 0) {
+      continue;
+    }
+    for (int b = 0; b < bit_count && received_count < (int)sizeof(received); b++) {
+      received[received_count++] = bits[b];
+    }
+    if (!equalize) {
+      // Never lets a run of flips reach EQUALIZER_FLIPS_TO_TRAIN, so the plain decisions stand
+      dpsk.eq.preamble_flips = 0;
+      continue;
+    }
+    if (dpsk.eq.mode == EQUALIZER_IDLE) {
+      since_training = -1;
+      continue;
+    }
+    if (since_training < 0) {
+      since_training = 0;
+      result->trainings++;
+    }
+    since_training++;
+    for (int r = 0; r < SIM_REPORT_POINTS; r++) {
+      if (report_points[r] == since_training) {
+        result->mse_sum[r] += dpsk.eq.mean_square_error;
+        result->mse_count[r]++;
+      }
+    }
+  }
+  result->errors += count_bit_errors(sent, sent_count, received, received_count);
+  result->bits += sent_count;
+
+  free(x);
+  free(codes);
+  free(baseband_i);
+  free(baseband_q);
+}
+
+/**
+ * Runs every trial of one channel with and without the equalizer and prints a line of results.
+ */
+static void run_channel(const modem_profile_t *profile, const sim_channel_t *channel, unsigned seed) {
+  sim_result_t equalized = {}, plain = {};
+  for (int t = 0; t < channel->trials; t++) {
+    run_trial(profile, channel, true, seed + t, &equalized);
+    run_trial(profile, channel, false, seed + t, &plain);
+  }
+  printf("%-9s echo %.1f at %4.0f ms  errors %5d / %5d of %d  trainings %2d in %d  mse", profile->name, channel->gain,
+         channel->delay_ms, equalized.errors, plain.errors, equalized.bits, equalized.trainings, channel->trials);
+  for (int r = 0; r < SIM_REPORT_POINTS; r++) {
+    if (equalized.mse_count[r] > 0) {
+      printf(" %.3f", equalized.mse_sum[r] / equalized.mse_count[r]);
+    } else {
+      printf("   -  ");
+    }
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  const char *only_profile = NULL;
+  double gains[] = {0, 0.5, 0.7};
+  double delays[] = {8, 25, 50};
+  int gain_count = 3, delay_count = 3;
+  sim_channel_t channel = {0, 0, 30, 8};
+  unsigned seed = 1;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      only_profile = argv[++i];
+    } else if (strcmp(argv[i], "--gain") == 0 && i + 1 < argc) {
+      gains[0] = atof(argv[++i]);
+      gain_count = 1;
+    } else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc) {
+      delays[0] = atof(argv[++i]);
+      delay_count = 1;
+    } else if (strcmp(argv[i], "--noise") == 0 && i + 1 < argc) {
+      channel.noise = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+      channel.trials = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = (unsigned)atoi(argv[++i]);
+    } else {
+      usage = true;
+      break;
+    }
+  }
+  if (usage || channel.trials < 1) {
+    fprintf(stderr, "usage: %s [--profile NAME] [--gain G] [--delay MS] [--noise COUNTS] [--trials N] "
+                    "[--seed N]\n", argv[0]);
+    return 2;
+  }
+
+  printf("equalizer: training step %.2f, tracking step %.2f, %d flips before training\n",
+         (double)EQUALIZER_TRAINING_STEP, (double)EQUALIZER_TRACKING_STEP, EQUALIZER_FLIPS_TO_TRAIN);
+  printf("mse at symbol");
+  for (int r = 0; r < SIM_REPORT_POINTS; r++) {
+    printf(" %d", report_points[r]);
+  }
+  printf(" from the start of training\n");
+
+  bool any = false;
+  for (int p = 0; p < get_modem_profile_count(); p++) {
+    const modem_profile_t *profile = get_modem_profile(p);
+    if ((profile->modulation != MODEM_MODULATION_DBPSK && profile->modulation != MODEM_MODULATION_DQPSK) ||
+        (only_profile && strcmp(only_profile, profile->name) != 0)) {
+      continue;
+    }
+    any = true;
+    for (int g = 0; g < gain_count; g++) {
+      channel.gain = gains[g];
+      for (int d = 0; d < ((gains[g] == 0) ? 1 : delay_count); d++) {
+        channel.delay_ms = (gains[g] == 0) ? 0 : delays[d];
+        run_channel(profile, &channel, seed);
+      }
+    }
+  }
+  if (!any) {
+    fprintf(stderr, "no PSK profile named %s\n", only_profile);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,458 @@
+// ==================================================================
+// mac_sim.cpp
+// Runs several nodes' copies of the firmware MAC against a shared acoustic channel model on a host
+// ==================================================================
+//
+// Each simulated diver runs firmware/mac.cpp (and with --tdma, firmware/tdma.cpp) unchanged, polled every
+// millisecond. Messages arrive at random (Poisson) and are broadcast. The channel model:
+// - Nodes sit at random points in a square; sound takes distance / 1500 m/s to reach each other node.
+// - Carrier sense runs firmware/carrier_sense.cpp as receiver_channel_busy() does, on each node's in-band
+//   power per 125 ms ADC block: a constant ambient level plus SIM_SIGNAL_POWER times the share of the block
+//   each packet (the node's own included) overlapped. So a node hears another's packet only once a block
+//   has been spent on it, and the noise floor sees long transmissions as the firmware's does.
+// - A node can't hear while it transmits (half duplex).
+// - A packet is lost at a receiver if any other packet overlaps it there (no capture effect).
+// Airtime comes from the chosen modem profile, including the preamble; text goes out as fragments, each
+// with its own and each a separate packet (with CSMA, sent as soon as carrier sense reads clear after the
+// last), and a message is scored as one packet, lost at a receiver if any fragment is.
+//
+// With --tdma, diver 0 is the boat station. Every diver has its own clock (a random offset, drifting by up
+// to SIM_CLOCK_DRIFT_PPM) and stamps the beacons and requests it receives cleanly with up to
+// SIM_TIMESTAMP_JITTER_MS of error, as the firmware does from its ADC block timestamps. Throughput and loss
+// count text messages only; beacons and requests show up as control airtime.
+//
+// TDMA trades delay for loss. A new message waits for a request minislot and then a slot in the next cycle,
+// 20 to 60 s each, so --nodes 8 --rate 1 --tdma delays messages 40 s on average and up to about 200 s, and
+// a diver who queues a fifth message in that time has it rejected (MAC_QUEUE_LENGTH is 4): 1.4 to 2.3% of
+// them over seeds 1-3, against none with CSMA. At fsk40 the beacon and minislots alone take 28 s a cycle,
+// so with --nodes 6 --rate 0.2 control takes over half the airtime and delays run to many minutes.
+//
+// Build from the repo root (CMSIS-DSP headers as for tools/replay):
+//
+//   CMSIS="-I$CMSIS_DSP/Include -I$CMSIS_DSP/PrivateInclude -I$CMSIS_CORE/Include"
+//   g++ -std=gnu++14 -O2 -DPROFILING_ENABLED=0 -Ifirmware $CMSIS tools/mac_sim/mac_sim.cpp
+//       firmware/{mac,tdma,fragment,modem_profile,carrier_sense}.cpp -o mac_sim
+//   (the g++ command is one line, wrapped here)
+//
+// Usage: mac_sim [--nodes N] [--rate PER_MINUTE] [--chars N] [--minutes N] [--range M] [--profile NAME]
+//                [--no-carrier-sense | --tdma] [--seed N] [--sweep]
+//   --nodes             divers sharing the channel (default 6)
+//   --rate              messages each diver sends per minute (default 0.5)
+//   --chars             mean message length (default 30)
+//   --minutes           simulated time (default 120)
+//   --range             side of the square the divers are spread over, in m (default 100)
+//   --profile           modem profile the group uses (default fsk160)
+//   --no-carrier-sense  report the channel clear regardless, i.e. slotted backoff only
+//   --tdma              diver 0 runs a TDMA station the others follow
+//   --sweep             run 2..8 nodes with each kind of access
+// e.g. --profile fsk80 --chars 150 --rate 0.1 sends messages of up to 50 s, as fragments of about 5 s, each well
+// inside the 17 s in which a noise floor that crept up through a transmission would start calling it clear
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "carrier_sense.h"
+#include "event_log.h"
+#include "fragment.h"
+#include "mac.h"
+#include "modem_profile.h"
+#include "tdma.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define SIM_MAX_NODES               32
+#define SIM_BLOCK_MS                125     // Carrier sense granularity (one ADC block)
+#define SIM_SOUND_SPEED             1500.0  // m/s
+#define SIM_CLOCK_DRIFT_PPM         50      // Crystal tolerance of each diver's clock, either way
+#define SIM_TIMESTAMP_JITTER_MS     20      // Error in a receiver's frame-arrival timestamp
+#define SIM_SIGNAL_POWER            100.0   // In-band power of any packet heard, over the ambient level (20 dB)
+
+typedef enum {
+  SIM_ACCESS_CSMA,
+  SIM_ACCESS_NONE,             // Backoff without carrier sense
+  SIM_ACCESS_TDMA,
+} sim_access_t;
+
+static const char *const access_names[] = {"csma", "none", "tdma"};
+
+typedef struct {
+  int source;
+  uint32_t start_ms;
+  uint32_t end_ms;
+  bool text;                   // Otherwise a TDMA beacon or request, kept for delivery:
+  mac_frame_t control;
+  int message;                 // Text: the message it carries a fragment of
+} sim_packet_t;
+
+typedef struct {
+  uint32_t queued_ms;
+  uint32_t start_ms;           // Its first packet's
+  uint32_t airtime_ms;
+  uint32_t lost_at;            // Bit j set when a packet of it overlapped another at node j
+  bool sent;                   // Its last packet has gone out
+} sim_message_t;
+
+typedef struct {
+  int nodes;
+  double rate_per_minute;
+  int mean_chars;
+  int minutes;
+  double range_m;
+  const modem_profile_t *profile;
+  sim_access_t access;
+  uint32_t seed;
+} sim_config_t;
+
+typedef struct {
+  double offered_load;         // Airtime offered per unit time
+  double throughput;           // Airtime delivered cleanly to every other node per unit time
+  double loss_rate;            // Share of (packet, receiver) pairs lost to overlap
+  double mean_delay_s;         // Queueing + backoff before a packet starts
+  double max_delay_s;
+  uint32_t packets;
+  uint32_t rejected;           // MAC queue full
+  double control_load;         // TDMA beacon and request airtime per unit time
+  double mean_sync_error_ms;   // How far synced divers' station clocks are off, sampled each second
+  double max_sync_error_ms;
+} sim_result_t;
+
+// The simulator's own uniform random numbers (arrivals, lengths, positions, clocks):
+static uint32_t sim_random_state = 1;
+
+// Each diver's clock: local time at simulated time t is clock_base_ms + t * (1 + clock_drift_ppm / 1e6)
+static uint32_t clock_base_ms[SIM_MAX_NODES];
+static double clock_drift_ppm[SIM_MAX_NODES];
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static double sim_random() {
+  sim_random_state = sim_random_state * 1664525u + 1013904223u;
+  return (sim_random_state >> 8) / 16777216.0;
+}
+
+/**
+ * Stands in for the firmware's event ring; the simulation reports its own statistics instead.
+ */
+void log_event(event_id_t id, int32_t arg0, int32_t arg1, int32_t arg2) {
+  (void)id;
+  (void)arg0;
+  (void)arg1;
+  (void)arg2;
+}
+
+static uint32_t local_ms(int node, uint32_t t) {
+  return clock_base_ms[node] + t + (int32_t)(t * clock_drift_ppm[node] / 1e6);
+}
+
+/**
+ * Whether packet k reached node j without any other packet overlapping it there (or j transmitting).
+ */
+static bool received_cleanly(const std::vector<sim_packet_t> &packets, size_t k, int j,
+                             uint32_t delay_ms[SIM_MAX_NODES][SIM_MAX_NODES]) {
+  const sim_packet_t *p = &packets[k];
+  uint32_t arrive = p->start_ms + delay_ms[p->source][j];
+  uint32_t leave = p->end_ms + delay_ms[p->source][j];
+  for (size_t m = 0; m < packets.size(); m++) {
+    const sim_packet_t *q = &packets[m];
+    if (m == k || q->start_ms > leave) {
+      continue;
+    }
+    // Our own transmission deafens us; anyone else's must not overlap at our position:
+    uint32_t q_arrive = q->start_ms + ((q->source == j) ? 0 : delay_ms[q->source][j]);
+    uint32_t q_leave = q->end_ms + ((q->source == j) ? 0 : delay_ms[q->source][j]);
+    if (q_leave > arrive && q_arrive < leave) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static sim_result_t run_simulation(const sim_config_t *config) {
+  static mac_state macs[SIM_MAX_NODES];
+  static tdma_state tdmas[SIM_MAX_NODES];
+  double x[SIM_MAX_NODES], y[SIM_MAX_NODES];
+  uint32_t delay_ms[SIM_MAX_NODES][SIM_MAX_NODES];
+  uint32_t block_phase_ms[SIM_MAX_NODES];
+  static carrier_sense_state senses[SIM_MAX_NODES];
+  std::vector<uint32_t> queued_at[SIM_MAX_NODES];
+  std::vector<sim_packet_t> packets;
+  std::vector<sim_message_t> messages;
+  int transmitting[SIM_MAX_NODES];  // Index into packets, or -1
+  int sending[SIM_MAX_NODES];       // Index into messages of the one going out, which may take several packets
+  const int n = config->nodes;
+
+  sim_random_state = config->seed;
+  for (int i = 0; i < n; i++) {
+    x[i] = sim_random() * config->range_m;
+    y[i] = sim_random() * config->range_m;
+    block_phase_ms[i] = (uint32_t)(sim_random() * SIM_BLOCK_MS);
+    clock_base_ms[i] = (uint32_t)(sim_random() * 4e9);
+    clock_drift_ppm[i] = (2 * sim_random() - 1) * SIM_CLOCK_DRIFT_PPM;
+    initialize_mac(&macs[i], MAC_MIN_ADDRESS + i, config->seed * 7919u + i + 1, local_ms(i, 0));
+    initialize_tdma(&tdmas[i], MAC_MIN_ADDRESS + i, &config->profile->tx, config->seed * 104729u + i + 1);
+    initialize_carrier_sense(&senses[i]);
+    transmitting[i] = -1;
+    queued_at[i].clear();
+  }
+  if (config->access == SIM_ACCESS_TDMA) {
+    set_tdma_station(&tdmas[0], true, local_ms(0, 0));
+  }
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      delay_ms[i][j] = (uint32_t)(hypot(x[i] - x[j], y[i] - y[j]) / SIM_SOUND_SPEED * 1000);
+    }
+  }
+
+  char text[MAX_TEXT_LENGTH];
+  const double arrival_per_ms = config->rate_per_minute / 60000.0;
+  const uint32_t duration_ms = (uint32_t)config->minutes * 60000;
+  uint64_t offered_airtime_ms = 0;
+  uint64_t control_airtime_ms = 0;
+  uint32_t rejected = 0;
+  double total_sync_error_ms = 0;
+  uint32_t sync_samples = 0;
+  sim_result_t result = {};
+  size_t first_recent = 0;  // Packets before this one are too old to affect carrier sense or be delivered
+  uint32_t longest_ms = fragmented_airtime_ms(&config->profile->tx, MAX_TEXT_LENGTH - 1);
+
+  for (uint32_t t = 0; t < duration_ms; t++) {
+    while (first_recent < packets.size() && packets[first_recent].end_ms + 2 * SIM_BLOCK_MS + 1000 < t &&
+           packets[first_recent].start_ms + longest_ms < t) {
+      first_recent++;
+    }
+
+    // Hands beacons and requests that finish arriving now to the nodes that heard them cleanly:
+    for (size_t k = first_recent; k < packets.size(); k++) {
+      const sim_packet_t *p = &packets[k];
+      for (int j = 0; j < n && !p->text; j++) {
+        if (j == p->source || p->end_ms + delay_ms[p->source][j] != t || !received_cleanly(packets, k, j, delay_ms)) {
+          continue;
+        }
+        uint32_t arrival = local_ms(j, p->start_ms + delay_ms[p->source][j]) +
+                           (uint32_t)(sim_random() * SIM_TIMESTAMP_JITTER_MS);
+        if (p->control.header.type == MAC_FRAME_TDMA_BEACON) {
+          handle_tdma_beacon(&tdmas[j], &p->control.header, p->control.text, arrival);
+        } else {
+          handle_tdma_request(&tdmas[j], &p->control.header, p->control.text, arrival);
+        }
+      }
+    }
+    if (config->access == SIM_ACCESS_TDMA && t % 1000 == 0) {
+      for (int i = 1; i < n; i++) {
+        if (tdmas[i].synced) {
+          double error_ms = fabs((double)(int32_t)(local_ms(i, t) + tdmas[i].clock_offset_ms - local_ms(0, t)));
+          total_sync_error_ms += error_ms;
+          result.max_sync_error_ms = std::max(result.max_sync_error_ms, error_ms);
+          sync_samples++;
+        }
+      }
+    }
+
+    for (int i = 0; i < n; i++) {
+      if (transmitting[i] >= 0) {
+        if (t < packets[transmitting[i]].end_ms) {
+          continue;
+        }
+        const sim_packet_t *sent = &packets[transmitting[i]];
+        if (sent->text && finish_mac_fragment(&macs[i], local_ms(i, t))) {
+          messages[sent->message].sent = true;
+          queued_at[i].erase(queued_at[i].begin());
+        }
+        transmitting[i] = -1;
+      }
+
+      if (sim_random() < arrival_per_ms) {
+        // Lengths spread evenly from 1 to twice the mean:
+        int chars = 1 + (int)(sim_random() * (2 * config->mean_chars - 1));
+        memset(text, 'x', chars);
+        text[chars] = '\0';
+        if (queue_mac_frame(&macs[i], MAC_BROADCAST_ADDRESS, text)) {
+          queued_at[i].push_back(t);
+          offered_airtime_ms += fragmented_airtime_ms(&config->profile->tx, chars);
+        } else {
+          rejected++;
+        }
+      }
+
+      // Each ADC block that completes moves our noise floor, and sets carrier sense until the next one:
+      if (t >= SIM_BLOCK_MS && (t + SIM_BLOCK_MS - block_phase_ms[i]) % SIM_BLOCK_MS == 0) {
+        double power = 1;
+        for (size_t k = first_recent; k < packets.size(); k++) {
+          const sim_packet_t *p = &packets[k];
+          uint32_t arrive = p->start_ms + ((p->source == i) ? 0 : delay_ms[p->source][i]);
+          uint32_t leave = p->end_ms + ((p->source == i) ? 0 : delay_ms[p->source][i]);
+          uint32_t overlap_start = std::max(arrive, t - SIM_BLOCK_MS);
+          uint32_t overlap_end = std::min(leave, t);
+          if (overlap_end > overlap_start) {
+            power += SIM_SIGNAL_POWER * (overlap_end - overlap_start) / SIM_BLOCK_MS;
+          }
+        }
+        update_carrier_sense(&senses[i], (float)power);
+      }
+      const bool busy = config->access != SIM_ACCESS_NONE && carrier_sense_busy(&senses[i]);
+
+      // As poll_outgoing_messages() does:
+      tdma_action_t action = TDMA_USE_CSMA;
+      const mac_frame_t *frame = nullptr;
+      sim_packet_t p;
+      p.source = i;
+      p.start_ms = t;
+      p.text = true;
+      if (config->access == SIM_ACCESS_TDMA) {
+        uint32_t head_airtime_ms;
+        uint32_t demand_ms = mac_queue_airtime_ms(&macs[i], &config->profile->tx, &head_airtime_ms);
+        action = update_tdma(&tdmas[i], local_ms(i, t), head_airtime_ms, demand_ms, &p.control);
+      }
+      if (action == TDMA_SEND_CONTROL) {
+        p.text = false;
+        p.end_ms = t + modem_packet_airtime_ms(&config->profile->tx, MAC_PACKET_OVERHEAD + p.control.header.length);
+        control_airtime_ms += p.end_ms - p.start_ms;
+      } else if (action == TDMA_SEND_QUEUED || action == TDMA_USE_CSMA) {
+        // As poll_outgoing_messages(), a slot or contention takes one fragment at a time:
+        frame = (action == TDMA_SEND_QUEUED) ? peek_mac_frame(&macs[i]) : update_mac(&macs[i], local_ms(i, t), busy);
+        if (!frame) {
+          continue;
+        }
+        const int fragment = macs[i].head_fragments_sent;
+        p.end_ms = t + fragment_airtime_ms(&config->profile->tx, frame->header.length, fragment);
+        if (fragment == 0) {
+          sending[i] = messages.size();
+          messages.push_back({queued_at[i].front(), t, 0, 0, false});
+        }
+        p.message = sending[i];
+      } else {
+        continue;
+      }
+      transmitting[i] = packets.size();
+      packets.push_back(p);
+    }
+  }
+
+  // Scores each message (every packet of it) at every other node:
+  for (size_t k = 0; k < packets.size(); k++) {
+    const sim_packet_t *p = &packets[k];
+    if (p->end_ms > duration_ms || !p->text) {
+      continue;
+    }
+    sim_message_t *m = &messages[p->message];
+    m->airtime_ms += p->end_ms - p->start_ms;
+    for (int j = 0; j < n; j++) {
+      if (j != p->source && !received_cleanly(packets, k, j, delay_ms)) {
+        m->lost_at |= 1u << j;
+      }
+    }
+  }
+  uint64_t delivered_airtime_ms = 0;
+  uint32_t pairs = 0, lost = 0;
+  double total_delay_s = 0;
+  for (const sim_message_t &m : messages) {
+    if (!m.sent) {
+      continue;
+    }
+    pairs += n - 1;
+    for (int j = 0; j < n; j++) {
+      lost += (m.lost_at >> j) & 1;
+    }
+    if (m.lost_at == 0) {
+      delivered_airtime_ms += m.airtime_ms;
+    }
+    double delay_s = (m.start_ms - m.queued_ms) / 1000.0;
+    total_delay_s += delay_s;
+    result.max_delay_s = std::max(result.max_delay_s, delay_s);
+    result.packets++;
+  }
+  result.offered_load = (double)offered_airtime_ms / duration_ms;
+  result.throughput = (double)delivered_airtime_ms / duration_ms;
+  result.loss_rate = (pairs > 0) ? (double)lost / pairs : 0;
+  result.mean_delay_s = (result.packets > 0) ? total_delay_s / result.packets : 0;
+  result.rejected = rejected;
+  result.control_load = (double)control_airtime_ms / duration_ms;
+  result.mean_sync_error_ms = (sync_samples > 0) ? total_sync_error_ms / sync_samples : 0;
+  return result;
+}
+
+static void print_result(const sim_config_t *config, const sim_result_t *r) {
+  printf("%5d %6s %8.3f %10.3f %8.1f%% %9.1f %9.1f %7u %8u", config->nodes, access_names[config->access],
+         r->offered_load, r->throughput, 100 * r->loss_rate, r->mean_delay_s, r->max_delay_s, r->packets,
+         r->rejected);
+  if (config->access == SIM_ACCESS_TDMA) {
+    printf(" %8.3f %5.0f/%.0f", r->control_load, r->mean_sync_error_ms, r->max_sync_error_ms);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  sim_config_t config = {6, 0.5, 30, 120, 100.0, nullptr, SIM_ACCESS_CSMA, 1};
+  const char *profile_name = "fsk160";
+  bool sweep = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+      config.nodes = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      config.rate_per_minute = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--chars") == 0 && i + 1 < argc) {
+      config.mean_chars = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--minutes") == 0 && i + 1 < argc) {
+      config.minutes = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+      config.range_m = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_name = argv[++i];
+    } else if (strcmp(argv[i], "--no-carrier-sense") == 0) {
+      config.access = SIM_ACCESS_NONE;
+    } else if (strcmp(argv[i], "--tdma") == 0) {
+      config.access = SIM_ACCESS_TDMA;
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      config.seed = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--sweep") == 0) {
+      sweep = true;
+    } else {
+      fprintf(stderr, "usage: %s [--nodes N] [--rate PER_MINUTE] [--chars N] [--minutes N] [--range M] "
+                      "[--profile NAME] [--no-carrier-sense | --tdma] [--seed N] [--sweep]\n", argv[0]);
+      return 2;
+    }
+  }
+  for (int p = 0; p < get_modem_profile_count(); p++) {
+    if (strcmp(get_modem_profile(p)->name, profile_name) == 0) {
+      config.profile = get_modem_profile(p);
+    }
+  }
+  if (!config.profile) {
+    fprintf(stderr, "unknown profile %s\n", profile_name);
+    return 2;
+  }
+  if (config.nodes < 1 || config.nodes > SIM_MAX_NODES || config.mean_chars < 1 ||
+      2 * config.mean_chars > MAX_TEXT_LENGTH) {
+    fprintf(stderr, "nodes run from 1 to %d, mean length from 1 to %d\n", SIM_MAX_NODES, MAX_TEXT_LENGTH / 2);
+    return 2;
+  }
+
+  printf("%s, %.2f messages/min per node of %d chars on average (%.1f s of airtime), %d m, %d min\n",
+         config.profile->name, config.rate_per_minute, config.mean_chars,
+         fragmented_airtime_ms(&config.profile->tx, config.mean_chars) / 1000.0,
+         (int)config.range_m, config.minutes);
+  printf("%5s %6s %8s %10s %9s %9s %9s %7s %8s %8s %s\n", "nodes", "access", "offered", "throughput", "lost",
+         "delay s", "max s", "packets", "rejected", "control", "sync ms (mean/max)");
+  if (!sweep) {
+    sim_result_t r = run_simulation(&config);
+    print_result(&config, &r);
+    return 0;
+  }
+  for (int nodes = 2; nodes <= 8; nodes++) {
+    for (int access = SIM_ACCESS_CSMA; access <= SIM_ACCESS_TDMA; access++) {
+      config.nodes = nodes;
+      config.access = (sim_access_t)access;
+      sim_result_t r = run_simulation(&config);
+      print_result(&config, &r);
+    }
+  }
+  return 0;
+}
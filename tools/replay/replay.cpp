@@ -0,0 +1,304 @@
+// ==================================================================
+// replay.cpp
+// Runs a raw ADC recording through the firmware's own receive chain on a host
+// ==================================================================
+//
+// Feeds each captured block (see firmware/capture.h; record with tools/capture_adc.py) to the same
+// receiver.cpp, front end, demodulators and deframer the firmware runs, and prints the messages it
+// decodes. Build from the repo root, with a CMSIS-DSP checkout (and the CMSIS Core headers it includes)
+// standing in for the Teensy's copy:
+//
+//   CMSIS="-I$CMSIS_DSP/Include -I$CMSIS_DSP/PrivateInclude -I$CMSIS_CORE/Include"
+//   FIRMWARE="receiver carrier_sense frontend dpsk equalizer chirp doppler deframer fragment"
+//   FIRMWARE="$FIRMWARE modem_profile goertzel sdft sine_table"
+//   DSP="BasicMath ComplexMath Filtering Statistics Transform FastMath"
+//   g++ -std=gnu++14 -O2 -DPROFILING_ENABLED=0 -Ifirmware $CMSIS tools/replay/replay.cpp
+//       $(for f in $FIRMWARE; do echo firmware/$f.cpp; done)
+//       $(for d in $DSP; do echo $CMSIS_DSP/Source/${d}Functions/${d}Functions.c; done)
+//       $CMSIS_DSP/Source/CommonTables/CommonTables.c -lm -o replay
+//   (the g++ command is one line, wrapped here)
+//
+// Usage: replay [--profile NAME] [--events] [--verbose] RECORDING
+//   --profile  decode as this profile instead of the one recorded with each block
+//   --events   also print the receiver's event log (Doppler retunes, frames)
+//   --verbose  include verbose events (per-symbol tone powers) with --events
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "deframer.h"
+#include "event_log.h"
+#include "fragment.h"
+#include "modem_profile.h"
+#include "receiver.h"
+#include "serial_frame.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define EVENT_LOG_NAME_ENTRY(id, verbose, format) #id,
+#define EVENT_LOG_FORMAT_ENTRY(id, verbose, format) format,
+#define EVENT_LOG_VERBOSE_ENTRY(id, verbose, format) verbose,
+
+static const char *const event_names[EVENT_COUNT] = {EVENT_LOG_EVENTS(EVENT_LOG_NAME_ENTRY)};
+static const char *const event_formats[EVENT_COUNT] = {EVENT_LOG_EVENTS(EVENT_LOG_FORMAT_ENTRY)};
+static const bool event_is_verbose[EVENT_COUNT] = {EVENT_LOG_EVENTS(EVENT_LOG_VERBOSE_ENTRY)};
+
+static bool print_events = false;
+static bool print_verbose_events = false;
+
+static deframer_state deframer;
+static reassembly_state reassembly;
+static uint32_t messages_decoded = 0;
+
+// Recording time of the block being processed, for stamping output:
+static double block_time_s = 0;
+
+// Block being reassembled from its chunks:
+static uint16_t block_samples[CAPTURE_BLOCK_SAMPLES];
+static capture_chunk_header_t block_header;
+static uint32_t block_filled = 0;
+
+// ------------------------------------------------------------------
+// Firmware hooks
+// ------------------------------------------------------------------
+
+/**
+ * Stands in for the firmware's event ring: prints the event straight away (when asked to) using its
+ * format from event_log.h.
+ */
+void log_event(event_id_t id, int32_t arg0, int32_t arg1, int32_t arg2) {
+  if (!print_events || (event_is_verbose[id] && !print_verbose_events)) {
+    return;
+  }
+  const int32_t args[EVENT_LOG_ARGS] = {arg0, arg1, arg2};
+  int next_arg = 0;
+  printf("[%10.6f] ", block_time_s);
+  for (const char *f = event_formats[id]; *f; f++) {
+    if (*f != '%') {
+      putchar(*f);
+      continue;
+    }
+    f++;
+    int32_t value = (next_arg < EVENT_LOG_ARGS) ? args[next_arg++] : 0;
+    float as_float;
+    switch (*f) {
+      case 'f':
+        memcpy(&as_float, &value, sizeof(as_float));
+        printf("%.2f", as_float);
+        break;
+      case 'u': printf("%u", (unsigned)value); break;
+      case 'x': printf("%x", (unsigned)value); break;
+      case 'c': putchar((char)value); break;
+      case '%': putchar('%'); next_arg--; break;
+      default: printf("%d", value); break;
+    }
+  }
+  printf("  (%s)\n", event_names[id]);
+}
+
+/**
+ * Takes the place of chat_logic.cpp's receive_bit(): deframes and prints each message, reassembling
+ * fragmented text (each fragment prints what has arrived so far).
+ */
+static void receive_bit(int bit) {
+  if (!update_deframer(&deframer, bit)) {
+    return;
+  }
+  const mac_header_t *header = &deframer.header;
+  if (header->type == MAC_FRAME_TEXT) {
+    messages_decoded++;
+    printf("[%10.6f] message %u/%u from %u to %u, %u hops (%d chars): %s\n", block_time_s, header->source,
+           header->sequence, header->source, header->destination, header->hops, deframer.text_length,
+           deframer.text);
+  } else if (header->type == MAC_FRAME_TEXT_FRAGMENT) {
+    fragment_slot_t *slot = add_fragment(&reassembly, header, deframer.text, (uint32_t)(block_time_s * 1000));
+    if (!slot) {
+      printf("[%10.6f] fragment from %u rejected or repeated\n", block_time_s, header->source);
+      return;
+    }
+    char text[MAX_TEXT_LENGTH];
+    render_fragments(slot, text, sizeof(text));
+    messages_decoded += slot->complete;
+    printf("[%10.6f] message %u/%u from %u to %u, %u hops (%d chars%s): %s\n", block_time_s, header->source,
+           header->sequence, header->source, header->destination, header->hops, slot->header.length,
+           slot->complete ? "" : ", partial", text);
+  } else {
+    printf("[%10.6f] frame type %u from %u to %u (%u bytes)\n", block_time_s, header->type, header->source,
+           header->destination, header->length);
+  }
+}
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static uint16_t fletcher16(const uint8_t *data, size_t length) {
+  uint32_t sum1 = 0, sum2 = 0;
+  for (size_t i = 0; i < length; i++) {
+    sum1 = (sum1 + data[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return sum1 | (sum2 << 8);
+}
+
+/**
+ * Runs one complete block, retuning first if its profile differs from the last block's and restarting the
+ * receive chain if blocks were dropped in between (the filters and symbol timing assume a contiguous stream).
+ */
+static void process_block(const char *forced_profile, double *audio_seconds) {
+  static const modem_profile_t *profile = nullptr;
+  static uint32_t expected_block = 0;
+  static int last_gain = -1;
+
+  const modem_profile_t *wanted = get_modem_profile(block_header.profile_index);
+  if (forced_profile) {
+    for (int i = 0; i < get_modem_profile_count(); i++) {
+      if (strcmp(get_modem_profile(i)->name, forced_profile) == 0) {
+        wanted = get_modem_profile(i);
+      }
+    }
+  }
+  if (!wanted) {
+    fprintf(stderr, "block %u: unknown profile %u, skipped\n", block_header.block, block_header.profile_index);
+    return;
+  }
+  if (block_header.sample_rate != MODEM_SAMPLE_RATE || block_header.block_samples != CAPTURE_BLOCK_SAMPLES) {
+    fprintf(stderr, "block %u: recorded at %u Hz x %u samples, receiver expects %u x %u; skipped\n",
+            block_header.block, block_header.sample_rate, block_header.block_samples, MODEM_SAMPLE_RATE,
+            CAPTURE_BLOCK_SAMPLES);
+    return;
+  }
+
+  block_time_s = block_header.timestamp_us / 1e6;
+  if (wanted != profile || block_header.block != expected_block) {
+    if (profile && block_header.block != expected_block) {
+      printf("[%10.6f] %u blocks missing from the recording, receiver restarted\n", block_time_s,
+             block_header.block - expected_block);
+    }
+    if (wanted != profile) {
+      printf("[%10.6f] profile %s\n", block_time_s, wanted->name);
+    }
+    profile = wanted;
+    initialize_receiver(profile, receive_bit);
+    initialize_deframer(&deframer);
+  }
+  if (block_header.gain_index != last_gain) {
+    printf("[%10.6f] charge amplifier gain %u\n", block_time_s, block_header.gain_index);
+    last_gain = block_header.gain_index;
+  }
+
+  process_receiver_samples(block_samples, CAPTURE_BLOCK_SAMPLES, block_header.timestamp_us);
+  expected_block = block_header.block + 1;
+  *audio_seconds += (double)CAPTURE_BLOCK_SAMPLES / MODEM_SAMPLE_RATE;
+}
+
+/**
+ * Adds one SERIAL_FRAME_ADC_CAPTURE chunk to the block being reassembled, running the block once whole.
+ * A chunk that doesn't continue the current block abandons it.
+ */
+static void add_chunk(const uint8_t *payload, size_t length, const char *forced_profile, double *audio_seconds) {
+  capture_chunk_header_t header;
+  if (length < sizeof(header)) {
+    return;
+  }
+  memcpy(&header, payload, sizeof(header));
+  if (header.sample_count % 2 != 0 || length != sizeof(header) + header.sample_count * 3 / 2 ||
+      header.first_sample + header.sample_count > CAPTURE_BLOCK_SAMPLES) {
+    fprintf(stderr, "malformed chunk in block %u, skipped\n", header.block);
+    return;
+  }
+  if (header.first_sample == 0) {
+    block_header = header;
+    block_filled = 0;
+  } else if (header.block != block_header.block || header.first_sample != block_filled) {
+    fprintf(stderr, "block %u: chunk at %u out of sequence, block dropped\n", header.block, header.first_sample);
+    block_filled = 0;
+    return;
+  }
+
+  const uint8_t *packed = payload + sizeof(header);
+  uint16_t *x = &block_samples[header.first_sample];
+  for (int i = 0; i < header.sample_count; i += 2, packed += 3) {
+    x[i] = packed[0] | ((packed[1] & 0x0F) << 8);
+    x[i + 1] = (packed[1] >> 4) | (packed[2] << 4);
+  }
+  block_filled += header.sample_count;
+  if (block_filled == header.block_samples) {
+    process_block(forced_profile, audio_seconds);
+    block_filled = 0;
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *forced_profile = nullptr;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      forced_profile = argv[++i];
+    } else if (strcmp(argv[i], "--events") == 0) {
+      print_events = true;
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      print_verbose_events = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if (!path) {
+    fprintf(stderr, "usage: %s [--profile NAME] [--events] [--verbose] RECORDING\n", argv[0]);
+    return 2;
+  }
+  initialize_reassembly(&reassembly);
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return 1;
+  }
+
+  // Scans for frames the same way decode_log.py does, so a raw serial dump works as well as a recording:
+  static uint8_t frame[5 + SERIAL_FRAME_MAX_PAYLOAD + 2];
+  size_t have = 0;
+  double audio_seconds = 0;
+  clock_t start = clock();
+  for (;;) {
+    size_t got = fread(&frame[have], 1, sizeof(frame) - have, file);
+    have += got;
+    if (have < SERIAL_FRAME_OVERHEAD) {
+      break;
+    }
+    if (frame[0] != SERIAL_FRAME_SYNC_0 || frame[1] != SERIAL_FRAME_SYNC_1) {
+      // Skips to the next possible sync byte (text or noise in between)
+      const uint8_t *next = (const uint8_t *)memchr(&frame[1], SERIAL_FRAME_SYNC_0, have - 1);
+      size_t skip = next ? next - frame : have;
+      have -= skip;
+      memmove(frame, &frame[skip], have);
+      continue;
+    }
+    size_t length = frame[3] | (frame[4] << 8);
+    if (length > SERIAL_FRAME_MAX_PAYLOAD || have < length + SERIAL_FRAME_OVERHEAD) {
+      if (length > SERIAL_FRAME_MAX_PAYLOAD || got == 0) {
+        memmove(frame, &frame[1], --have);
+      }
+      continue;
+    }
+    uint16_t checksum = frame[5 + length] | (frame[6 + length] << 8);
+    if (fletcher16(&frame[2], 3 + length) != checksum) {
+      memmove(frame, &frame[1], --have);
+      continue;
+    }
+    if (frame[2] == SERIAL_FRAME_ADC_CAPTURE) {
+      add_chunk(&frame[5], length, forced_profile, &audio_seconds);
+    }
+    have -= length + SERIAL_FRAME_OVERHEAD;
+    memmove(frame, &frame[length + SERIAL_FRAME_OVERHEAD], have);
+  }
+  fclose(file);
+
+  double cpu_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  fprintf(stderr, "%u messages from %.1f s of audio in %.2f s (%.0fx real time)\n", messages_decoded,
+          audio_seconds, cpu_seconds, (cpu_seconds > 0) ? audio_seconds / cpu_seconds : 0);
+  return 0;
+}
@@ -0,0 +1,369 @@
+// ==================================================================
+// sdft_bench.cpp
+// Compares the sliding DFT tone tracker with the block Goertzel detector: accuracy, cost and symbol timing
+// ==================================================================
+//
+// Runs firmware/sdft.cpp and each FSK profile's own tone detector (the windowed Goertzel the receiver runs
+// once per symbol) on synthetic complex baseband at MODEM_BASEBAND_RATE, as the front end would deliver
+// it: phase-continuous FSK with white Gaussian noise, its symbols starting at a random fraction of a sample.
+// Three measurements:
+// - Drift: an hour of noisy tones through update_sdft() and through a textbook sliding DFT (the running sum
+//   rotated by e^(j 2 pi k / N) every sample, in float), each compared with a direct DFT in double.
+// - Cost: time per input sample on this host for the tracker (both tones, every sample) and for a bank of
+//   Goertzel detectors staggered M ways, which gives M tone measurements per symbol. M = 1 is what the
+//   receiver runs today; M = N gives a measurement at every sample, like the tracker.
+// - Timing: the symbol clock (see get_sdft_symbol_end()) after RECEIVER_TIMING_SYMBOLS preamble symbols,
+//   against the same clock fed only the Goertzel bank's M measurements per symbol. Prints the bias and
+//   standard deviation of the symbol boundary error, and how often it was off by more than a quarter
+//   symbol. With no timing recovery the boundary is uniformly anywhere: N / sqrt(12) samples of error.
+// SNR is signal power over noise power per baseband sample (the band the front end passes), as
+// get_receiver_arrival() measures it.
+//
+// Build from the repo root (CMSIS-DSP headers as for tools/replay):
+//
+//   CMSIS="-I$CMSIS_DSP/Include -I$CMSIS_DSP/PrivateInclude -I$CMSIS_CORE/Include"
+//   g++ -std=gnu++14 -O2 -DPROFILING_ENABLED=0 -Ifirmware $CMSIS tools/sdft_bench/sdft_bench.cpp
+//       firmware/{sdft,modem_profile}.cpp -o sdft_bench
+//   (the g++ command is one line, wrapped here)
+//
+// Usage: sdft_bench [--profile NAME] [--trials N] [--seed N]
+//   --profile  only this FSK profile (default: every FSK profile)
+//   --trials   packets per SNR for the timing measurement (default 400)
+//   --seed     random seed (default 1)
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "modem_profile.h"
+#include "receiver.h"
+#include "sdft.h"
+
+// ------------------------------------------------------------------
+// State
+// ------------------------------------------------------------------
+
+#define BENCH_DRIFT_SECONDS         3600    // Length of the drift run
+#define BENCH_DRIFT_CHECKS          6       // Comparisons with the direct DFT along the way
+#define BENCH_COST_SAMPLES          2000000 // Samples timed for each detector
+#define BENCH_LEAD_IN_SYMBOLS       4       // Noise ahead of each packet, at most
+
+static const float bench_snr_db[] = {20, 10, 6, 3, 0};
+#define BENCH_SNR_COUNT (sizeof(bench_snr_db) / sizeof(bench_snr_db[0]))
+
+// Goertzel bank sizes compared (0 stands for one detector per sample, M = N):
+static const uint32_t bench_bank_sizes[] = {1, 4, 8, 0};
+#define BENCH_BANK_COUNT (sizeof(bench_bank_sizes) / sizeof(bench_bank_sizes[0]))
+
+typedef struct {
+  double sum, sum2;
+  int count;
+  int gross;                   // Off by more than a quarter symbol
+} timing_stats_t;
+
+// ------------------------------------------------------------------
+// Functions
+// ------------------------------------------------------------------
+
+static double uniform() {
+  return (rand() + 1.0) / (RAND_MAX + 2.0);
+}
+
+static double gauss() {
+  return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+static double now_seconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int32_t tone_bin(const modem_profile_t *profile, int k) {
+  return ((int32_t)profile->tone_hz[k] - (int32_t)profile->center_hz) * (int32_t)profile->symbol_samples /
+         MODEM_BASEBAND_RATE;
+}
+
+/**
+ * Generates count samples of phase-continuous two-tone FSK at baseband: symbols of N samples, the first
+ * starting at sample start (fractional; noise only before it), tone 0 for a 0 bit. Noise has power noise_power
+ * per complex sample; the signal has amplitude 1.
+ */
+static void generate_fsk(const modem_profile_t *profile, const uint8_t *bits, int bit_count, double start,
+                         double noise_power, uint32_t count, float *x_i, float *x_q) {
+  const double n = profile->symbol_samples;
+  const double noise_amplitude = sqrt(noise_power / 2);
+  double phase = 2 * M_PI * uniform();
+  for (uint32_t m = 0; m < count; m++) {
+    double i = noise_amplitude * gauss(), q = noise_amplitude * gauss();
+    const double t = m - start;
+    const int symbol = (int)floor(t / n);
+    if (t >= 0 && symbol < bit_count) {
+      const double hz = (double)profile->tone_hz[bits[symbol]] - profile->center_hz;
+      // Phase-continuous: the phase at t accumulates each earlier symbol's full turn count plus this one's part
+      double p = phase;
+      for (int s = 0; s < symbol; s++) {
+        p += 2 * M_PI * ((double)profile->tone_hz[bits[s]] - profile->center_hz) * n / MODEM_BASEBAND_RATE;
+      }
+      p += 2 * M_PI * hz * (t - symbol * n) / MODEM_BASEBAND_RATE;
+      i += cos(p);
+      q += sin(p);
+    }
+    x_i[m] = (float)i;
+    x_q[m] = (float)q;
+  }
+}
+
+/**
+ * Runs an hour of noisy tone through the tracker and through a textbook SDFT, printing each one's largest
+ * error against a direct DFT of the same window along the way.
+ */
+static void run_drift(const modem_profile_t *profile) {
+  static sdft_state tracker;
+  initialize_sdft_tones(&tracker, profile);
+  const uint32_t n = profile->symbol_samples;
+  const int32_t k = tone_bin(profile, 1);
+  const double rotate = 2 * M_PI * k / n;
+  const float r_re = (float)cos(rotate), r_im = (float)sin(rotate);
+  float classic_re = 0, classic_im = 0;
+  double *window_i = (double *)calloc(n, sizeof(double)), *window_q = (double *)calloc(n, sizeof(double));
+
+  const uint64_t total = (uint64_t)BENCH_DRIFT_SECONDS * MODEM_BASEBAND_RATE;
+  double phase = 0;
+  printf("%s drift over %d s (%llu samples), largest error / signal amplitude:\n", profile->name,
+         BENCH_DRIFT_SECONDS, (unsigned long long)total);
+  printf("  %10s %14s %14s\n", "seconds", "sliding DFT", "textbook SDFT");
+  for (uint64_t m = 0; m < total; m++) {
+    phase += 2 * M_PI * ((double)profile->tone_hz[1] - profile->center_hz) / MODEM_BASEBAND_RATE;
+    const float x_i = (float)(cos(phase) + 0.3 * gauss()), x_q = (float)(sin(phase) + 0.3 * gauss());
+    update_sdft(&tracker, x_i, x_q);
+    const uint32_t slot = (uint32_t)(m % n);
+    // Textbook recursion: S(n) = (S(n-1) + x(n) - x(n-N)) * e^(j 2 pi k / N)
+    const float d_i = x_i - (float)window_i[slot], d_q = x_q - (float)window_q[slot];
+    const float s_re = classic_re + d_i, s_im = classic_im + d_q;
+    classic_re = s_re * r_re - s_im * r_im;
+    classic_im = s_re * r_im + s_im * r_re;
+    window_i[slot] = x_i;
+    window_q[slot] = x_q;
+
+    if ((m + 1) % (total / BENCH_DRIFT_CHECKS) != 0) {
+      continue;
+    }
+    // Direct DFT of the window, oldest sample first, with the window's start as time 0:
+    double d_re = 0, d_im = 0;
+    for (uint32_t j = 0; j < n; j++) {
+      const uint32_t at = (uint32_t)((m + 1 + j) % n);
+      const double w = -2 * M_PI * k * j / n;
+      d_re += window_i[at] * cos(w) - window_q[at] * sin(w);
+      d_im += window_i[at] * sin(w) + window_q[at] * cos(w);
+    }
+    float y_re, y_im;
+    get_sdft_bin(&tracker, 1, &y_re, &y_im);
+    const double sliding_error = hypot(y_re - d_re / n, y_im - d_im / n);
+    // The textbook sum is the DFT with the newest sample as time N - 1, i.e. the same:
+    const double classic_error = hypot(classic_re / n - d_re / n, classic_im / n - d_im / n);
+    printf("  %10.0f %14.2e %14.2e\n", (m + 1) / (double)MODEM_BASEBAND_RATE, sliding_error, classic_error);
+  }
+  free(window_i);
+  free(window_q);
+}
+
+/**
+ * Time per input sample of the tracker and of Goertzel banks staggered M ways.
+ */
+static void run_cost(const modem_profile_t *profile) {
+  const uint32_t n = profile->symbol_samples;
+  float *x_i = (float *)malloc(BENCH_COST_SAMPLES * sizeof(float));
+  float *x_q = (float *)malloc(BENCH_COST_SAMPLES * sizeof(float));
+  for (uint32_t m = 0; m < BENCH_COST_SAMPLES; m++) {
+    x_i[m] = (float)gauss();
+    x_q[m] = (float)gauss();
+  }
+  volatile float sink = 0;
+
+  printf("%s cost per input sample (this host):\n", profile->name);
+  static sdft_state tracker;
+  initialize_sdft_tones(&tracker, profile);
+  double start = now_seconds();
+  for (uint32_t m = 0; m < BENCH_COST_SAMPLES; m++) {
+    update_sdft(&tracker, x_i[m], x_q[m]);
+  }
+  sink = sink + tracker.sum_re[0];
+  const double sdft_ns = (now_seconds() - start) * 1e9 / BENCH_COST_SAMPLES;
+  printf("  %-28s %8.1f ns\n", "sliding DFT, every sample", sdft_ns);
+
+  for (uint32_t b = 0; b < BENCH_BANK_COUNT; b++) {
+    const uint32_t bank = (bench_bank_sizes[b] == 0) ? n : bench_bank_sizes[b];
+    const uint32_t stride = n / bank;
+    float y_re[MODEM_TONE_COUNT], y_im[MODEM_TONE_COUNT];
+    start = now_seconds();
+    for (uint32_t m = n; m + stride <= BENCH_COST_SAMPLES; m += stride) {
+      profile->detect_tones(&x_i[m - n], &x_q[m - n], y_re, y_im);
+      sink = sink + y_re[0];
+    }
+    const double ns = (now_seconds() - start) * 1e9 / (BENCH_COST_SAMPLES - n);
+    char name[64];
+    snprintf(name, sizeof(name), "Goertzel x%u (%s)", (unsigned)bank,
+             (bank == 1) ? "receiver today" : (bank == n) ? "every sample" : "every N/M");
+    printf("  %-28s %8.1f ns  (%.2fx the sliding DFT)\n", name, ns, ns / sdft_ns);
+  }
+  (void)sink;
+  free(x_i);
+  free(x_q);
+}
+
+/**
+ * Estimates symbol timing like get_sdft_symbol_end() from contrast measured only at the samples a bank of
+ * M staggered Goertzel detectors finishes on.
+ */
+static void add_clock(double *clock_re, double *clock_im, uint32_t n, uint32_t m, float contrast) {
+  *clock_re += contrast * cos(2 * M_PI * (m % n) / n);
+  *clock_im -= contrast * sin(2 * M_PI * (m % n) / n);
+}
+
+static float clock_samples_ago(double clock_re, double clock_im, uint32_t n, uint32_t newest) {
+  double peak = -atan2(clock_im, clock_re) * n / (2 * M_PI);
+  double ago = fmod((double)(newest % n) - peak, n);
+  return (float)((ago < 0) ? ago + n : ago);
+}
+
+static void add_timing(timing_stats_t *stats, double error, uint32_t n) {
+  // Wraps into -N/2 .. N/2: a whole symbol either way is the same boundary
+  error = fmod(error, n);
+  if (error >= n / 2.0) {
+    error -= n;
+  } else if (error < -(n / 2.0)) {
+    error += n;
+  }
+  stats->sum += error;
+  stats->sum2 += error * error;
+  stats->count++;
+  stats->gross += (fabs(error) > n / 4.0) ? 1 : 0;
+}
+
+static void print_timing(const char *name, const timing_stats_t *stats, const modem_profile_t *profile) {
+  const double mean = stats->sum / stats->count;
+  const double sd = sqrt(stats->sum2 / stats->count - mean * mean);
+  const double us_per_sample = 1e6 / MODEM_BASEBAND_RATE;
+  printf("    %-22s bias %6.2f  sd %6.2f samples (%7.1f us)  >N/4 %5.1f%%\n", name, mean, sd, sd * us_per_sample,
+         100.0 * stats->gross / stats->count);
+  (void)profile;
+}
+
+/**
+ * Times trials packets' preambles at each SNR with the tracker and with each Goertzel bank.
+ */
+static void run_timing(const modem_profile_t *profile, int trials) {
+  const uint32_t n = profile->symbol_samples;
+  const int preamble = MODEM_PREAMBLE_SYMBOLS;
+  const uint32_t count = (BENCH_LEAD_IN_SYMBOLS + RECEIVER_TIMING_SYMBOLS + 1) * n;
+  float *x_i = (float *)malloc(count * sizeof(float)), *x_q = (float *)malloc(count * sizeof(float));
+  uint8_t bits[MODEM_PREAMBLE_SYMBOLS];
+  for (int k = 0; k < preamble; k++) {
+    bits[k] = k & 1;
+  }
+  static sdft_state tracker;
+
+  printf("%s symbol timing after %d preamble symbols (N = %u samples; none: sd %.2f samples):\n", profile->name,
+         RECEIVER_TIMING_SYMBOLS, (unsigned)n, n / sqrt(12.0));
+  for (uint32_t s = 0; s < BENCH_SNR_COUNT; s++) {
+    timing_stats_t sdft_stats = {}, bank_stats[BENCH_BANK_COUNT] = {};
+    const double noise_power = pow(10, -bench_snr_db[s] / 10);
+    for (int trial = 0; trial < trials; trial++) {
+      const double start = uniform() * BENCH_LEAD_IN_SYMBOLS * n;
+      generate_fsk(profile, bits, preamble, start, noise_power, count, x_i, x_q);
+      // The clock starts where the arrival tracker would see the packet begin, and runs for
+      // RECEIVER_TIMING_SYMBOLS symbols like the receiver's:
+      const uint32_t first = (uint32_t)ceil(start);
+      const uint32_t newest = first + RECEIVER_TIMING_SYMBOLS * n - 1;
+      // The window holds only one symbol when it ends anywhere from start + k N - 1 to the next sample,
+      // so the best boundary is halfway between:
+      const double truth_end = start - 0.5;
+
+      initialize_sdft_tones(&tracker, profile);
+      for (uint32_t m = 0; m <= newest; m++) {
+        if (m == first) {
+          reset_sdft_timing(&tracker);
+        }
+        update_sdft(&tracker, x_i[m], x_q[m]);
+      }
+      float ago, strength;
+      if (get_sdft_symbol_end(&tracker, &ago, &strength)) {
+        add_timing(&sdft_stats, (newest - ago) - truth_end, n);
+      }
+
+      for (uint32_t b = 0; b < BENCH_BANK_COUNT; b++) {
+        const uint32_t bank = (bench_bank_sizes[b] == 0) ? n : bench_bank_sizes[b];
+        if (bank < 3) {
+          continue;  // Two or fewer measurements a symbol can't place the symbol-rate component
+        }
+        const uint32_t stride = n / bank;
+        double clock_re = 0, clock_im = 0;
+        for (uint32_t m = first + n - 1; m <= newest; m++) {
+          if (m % stride != 0) {
+            continue;
+          }
+          float y_re[MODEM_TONE_COUNT], y_im[MODEM_TONE_COUNT];
+          profile->detect_tones(&x_i[m + 1 - n], &x_q[m + 1 - n], y_re, y_im);
+          const float contrast = fabsf(y_re[1] * y_re[1] + y_im[1] * y_im[1] - y_re[0] * y_re[0] - y_im[0] * y_im[0]);
+          add_clock(&clock_re, &clock_im, n, m, contrast);
+        }
+        add_timing(&bank_stats[b], (newest - clock_samples_ago(clock_re, clock_im, n, newest)) - truth_end, n);
+      }
+    }
+    printf("  SNR %4.0f dB:\n", bench_snr_db[s]);
+    print_timing("sliding DFT", &sdft_stats, profile);
+    for (uint32_t b = 0; b < BENCH_BANK_COUNT; b++) {
+      const uint32_t bank = (bench_bank_sizes[b] == 0) ? n : bench_bank_sizes[b];
+      if (bank < 3) {
+        continue;
+      }
+      char name[32];
+      snprintf(name, sizeof(name), "Goertzel x%u", (unsigned)bank);
+      print_timing(name, &bank_stats[b], profile);
+    }
+  }
+  free(x_i);
+  free(x_q);
+}
+
+int main(int argc, char **argv) {
+  const char *only = NULL;
+  int trials = 400;
+  unsigned seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      only = argv[++i];
+    } else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+      trials = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = (unsigned)atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--profile NAME] [--trials N] [--seed N]\n", argv[0]);
+      return 2;
+    }
+  }
+  srand(seed);
+
+  bool any = false;
+  for (int p = 0; p < get_modem_profile_count(); p++) {
+    const modem_profile_t *profile = get_modem_profile(p);
+    if (profile->modulation != MODEM_MODULATION_FSK || (only && strcmp(only, profile->name) != 0)) {
+      continue;
+    }
+    if (any) {
+      printf("\n");
+    }
+    any = true;
+    run_drift(profile);
+    run_cost(profile);
+    run_timing(profile, trials);
+  }
+  if (!any) {
+    fprintf(stderr, "no FSK profile named %s\n", only);
+    return 2;
+  }
+  return 0;
+}